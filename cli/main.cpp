@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <cassert>
+#include <deque>
 #include <iostream>
 #include <string>
 #include <string_view>
@@ -9,6 +10,7 @@
 #include "core/overloaded_visitor.hpp"
 #include "core/streambuf.hpp"
 #include "core/tag.hpp"
+#include "db/schema_layout.hpp"
 #include "io/socket.hpp"
 #include "protocol/binary_protocol.hpp"
 
@@ -75,48 +77,87 @@ void print_aggregate_type(const AggregateType& agg, int key_field_index = -1, in
     }
 }
 
-void print_aggregate(const AggregateType& agg, const void* data, int indent = 0) {
-    auto field_index = 0;
+// Leaves are flattened out of their aggregates, so this prints (using header as the format)
+// the names of the aggregates the leaf at path is nested in which the previous leaf wasn't.
+// Returns how deeply the leaf is nested.
+int enter_aggregates(std::string_view prev_path, std::string_view path, std::string_view header,
+                     bool show) {
+    int depth = 0;
+    bool same = true;
+
+    for (auto dot = path.find('.'); dot != std::string_view::npos; dot = path.find('.')) {
+        auto name = path.substr(0, dot);
+
+        auto prev_dot = prev_path.find('.');
+
+        same = same && prev_dot != std::string_view::npos && prev_path.substr(0, prev_dot) == name;
+
+        if (!same && show) {
+            for (int i = 0; i < depth; ++i) {
+                std::cout << '\t';
+            }
+
+            std::cout << format(header, name);
+        }
+
+        path.remove_prefix(dot + 1);
+        prev_path.remove_prefix(prev_dot == std::string_view::npos ? prev_path.size()
+                                                                   : prev_dot + 1);
+
+        depth += 1;
+    }
+
+    return depth;
+}
+
+std::string_view leaf_name(std::string_view path) {
+    auto dot = path.rfind('.');
+
+    return dot == std::string_view::npos ? path : path.substr(dot + 1);
+}
+
+void print_document(const SchemaLayout& layout, const void* data) {
+    std::string_view prev_path;
+
+    for (const auto& leaf : layout.leaves()) {
+        auto indent = enter_aggregates(prev_path, leaf.path, "{} = \n", true);
+        prev_path = leaf.path;
 
-    for (const auto& field : agg) {
         for (int i = 0; i < indent; ++i) {
             std::cout << '\t';
         }
 
-        std::cout << field.name << " = ";
+        std::cout << leaf_name(leaf.path) << " = ";
 
-        // TODO Optimize O(n^2) offset calculation here
-        auto* value = reinterpret_cast<const char*>(data) + offset(agg, field_index);
-        field_index++;
+        auto* value = reinterpret_cast<const char*>(data) + leaf.offset;
 
         std::visit(
             OverloadedVisitor{
                 [&](StringType) {
                     const auto* hdr = reinterpret_cast<const StringHeader*>(value);
-                    std::cout << '"' << std::string_view{value + sizeof(*hdr), hdr->len} << "\"\n";
+                    std::cout << '"' << std::string_view{value + sizeof(*hdr), hdr->len}
+                              << "\"\n";
                 },
-                [&](const AggregateType& a) {
-                    std::cout << '\n';
-                    print_aggregate(a, value, indent + 1);
+                [&](const AggregateType&) {
+                    // Leaves are never aggregates
+                    assert(false);
                 },
                 [&](auto&& t) {
                     using T = typename ImplType<std::decay_t<decltype(t)>>::Type;
 
                     std::cout << *reinterpret_cast<const T*>(value) << '\n';
                 }},
-            field.type);
+            leaf.type);
     }
 };
 
-void read_aggregate(const AggregateType& agg, void* dest, bool show_prompts, int indent = 0);
-
-void read_field(const Field& field, void* dest, bool show_prompts, int indent = 0) {
+void read_leaf(const LeafField& leaf, void* dest, bool show_prompts, int indent = 0) {
     if (show_prompts) {
         for (int i = 0; i < indent; ++i) {
             std::cout << '\t';
         }
 
-        std::cout << format("value for {} > ", field.name);
+        std::cout << format("value for {} > ", leaf_name(leaf.path));
     }
 
     // HACK Assumes write is only called once below for this field
@@ -139,12 +180,9 @@ void read_field(const Field& field, void* dest, bool show_prompts, int indent =
 
                        write(write_fn, LengthPrefixedString{value});
                    },
-                   [&](const AggregateType& a) {
-                       if (show_prompts) {
-                           std::cout << '\n';
-                       }
-
-                       read_aggregate(a, dest, show_prompts, indent + 1);
+                   [&](const AggregateType&) {
+                       // Leaves are never aggregates
+                       assert(false);
                    },
                    [&](auto type) {
                        using T = std::decay_t<decltype(type)>;
@@ -166,16 +204,34 @@ void read_field(const Field& field, void* dest, bool show_prompts, int indent =
 
                        // TODO Check exhaustiveness with a static_assert
                    }},
-               field.type);
+               leaf.type);
 }
 
-void read_aggregate(const AggregateType& agg, void* dest, bool show_prompts, int indent) {
-    auto field_index = 0;
+// Reads a value for the leaf into buf and returns it the way keys and field updates take it,
+// which for strings is just their characters
+ConstBuffer read_leaf_value(const LeafField& leaf, std::vector<char>& buf, bool show_prompts) {
+    buf.resize(leaf.size);
 
-    for (const auto& field : agg) {
-        read_field(field, reinterpret_cast<char*>(dest) + offset(agg, field_index), show_prompts,
-                   indent);
-        field_index += 1;
+    read_leaf(leaf, buf.data(), show_prompts);
+
+    if (std::holds_alternative<StringType>(leaf.type)) {
+        LengthPrefixType len;
+        std::memcpy(&len, buf.data(), sizeof(LengthPrefixType));
+
+        return {buf.data() + sizeof(LengthPrefixType), len};
+    }
+
+    return {buf.data(), buf.size()};
+}
+
+void read_document(const SchemaLayout& layout, void* dest, bool show_prompts) {
+    std::string_view prev_path;
+
+    for (const auto& leaf : layout.leaves()) {
+        auto indent = enter_aggregates(prev_path, leaf.path, "value for {} > \n", show_prompts);
+        prev_path = leaf.path;
+
+        read_leaf(leaf, reinterpret_cast<char*>(dest) + leaf.offset, show_prompts, indent);
     }
 }
 
@@ -203,7 +259,8 @@ int main(int argc, char** argv) {
     client.set_non_blocking(false);
 
     std::unordered_map<std::string, Schema> schemas;
-    std::unordered_map<std::string, Schema> colschemas;
+    // Collection schemas are only needed for reading and printing documents
+    std::unordered_map<std::string, SchemaLayout> collayouts;
 
     std::string str;
     std::string str2;
@@ -226,6 +283,10 @@ int main(int argc, char** argv) {
 
         std::vector<char> buf;
 
+        // Values of the updates in a set command (or the bounds of a query), which can't move
+        // until it's been sent
+        std::deque<std::vector<char>> update_bufs;
+
         Command cmd;
 
         if (str == "schema") {
@@ -332,12 +393,42 @@ int main(int argc, char** argv) {
             prompt("schema name > ");
             std::getline(std::cin, str2);
 
-            cmd = CreateCollectionCommand{str, str2};
+            CreateCollectionCommand create{str, str2};
+
+            std::string value;
+
+            prompt("max memory per shard in bytes, or 0 for none > ");
+            std::getline(std::cin, value);
+
+            create.max_memory = value.empty() ? 0 : std::stoull(value);
+
+            if (create.max_memory != 0) {
+                prompt("eviction policy (none, lru, lfu or clock) > ");
+                std::getline(std::cin, value);
+
+                if (value == "lru") {
+                    create.eviction = EvictionPolicy::SAMPLED_LRU;
+                } else if (value == "lfu") {
+                    create.eviction = EvictionPolicy::LFU;
+                } else if (value == "clock") {
+                    create.eviction = EvictionPolicy::CLOCK;
+                } else if (value != "none") {
+                    std::cerr << "Unknown eviction policy " << value << '\n';
+                    continue;
+                }
+            }
+
+            cmd = create;
         } else if (str == "getschema") {
             prompt("name > ");
             std::getline(std::cin, str);
 
             cmd = GetSchemaCommand{str};
+        } else if (str == "stats") {
+            prompt("collection name > ");
+            std::getline(std::cin, str);
+
+            cmd = GetCollectionStatsCommand{str};
         } else if (str == "colschema") {
             prompt("name > ");
             std::getline(std::cin, str);
@@ -349,51 +440,166 @@ int main(int argc, char** argv) {
             prompt("collection name > ");
             std::getline(std::cin, str2);
 
-            auto found = colschemas.find(str2);
+            auto found = collayouts.find(str2);
 
-            if (found == colschemas.end()) {
+            if (found == collayouts.end()) {
                 std::cerr << "Run colschema to cache the schema for this collection first.\n";
                 continue;
             }
 
-            const auto& field = found->second.fields[found->second.key_field_index];
+            auto key = read_leaf_value(found->second.key(), buf, show_prompts);
 
-            buf.resize(size(field.type));
-
-            read_field(field, buf.data(), show_prompts);
+            if (cmd_name == "get") {
+                cmd = GetCommand{str2, key};
+            } else {
+                cmd = DeleteCommand{str2, key};
+            }
+        } else if (str == "put" || str == "putttl") {
+            std::string cmd_name{std::move(str)};
 
-            ConstBuffer key{buf.data(), buf.size()};
+            prompt("collection name > ");
+            std::getline(std::cin, str2);
 
-            if (std::holds_alternative<StringType>(field.type)) {
-                LengthPrefixType len;
-                std::memcpy(&len, buf.data(), sizeof(LengthPrefixType));
+            auto found_layout = collayouts.find(str2);
 
-                key = {buf.data() + sizeof(LengthPrefixType), len};
+            if (found_layout == collayouts.end()) {
+                std::cerr << "Run colschema to cache the schema for this collection first.\n";
+                continue;
             }
 
-            if (cmd_name == "get") {
-                cmd = GetCommand{str2, key};
+            buf.resize(found_layout->second.size());
+
+            read_document(found_layout->second, buf.data(), show_prompts);
+
+            if (cmd_name == "put") {
+                cmd = PutCommand{str2, ConstBuffer{buf.data(), buf.size()}};
             } else {
-                cmd = DeleteCommand{str2, key};
+                prompt("ttl in milliseconds > ");
+                std::getline(std::cin, str);
+
+                cmd = PutWithTtlCommand{str2, ConstBuffer{buf.data(), buf.size()},
+                                        std::stoull(str)};
+            }
+        } else if (str == "set") {
+            prompt("collection name > ");
+            std::getline(std::cin, str2);
+
+            auto found = collayouts.find(str2);
+
+            if (found == collayouts.end()) {
+                std::cerr << "Run colschema to cache the schema for this collection first.\n";
+                continue;
+            }
+
+            const auto& layout = found->second;
+
+            SetCommand set{str2, read_leaf_value(layout.key(), buf, show_prompts), {}};
+
+            for (;;) {
+                prompt("field path (empty to finish) > ");
+                std::getline(std::cin, str);
+
+                if (str.empty()) {
+                    break;
+                }
+
+                const auto* leaf = layout.find(str);
+
+                if (!leaf) {
+                    std::cerr << "No field " << str << " in this collection.\n";
+                    continue;
+                }
+
+                FieldUpdate update;
+
+                update.path = leaf->path;
+
+                prompt("set, add or cas > ");
+                std::getline(std::cin, str);
+
+                if (str == "add") {
+                    update.op = FieldUpdate::Op::ADD;
+                } else if (str == "cas") {
+                    update.op = FieldUpdate::Op::COMPARE_AND_SET;
+
+                    prompt("expected:\n");
+                    update.expected =
+                        read_leaf_value(*leaf, update_bufs.emplace_back(), show_prompts);
+                } else if (str != "set") {
+                    std::cerr << "Unknown operation " << str << '\n';
+                    continue;
+                }
+
+                update.value = read_leaf_value(*leaf, update_bufs.emplace_back(), show_prompts);
+
+                set.updates.push_back(update);
+            }
+
+            cmd = std::move(set);
+        } else if (str == "index") {
+            prompt("collection name > ");
+            std::getline(std::cin, str);
+
+            prompt("field path > ");
+            std::getline(std::cin, str2);
+
+            CreateIndexCommand create{str, str2};
+
+            prompt("hash or ordered > ");
+
+            std::string type;
+            std::getline(std::cin, type);
+
+            if (type == "ordered") {
+                create.type = SecondaryIndexType::ORDERED;
+            } else if (type != "hash") {
+                std::cerr << "Unknown index type " << type << '\n';
+                continue;
             }
-        } else if (str == "put") {
-            std::string coll_name;
 
+            cmd = std::move(create);
+        } else if (str == "query") {
             prompt("collection name > ");
-            std::getline(std::cin, coll_name);
+            std::getline(std::cin, str2);
 
-            auto found_schema = colschemas.find(coll_name);
+            auto found = collayouts.find(str2);
 
-            if (found_schema == colschemas.end()) {
+            if (found == collayouts.end()) {
                 std::cerr << "Run colschema to cache the schema for this collection first.\n";
                 continue;
             }
 
-            buf.resize(size(found_schema->second));
+            prompt("field path > ");
+            std::getline(std::cin, str);
+
+            const auto* leaf = found->second.find(str);
+
+            if (!leaf) {
+                std::cerr << "No field " << str << " in this collection.\n";
+                continue;
+            }
+
+            QueryCommand query{str2, leaf->path};
 
-            read_aggregate(found_schema->second.fields, buf.data(), show_prompts);
+            prompt("equal or range > ");
+            std::getline(std::cin, str);
+
+            if (str == "range") {
+                query.op = QueryCommand::Op::RANGE;
+
+                prompt("min:\n");
+                query.min = read_leaf_value(*leaf, update_bufs.emplace_back(), show_prompts);
+
+                prompt("max:\n");
+                query.max = read_leaf_value(*leaf, update_bufs.emplace_back(), show_prompts);
+            } else if (str == "equal") {
+                query.min = read_leaf_value(*leaf, buf, show_prompts);
+            } else {
+                std::cerr << "Unknown operation " << str << '\n';
+                continue;
+            }
 
-            cmd = PutCommand{coll_name, ConstBuffer{buf.data(), buf.size()}};
+            cmd = std::move(query);
         } else {
             std::cout << "Unknown command.\n";
             continue;
@@ -455,16 +661,16 @@ int main(int argc, char** argv) {
                             std::cout << "Not found.\n";
                         } else if constexpr (std::is_same_v<T, FoundResponse>) {
                             if (std::holds_alternative<GetCommand>(cmd)) {
-                                auto found = colschemas.find(
+                                auto found = collayouts.find(
                                     std::string{std::get<GetCommand>(cmd).coll_name});
 
-                                if (found == colschemas.end()) {
+                                if (found == collayouts.end()) {
                                     std::cout << "No schema cached for this so data cannot be "
                                                  "displayed well. Run colschema.\n";
                                     return;
                                 }
 
-                                print_aggregate(found->second.fields, v.value.data);
+                                print_document(found->second, v.value.data);
                             } else {
                                 std::cout << std::string_view{v.value.data, v.value.len} << '\n';
                             }
@@ -478,13 +684,35 @@ int main(int argc, char** argv) {
                                 schema = &iter->second;
                             } else if (auto* schema_cmd =
                                            std::get_if<GetCollectionSchemaCommand>(&cmd)) {
-                                auto [iter, inserted] = colschemas.insert_or_assign(
-                                    std::string{schema_cmd->name}, std::move(v.schema));
-
-                                schema = &iter->second;
+                                collayouts.insert_or_assign(std::string{schema_cmd->name},
+                                                            SchemaLayout{v.schema});
                             }
 
                             print_aggregate_type(schema->fields, schema->key_field_index);
+                        } else if constexpr (std::is_same_v<T, MultiFoundResponse>) {
+                            const auto* query = std::get_if<QueryCommand>(&cmd);
+
+                            auto found = query ? collayouts.find(std::string{query->coll_name})
+                                               : collayouts.end();
+
+                            if (found == collayouts.end()) {
+                                std::cout << v.values.size() << " documents found.\n";
+                                return;
+                            }
+
+                            for (const auto& value : v.values) {
+                                print_document(found->second, value.data);
+                                std::cout << '\n';
+                            }
+
+                            std::cout << v.values.size() << " documents found.\n";
+                        } else if constexpr (std::is_same_v<T, CollectionStatsResponse>) {
+                            std::cout << "documents " << v.count << '\n';
+                            std::cout << "memory usage " << v.memory_usage << '\n';
+                            std::cout << "max memory " << v.max_memory << '\n';
+                            std::cout << "hits " << v.hit_count << '\n';
+                            std::cout << "misses " << v.miss_count << '\n';
+                            std::cout << "evictions " << v.eviction_count << '\n';
                         }
                     },
                     res);
@@ -0,0 +1,70 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+namespace boutique {
+
+Arena::Arena(std::size_t block_size) {
+    assert(block_size > 0);
+
+    add_block(block_size);
+}
+
+void Arena::reset() {
+    if (m_blocks.size() > 1) {
+        auto total = used();
+
+        m_blocks.clear();
+        add_block(total);
+    }
+
+    m_ptr = m_blocks.front().data.get();
+    m_end = m_ptr + m_blocks.front().size;
+
+    m_used_before = 0;
+}
+
+std::size_t Arena::used() const {
+    return m_used_before + (m_ptr - m_blocks.back().data.get());
+}
+
+void Arena::add_block(std::size_t size) {
+    if (!m_blocks.empty()) {
+        m_used_before += m_ptr - m_blocks.back().data.get();
+    }
+
+    m_blocks.push_back({std::unique_ptr<char[]>{new char[size]}, size});
+
+    m_ptr = m_blocks.back().data.get();
+    m_end = m_ptr + size;
+}
+
+void* Arena::do_allocate(std::size_t bytes, std::size_t alignment) {
+    auto align = [&] {
+        auto addr = reinterpret_cast<std::uintptr_t>(m_ptr);
+        return reinterpret_cast<char*>((addr + alignment - 1) & ~(alignment - 1));
+    };
+
+    auto* p = align();
+
+    if (p > m_end || static_cast<std::size_t>(m_end - p) < bytes) {
+        // Enough for this allocation wherever new[] puts the block
+        add_block(std::max(m_blocks.front().size, bytes + alignment));
+
+        p = align();
+    }
+
+    m_ptr = p + bytes;
+
+    return p;
+}
+
+void Arena::do_deallocate(void*, std::size_t, std::size_t) {}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+}  // namespace boutique
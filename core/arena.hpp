@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+namespace boutique {
+
+// Monotonic allocator for memory that only lives as long as one request, e.g. the item list of
+// a parsed batch command. Allocating is a pointer bump, deallocating does nothing, and reset
+// frees everything at once.
+//
+// Unlike std::pmr::monotonic_buffer_resource, reset keeps the memory around: if the arena had
+// to take on more blocks, they're replaced by one block big enough for all of them, so once it
+// has seen the biggest request it's going to get it never touches the heap again.
+struct Arena : std::pmr::memory_resource {
+    explicit Arena(std::size_t block_size = 16 * 1024);
+
+    Arena(const Arena& other) = delete;
+    Arena& operator=(const Arena& other) = delete;
+
+    // Invalidates everything allocated from the arena
+    void reset();
+
+    // Bytes allocated since the last reset, including alignment padding
+    std::size_t used() const;
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        std::size_t size = 0;
+    };
+
+    // Never empty, the first one is the one we keep on reset
+    std::vector<Block> m_blocks;
+
+    // Free space in the last block
+    char* m_ptr = nullptr;
+    char* m_end = nullptr;
+
+    // Bytes used in all of the blocks before the last one
+    std::size_t m_used_before = 0;
+
+    void add_block(std::size_t size);
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+}  // namespace boutique
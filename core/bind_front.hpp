@@ -11,4 +11,14 @@ auto bind_front(Fn&& fn, Args&&... args) {
     };
 }
 
+// Same as above for a function known at compile time, e.g. bind_front<&Foo::bar>(this). The
+// result only holds the bound arguments, which for a member function and its object is small
+// enough to fit in a std::function without allocating.
+template <auto Fn, typename... Args>
+auto bind_front(Args&&... args) {
+    return [args...](auto&&... inner_args) {
+        return std::invoke(Fn, args..., std::forward<decltype(inner_args)>(inner_args)...);
+    };
+}
+
 }  // namespace boutique
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <memory>
+#include <type_traits>
+#include <utility>
+
 namespace boutique {
 
 template <typename Fn>
@@ -13,12 +17,14 @@ struct FunctionView<R(Args...)> {
               return (*static_cast<std::decay_t<Fn>*>(callable))(std::forward<Args>(args)...);
           }} {}
 
+    // Arguments are converted to the parameter types first, so that e.g. an lvalue can be
+    // passed for a by-value parameter
     template <typename... CallArgs>
     R operator()(CallArgs&&... args) const {
         if constexpr (std::is_same_v<R, void>) {
-            m_fn(m_callable, std::forward<CallArgs>(args)...);
+            m_fn(m_callable, static_cast<Args>(std::forward<CallArgs>(args))...);
         } else {
-            return m_fn(m_callable, std::forward<CallArgs>(args)...);
+            return m_fn(m_callable, static_cast<Args>(std::forward<CallArgs>(args))...);
         }
     }
 
@@ -0,0 +1,76 @@
+#include "recv_buffer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace boutique {
+
+RecvBuffer::RecvBuffer(std::size_t capacity)
+    : m_base_capacity{capacity}, m_capacity{capacity}, m_buf{new char[capacity]} {
+    assert(capacity > 0);
+}
+
+Span<char> RecvBuffer::prepare() {
+    if (m_read > 0) {
+        std::memmove(m_buf.get(), m_buf.get() + m_read, m_write - m_read);
+
+        m_write -= m_read;
+        m_read = 0;
+    }
+
+    return {m_buf.get() + m_write, m_capacity - m_write};
+}
+
+void RecvBuffer::commit(std::size_t len) {
+    assert(m_write + len <= m_capacity);
+
+    m_write += len;
+}
+
+ConstBuffer RecvBuffer::data() const { return {m_buf.get() + m_read, m_write - m_read}; }
+
+void RecvBuffer::consume(std::size_t len) {
+    assert(m_read + len <= m_write);
+
+    m_read += len;
+
+    if (m_read < m_write) {
+        return;
+    }
+
+    m_read = 0;
+    m_write = 0;
+
+    // The oversized message that we grew for is done with
+    if (m_capacity != m_base_capacity) {
+        m_capacity = m_base_capacity;
+        m_buf.reset(new char[m_capacity]);
+    }
+}
+
+bool RecvBuffer::full() const { return m_read == 0 && m_write == m_capacity; }
+
+bool RecvBuffer::grow(std::size_t max_capacity) {
+    if (m_capacity >= max_capacity) {
+        return false;
+    }
+
+    auto capacity = std::min(m_capacity * 2, max_capacity);
+
+    std::unique_ptr<char[]> buf{new char[capacity]};
+
+    std::memcpy(buf.get(), m_buf.get() + m_read, m_write - m_read);
+
+    m_write -= m_read;
+    m_read = 0;
+
+    m_capacity = capacity;
+    m_buf = std::move(buf);
+
+    return true;
+}
+
+std::size_t RecvBuffer::capacity() const { return m_capacity; }
+
+}  // namespace boutique
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include "const_buffer.hpp"
+#include "span.hpp"
+
+namespace boutique {
+
+// Fixed-size buffer for data coming off of a socket. Data is received straight into it and
+// parsed in place, and the space taken up by consumed data is reclaimed by moving whatever is
+// left (usually nothing, or part of a message) back to the front. Unlike StreamBuf, a peer that
+// keeps sending can't make it grow; the one exception is a single message too big to fit, which
+// the owner can make room for with grow, and which is given back once it's consumed.
+struct RecvBuffer {
+    explicit RecvBuffer(std::size_t capacity);
+
+    // Space to receive into, which is never empty unless the buffer is full of unconsumed data
+    Span<char> prepare();
+
+    // Marks len bytes at the start of the prepared space as received
+    void commit(std::size_t len);
+
+    // Received data which hasn't been consumed yet
+    ConstBuffer data() const;
+    void consume(std::size_t len);
+
+    bool full() const;
+
+    // Doubles the capacity, up to max_capacity. Returns false if it's already there.
+    bool grow(std::size_t max_capacity);
+
+    std::size_t capacity() const;
+
+private:
+    std::size_t m_base_capacity = 0;
+    std::size_t m_capacity = 0;
+
+    std::unique_ptr<char[]> m_buf;
+
+    // Data lives in [m_read, m_write)
+    std::size_t m_read = 0;
+    std::size_t m_write = 0;
+};
+
+}  // namespace boutique
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace boutique {
+
+// Unbounded, lock-free, single-producer single-consumer queue. Items live in fixed-size blocks
+// which are linked together as the producer outgrows them, so push never fails or blocks. Each
+// side only ever touches its own end of the queue plus one atomic per block.
+template <typename T, std::size_t BLOCK_SIZE = 256>
+struct SpscQueue {
+    SpscQueue() : m_head{new Block}, m_tail{m_head} {}
+
+    SpscQueue(const SpscQueue& other) = delete;
+    SpscQueue& operator=(const SpscQueue& other) = delete;
+
+    ~SpscQueue() {
+        while (m_head) {
+            auto* next = m_head->next.load(std::memory_order_relaxed);
+            delete m_head;
+            m_head = next;
+        }
+    }
+
+    // Must only be called from the producer thread
+    void push(T value) {
+        if (m_tail_pos == BLOCK_SIZE) {
+            auto* block = new Block;
+
+            m_tail->next.store(block, std::memory_order_release);
+
+            m_tail = block;
+            m_tail_pos = 0;
+        }
+
+        m_tail->items[m_tail_pos] = std::move(value);
+        m_tail_pos += 1;
+
+        m_tail->committed.store(m_tail_pos, std::memory_order_release);
+    }
+
+    // Must only be called from the consumer thread
+    bool pop(T& out) {
+        if (m_head_pos == BLOCK_SIZE) {
+            auto* next = m_head->next.load(std::memory_order_acquire);
+
+            if (!next) {
+                return false;
+            }
+
+            // The producer never touches a block again once it has linked the next one
+            delete m_head;
+
+            m_head = next;
+            m_head_pos = 0;
+        }
+
+        if (m_head_pos == m_head->committed.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        out = std::move(m_head->items[m_head_pos]);
+        m_head_pos += 1;
+
+        return true;
+    }
+
+private:
+    struct Block {
+        T items[BLOCK_SIZE];
+
+        // Number of items in this block which are visible to the consumer
+        std::atomic<std::size_t> committed{0};
+        std::atomic<Block*> next{nullptr};
+    };
+
+    // Each side gets its own cache line so they don't false share
+    alignas(64) Block* m_head = nullptr;
+    std::size_t m_head_pos = 0;
+
+    alignas(64) Block* m_tail = nullptr;
+    std::size_t m_tail_pos = 0;
+};
+
+}  // namespace boutique
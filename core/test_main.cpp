@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <string_view>
+
+#include "recv_buffer.hpp"
+
+namespace {
+
+// Receives s into buf the way a socket would, taking as much of it as fits. Returns how much
+// that was.
+std::size_t receive(boutique::RecvBuffer& buf, std::string_view s) {
+    auto space = buf.prepare();
+
+    auto len = std::min(space.len, s.size());
+
+    std::memcpy(space.data, s.data(), len);
+    buf.commit(len);
+
+    return len;
+}
+
+bool data_is(const boutique::RecvBuffer& buf, std::string_view s) {
+    auto data = buf.data();
+
+    return std::string_view{data.data, data.len} == s;
+}
+
+void test_recv_buffer() {
+    using namespace boutique;
+
+    RecvBuffer buf{8};
+
+    assert(buf.capacity() == 8 && buf.data().len == 0);
+    assert(buf.prepare().len == 8);
+
+    // A whole message and part of the next one
+    assert(receive(buf, "abcdef") == 6);
+    assert(data_is(buf, "abcdef") && !buf.full());
+
+    buf.consume(4);
+
+    assert(data_is(buf, "ef"));
+
+    // The partial message is moved to the front to make room for the rest of it
+    auto space = buf.prepare();
+
+    assert(space.len == 6);
+    assert(data_is(buf, "ef") && buf.data().data + 2 == space.data);
+
+    assert(receive(buf, "ghijklmn") == 6);
+    assert(data_is(buf, "efghijkl") && buf.full());
+    assert(buf.prepare().len == 0);
+
+    // Growing keeps the message, and stops at the maximum
+    assert(buf.grow(20));
+    assert(buf.capacity() == 16 && data_is(buf, "efghijkl"));
+
+    assert(receive(buf, "mnopqrstuvwxyz") == 8);
+    assert(buf.full());
+
+    assert(buf.grow(20));
+    assert(buf.capacity() == 20);
+
+    assert(receive(buf, "uvwxyz") == 4);
+    assert(data_is(buf, "efghijklmnopqrstuvwx") && buf.full());
+
+    // A message which still doesn't fit is over the limit
+    assert(!buf.grow(20));
+    assert(buf.capacity() == 20 && data_is(buf, "efghijklmnopqrstuvwx"));
+
+    // The buffer stays big until the message is done with, and then goes back to its size
+    buf.consume(10);
+
+    assert(buf.capacity() == 20 && data_is(buf, "opqrstuvwx"));
+    assert(buf.prepare().len == 10);
+
+    buf.consume(10);
+
+    assert(buf.capacity() == 8 && buf.data().len == 0);
+    assert(buf.prepare().len == 8);
+
+    // Consuming everything at once doesn't need a move
+    assert(receive(buf, "abc") == 3);
+
+    buf.consume(3);
+
+    assert(buf.prepare().len == 8);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    test_recv_buffer();
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+namespace boutique {
+
+// Gets memory from calloc and skips value-initializing elements, leaving them zeroed. Large
+// calloc allocations come straight from the OS as pages which are only zeroed when first
+// touched, so e.g. std::vector<T, ZeroedAllocator<T>>(n) doesn't memset n elements up front.
+//
+// Only use this for trivial types whose value-initialized state is all zero bytes.
+template <typename T>
+struct ZeroedAllocator {
+    using value_type = T;
+
+    ZeroedAllocator() = default;
+
+    template <typename U>
+    ZeroedAllocator(const ZeroedAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        auto* p = std::calloc(n, sizeof(T));
+
+        if (!p) {
+            throw std::bad_alloc{};
+        }
+
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, std::size_t) { std::free(p); }
+
+    // Value-initialization, which calloc already did for us
+    template <typename U>
+    void construct(U*) {}
+
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    bool operator==(const ZeroedAllocator<U>&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const ZeroedAllocator<U>&) const {
+        return false;
+    }
+};
+
+}  // namespace boutique
@@ -1,16 +1,772 @@
+#include <algorithm>
+#include <array>
 #include <charconv>
 #include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
+#include "concurrent_collection.hpp"
 #include "database.hpp"
 #include "storage.hpp"
+#include "timing_wheel.hpp"
+#include "typed_collection.hpp"
 
 namespace {
 
 // NOCOMMIT Just while running under valgrind
 const int OP_COUNT = 1'000'000;
 
+const std::uint64_t LATENCY_DOC_COUNT = 8'000'000;
+
+const std::uint64_t MT_KEY_COUNT = 1'000'000;
+const int MT_OPS_PER_THREAD = 2'000'000;
+
+struct Account {
+    std::uint64_t id;
+    std::int64_t balance;
+};
+
+BOUTIQUE_REFLECT(Account, id, balance)
+
+const char* index_type_name(boutique::IndexType index_type) {
+    switch (index_type) {
+        case boutique::IndexType::LINEAR_PROBE:
+            return "linear probe";
+        case boutique::IndexType::SWISS:
+            return "swiss";
+    }
+
+    return "unknown";
+}
+
+// Compares the index implementations on hits, misses, and delete churn (which leaves
+// tombstones behind) over random keys.
+void benchmark_indexes() {
+    using namespace boutique;
+
+    auto key_buf = [](const std::uint64_t& id) {
+        return ConstBuffer{reinterpret_cast<const char*>(&id), sizeof(id)};
+    };
+
+    std::vector<std::uint64_t> ids(OP_COUNT);
+
+    std::mt19937_64 rng{1};
+
+    for (auto& id : ids) {
+        id = rng();
+    }
+
+    for (auto index_type : {IndexType::LINEAR_PROBE, IndexType::SWISS}) {
+        Collection coll{Schema{{{"id", UInt64Type{}}, {"balance", Int64Type{}}}}, {index_type}};
+
+        auto time_ms = [](auto&& fn) {
+            auto prev_time = std::chrono::high_resolution_clock::now();
+
+            fn();
+
+            auto new_time = std::chrono::high_resolution_clock::now();
+
+            return std::chrono::duration_cast<std::chrono::milliseconds>(new_time - prev_time)
+                .count();
+        };
+
+        auto insert_ms = time_ms([&] {
+            for (auto id : ids) {
+                Account account{id, 0};
+                coll.put(&account);
+            }
+        });
+
+        auto hit_ms = time_ms([&] {
+            for (auto id : ids) {
+                if (!coll.find(key_buf(id))) {
+                    std::cerr << "Failed to find!\n";
+                    std::exit(1);
+                }
+            }
+        });
+
+        auto miss_ms = time_ms([&] {
+            for (auto id : ids) {
+                auto missing = id + 1;
+
+                if (coll.find(key_buf(missing))) {
+                    std::cerr << "Found missing key!\n";
+                    std::exit(1);
+                }
+            }
+        });
+
+        // Replace a quarter of the documents with new ones and then look everything up again
+        auto churn_ms = time_ms([&] {
+            for (std::size_t i = 0; i < ids.size(); i += 4) {
+                coll.remove(key_buf(ids[i]));
+
+                ids[i] = rng();
+
+                Account account{ids[i], 0};
+                coll.put(&account);
+            }
+
+            for (auto id : ids) {
+                if (!coll.find(key_buf(id))) {
+                    std::cerr << "Failed to find!\n";
+                    std::exit(1);
+                }
+            }
+        });
+
+        std::cout << index_type_name(index_type) << " index over " << OP_COUNT
+                  << " random keys: insert " << insert_ms << "ms, find hits " << hit_ms
+                  << "ms, find misses " << miss_ms << "ms, churn " << churn_ms << "ms, "
+                  << coll.index_memory_usage() / (1024 * 1024) << "MiB.\n";
+    }
+}
+
+// The same puts and finds through a Collection, which hashes and compares keys through function
+// pointers, and a TypedCollection, which has them inlined.
+void benchmark_typed() {
+    using namespace boutique;
+
+    std::vector<std::uint64_t> ids(OP_COUNT);
+
+    std::mt19937_64 rng{2};
+
+    for (auto& id : ids) {
+        id = rng();
+    }
+
+    auto time_ms = [](auto&& fn) {
+        auto prev_time = std::chrono::high_resolution_clock::now();
+
+        fn();
+
+        auto new_time = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration_cast<std::chrono::milliseconds>(new_time - prev_time).count();
+    };
+
+    for (auto index_type : {IndexType::LINEAR_PROBE, IndexType::SWISS}) {
+        Collection coll{Schema{{{"id", UInt64Type{}}, {"balance", Int64Type{}}}}, {index_type}};
+        TypedCollection<Account, &Account::id> typed{index_type};
+
+        auto put_ms = time_ms([&] {
+            for (auto id : ids) {
+                Account account{id, 0};
+                coll.put(&account);
+            }
+        });
+
+        auto typed_put_ms = time_ms([&] {
+            for (auto id : ids) {
+                typed.put({id, 0});
+            }
+        });
+
+        std::int64_t sum = 0;
+
+        auto find_ms = time_ms([&] {
+            for (auto id : ids) {
+                sum += static_cast<Account*>(
+                           coll.find({reinterpret_cast<const char*>(&id), sizeof(id)}))
+                           ->balance;
+            }
+        });
+
+        auto typed_find_ms = time_ms([&] {
+            for (auto id : ids) {
+                sum += typed.find(id)->balance;
+            }
+        });
+
+        std::cout << index_type_name(index_type) << " index, " << OP_COUNT
+                  << " random keys: put " << put_ms << "ms vs " << typed_put_ms
+                  << "ms typed, find " << find_ms << "ms vs " << typed_find_ms << "ms typed"
+                  << (sum == 0 ? ".\n" : "!\n");
+    }
+}
+
+const char* hasher_name(boutique::KeyHasher hasher) {
+    switch (hasher) {
+        case boutique::KeyHasher::STD:
+            return "std::hash";
+        case boutique::KeyHasher::WYHASH:
+            return "wyhash";
+    }
+
+    return "unknown";
+}
+
+// Inserts and then finds sequential integer keys, random integer keys and random string keys
+// with each hasher. std::hash leaves integers as they are, so sequential keys land in
+// sequential buckets and every other key shape relies on the index's own mixing.
+void benchmark_hashers() {
+    using namespace boutique;
+
+    struct Named {
+        FixedString<16> name;
+        std::int64_t balance;
+    };
+
+    auto time_ms = [](auto&& fn) {
+        auto prev_time = std::chrono::high_resolution_clock::now();
+
+        fn();
+
+        auto new_time = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration_cast<std::chrono::milliseconds>(new_time - prev_time).count();
+    };
+
+    std::vector<std::uint64_t> sequential(OP_COUNT);
+    std::vector<std::uint64_t> random(OP_COUNT);
+    std::vector<std::string> names(OP_COUNT);
+
+    std::mt19937_64 rng{3};
+
+    for (int i = 0; i < OP_COUNT; ++i) {
+        sequential[i] = i;
+        random[i] = rng();
+        names[i] = "user:" + std::to_string(rng() % 1'000'000'000);
+    }
+
+    auto bench = [&](const char* shape, IndexType index_type, KeyHasher hasher, auto key_field,
+                     const auto& keys, auto make_doc, auto key_buf) {
+        Collection coll{Schema{{{"key", key_field}, {"balance", Int64Type{}}}},
+                        {index_type, StorageLayout::ROW, hasher}};
+
+        auto insert_ms = time_ms([&] {
+            for (const auto& key : keys) {
+                auto doc = make_doc(key);
+                coll.put(&doc);
+            }
+        });
+
+        auto find_ms = time_ms([&] {
+            for (const auto& key : keys) {
+                if (!coll.find(key_buf(key))) {
+                    std::cerr << "Failed to find!\n";
+                    std::exit(1);
+                }
+            }
+        });
+
+        std::cout << index_type_name(index_type) << " index, " << hasher_name(hasher) << ", "
+                  << OP_COUNT << " " << shape << " keys: insert " << insert_ms << "ms, find "
+                  << find_ms << "ms.\n";
+    };
+
+    auto int_doc = [](std::uint64_t key) { return Account{key, 0}; };
+    auto int_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    auto str_doc = [](const std::string& key) { return Named{std::string_view{key}, 0}; };
+    auto str_buf = [](const std::string& key) { return ConstBuffer{key.data(), key.size()}; };
+
+    for (auto index_type : {IndexType::LINEAR_PROBE, IndexType::SWISS}) {
+        for (auto hasher : {KeyHasher::STD, KeyHasher::WYHASH}) {
+            bench("sequential", index_type, hasher, UInt64Type{}, sequential, int_doc, int_buf);
+            bench("random", index_type, hasher, UInt64Type{}, random, int_doc, int_buf);
+            bench("string", index_type, hasher, StringType{16}, names, str_doc, str_buf);
+        }
+    }
+}
+
+// Sums one field, and then filters on one field while summing another, over wide documents
+// stored row-wise versus columnar.
+void benchmark_scans() {
+    using namespace boutique;
+
+    struct Order {
+        std::uint64_t id;
+        std::uint64_t customer_id;
+        std::int64_t price;
+        std::uint32_t quantity;
+        std::uint32_t status;
+        std::uint32_t note_len;
+        std::array<char, 60> note;
+    };
+
+    Schema order_schema{{{"id", UInt64Type{}},
+                         {"customer_id", UInt64Type{}},
+                         {"price", Int64Type{}},
+                         {"quantity", UInt32Type{}},
+                         {"status", UInt32Type{}},
+                         {"note", StringType{60}}}};
+
+    SchemaLayout layout{order_schema};
+    const auto& leaves = layout.leaves();
+
+    Storage rows{layout.size()};
+    Collection coll{order_schema, {IndexType::SWISS, StorageLayout::COLUMNAR}};
+
+    for (int i = 1; i <= OP_COUNT; ++i) {
+        Order order{};
+
+        order.id = i;
+        order.price = i % 1000;
+        order.quantity = i % 7;
+
+        rows.put(&order);
+        coll.put(&order);
+    }
+
+    auto time_us = [](auto&& fn) {
+        auto prev_time = std::chrono::high_resolution_clock::now();
+
+        fn();
+
+        auto new_time = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration_cast<std::chrono::microseconds>(new_time - prev_time)
+            .count();
+    };
+
+    // Keeps the compiler from throwing away the loops
+    volatile std::int64_t sink = 0;
+
+    auto row_sum_us = time_us([&] {
+        std::int64_t sum = 0;
+
+        for (std::size_t i = 0; i < rows.count(); ++i) {
+            sum += *reinterpret_cast<const std::int64_t*>(static_cast<const char*>(rows[i]) +
+                                                           leaves[2].offset);
+        }
+
+        sink = sum;
+    });
+
+    auto columnar_sum_us = time_us([&] {
+        std::int64_t sum = 0;
+
+        for (std::size_t i = 0; i < coll.count();) {
+            auto run = coll.column_run(2, i);
+
+            const auto* prices = static_cast<const std::int64_t*>(run.values);
+
+            for (std::size_t j = 0; j < run.count; ++j) {
+                sum += prices[j];
+            }
+
+            i += run.count;
+        }
+
+        sink = sum;
+    });
+
+    auto row_filter_us = time_us([&] {
+        std::int64_t sum = 0;
+
+        for (std::size_t i = 0; i < rows.count(); ++i) {
+            const auto* row = static_cast<const char*>(rows[i]);
+
+            auto quantity = *reinterpret_cast<const std::uint32_t*>(row + leaves[3].offset);
+            auto price = *reinterpret_cast<const std::int64_t*>(row + leaves[2].offset);
+
+            sum += quantity > 3 ? price : 0;
+        }
+
+        sink = sum;
+    });
+
+    auto columnar_filter_us = time_us([&] {
+        std::int64_t sum = 0;
+
+        for (std::size_t i = 0; i < coll.count();) {
+            auto price_run = coll.column_run(2, i);
+            auto quantity_run = coll.column_run(3, i);
+
+            auto n = std::min(price_run.count, quantity_run.count);
+
+            const auto* prices = static_cast<const std::int64_t*>(price_run.values);
+            const auto* quantities = static_cast<const std::uint32_t*>(quantity_run.values);
+
+            for (std::size_t j = 0; j < n; ++j) {
+                sum += quantities[j] > 3 ? prices[j] : 0;
+            }
+
+            i += n;
+        }
+
+        sink = sum;
+    });
+
+    std::cout << "Scans over " << OP_COUNT << " " << sizeof(Order) << " byte documents: sum row "
+              << row_sum_us << "us, columnar " << columnar_sum_us << "us; filter+sum row "
+              << row_filter_us << "us, columnar " << columnar_filter_us << "us.\n";
+}
+
+// Latencies are bucketed by powers of 2 nanoseconds
+struct LatencyHistogram {
+    static constexpr int BUCKET_COUNT = 40;
+
+    std::uint64_t counts[BUCKET_COUNT] = {};
+    std::uint64_t total = 0;
+    std::uint64_t max_ns = 0;
+
+    void record(std::uint64_t ns) {
+        int bucket = 0;
+
+        while (bucket < BUCKET_COUNT - 1 && (std::uint64_t{1} << (bucket + 1)) <= ns) {
+            bucket += 1;
+        }
+
+        counts[bucket] += 1;
+        total += 1;
+        max_ns = std::max(max_ns, ns);
+    }
+
+    // Upper bound of the bucket the given percentile falls into
+    std::uint64_t percentile(double p) const {
+        auto target = static_cast<std::uint64_t>(static_cast<double>(total) * p / 100);
+        std::uint64_t seen = 0;
+
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            seen += counts[i];
+
+            if (seen > target) {
+                return std::uint64_t{1} << (i + 1);
+            }
+        }
+
+        return max_ns;
+    }
+
+    void print(const char* name) const {
+        std::cout << name << ": p50 < " << percentile(50) << "ns, p99 < " << percentile(99)
+                  << "ns, p99.9 < " << percentile(99.9) << "ns, p99.99 < " << percentile(99.99)
+                  << "ns, max " << max_ns << "ns.\n";
+
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            if (counts[i] > 0) {
+                std::cout << "  < " << (std::uint64_t{1} << (i + 1)) << "ns: " << counts[i]
+                          << "\n";
+            }
+        }
+    }
+};
+
+template <typename PutFn>
+LatencyHistogram measure_put_latency(PutFn put) {
+    LatencyHistogram hist;
+
+    for (std::uint64_t i = 1; i <= LATENCY_DOC_COUNT; ++i) {
+        auto prev_time = std::chrono::steady_clock::now();
+
+        put(i);
+
+        auto new_time = std::chrono::steady_clock::now();
+
+        hist.record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(new_time - prev_time).count());
+    }
+
+    return hist;
+}
+
+// Growing an index all at once shows up as a handful of puts which take orders of magnitude
+// longer than the rest. We compare against unordered_map, which does exactly that.
+void benchmark_put_latency() {
+    using namespace boutique;
+
+    std::cout << "Put latency while growing to " << LATENCY_DOC_COUNT << " documents.\n";
+
+    {
+        std::unordered_map<std::uint64_t, Account> map;
+
+        measure_put_latency([&](std::uint64_t id) {
+            map.insert_or_assign(id, Account{id, 0});
+        }).print("unordered_map");
+    }
+
+    {
+        Collection coll{Schema{{{"id", UInt64Type{}}, {"balance", Int64Type{}}}}};
+
+        measure_put_latency([&](std::uint64_t id) {
+            Account account{id, 0};
+            coll.put(&account);
+        }).print("bt collection");
+    }
+}
+
+// Runs MT_OPS_PER_THREAD random gets and puts on each of thread_count threads and returns the
+// total throughput in millions of operations per second.
+template <typename GetFn, typename PutFn>
+double run_mixed(int thread_count, int read_percent, GetFn get, PutFn put) {
+    std::vector<std::thread> threads;
+
+    auto prev_time = std::chrono::high_resolution_clock::now();
+
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937_64 rng{static_cast<std::uint64_t>(t)};
+
+            Account account;
+
+            for (int i = 0; i < MT_OPS_PER_THREAD; ++i) {
+                auto r = rng();
+
+                account.id = 1 + r % MT_KEY_COUNT;
+
+                if (static_cast<int>((r >> 32) % 100) < read_percent) {
+                    if (!get(account.id, account)) {
+                        std::cerr << "Failed to find!\n";
+                        std::exit(1);
+                    }
+                } else {
+                    account.balance = i;
+                    put(account);
+                }
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    auto new_time = std::chrono::high_resolution_clock::now();
+
+    return static_cast<double>(thread_count) * MT_OPS_PER_THREAD /
+           std::chrono::duration<double, std::micro>(new_time - prev_time).count();
+}
+
+void benchmark_multi_threaded() {
+    using namespace boutique;
+
+    Schema account_schema{{{"id", UInt64Type{}}, {"balance", Int64Type{}}}};
+
+    auto key_buf = [](const std::uint64_t& id) {
+        return ConstBuffer{reinterpret_cast<const char*>(&id), sizeof(id)};
+    };
+
+    // The baseline is what embedding a Collection in a multi-threaded process looks like today
+    Collection coll{account_schema};
+    std::mutex coll_mutex;
+
+    ConcurrentCollection concurrent_coll{account_schema};
+
+    // Collection can't find a key which hashes to 0 (and std::hash of 0 is 0), so skip it
+    for (std::uint64_t i = 1; i <= MT_KEY_COUNT; ++i) {
+        Account account{i, 0};
+
+        coll.put(&account);
+        concurrent_coll.put(&account);
+    }
+
+    auto max_threads = static_cast<int>(std::max(2u, std::thread::hardware_concurrency()));
+
+    for (int read_percent : {95, 50}) {
+        std::cout << read_percent << "/" << 100 - read_percent << " read/write over "
+                  << MT_KEY_COUNT << " documents, " << MT_OPS_PER_THREAD
+                  << " ops per thread.\n";
+
+        double mutex_base = 0;
+        double concurrent_base = 0;
+
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            auto mutex_mops = run_mixed(
+                threads, read_percent,
+                [&](std::uint64_t id, Account& out) {
+                    std::lock_guard<std::mutex> lock{coll_mutex};
+
+                    auto* found = coll.find(key_buf(id));
+
+                    if (found) {
+                        std::memcpy(&out, found, sizeof(out));
+                    }
+
+                    return found != nullptr;
+                },
+                [&](const Account& account) {
+                    std::lock_guard<std::mutex> lock{coll_mutex};
+                    coll.put(&account);
+                });
+
+            auto concurrent_mops = run_mixed(
+                threads, read_percent,
+                [&](std::uint64_t id, Account& out) {
+                    return concurrent_coll.find(key_buf(id), &out);
+                },
+                [&](const Account& account) { concurrent_coll.put(&account); });
+
+            if (threads == 1) {
+                mutex_base = mutex_mops;
+                concurrent_base = concurrent_mops;
+            }
+
+            std::cout << threads << " threads: Collection + mutex " << mutex_mops << " Mops/s ("
+                      << mutex_mops / mutex_base << "x), ConcurrentCollection "
+                      << concurrent_mops << " Mops/s (" << concurrent_mops / concurrent_base
+                      << "x).\n";
+        }
+    }
+}
+
+// Puts OP_COUNT documents which expire at random over the next EXPIRY_SPAN_MS, then reaps
+// them the way a server worker does: a bounded slice every few milliseconds. Reports the cost
+// per document and the longest any one slice took.
+void benchmark_expiry() {
+    using namespace boutique;
+
+    const std::uint64_t EXPIRY_SPAN_MS = 60'000;
+    const std::uint64_t TICK_MS = 10;
+    const std::size_t SLICE_SIZE = 4096;
+
+    Collection coll{Schema{{{"id", UInt64Type{}}, {"balance", Int64Type{}}}}};
+
+    std::mt19937_64 rng{1};
+
+    auto start = unix_time_ms();
+
+    std::cout << "Put " << OP_COUNT << " documents expiring over " << EXPIRY_SPAN_MS
+              << "ms.\n";
+
+    auto prev_time = std::chrono::high_resolution_clock::now();
+
+    for (int i = 1; i <= OP_COUNT; ++i) {
+        Account account{static_cast<std::uint64_t>(i), 0};
+        coll.put(&account, start + 1 + rng() % EXPIRY_SPAN_MS);
+    }
+
+    auto new_time = std::chrono::high_resolution_clock::now();
+
+    std::cout
+        << "Took "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(new_time - prev_time).count()
+        << "ms.\n";
+
+    std::chrono::nanoseconds total{0};
+    std::chrono::nanoseconds longest{0};
+
+    for (auto now = start; now <= start + EXPIRY_SPAN_MS + TICK_MS; now += TICK_MS) {
+        bool done = false;
+
+        while (!done) {
+            prev_time = std::chrono::high_resolution_clock::now();
+
+            done = coll.expire(now, SLICE_SIZE);
+
+            auto elapsed = std::chrono::high_resolution_clock::now() - prev_time;
+
+            total += elapsed;
+            longest = std::max(longest, elapsed);
+        }
+    }
+
+    if (coll.count() != 0) {
+        std::cerr << "Failed to expire!\n";
+        std::exit(1);
+    }
+
+    std::cout << "Expiring took "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(total).count() << "ms ("
+              << total.count() / OP_COUNT << "ns per document), longest slice "
+              << std::chrono::duration_cast<std::chrono::microseconds>(longest).count()
+              << "us.\n";
+}
+
+// Ids 1 to key_count drawn with Zipfian frequencies (rank r has weight 1 / r^skew), which is
+// roughly what cache traffic looks like
+std::vector<std::uint64_t> zipfian_trace(std::uint64_t key_count, std::size_t length,
+                                         double skew) {
+    std::vector<double> cdf(key_count);
+
+    double sum = 0;
+
+    for (std::uint64_t i = 0; i < key_count; ++i) {
+        sum += 1 / std::pow(static_cast<double>(i + 1), skew);
+        cdf[i] = sum;
+    }
+
+    std::mt19937_64 rng{1};
+    std::uniform_real_distribution<double> dist{0, sum};
+
+    std::vector<std::uint64_t> trace(length);
+
+    for (auto& id : trace) {
+        id = 1 + static_cast<std::uint64_t>(std::lower_bound(cdf.begin(), cdf.end(), dist(rng)) -
+                                            cdf.begin());
+    }
+
+    return trace;
+}
+
+// Uses a collection as a cache in front of a Zipfian trace: every miss is followed by a put of
+// the missing document. Compares the hit ratio and throughput of each eviction policy with a
+// limit of a tenth of what the whole key space takes.
+void benchmark_eviction() {
+    using namespace boutique;
+
+    const std::uint64_t KEY_COUNT = 1'000'000;
+    const std::size_t TRACE_LENGTH = 10'000'000;
+
+    Schema schema{{{"id", UInt64Type{}}, {"balance", Int64Type{}}}};
+
+    auto trace = zipfian_trace(KEY_COUNT, TRACE_LENGTH, 0.99);
+
+    std::size_t full_memory = 0;
+
+    {
+        Collection coll{schema};
+
+        for (std::uint64_t id = 1; id <= KEY_COUNT; ++id) {
+            Account account{id, 0};
+            coll.put(&account);
+        }
+
+        full_memory = coll.memory_usage();
+    }
+
+    std::cout << "Zipfian trace of " << TRACE_LENGTH << " gets over " << KEY_COUNT
+              << " keys, putting on a miss, with a limit of " << full_memory / 10 / 1024
+              << "KiB.\n";
+
+    const std::pair<EvictionPolicy, const char*> policies[] = {
+        {EvictionPolicy::NONE, "unbounded"},
+        {EvictionPolicy::SAMPLED_LRU, "sampled LRU"},
+        {EvictionPolicy::LFU, "LFU"},
+        {EvictionPolicy::CLOCK, "CLOCK"}};
+
+    for (auto [policy, name] : policies) {
+        CollectionOptions options;
+
+        if (policy != EvictionPolicy::NONE) {
+            options.max_memory = full_memory / 10;
+            options.eviction = policy;
+        }
+
+        Collection coll{schema, options};
+
+        auto prev_time = std::chrono::high_resolution_clock::now();
+
+        for (auto id : trace) {
+            if (!coll.find(ConstBuffer{reinterpret_cast<const char*>(&id), sizeof(id)})) {
+                Account account{id, 0};
+                coll.put(&account);
+            }
+        }
+
+        auto new_time = std::chrono::high_resolution_clock::now();
+
+        auto stats = coll.stats();
+
+        std::cout << name << ": hit ratio "
+                  << static_cast<double>(stats.hit_count) / TRACE_LENGTH << ", "
+                  << TRACE_LENGTH /
+                         std::chrono::duration<double, std::micro>(new_time - prev_time).count()
+                  << " Mops/s, " << stats.eviction_count << " evictions.\n";
+    }
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -133,5 +889,14 @@ int main(int argc, char** argv) {
             << "ms.\n";
     }
 
+    benchmark_indexes();
+    benchmark_typed();
+    benchmark_hashers();
+    benchmark_scans();
+    benchmark_put_latency();
+    benchmark_multi_threaded();
+    benchmark_expiry();
+    benchmark_eviction();
+
     return 0;
 }
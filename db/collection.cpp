@@ -2,225 +2,621 @@
 
 #include <algorithm>
 
-#include "core/logger.hpp"
 #include "core/overloaded_visitor.hpp"
-#include "core/time_tracker.hpp"
+
+namespace boutique {
 
 namespace {
 
-const std::size_t TOMBSTONE_KEY_HASH = ~0;
+// find_many hashes and prefetches this many keys at a time. Enough to cover the latency of a
+// cache miss without the prefetches evicting each other.
+const std::size_t FIND_MANY_GROUP_SIZE = 16;
 
-}  // namespace
+// Most documents a put evicts to make room for a new one. More than one so that a collection
+// which is over its limit gets back under it, but few enough that no one put takes long.
+const std::size_t MAX_EVICTIONS_PER_PUT = 2;
 
-namespace boutique {
+// The schema of just the key field, which is what the key column of a columnar collection
+// stores
+Schema key_schema(const Schema& schema) {
+    return Schema{{schema.fields[schema.key_field_index]}, 0};
+}
+
+std::variant<Storage, ColumnarStorage> make_storage(const SchemaLayout& schema_layout,
+                                                    StorageLayout layout) {
+    if (layout == StorageLayout::COLUMNAR) {
+        return ColumnarStorage{schema_layout};
+    }
+
+    return Storage{schema_layout.size()};
+}
 
-Collection::Collection(Schema schema)
+}  // namespace
+
+Collection::Collection(Schema schema, CollectionOptions options)
     : m_schema{std::move(schema)},
-      m_storage{size(m_schema)},
-      m_key_offset{offset(m_schema, m_schema.key_field_index)} {
-    std::visit(
-        OverloadedVisitor{
-            [&](StringType) {
-                m_key_buffer_fn = [](const void* data, std::size_t key_offset) -> ConstBuffer {
-                    const auto* key = reinterpret_cast<const char*>(data) + key_offset;
-                    const auto* str_header = reinterpret_cast<const StringHeader*>(key);
-
-                    return {reinterpret_cast<const char*>(str_header) + sizeof(*str_header),
-                            str_header->len};
-                };
-
-                m_hash_fn = [](ConstBuffer buf) {
-                    return std::hash<std::string_view>{}({buf.data, buf.len});
-                };
-            },
-            [](AggregateType) {
-                // Aggregate should never be the key field
-                assert(false);
-            },
-            [&](auto&& v) {
-                using T = typename ImplType<std::decay_t<decltype(v)>>::Type;
-
-                m_key_buffer_fn = [](const void* data, std::size_t key_offset) -> ConstBuffer {
-                    const auto* key = reinterpret_cast<const char*>(data) + key_offset;
-
-                    return {reinterpret_cast<const char*>(key), sizeof(T)};
-                };
-
-                m_hash_fn = [](ConstBuffer buf) {
-                    assert(buf.len == sizeof(T));
-
-                    return std::hash<T>{}(*reinterpret_cast<const T*>(buf.data));
-                };
-            }},
-        m_schema.fields[m_schema.key_field_index].type);
+      m_schema_layout{m_schema},
+      m_hasher{options.hasher},
+      m_key{m_schema_layout, options.hasher},
+      m_index_key{options.layout == StorageLayout::COLUMNAR ? SchemaLayout{key_schema(m_schema)}
+                                                            : m_schema_layout,
+                  options.hasher},
+      m_storage{make_storage(m_schema_layout, options.layout)},
+      m_max_memory{options.max_memory} {
+    if (auto* columns = std::get_if<ColumnarStorage>(&m_storage)) {
+        m_key_column = m_schema_layout.key_leaf_index();
+        m_row.resize(columns->doc_size());
+    }
+
+    switch (options.index_type) {
+        case IndexType::LINEAR_PROBE:
+            m_index.emplace<LinearProbeIndex>();
+            break;
+
+        case IndexType::SWISS:
+            m_index.emplace<SwissIndex>();
+            break;
+    }
+
+    if (m_max_memory != 0 && options.eviction != EvictionPolicy::NONE) {
+        m_eviction.emplace(options.eviction);
+    }
+}
+
+void* Collection::put(const void* data) { return put(data, 0); }
+
+void* Collection::put(const void* data, std::uint64_t expires_at) {
+    auto data_key = m_key.key(data);
+    auto keys = index_keys();
+
+    return put_internal(
+        data, m_key.hash(data_key),
+        [&](std::size_t value_index) {
+            auto key = keys.key_at(value_index);
+
+            return key.len == data_key.len && std::memcmp(key.data, data_key.data, key.len) == 0;
+        },
+        expires_at);
+}
+
+void Collection::remove(ConstBuffer key) {
+    auto keys = index_keys();
+
+    remove_internal(
+        m_key.hash(key),
+        [&](std::size_t value_index) {
+            auto data_key = keys.key_at(value_index);
+
+            return key.len == data_key.len && std::memcmp(key.data, data_key.data, key.len) == 0;
+        },
+        [&](std::size_t value_index) { return keys.hash_at(value_index); });
+}
+
+bool Collection::expire(std::uint64_t now, std::size_t max_count) {
+    if (!m_expiry) {
+        return true;
+    }
+
+    auto keys = index_keys();
+
+    return m_expiry->advance(
+        now,
+        [&](std::uint64_t id) {
+            auto key_hash = static_cast<std::size_t>(id);
+
+            // The document the entry was for might have been given a later expiry or removed
+            // since, so this only looks for one which has expired by now. Any other documents
+            // whose keys have the same hash have entries of their own.
+            remove_internal(
+                key_hash,
+                [&](std::size_t value_index) {
+                    auto expires_at = m_expires_at[value_index];
+
+                    return expires_at != 0 && expires_at <= now &&
+                           keys.hash_at(value_index) == key_hash;
+                },
+                [&](std::size_t value_index) { return keys.hash_at(value_index); });
+        },
+        max_count);
+}
+
+// If the key type is a string, we convert the ConstBuffer to a string_view
+// and perform the lookup using that.
+void* Collection::find(ConstBuffer key) {
+    auto value_index = find_index(key);
+
+    return value_index == NO_POS ? nullptr : doc(value_index);
 }
 
-void* Collection::put(const void* data) {
-    if (m_storage.count() + 1 >= static_cast<std::size_t>(m_buckets.size() / 1.4)) {
-        auto new_bucket_count = m_buckets.size() * 2;
+UpdateResult Collection::update(ConstBuffer key, Span<const FieldUpdate> updates) {
+    for (const auto& update : updates) {
+        const auto* leaf = m_schema_layout.find(update.path);
 
-        if (new_bucket_count == 0) {
-            new_bucket_count = 32;
+        // The key can't change since the index is keyed by it
+        if (!leaf || leaf == &m_schema_layout.key() || !can_apply(*leaf, update)) {
+            return UpdateResult::INVALID;
         }
+    }
 
-        {
-            std::vector<KeyValue> new_buckets(new_bucket_count);
+    auto value_index = find_index(key);
 
-            for (std::size_t i = 0; i < m_storage.count(); ++i) {
-                auto* elem = m_storage[i];
-                auto elem_key = m_key_buffer_fn(elem, m_key_offset);
+    if (value_index == NO_POS) {
+        return UpdateResult::NOT_FOUND;
+    }
 
-                auto elem_key_h = m_hash_fn(elem_key);
+    for (const auto& update : updates) {
+        if (update.op != FieldUpdate::Op::COMPARE_AND_SET) {
+            continue;
+        }
 
-                // TODO We can optimize the put_internal here by having it skip checking for
-                // duplicates, since there will never be duplicates
-                if (auto* res = put_internal(new_buckets, elem_key, elem_key_h)) {
-                    assert(res->value_index == m_storage.count());
-                    res->value_index = i;
-                } else {
-                    // Failed to rehash, insert failed
-                    return nullptr;
-                }
-            }
+        const auto& leaf = *m_schema_layout.find(update.path);
 
-            m_buckets = std::move(new_buckets);
+        if (!field_equals(leaf, leaf_data(value_index, leaf), update.expected)) {
+            return UpdateResult::COMPARE_FAILED;
         }
     }
 
-    auto data_key = m_key_buffer_fn(data, m_key_offset);
-    auto data_key_h = m_hash_fn(data_key);
+    for (const auto& update : updates) {
+        const auto& leaf = *m_schema_layout.find(update.path);
 
-    if (auto* res = put_internal(m_buckets, data_key, data_key_h)) {
-        if (res->value_index == m_storage.count()) {
-            return m_storage.put(data);
+        auto* field = leaf_data(value_index, leaf);
+
+        auto indexed = std::any_of(
+            m_secondary_indexes.begin(), m_secondary_indexes.end(),
+            [&](const SecondaryIndex& index) { return index.leaf().offset == leaf.offset; });
+
+        if (!indexed) {
+            apply(leaf, field, update);
+            continue;
         }
 
-        auto* dest = m_storage[res->value_index];
+        m_old_field.assign(static_cast<const char*>(field),
+                           static_cast<const char*>(field) + leaf.size);
 
-        std::memcpy(m_storage[res->value_index], data, m_storage.doc_size());
+        apply(leaf, field, update);
 
-        return dest;
+        for (auto& index : m_secondary_indexes) {
+            if (index.leaf().offset == leaf.offset) {
+                index.change(value_index, m_old_field.data(), field);
+            }
+        }
     }
 
-    return nullptr;
+    return UpdateResult::SUCCESS;
 }
 
-void Collection::remove(ConstBuffer key) {
-    auto h = m_hash_fn(key);
+std::size_t Collection::find_index(ConstBuffer key) {
+    auto h = m_key.hash(key);
 
-    auto* found = find_internal(key, h);
+    auto value_index = std::visit(
+        [&](auto& index) {
+            auto pos = index.find(index_keys(), key, h);
 
-    if (!found) {
-        return;
+            return pos == NO_POS ? NO_POS : index.value(pos);
+        },
+        m_index);
+
+    if (value_index == NO_POS) {
+        m_miss_count += 1;
+        return NO_POS;
+    }
+
+    // Expired documents are left for expire, since removing one here would move another
+    // document into its place while the caller might still be holding on to it
+    if (expired(value_index)) {
+        m_miss_count += 1;
+        return NO_POS;
+    }
+
+    touch(value_index);
+
+    return value_index;
+}
+
+void Collection::find_many(Span<const ConstBuffer> keys, void** out) {
+    auto* columns = std::get_if<ColumnarStorage>(&m_storage);
+
+    if (columns) {
+        m_rows.resize(keys.size() * doc_size());
     }
 
-    if (found->value_index != m_storage.count() - 1) {
-        // If this isn't the last element, then adjust the index of the last element in the internal
-        // index
+    std::size_t hashes[FIND_MANY_GROUP_SIZE];
 
-        auto* last_elem_data = m_storage[m_storage.count() - 1];
-        auto last_elem_data_key = m_key_buffer_fn(last_elem_data, m_key_offset);
+    std::visit(
+        [&](auto& index) {
+            auto index_keys = this->index_keys();
+
+            for (std::size_t first = 0; first < keys.size(); first += FIND_MANY_GROUP_SIZE) {
+                auto n = std::min(FIND_MANY_GROUP_SIZE, keys.size() - first);
+
+                for (std::size_t i = 0; i < n; ++i) {
+                    hashes[i] = m_key.hash(keys.data[first + i]);
+                    index.prefetch(hashes[i]);
+                }
+
+                for (std::size_t i = 0; i < n; ++i) {
+                    auto pos = index.find(index_keys, keys.data[first + i], hashes[i]);
+
+                    if (pos == NO_POS || expired(index.value(pos))) {
+                        m_miss_count += 1;
+                        out[first + i] = nullptr;
+                        continue;
+                    }
 
-        auto last_elem_data_key_hash = m_hash_fn(last_elem_data_key);
+                    touch(index.value(pos));
 
-        auto* last_elem_found = find_internal(last_elem_data_key, last_elem_data_key_hash);
+                    if (columns) {
+                        auto* row = m_rows.data() + (first + i) * doc_size();
 
-        assert(last_elem_found);
+                        columns->read(index.value(pos), row);
+                        out[first + i] = row;
+                    } else {
+                        out[first + i] = std::get<Storage>(m_storage)[index.value(pos)];
+                    }
+                }
+            }
+        },
+        m_index);
+}
+
+void Collection::prefetch(ConstBuffer key) {
+    auto h = m_key.hash(key);
+
+    std::visit([&](const auto& index) { index.prefetch(h); }, m_index);
+}
 
-        last_elem_found->value_index = found->value_index;
+bool Collection::create_index(std::string_view path, SecondaryIndexType type) {
+    const auto* leaf = m_schema_layout.find(path);
+
+    if (!leaf || !can_index(leaf->type)) {
+        return false;
+    }
+
+    for (const auto& index : m_secondary_indexes) {
+        if (index.leaf().offset == leaf->offset && index.type() == type) {
+            return true;
+        }
     }
 
-    m_storage.remove(m_storage[found->value_index]);
+    auto& index = m_secondary_indexes.emplace_back(
+        *leaf, static_cast<std::size_t>(leaf - m_schema_layout.leaves().data()), type);
+
+    for (std::size_t i = 0; i < count(); ++i) {
+        index.add(i, leaf_data(i, *leaf));
+    }
 
-    found->key_hash = TOMBSTONE_KEY_HASH;
+    return true;
 }
 
-// If the key type is a string, we convert the ConstBuffer to a string_view
-// and perform the lookup using that.
-void* Collection::find(ConstBuffer key) {
-    auto h = m_hash_fn(key);
+bool Collection::find_equal(std::string_view path, ConstBuffer value,
+                            FunctionView<bool(const void* doc)> fn) {
+    auto* index = secondary_index(path, false);
+
+    if (!index || !index->fits(value)) {
+        return false;
+    }
+
+    index->find(value, [&](std::size_t value_index) { return visit_found(value_index, fn); });
+
+    return true;
+}
+
+bool Collection::find_range(std::string_view path, ConstBuffer min, ConstBuffer max,
+                            FunctionView<bool(const void* doc)> fn) {
+    auto* index = secondary_index(path, true);
+
+    if (!index || (min.len != 0 && !index->fits(min)) || (max.len != 0 && !index->fits(max))) {
+        return false;
+    }
+
+    index->find_range(min, max,
+                      [&](std::size_t value_index) { return visit_found(value_index, fn); });
+
+    return true;
+}
+
+const std::vector<SecondaryIndex>& Collection::secondary_indexes() const {
+    return m_secondary_indexes;
+}
+
+ConstBuffer Collection::key(const void* data) const { return m_key.key(data); }
 
-    auto* found = find_internal(key, h);
+std::size_t Collection::key_hash(const void* data) const { return m_key.hash(m_key.key(data)); }
 
-    if (!found) {
-        return nullptr;
+bool Collection::map(int fd, std::uint64_t offset, Span<const std::size_t> key_hashes) {
+    assert(count() == 0);
+
+    auto& storage = std::get<Storage>(m_storage);
+
+    if (!std::visit([&](auto& index) { return index.build(key_hashes); }, m_index)) {
+        return false;
+    }
+
+    storage.map(fd, offset, key_hashes.size());
+
+    if (m_eviction) {
+        m_eviction->resize(count());
+    }
+
+    for (std::size_t i = 0; i < count(); ++i) {
+        index_added(i);
     }
 
-    return m_storage[found->value_index];
+    return true;
 }
 
 const Schema& Collection::schema() const { return m_schema; }
 
-std::size_t Collection::doc_size() const { return m_storage.doc_size(); }
+const SchemaLayout& Collection::schema_layout() const { return m_schema_layout; }
 
-std::size_t Collection::count() const { return m_storage.count(); }
+const Projection* Collection::projection(Span<const std::string_view> paths) {
+    return m_projections.find(m_schema_layout, paths);
+}
 
-Collection::KeyValue* Collection::put_internal(std::vector<KeyValue>& dest, ConstBuffer key,
-                                               std::size_t key_hash) {
-    auto idx = key_hash & (dest.size() - 1);
-    auto orig_idx = idx;
+std::size_t Collection::doc_size() const { return m_schema_layout.size(); }
 
-    for (;;) {
-        auto& bucket = dest[idx];
+std::size_t Collection::count() const {
+    return std::visit([](const auto& storage) { return storage.count(); }, m_storage);
+}
 
-        if (bucket.key_hash == 0 || bucket.key_hash == TOMBSTONE_KEY_HASH) {
-            bucket.key_hash = key_hash;
-            bucket.value_index = m_storage.count();
+IndexType Collection::index_type() const {
+    return std::holds_alternative<SwissIndex>(m_index) ? IndexType::SWISS
+                                                       : IndexType::LINEAR_PROBE;
+}
 
-            return &bucket;
-        }
+KeyHasher Collection::hasher() const { return m_hasher; }
 
-        // If it matches a previously existing element, just return the existing bucket
-        if (bucket.key_hash == key_hash) {
-            auto* data = m_storage[bucket.value_index];
-            auto data_key = m_key_buffer_fn(data, m_key_offset);
+std::size_t Collection::max_memory() const { return m_max_memory; }
 
-            if (data_key.len == key.len && std::memcmp(data_key.data, key.data, key.len) == 0) {
-                return &bucket;
-            }
+EvictionPolicy Collection::eviction_policy() const {
+    return m_eviction ? m_eviction->policy() : EvictionPolicy::NONE;
+}
+
+StorageLayout Collection::layout() const {
+    return std::holds_alternative<ColumnarStorage>(m_storage) ? StorageLayout::COLUMNAR
+                                                              : StorageLayout::ROW;
+}
+
+ColumnRun Collection::column_run(std::size_t leaf_index, std::size_t first) {
+    auto& column = std::get<ColumnarStorage>(m_storage).column(leaf_index);
+
+    if (first >= column.count()) {
+        return {};
+    }
+
+    return {column[first], column.run_length(first)};
+}
+
+void Collection::for_each_run(FunctionView<void(const void* docs, std::size_t count)> fn) {
+    auto doc_count = count();
+
+    if (auto* storage = std::get_if<Storage>(&m_storage)) {
+        for (std::size_t i = 0; i < doc_count;) {
+            auto len = storage->run_length(i);
+
+            fn((*storage)[i], len);
+
+            i += len;
         }
 
-        idx += 1;
-        idx &= (dest.size() - 1);
+        return;
+    }
+
+    for (std::size_t i = 0; i < doc_count; ++i) {
+        fn(doc(i), 1);
+    }
+}
+
+Span<const std::uint64_t> Collection::expiry_times() const {
+    return {m_expires_at.data(), m_expires_at.size()};
+}
+
+void Collection::set_expiry_times(Span<const std::uint64_t> times) {
+    assert(times.size() == count());
+
+    auto keys = index_keys();
 
-        // We wrapped around, insert failed
-        if (idx == orig_idx) {
-            return nullptr;
+    for (std::size_t i = 0; i < times.size(); ++i) {
+        if (times.data[i] != 0) {
+            set_expiry(i, keys.hash_at(i), times.data[i]);
         }
     }
 }
 
-Collection::KeyValue* Collection::find_internal(ConstBuffer key, std::size_t key_hash) {
-    if (m_buckets.empty()) {
-        return nullptr;
+std::size_t Collection::index_memory_usage() const {
+    return std::visit([](const auto& index) { return index.memory_usage(); }, m_index);
+}
+
+std::size_t Collection::memory_usage() const {
+    auto usage = std::visit([](const auto& storage) { return storage.memory_usage(); },
+                            m_storage) +
+                 index_memory_usage() + m_expires_at.size() * sizeof(std::uint64_t);
+
+    if (m_eviction) {
+        usage += m_eviction->memory_usage();
     }
 
-    auto idx = key_hash & (m_buckets.size() - 1);
-    auto orig_idx = idx;
+    for (const auto& index : m_secondary_indexes) {
+        usage += index.memory_usage();
+    }
+
+    return usage;
+}
+
+CollectionStats Collection::stats() const {
+    CollectionStats stats;
+
+    // Every column grows and shrinks together, so the key's column speaks for all of them
+    const auto& storage = const_cast<Collection*>(this)->index_keys().storage;
+
+    stats.count = storage.count();
+    stats.storage_capacity = storage.capacity();
+    stats.storage_shrink_count = storage.shrink_count();
+    stats.index = std::visit([](const auto& index) { return index.stats(); }, m_index);
+    stats.memory_usage = memory_usage();
+    stats.hit_count = m_hit_count;
+    stats.miss_count = m_miss_count;
+    stats.eviction_count = m_eviction_count;
 
-    for (;;) {
-        auto& bucket = m_buckets[idx];
+    return stats;
+}
+
+IndexKeys Collection::index_keys() {
+    return std::visit(
+        OverloadedVisitor{
+            [&](Storage& storage) { return IndexKeys{storage, m_index_key}; },
+            [&](ColumnarStorage& columns) {
+                return IndexKeys{columns.column(m_key_column), m_index_key};
+            }},
+        m_storage);
+}
 
-        if (m_buckets[idx].key_hash == 0) {
-            return nullptr;
+void* Collection::doc(std::size_t value_index) {
+    return std::visit(OverloadedVisitor{[&](Storage& storage) { return storage[value_index]; },
+                                        [&](ColumnarStorage& columns) -> void* {
+                                            columns.read(value_index, m_row.data());
+                                            return m_row.data();
+                                        }},
+                      m_storage);
+}
+
+void* Collection::leaf_data(std::size_t value_index, const LeafField& leaf) {
+    return std::visit(
+        OverloadedVisitor{[&](Storage& storage) -> void* {
+                              return static_cast<char*>(storage[value_index]) + leaf.offset;
+                          },
+                          [&](ColumnarStorage& columns) {
+                              auto leaf_index = &leaf - m_schema_layout.leaves().data();
+
+                              return columns.column(leaf_index)[value_index];
+                          }},
+        m_storage);
+}
+
+void* Collection::leaf_data(std::size_t value_index, const SecondaryIndex& index) {
+    return leaf_data(value_index, m_schema_layout.leaves()[index.leaf_index()]);
+}
+
+bool Collection::expired(std::size_t value_index) const {
+    // Only documents with an expiry pay for reading the clock
+    return !m_expires_at.empty() && m_expires_at[value_index] != 0 &&
+           m_expires_at[value_index] <= unix_time_ms();
+}
+
+SecondaryIndex* Collection::secondary_index(std::string_view path, bool range) {
+    SecondaryIndex* found = nullptr;
+
+    for (auto& index : m_secondary_indexes) {
+        if (index.leaf().path != path) {
+            continue;
         }
 
-        if (m_buckets[idx].key_hash == key_hash) {
-            auto* data = m_storage[bucket.value_index];
-            auto data_key = m_key_buffer_fn(data, m_key_offset);
+        // Either kind can find a value, but hash indexes are quicker at it
+        if (index.type() == SecondaryIndexType::ORDERED) {
+            found = found ? found : &index;
+        } else if (!range) {
+            found = &index;
+        }
+    }
 
-            if (key.len == data_key.len && std::memcmp(data_key.data, key.data, key.len) == 0) {
-                return &bucket;
-            }
+    return found;
+}
+
+bool Collection::visit_found(std::size_t value_index, FunctionView<bool(const void* doc)> fn) {
+    // Expired documents are left for expire, since removing them would change the index
+    // that's being walked
+    if (expired(value_index)) {
+        m_miss_count += 1;
+        return true;
+    }
+
+    touch(value_index);
+
+    return fn(doc(value_index));
+}
+
+void Collection::index_added(std::size_t value_index) {
+    for (auto& index : m_secondary_indexes) {
+        index.add(value_index, leaf_data(value_index, index));
+    }
+}
+
+void Collection::index_changing(std::size_t value_index, const void* data) {
+    for (auto& index : m_secondary_indexes) {
+        index.change(value_index, leaf_data(value_index, index),
+                     static_cast<const char*>(data) + index.leaf().offset);
+    }
+}
+
+void Collection::index_removing(std::size_t value_index, std::size_t last_index) {
+    for (auto& index : m_secondary_indexes) {
+        index.remove(value_index, leaf_data(value_index, index), last_index,
+                     leaf_data(last_index, index));
+    }
+}
+
+void Collection::set_expiry(std::size_t value_index, std::size_t key_hash,
+                            std::uint64_t expires_at) {
+    if (m_expires_at.empty()) {
+        if (expires_at == 0) {
+            return;
         }
 
-        idx += 1;
-        idx &= (m_buckets.size() - 1);
+        m_expires_at.resize(count());
+    } else if (m_expires_at.size() < count()) {
+        // The document was just added
+        m_expires_at.push_back(0);
+    }
+
+    m_expires_at[value_index] = expires_at;
+
+    if (expires_at == 0) {
+        return;
+    }
+
+    if (!m_expiry) {
+        m_expiry.emplace(unix_time_ms());
+    }
+
+    m_expiry->add(expires_at, key_hash);
+}
 
-        if (idx == orig_idx) {
-            return nullptr;
+bool Collection::make_room() {
+    // Room for the document's bookkeeping, and a new chunk if storage is full. Evicting a
+    // document from a full storage makes room for the next one without growing.
+    auto needed = m_eviction ? sizeof(std::uint32_t) : 0;
+
+    const auto next_chunk_size = [&] {
+        return std::visit([](const auto& storage) { return storage.next_chunk_size(); },
+                          m_storage);
+    };
+
+    for (std::size_t i = 0; i < MAX_EVICTIONS_PER_PUT; ++i) {
+        if (memory_usage() + needed + next_chunk_size() <= m_max_memory) {
+            return true;
+        }
+
+        if (!m_eviction || count() == 0) {
+            return false;
         }
+
+        auto value_index = m_eviction->victim();
+
+        remove_at(index_keys().hash_at(value_index), value_index);
+
+        m_eviction_count += 1;
     }
+
+    // Still over, but the next puts will carry on evicting
+    return true;
+}
+
+void Collection::remove_at(std::size_t key_hash, std::size_t value_index) {
+    auto keys = index_keys();
+
+    remove_internal(
+        key_hash, [&](std::size_t other) { return other == value_index; },
+        [&](std::size_t other) { return keys.hash_at(other); });
 }
 
 }  // namespace boutique
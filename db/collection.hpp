@@ -3,58 +3,489 @@
 #include <cassert>
 #include <cstddef>
 #include <cstring>
-#include <functional>
+#include <optional>
 #include <string_view>
+#include <variant>
 #include <vector>
 
+#include "columnar_storage.hpp"
 #include "core/const_buffer.hpp"
+#include "core/function_view.hpp"
+#include "core/span.hpp"
+#include "eviction.hpp"
+#include "field_update.hpp"
+#include "index.hpp"
+#include "key_accessor.hpp"
+#include "key_hash.hpp"
+#include "linear_probe_index.hpp"
+#include "projection.hpp"
 #include "schema.hpp"
+#include "schema_layout.hpp"
+#include "secondary_index.hpp"
 #include "storage.hpp"
+#include "swiss_index.hpp"
+#include "timing_wheel.hpp"
 
 namespace boutique {
 
+enum class StorageLayout : std::uint8_t {
+    // Whole documents are stored next to each other
+    ROW,
+
+    // Each leaf field is stored in its own column. Scanning a field or two is much cheaper,
+    // but reading whole documents means assembling them.
+    COLUMNAR,
+};
+
+struct CollectionOptions {
+    IndexType index_type = IndexType::LINEAR_PROBE;
+    StorageLayout layout = StorageLayout::ROW;
+    KeyHasher hasher = KeyHasher::WYHASH;
+
+    // Limit on memory_usage, or 0 for none. Each put of a new document first evicts up to a
+    // couple of others (chosen by the eviction policy) if there isn't room for it, so a
+    // collection which goes over (e.g. when its index grows) is brought back under gradually.
+    std::size_t max_memory = 0;
+    EvictionPolicy eviction = EvictionPolicy::NONE;
+};
+
+// Values of one leaf field for a run of consecutive documents, contiguous in memory
+struct ColumnRun {
+    const void* values = nullptr;
+    std::size_t count = 0;
+};
+
+struct CollectionStats {
+    std::size_t count = 0;
+
+    std::size_t storage_capacity = 0;
+    std::size_t storage_shrink_count = 0;
+
+    IndexStats index;
+
+    std::size_t memory_usage = 0;
+
+    // Documents found and keys not found (or expired) by find, find_many and find_hashed
+    std::size_t hit_count = 0;
+    std::size_t miss_count = 0;
+
+    // Documents removed to make room under max_memory
+    std::size_t eviction_count = 0;
+};
+
 struct Collection {
-    Collection(Schema schema);
+    Collection(Schema schema, CollectionOptions options = {});
 
+    // For columnar collections, the returned document is assembled into a buffer which is
+    // only valid until the next call to put or find.
+    //
+    // Returns nullptr if the document is new and there's no room for it under max_memory.
     void* put(const void* data);
 
+    // Same as put, except the document expires at the given time (see unix_time_ms). From then
+    // on it's as good as removed: finds don't see it, and expire removes it. A plain put takes a
+    // document's expiry away again.
+    void* put(const void* data, std::uint64_t expires_at);
+
     void remove(ConstBuffer key);
 
+    // Changes the given fields of the document with the given key in place, without copying the
+    // rest of it. Every update is checked (including the comparisons of COMPARE_AND_SET) before
+    // any of them are applied, so either all of them are or none are.
+    UpdateResult update(ConstBuffer key, Span<const FieldUpdate> updates);
+
+    // Removes documents which expired by now, up to max_count of them, and returns false if
+    // there are more, so that a lot of documents expiring at once can be dealt with a slice at a
+    // time.
+    bool expire(std::uint64_t now, std::size_t max_count);
+
     // If the key type is a string, we convert the ConstBuffer to a string_view
     // and perform the lookup using that.
+    //
+    // Same as put for columnar collections.
     void* find(ConstBuffer key);
 
+    // Same as find for each of the keys, writing the results to out. Keys are hashed and
+    // their index slots prefetched a group at a time before any of them are probed, so the
+    // cache misses within a batch overlap instead of being taken one after another.
+    //
+    // Expired documents aren't found, but they're left for expire to remove so that the ones
+    // which were found stay where they are.
+    //
+    // For columnar collections, the documents are assembled into a buffer which is only valid
+    // until the next call to find_many.
+    void find_many(Span<const ConstBuffer> keys, void** out);
+
+    // Starts loading the index slot for the key, for callers about to put or remove several
+    // keys one at a time
+    void prefetch(ConstBuffer key);
+
+    // Adds a secondary index on the leaf field with the given path, and fills it in with the
+    // documents already here. From then on it's kept up to date as documents change. Returns
+    // false if there's no such field or it can't be indexed (see can_index). Adding one which
+    // is already there does nothing.
+    bool create_index(std::string_view path, SecondaryIndexType type);
+
+    // Calls fn with each document whose field at path is value (encoded like
+    // FieldUpdate::value), using a secondary index, until fn returns false. Expired documents
+    // are skipped. Columnar documents are assembled into a buffer which is only valid during
+    // the call to fn.
+    //
+    // Returns false if the field has no secondary index or the value doesn't fit it.
+    bool find_equal(std::string_view path, ConstBuffer value,
+                    FunctionView<bool(const void* doc)> fn);
+
+    // Same as find_equal for documents whose field is between min and max (inclusive), in order
+    // of their values. Either end can be left empty to leave it open. Needs an ORDERED index.
+    bool find_range(std::string_view path, ConstBuffer min, ConstBuffer max,
+                    FunctionView<bool(const void* doc)> fn);
+
+    // In the order they were created
+    const std::vector<SecondaryIndex>& secondary_indexes() const;
+
+    // Same as find, put and remove, for callers which know the type of the key at compile time
+    // (see TypedCollection). They hash the key themselves with hash_key<hasher()> and compare it
+    // against documents with key_equals(const void* doc), both of which can then be inlined,
+    // instead of going through the KeyAccessor. Only for row collections.
+    template <typename KeyEquals>
+    void* find_hashed(std::size_t key_hash, KeyEquals&& key_equals);
+
+    template <typename KeyEquals>
+    void* put_hashed(const void* data, std::size_t key_hash, KeyEquals&& key_equals);
+
+    // doc_hash(const void* doc) hashes the key of a document. Removing moves the last document
+    // into the removed one's place, and its index entry has to be found to point it there.
+    template <typename KeyEquals, typename DocHash>
+    void remove_hashed(std::size_t key_hash, KeyEquals&& key_equals, DocHash&& doc_hash);
+
+    // The key of the given document, which must have this collection's schema
+    ConstBuffer key(const void* data) const;
+
+    // Hash of the key of the given document, which is what the index stores it under
+    std::size_t key_hash(const void* data) const;
+
+    // Makes the collection's documents the ones at offset in the file fd (see Storage::map) and
+    // builds the index from key_hashes, the key_hash of each of them in order, so none of the
+    // documents are read until they're used. Only for empty row collections. Returns false if
+    // the index has no room for them.
+    bool map(int fd, std::uint64_t offset, Span<const std::size_t> key_hashes);
+
     const Schema& schema() const;
+    const SchemaLayout& schema_layout() const;
+
+    // The projection of the given field paths onto this collection's documents, or nullptr if
+    // any of them isn't a field. Compiled projections are cached (see ProjectionCache), so the
+    // returned one is only good until the next call.
+    const Projection* projection(Span<const std::string_view> paths);
+
     std::size_t doc_size() const;
 
     std::size_t count() const;
 
+    IndexType index_type() const;
+    StorageLayout layout() const;
+    KeyHasher hasher() const;
+    std::size_t max_memory() const;
+    EvictionPolicy eviction_policy() const;
+
+    // Only available for columnar collections. Returns the values of the given leaf field (see
+    // SchemaLayout::leaves) for documents starting at index first, up to wherever they stop being
+    // contiguous. Documents are in the same order in every column, so scanning several fields
+    // at once means taking the shortest run of them and going from there.
+    ColumnRun column_run(std::size_t leaf_index, std::size_t first);
+
+    // Calls fn with every document in storage order, a contiguous run of them at a time.
+    // Columnar documents are assembled one at a time, so each of their runs is one document.
+    void for_each_run(FunctionView<void(const void* docs, std::size_t count)> fn);
+
+    // When each document expires, in storage order, with 0 for never. Empty if none of them
+    // ever has.
+    Span<const std::uint64_t> expiry_times() const;
+
+    // Sets when each document expires, for restoring them along with the documents. times must
+    // hold one for each document in storage order, like expiry_times.
+    void set_expiry_times(Span<const std::uint64_t> times);
+
+    // Bytes used by the index, not including the documents themselves
+    std::size_t index_memory_usage() const;
+
+    // Bytes used by the documents, the index and the bookkeeping for expiry and eviction. The
+    // documents count for all of the storage allocated for them, free space included.
+    std::size_t memory_usage() const;
+
+    CollectionStats stats() const;
+
 private:
     // We copy the schema into the collection since we don't want it to be modified
     // without the collection's knowledge.
     Schema m_schema;
+    SchemaLayout m_schema_layout;
+
+    KeyHasher m_hasher;
+
+    KeyAccessor m_key;
+
+    // Finds keys in whatever the index looks them up in; for columnar collections that's the
+    // key's column rather than whole documents.
+    KeyAccessor m_index_key;
+
+    // This stores all of the documents. This does not retain insertion order as removing
+    // swaps the last element in the storage with the removed element.
+    std::variant<Storage, ColumnarStorage> m_storage;
+
+    std::size_t m_key_column = 0;
+
+    // Columnar documents get assembled into these
+    std::vector<char> m_row;
+    std::vector<char> m_rows;
+
+    // Maps keys to the index of their document in m_storage
+    std::variant<LinearProbeIndex, SwissIndex> m_index;
+
+    // When each document expires (0 for never) by value index, like m_storage. Empty until a
+    // document is first given an expiry, since most collections never will be.
+    std::vector<std::uint64_t> m_expires_at;
+
+    // The key hash of each document with an expiry, to be looked up and removed once it comes.
+    // Documents move around as others are removed, so they can't be tracked by value index.
+    // Entries aren't taken out when a document's expiry changes, they just don't find anything
+    // to remove when their time comes.
+    std::optional<TimingWheel> m_expiry;
+
+    ProjectionCache m_projections;
+
+    std::vector<SecondaryIndex> m_secondary_indexes;
 
-    // We cache this because computing the offset can be a bottleneck
-    std::size_t m_key_offset = 0;
+    // Where update keeps a field's old value while it tells the secondary indexes about it
+    std::vector<char> m_old_field;
 
-    ConstBuffer (*m_key_buffer_fn)(const void* data, std::size_t key_offset);
+    std::size_t m_max_memory = 0;
 
-    // We cache this because it never changes with a constant schema
-    std::size_t (*m_hash_fn)(ConstBuffer);
+    // Set if the collection has both a memory limit and a policy for evicting documents
+    std::optional<EvictionTracker> m_eviction;
 
-    // This stores all of the documents contiguously. This does not retain insertion order
-    // as removing swaps the last element in the storage with the removed element.
-    Storage m_storage;
+    // Reported by stats
+    std::size_t m_hit_count = 0;
+    std::size_t m_miss_count = 0;
+    std::size_t m_eviction_count = 0;
 
-    struct KeyValue {
-        std::size_t key_hash;
-        std::size_t value_index;
-    };
+    IndexKeys index_keys();
 
-    std::vector<KeyValue> m_buckets;
+    void* doc(std::size_t value_index);
 
-    KeyValue* find_internal(ConstBuffer key, std::size_t key_hash);
-    KeyValue* put_internal(std::vector<KeyValue>& dest, ConstBuffer key, std::size_t key_hash);
+    // Value index of the document with the given key, or NO_POS if it isn't there (or has
+    // expired). Counts as a find.
+    std::size_t find_index(ConstBuffer key);
+
+    // Where the given leaf (which must be one of m_schema_layout's) of the document at
+    // value_index is stored
+    void* leaf_data(std::size_t value_index, const LeafField& leaf);
+
+    // Same for the leaf a secondary index is on
+    void* leaf_data(std::size_t value_index, const SecondaryIndex& index);
+
+    // Whether the document at value_index has expired
+    bool expired(std::size_t value_index) const;
+
+    // The index on the leaf at path which can find documents by its value (and a range of
+    // them, if range is set), or nullptr if there isn't one
+    SecondaryIndex* secondary_index(std::string_view path, bool range);
+
+    // Calls fn with the document at value_index, unless it's expired. Returns what fn did.
+    bool visit_found(std::size_t value_index, FunctionView<bool(const void* doc)> fn);
+
+    // Tells the secondary indexes about documents being added, put over with data, and
+    // removed with the last document moved into their place
+    void index_added(std::size_t value_index);
+    void index_changing(std::size_t value_index, const void* data);
+    void index_removing(std::size_t value_index, std::size_t last_index);
+
+    void set_expiry(std::size_t value_index, std::size_t key_hash, std::uint64_t expires_at);
+
+    // Removes the document at value_index, whose key has the given hash
+    void remove_at(std::size_t key_hash, std::size_t value_index);
+
+    // The document at value_index was found (or put over)
+    void touch(std::size_t value_index) {
+        m_hit_count += 1;
+
+        if (m_eviction) {
+            m_eviction->touch(value_index);
+        }
+    }
+
+    // Evicts documents until there's room for a new one under max_memory, up to a few of them.
+    // Returns false if there's no room and nothing can be evicted.
+    bool make_room();
+
+    // The rest of put and remove once the key has been hashed. key_equals takes the value
+    // index of a document, hash_at the value index of a document and returns its key's hash.
+    template <typename KeyEquals>
+    void* put_internal(const void* data, std::size_t key_hash, KeyEquals&& key_equals,
+                       std::uint64_t expires_at = 0);
+
+    template <typename KeyEquals, typename HashAt>
+    void remove_internal(std::size_t key_hash, KeyEquals&& key_equals, HashAt&& hash_at);
 };
 
+template <typename KeyEquals>
+void* Collection::find_hashed(std::size_t key_hash, KeyEquals&& key_equals) {
+    auto& storage = std::get<Storage>(m_storage);
+
+    auto value_index = std::visit(
+        [&](auto& index) {
+            auto pos = index.find(key_hash, [&](std::size_t value_index) {
+                return key_equals(static_cast<const void*>(storage[value_index]));
+            });
+
+            return pos == NO_POS ? NO_POS : index.value(pos);
+        },
+        m_index);
+
+    if (value_index == NO_POS) {
+        m_miss_count += 1;
+        return nullptr;
+    }
+
+    if (expired(value_index)) {
+        m_miss_count += 1;
+        return nullptr;
+    }
+
+    touch(value_index);
+
+    return storage[value_index];
+}
+
+template <typename KeyEquals>
+void* Collection::put_hashed(const void* data, std::size_t key_hash, KeyEquals&& key_equals) {
+    auto& storage = std::get<Storage>(m_storage);
+
+    return put_internal(data, key_hash, [&](std::size_t value_index) {
+        return key_equals(static_cast<const void*>(storage[value_index]));
+    });
+}
+
+template <typename KeyEquals, typename DocHash>
+void Collection::remove_hashed(std::size_t key_hash, KeyEquals&& key_equals, DocHash&& doc_hash) {
+    auto& storage = std::get<Storage>(m_storage);
+
+    remove_internal(
+        key_hash,
+        [&](std::size_t value_index) {
+            return key_equals(static_cast<const void*>(storage[value_index]));
+        },
+        [&](std::size_t value_index) {
+            return doc_hash(static_cast<const void*>(storage[value_index]));
+        });
+}
+
+template <typename KeyEquals>
+void* Collection::put_internal(const void* data, std::size_t key_hash, KeyEquals&& key_equals,
+                               std::uint64_t expires_at) {
+    return std::visit(
+        [&](auto& index) -> void* {
+            auto pos = index.find(key_hash, key_equals);
+
+            if (pos != NO_POS) {
+                auto value_index = index.value(pos);
+
+                if (!m_secondary_indexes.empty()) {
+                    index_changing(value_index, data);
+                }
+
+                if (auto* storage = std::get_if<Storage>(&m_storage)) {
+                    std::memcpy((*storage)[value_index], data, storage->doc_size());
+                } else {
+                    std::get<ColumnarStorage>(m_storage).set(value_index, data);
+                }
+
+                set_expiry(value_index, key_hash, expires_at);
+
+                if (m_eviction) {
+                    m_eviction->touch(value_index);
+                }
+
+                return doc(value_index);
+            }
+
+            // This is before the new document goes in so that it can't be the one evicted. The
+            // evictions don't invalidate anything found above since only the key's absence is
+            // used from here on.
+            if (m_max_memory != 0 && !make_room()) {
+                return nullptr;
+            }
+
+            auto value_index = count();
+
+            if (!index.insert(index_keys(), key_hash, value_index)) {
+                return nullptr;
+            }
+
+            std::visit([&](auto& storage) { storage.put(data); }, m_storage);
+
+            if (m_eviction) {
+                m_eviction->add();
+            }
+
+            if (!m_secondary_indexes.empty()) {
+                index_added(value_index);
+            }
+
+            set_expiry(value_index, key_hash, expires_at);
+
+            return doc(value_index);
+        },
+        m_index);
+}
+
+template <typename KeyEquals, typename HashAt>
+void Collection::remove_internal(std::size_t key_hash, KeyEquals&& key_equals, HashAt&& hash_at) {
+    std::visit(
+        [&](auto& index) {
+            auto pos = index.find(key_hash, key_equals);
+
+            if (pos == NO_POS) {
+                return;
+            }
+
+            auto value_index = index.value(pos);
+            auto last_index = count() - 1;
+
+            index.erase(index_keys(), pos);
+
+            if (value_index != last_index) {
+                // If this isn't the last element, then adjust the index of the last element in
+                // the internal index since it's about to be moved into the removed one's place.
+                // It's the only entry with its value index, so that's all we need to compare.
+                auto last_elem_pos = index.find(
+                    hash_at(last_index), [&](std::size_t other) { return other == last_index; });
+
+                assert(last_elem_pos != NO_POS);
+
+                index.set_value(last_elem_pos, value_index);
+            }
+
+            if (!m_expires_at.empty()) {
+                m_expires_at[value_index] = m_expires_at[last_index];
+                m_expires_at.pop_back();
+            }
+
+            if (m_eviction) {
+                m_eviction->remove(value_index);
+            }
+
+            if (!m_secondary_indexes.empty()) {
+                index_removing(value_index, last_index);
+            }
+
+            if (auto* storage = std::get_if<Storage>(&m_storage)) {
+                storage->remove((*storage)[value_index]);
+            } else {
+                std::get<ColumnarStorage>(m_storage).remove(value_index);
+            }
+        },
+        m_index);
+}
+
 }  // namespace boutique
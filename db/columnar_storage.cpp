@@ -0,0 +1,81 @@
+#include "columnar_storage.hpp"
+
+#include <cstring>
+
+namespace boutique {
+
+ColumnarStorage::ColumnarStorage(const SchemaLayout& layout)
+    : m_doc_size{layout.size()}, m_leaves{layout.leaves()} {
+    m_columns.reserve(m_leaves.size());
+
+    // Each column starts out with its share of a page, so the columns hold as many documents
+    // to begin with as a page of rows would, and take up about as much memory
+    for (const auto& leaf : m_leaves) {
+        m_columns.emplace_back(leaf.size, Storage::FIRST_CHUNK_SIZE * leaf.size / m_doc_size);
+    }
+}
+
+void ColumnarStorage::put(const void* elem_data) {
+    const auto* data = static_cast<const char*>(elem_data);
+
+    for (std::size_t i = 0; i < m_leaves.size(); ++i) {
+        m_columns[i].put(data + m_leaves[i].offset);
+    }
+}
+
+void ColumnarStorage::set(std::size_t index, const void* elem_data) {
+    const auto* data = static_cast<const char*>(elem_data);
+
+    for (std::size_t i = 0; i < m_leaves.size(); ++i) {
+        std::memcpy(m_columns[i][index], data + m_leaves[i].offset, m_leaves[i].size);
+    }
+}
+
+void ColumnarStorage::remove(std::size_t index) {
+    for (auto& column : m_columns) {
+        column.remove(column[index]);
+    }
+}
+
+void ColumnarStorage::read(std::size_t index, void* out) {
+    auto* data = static_cast<char*>(out);
+
+    // Padding between fields isn't stored anywhere
+    std::memset(data, 0, m_doc_size);
+
+    for (std::size_t i = 0; i < m_leaves.size(); ++i) {
+        std::memcpy(data + m_leaves[i].offset, m_columns[i][index], m_leaves[i].size);
+    }
+}
+
+const std::vector<LeafField>& ColumnarStorage::leaves() const { return m_leaves; }
+
+Storage& ColumnarStorage::column(std::size_t leaf_index) { return m_columns[leaf_index]; }
+
+std::size_t ColumnarStorage::count() const {
+    return m_columns.empty() ? 0 : m_columns.front().count();
+}
+
+std::size_t ColumnarStorage::doc_size() const { return m_doc_size; }
+
+std::size_t ColumnarStorage::memory_usage() const {
+    std::size_t usage = 0;
+
+    for (const auto& column : m_columns) {
+        usage += column.memory_usage();
+    }
+
+    return usage;
+}
+
+std::size_t ColumnarStorage::next_chunk_size() const {
+    std::size_t size = 0;
+
+    for (const auto& column : m_columns) {
+        size += column.next_chunk_size();
+    }
+
+    return size;
+}
+
+}  // namespace boutique
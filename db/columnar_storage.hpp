@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "schema_layout.hpp"
+#include "storage.hpp"
+
+namespace boutique {
+
+// Stores each leaf field of the schema in its own column rather than storing whole documents
+// next to each other, so that reading one field across many documents only touches that
+// field's memory. Every column has the documents in the same order, and documents are
+// assembled from (and split into) their columns on the way in and out.
+struct ColumnarStorage {
+    explicit ColumnarStorage(const SchemaLayout& layout);
+
+    void put(const void* elem_data);
+
+    // Overwrites the document at the given index
+    void set(std::size_t index, const void* elem_data);
+
+    // Moves the last document into the removed one's place, same as Storage
+    void remove(std::size_t index);
+
+    // Assembles the document at the given index into out, which must be doc_size() bytes
+    void read(std::size_t index, void* out);
+
+    const std::vector<LeafField>& leaves() const;
+    Storage& column(std::size_t leaf_index);
+
+    std::size_t count() const;
+    std::size_t doc_size() const;
+
+    // Same as Storage's, across every column
+    std::size_t memory_usage() const;
+    std::size_t next_chunk_size() const;
+
+private:
+    std::size_t m_doc_size = 0;
+
+    std::vector<LeafField> m_leaves;
+
+    // m_columns[i] holds the values of m_leaves[i]
+    std::vector<Storage> m_columns;
+};
+
+}  // namespace boutique
@@ -0,0 +1,503 @@
+#include "concurrent_collection.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+const std::size_t INIT_SEGMENT_CAPACITY = 16;
+
+// A segment grows once it has 1/1.4 as many documents as buckets, and grows again after
+// about that many more puts, so this moves the old buckets over well before then.
+const std::size_t MIGRATE_BUCKETS_PER_OP = 16;
+
+const std::size_t READER_SLOT_COUNT = 64;
+
+std::atomic<std::size_t> next_reader_slot{0};
+
+// Threads take reader slots in turn the first time they read from any collection
+std::size_t this_thread_reader_slot() {
+    thread_local std::size_t slot = next_reader_slot.fetch_add(1, std::memory_order_relaxed);
+
+    return slot % READER_SLOT_COUNT;
+}
+
+// Readers spin while a write is in progress since writes only ever take a memcpy's worth of
+// time.
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+}  // namespace
+
+namespace boutique {
+
+ConcurrentCollection::ConcurrentCollection(Schema schema, std::size_t segment_count)
+    : m_schema{std::move(schema)},
+      m_layout{m_schema},
+      m_key{m_layout, KeyHasher::STD},
+      m_doc_size{m_layout.size()} {
+    while ((std::size_t{1} << m_segment_bits) < segment_count) {
+        m_segment_bits += 1;
+    }
+
+    m_segments.reset(new Segment[std::size_t{1} << m_segment_bits]);
+    m_reader_slots.reset(new ReaderSlot[READER_SLOT_COUNT]);
+}
+
+void ConcurrentCollection::put(const void* data) {
+    auto data_key = m_key.key(data);
+    auto h = hash(data_key);
+
+    auto& seg = segment_for(h);
+
+    std::unique_ptr<Table> retired;
+
+    {
+        std::lock_guard<std::mutex> lock{seg.mutex};
+
+        auto count = seg.count.load(std::memory_order_relaxed);
+
+        // Same max load factor as Collection. The new table is allocated up front so that
+        // readers don't spin while it's being zeroed.
+        std::unique_ptr<Table> grown;
+
+        if (!seg.current || static_cast<double>(count + 1) * 1.4 >=
+                                static_cast<double>(seg.current->mask + 1)) {
+            auto capacity = seg.current ? (seg.current->mask + 1) * 2 : INIT_SEGMENT_CAPACITY;
+
+            grown = std::make_unique<Table>(capacity, m_doc_size);
+        }
+
+        auto seq = seg.seq.load(std::memory_order_relaxed);
+
+        seg.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        if (grown) {
+            // Only has anything left to move if the segment grew very recently
+            if (seg.old) {
+                migrate(seg, seg.old->mask + 1, retired);
+            }
+
+            seg.old = std::move(seg.current);
+            seg.current = std::move(grown);
+            seg.migrate_pos = 0;
+
+            // Released so that readers see the new table's fields, not just its address
+            seg.old_table.store(seg.old.get(), std::memory_order_release);
+            seg.table.store(seg.current.get(), std::memory_order_release);
+        } else {
+            migrate(seg, MIGRATE_BUCKETS_PER_OP, retired);
+        }
+
+        auto& table = *seg.current;
+
+        // Keys are only ever in one of the tables, so one which is still in the old table
+        // moves to the current one
+        bool was_old = false;
+
+        if (seg.old) {
+            auto old_idx = find_bucket(*seg.old, data_key, h);
+
+            if (old_idx != NO_BUCKET) {
+                seg.old->key_hashes[old_idx].store(TOMBSTONE_KEY_HASH, std::memory_order_relaxed);
+                was_old = true;
+            }
+        }
+
+        auto idx = probe(table, data_key, h);
+        auto is_new = table.key_hashes[idx].load(std::memory_order_relaxed) == EMPTY_KEY_HASH;
+
+        std::memcpy(doc(table, idx), data, m_doc_size);
+
+        if (is_new) {
+            table.key_hashes[idx].store(h, std::memory_order_relaxed);
+        }
+
+        seg.seq.store(seq + 2, std::memory_order_release);
+
+        if (is_new && !was_old) {
+            seg.count.store(count + 1, std::memory_order_relaxed);
+        }
+    }
+
+    reclaim(std::move(retired));
+}
+
+bool ConcurrentCollection::remove(ConstBuffer key) {
+    if (key.len > m_key.max_len()) {
+        return false;
+    }
+
+    auto h = hash(key);
+
+    auto& seg = segment_for(h);
+
+    std::unique_ptr<Table> retired;
+
+    {
+        std::lock_guard<std::mutex> lock{seg.mutex};
+
+        if (!seg.current) {
+            return false;
+        }
+
+        auto& table = *seg.current;
+
+        auto idx = probe(table, key, h);
+        auto in_table = table.key_hashes[idx].load(std::memory_order_relaxed) != EMPTY_KEY_HASH;
+
+        auto old_idx = !in_table && seg.old ? find_bucket(*seg.old, key, h) : NO_BUCKET;
+
+        if (!in_table && old_idx == NO_BUCKET) {
+            return false;
+        }
+
+        auto seq = seg.seq.load(std::memory_order_relaxed);
+
+        seg.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        if (in_table) {
+            // Rather than leaving a tombstone, shift the rest of the probe chain back over the
+            // hole so that lookups never have to walk past deleted buckets.
+            for (auto next = (idx + 1) & table.mask;; next = (next + 1) & table.mask) {
+                auto next_h = table.key_hashes[next].load(std::memory_order_relaxed);
+
+                if (next_h == EMPTY_KEY_HASH) {
+                    break;
+                }
+
+                auto home = next_h & table.mask;
+
+                // The document at next can only move back to idx if idx is still within its
+                // probe chain, i.e. between its home bucket and where it is now.
+                if (((next - home) & table.mask) >= ((next - idx) & table.mask)) {
+                    std::memcpy(doc(table, idx), doc(table, next), m_doc_size);
+                    table.key_hashes[idx].store(next_h, std::memory_order_relaxed);
+
+                    idx = next;
+                }
+            }
+
+            table.key_hashes[idx].store(EMPTY_KEY_HASH, std::memory_order_relaxed);
+        } else {
+            // Shifting here could move a bucket back past migrate_pos, where it'd never be
+            // moved over
+            seg.old->key_hashes[old_idx].store(TOMBSTONE_KEY_HASH, std::memory_order_relaxed);
+        }
+
+        migrate(seg, MIGRATE_BUCKETS_PER_OP, retired);
+
+        seg.seq.store(seq + 2, std::memory_order_release);
+
+        seg.count.store(seg.count.load(std::memory_order_relaxed) - 1,
+                        std::memory_order_relaxed);
+    }
+
+    reclaim(std::move(retired));
+
+    return true;
+}
+
+bool ConcurrentCollection::find(ConstBuffer key, void* out) const {
+    // Keys this long can't be in here, and checking up front means a torn read of a document's
+    // key length can never make us compare past the end of its key field.
+    if (key.len > m_key.max_len()) {
+        return false;
+    }
+
+    auto h = hash(key);
+
+    const auto& seg = segment_for(h);
+
+    auto& active = start_read();
+
+    bool found = false;
+
+    for (;;) {
+        auto seq = seg.seq.load(std::memory_order_acquire);
+
+        if (seq & 1) {
+            cpu_relax();
+            continue;
+        }
+
+        const auto* table = seg.table.load(std::memory_order_acquire);
+
+        found = false;
+
+        if (table) {
+            auto idx = find_bucket(*table, key, h);
+
+            if (idx == NO_BUCKET) {
+                table = seg.old_table.load(std::memory_order_acquire);
+                idx = table ? find_bucket(*table, key, h) : NO_BUCKET;
+            }
+
+            if (idx != NO_BUCKET) {
+                std::memcpy(out, doc(*table, idx), m_doc_size);
+                found = true;
+            }
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (seg.seq.load(std::memory_order_relaxed) == seq) {
+            break;
+        }
+    }
+
+    active.fetch_sub(1, std::memory_order_release);
+
+    return found;
+}
+
+ConstBuffer ConcurrentCollection::key(const void* data) const { return m_key.key(data); }
+
+const Schema& ConcurrentCollection::schema() const { return m_schema; }
+
+std::size_t ConcurrentCollection::doc_size() const { return m_doc_size; }
+
+std::size_t ConcurrentCollection::count() const {
+    std::size_t total = 0;
+
+    for (std::size_t i = 0; i < (std::size_t{1} << m_segment_bits); ++i) {
+        total += m_segments[i].count.load(std::memory_order_relaxed);
+    }
+
+    return total;
+}
+
+std::size_t ConcurrentCollection::memory_usage() const {
+    const auto table_size = [&](const Table* table) -> std::size_t {
+        if (!table) {
+            return 0;
+        }
+
+        return (table->mask + 1) * (sizeof(std::atomic<std::size_t>) + m_doc_size);
+    };
+
+    std::size_t total = 0;
+
+    for (std::size_t i = 0; i < (std::size_t{1} << m_segment_bits); ++i) {
+        auto& seg = m_segments[i];
+
+        std::lock_guard<std::mutex> lock{seg.mutex};
+
+        total += table_size(seg.current.get()) + table_size(seg.old.get());
+    }
+
+    std::lock_guard<std::mutex> lock{m_retired_mutex};
+
+    for (const auto& retired : m_retired) {
+        total += table_size(retired.table.get());
+    }
+
+    return total;
+}
+
+ConcurrentCollection::Table::Table(std::size_t capacity, std::size_t doc_size)
+    : mask{capacity - 1},
+      key_hashes{new std::atomic<std::size_t>[capacity]},
+      docs{new char[capacity * doc_size]} {
+    for (std::size_t i = 0; i < capacity; ++i) {
+        key_hashes[i].store(EMPTY_KEY_HASH, std::memory_order_relaxed);
+    }
+}
+
+std::size_t ConcurrentCollection::hash(ConstBuffer key) const {
+    auto h = m_key.hash(key);
+
+    if (h == EMPTY_KEY_HASH) {
+        return h + 1;
+    }
+
+    if (h == TOMBSTONE_KEY_HASH) {
+        return h - 1;
+    }
+
+    return h;
+}
+
+ConcurrentCollection::Segment& ConcurrentCollection::segment_for(std::size_t key_hash) const {
+    if (m_segment_bits == 0) {
+        return m_segments[0];
+    }
+
+    // The low bits pick the bucket within a segment, and std::hash is the identity for
+    // integers, so we mix the hash before taking the segment from its high bits.
+    auto mixed = static_cast<std::uint64_t>(key_hash) * 0x9e3779b97f4a7c15ull;
+
+    return m_segments[mixed >> (64 - m_segment_bits)];
+}
+
+char* ConcurrentCollection::doc(const Table& table, std::size_t index) const {
+    return table.docs.get() + index * m_doc_size;
+}
+
+std::atomic<std::uint64_t>& ConcurrentCollection::start_read() const {
+    auto& slot = m_reader_slots[this_thread_reader_slot()];
+
+    for (;;) {
+        auto epoch = m_epoch.load(std::memory_order_seq_cst);
+        auto& active = slot.active[epoch & 1];
+
+        active.fetch_add(1, std::memory_order_seq_cst);
+
+        // If the epoch moved on in between, reclaim may already have checked this counter
+        // without seeing us
+        if (m_epoch.load(std::memory_order_seq_cst) == epoch) {
+            return active;
+        }
+
+        active.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void ConcurrentCollection::migrate(Segment& seg, std::size_t bucket_count,
+                                   std::unique_ptr<Table>& retired) {
+    if (!seg.old) {
+        return;
+    }
+
+    auto& old = *seg.old;
+    auto& table = *seg.current;
+
+    auto end = std::min(old.mask + 1, seg.migrate_pos + bucket_count);
+
+    for (; seg.migrate_pos < end; ++seg.migrate_pos) {
+        auto h = old.key_hashes[seg.migrate_pos].load(std::memory_order_relaxed);
+
+        if (h == EMPTY_KEY_HASH || h == TOMBSTONE_KEY_HASH) {
+            continue;
+        }
+
+        // Keys are never in both tables, so this doesn't have to look at the key
+        auto idx = empty_bucket(table, h);
+
+        std::memcpy(doc(table, idx), doc(old, seg.migrate_pos), m_doc_size);
+        table.key_hashes[idx].store(h, std::memory_order_relaxed);
+
+        // This has to be a tombstone rather than empty so that lookups of keys further along
+        // the probe chain which haven't been moved yet still find them.
+        old.key_hashes[seg.migrate_pos].store(TOMBSTONE_KEY_HASH, std::memory_order_relaxed);
+    }
+
+    if (seg.migrate_pos == old.mask + 1) {
+        seg.old_table.store(nullptr, std::memory_order_relaxed);
+
+        retired = std::move(seg.old);
+        seg.migrate_pos = 0;
+    }
+}
+
+// Readers count themselves under the epoch's parity while they might be looking at a table
+// (see start_read). We only move the epoch on once everyone counted under the other parity
+// has finished, i.e. everyone who started two or more epochs ago. So once the epoch is two
+// past when a table was unlinked, whoever could have reached it has finished with it.
+void ConcurrentCollection::reclaim(std::unique_ptr<Table> retired) {
+    if (!retired && m_retired_count.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock{m_retired_mutex, std::defer_lock};
+
+    // Every write tries this while there are tables waiting, and one of them is enough
+    if (retired) {
+        lock.lock();
+    } else if (!lock.try_lock()) {
+        return;
+    }
+
+    if (retired) {
+        m_retired.push_back({std::move(retired), m_epoch.load(std::memory_order_seq_cst)});
+    }
+
+    for (;;) {
+        auto epoch = m_epoch.load(std::memory_order_relaxed);
+
+        m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+                                       [&](const auto& r) { return r.epoch + 2 <= epoch; }),
+                        m_retired.end());
+
+        if (m_retired.empty()) {
+            break;
+        }
+
+        auto previous = (epoch - 1) & 1;
+
+        bool drained = true;
+
+        for (std::size_t i = 0; i < READER_SLOT_COUNT && drained; ++i) {
+            drained = m_reader_slots[i].active[previous].load(std::memory_order_seq_cst) == 0;
+        }
+
+        if (!drained) {
+            break;
+        }
+
+        m_epoch.store(epoch + 1, std::memory_order_seq_cst);
+    }
+
+    m_retired_count.store(m_retired.size(), std::memory_order_relaxed);
+}
+
+std::size_t ConcurrentCollection::find_bucket(const Table& table, ConstBuffer key,
+                                              std::size_t key_hash) const {
+    auto idx = key_hash & table.mask;
+
+    for (std::size_t i = 0; i <= table.mask; ++i) {
+        auto h = table.key_hashes[idx].load(std::memory_order_relaxed);
+
+        if (h == EMPTY_KEY_HASH) {
+            break;
+        }
+
+        if (h == key_hash && key_equals(doc(table, idx), key)) {
+            return idx;
+        }
+
+        idx = (idx + 1) & table.mask;
+    }
+
+    return NO_BUCKET;
+}
+
+std::size_t ConcurrentCollection::probe(const Table& table, ConstBuffer key,
+                                        std::size_t key_hash) const {
+    auto idx = key_hash & table.mask;
+
+    for (;;) {
+        auto h = table.key_hashes[idx].load(std::memory_order_relaxed);
+
+        if (h == EMPTY_KEY_HASH || (h == key_hash && key_equals(doc(table, idx), key))) {
+            return idx;
+        }
+
+        // The load factor guarantees we hit an empty bucket eventually
+        idx = (idx + 1) & table.mask;
+    }
+}
+
+std::size_t ConcurrentCollection::empty_bucket(const Table& table, std::size_t key_hash) const {
+    auto idx = key_hash & table.mask;
+
+    while (table.key_hashes[idx].load(std::memory_order_relaxed) != EMPTY_KEY_HASH) {
+        idx = (idx + 1) & table.mask;
+    }
+
+    return idx;
+}
+
+bool ConcurrentCollection::key_equals(const char* doc, ConstBuffer key) const {
+    auto doc_key = m_key.key(doc);
+
+    return doc_key.len == key.len && std::memcmp(doc_key.data, key.data, key.len) == 0;
+}
+
+}  // namespace boutique
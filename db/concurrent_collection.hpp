@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "core/const_buffer.hpp"
+#include "key_accessor.hpp"
+#include "schema.hpp"
+#include "schema_layout.hpp"
+
+namespace boutique {
+
+// A collection which can be used from many threads at once. Documents are spread over
+// segments by key hash, and each segment is a small linear-probing table with the documents
+// stored inline.
+//
+// Writers lock their segment's mutex, so writes to different segments never contend. Readers
+// take no locks at all: they probe the table optimistically and then check the segment's
+// sequence number to see whether a writer got in the way, in which case they retry.
+//
+// Segments grow incrementally like LinearProbeIndex: each write moves a few buckets of the old
+// table into the new one, and readers look in both until it's done. Old tables are freed once
+// no reader can still be looking at them, which readers keep track of by counting themselves
+// in per-thread slots (see reclaim).
+//
+// Since a document can be overwritten or moved as soon as find returns, documents are copied
+// out rather than handed out by pointer.
+struct ConcurrentCollection {
+    // The segment count is rounded up to a power of 2
+    explicit ConcurrentCollection(Schema schema, std::size_t segment_count = 64);
+
+    ConcurrentCollection(const ConcurrentCollection& other) = delete;
+    ConcurrentCollection& operator=(const ConcurrentCollection& other) = delete;
+
+    void put(const void* data);
+
+    // Returns whether there was a document with the given key
+    bool remove(ConstBuffer key);
+
+    // Copies the document with the given key into out, which must be at least doc_size() bytes.
+    // Returns whether the document was found.
+    bool find(ConstBuffer key, void* out) const;
+
+    ConstBuffer key(const void* data) const;
+
+    const Schema& schema() const;
+    std::size_t doc_size() const;
+
+    // This is only a snapshot if there are writes going on concurrently
+    std::size_t count() const;
+
+    // Bytes taken up by tables, including old ones which haven't been freed yet
+    std::size_t memory_usage() const;
+
+private:
+    // Bucket hashes with special meanings. Key hashes which collide with these are nudged off
+    // of them (see hash).
+    static constexpr std::size_t EMPTY_KEY_HASH = 0;
+
+    // Only ever in a segment's old table, whose documents are moved out or removed without
+    // shifting the rest of their probe chain back
+    static constexpr std::size_t TOMBSTONE_KEY_HASH = ~std::size_t{0};
+
+    static constexpr std::size_t NO_BUCKET = ~std::size_t{0};
+
+    struct Table {
+        Table(std::size_t capacity, std::size_t doc_size);
+
+        std::size_t mask = 0;
+
+        // Readers load these while writers store them, hence the atomics. The documents
+        // themselves are plain memory; the sequence number check throws away any copy which
+        // raced with a write.
+        std::unique_ptr<std::atomic<std::size_t>[]> key_hashes;
+        std::unique_ptr<char[]> docs;
+    };
+
+    struct alignas(64) Segment {
+        // Odd while a writer is modifying either table
+        std::atomic<std::uint64_t> seq{0};
+
+        std::atomic<Table*> table{nullptr};
+
+        // The table being grown out of, until all of its documents have been moved into table
+        std::atomic<Table*> old_table{nullptr};
+
+        std::mutex mutex;
+
+        // Documents in both tables
+        std::atomic<std::size_t> count{0};
+
+        // What table and old_table point to. Only touched with the mutex held.
+        std::unique_ptr<Table> current;
+        std::unique_ptr<Table> old;
+
+        // Buckets of old before this have all been moved
+        std::size_t migrate_pos = 0;
+    };
+
+    // Readers count themselves in here for as long as they might be looking at a table, under
+    // the parity of the epoch they started in. Threads get their own slot (until there are
+    // more threads than slots) so that they don't contend over it.
+    struct alignas(64) ReaderSlot {
+        std::atomic<std::uint64_t> active[2]{};
+    };
+
+    struct RetiredTable {
+        std::unique_ptr<Table> table;
+
+        // m_epoch when the table stopped being reachable
+        std::uint64_t epoch = 0;
+    };
+
+    Schema m_schema;
+    SchemaLayout m_layout;
+
+    // Always hashes with KeyHasher::STD, which segment_for and the bucket layout were written
+    // around, rather than KeyAccessor's default
+    KeyAccessor m_key;
+
+    std::size_t m_doc_size = 0;
+
+    int m_segment_bits = 0;
+    std::unique_ptr<Segment[]> m_segments;
+
+    std::atomic<std::uint64_t> m_epoch{0};
+    std::unique_ptr<ReaderSlot[]> m_reader_slots;
+
+    mutable std::mutex m_retired_mutex;
+    std::vector<RetiredTable> m_retired;
+
+    // m_retired.size(), so writers can skip reclaiming without taking the mutex
+    std::atomic<std::size_t> m_retired_count{0};
+
+    std::size_t hash(ConstBuffer key) const;
+    Segment& segment_for(std::size_t key_hash) const;
+
+    char* doc(const Table& table, std::size_t index) const;
+
+    // Counts the calling thread as a reader until the returned counter is decremented
+    std::atomic<std::uint64_t>& start_read() const;
+
+    // Moves up to bucket_count buckets of the segment's old table into its current one. Once
+    // they've all been moved, the old table is unlinked and handed back in retired. Must be
+    // called with the segment locked and its sequence number odd.
+    void migrate(Segment& seg, std::size_t bucket_count, std::unique_ptr<Table>& retired);
+
+    // Takes a table which readers can no longer reach, if given, and frees whichever retired
+    // tables no reader can still be looking at
+    void reclaim(std::unique_ptr<Table> retired);
+
+    // Index of the bucket holding the key, or NO_BUCKET. Skips tombstones, so it works on old
+    // tables too. Readers call this without the lock and check the sequence number after.
+    std::size_t find_bucket(const Table& table, ConstBuffer key, std::size_t key_hash) const;
+
+    // Index of the bucket holding the key, or of the empty bucket where it would go. Only for
+    // current tables, and must be called with the segment locked.
+    std::size_t probe(const Table& table, ConstBuffer key, std::size_t key_hash) const;
+
+    // Index of the empty bucket where a key which isn't in the table would go
+    std::size_t empty_bucket(const Table& table, std::size_t key_hash) const;
+
+    bool key_equals(const char* doc, ConstBuffer key) const;
+};
+
+}  // namespace boutique
@@ -1,20 +1,23 @@
 #include "database.hpp"
 
+#include <algorithm>
 #include <cassert>
 
 namespace boutique {
 
-const Schema& Database::register_schema(std::string name, Schema schema) {
-    const auto [iter, _] = m_schemas.insert_or_assign(std::move(name), std::move(schema));
+const Schema& Database::register_schema(std::string_view name, Schema schema) {
+    const auto [iter, _] = m_schemas.insert_or_assign(intern(name), std::move(schema));
     return iter->second;
 }
 
-Collection& Database::create_collection(std::string name, Schema schema) {
-    const auto [iter, inserted_new] = m_colls.insert_or_assign(std::move(name), std::move(schema));
+Collection& Database::create_collection(std::string_view name, Schema schema,
+                                        CollectionOptions options) {
+    const auto [iter, inserted_new] =
+        m_colls.insert_or_assign(intern(name), Collection{std::move(schema), options});
     return iter->second;
 }
 
-const Schema* Database::schema(const std::string& name) {
+const Schema* Database::schema(std::string_view name) {
     auto found = m_schemas.find(name);
     if (found == m_schemas.end()) {
         return nullptr;
@@ -23,7 +26,7 @@ const Schema* Database::schema(const std::string& name) {
     return &found->second;
 }
 
-Collection* Database::collection(const std::string& name) {
+Collection* Database::collection(std::string_view name) {
     auto found = m_colls.find(name);
     if (found == m_colls.end()) {
         return nullptr;
@@ -32,4 +35,36 @@ Collection* Database::collection(const std::string& name) {
     return &found->second;
 }
 
+void Database::for_each_schema(
+    FunctionView<void(std::string_view name, const Schema& schema)> fn) {
+    for (const auto& [name, schema] : m_schemas) {
+        fn(name, schema);
+    }
+}
+
+void Database::for_each_collection(
+    FunctionView<void(std::string_view name, Collection& coll)> fn) {
+    for (auto& [name, coll] : m_colls) {
+        fn(name, coll);
+    }
+}
+
+bool Database::expire(std::uint64_t now, std::size_t max_count) {
+    for (auto& [name, coll] : m_colls) {
+        auto before = coll.count();
+
+        if (!coll.expire(now, max_count)) {
+            return false;
+        }
+
+        max_count -= std::min(max_count, before - coll.count());
+    }
+
+    return true;
+}
+
+std::string_view Database::intern(std::string_view name) {
+    return *m_names.emplace(name).first;
+}
+
 }  // namespace boutique
@@ -2,26 +2,45 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "collection.hpp"
+#include "core/function_view.hpp"
 #include "schema.hpp"
 
 namespace boutique {
 
 struct Database {
-    const Schema& register_schema(std::string name, Schema schema);
-    Collection& create_collection(std::string name, Schema schema);
+    const Schema& register_schema(std::string_view name, Schema schema);
+    Collection& create_collection(std::string_view name, Schema schema,
+                                  CollectionOptions options = {});
 
-    const Schema* schema(const std::string& name);
-    Collection* collection(const std::string& name);
+    // Names can be looked up straight out of a parsed command, without building a string
+    const Schema* schema(std::string_view name);
+    Collection* collection(std::string_view name);
 
-    // TODO Add higher-level functions that will find a document given a query,
-    // maintain indexes, modify schemas, etc
+    // Visit everything in the database, in no particular order
+    void for_each_schema(FunctionView<void(std::string_view name, const Schema& schema)> fn);
+    void for_each_collection(FunctionView<void(std::string_view name, Collection& coll)> fn);
+
+    // Collection::expire for every collection, sharing max_count between them. Returns false if
+    // there are more expired documents to remove.
+    bool expire(std::uint64_t now, std::size_t max_count);
+
+    // TODO Add higher-level functions that will find a document given a query, modify
+    // schemas, etc
 
 private:
-    std::unordered_map<std::string, Schema> m_schemas;
-    std::unordered_map<std::string, Collection> m_colls;
+    // Every name we've been given. The maps below are keyed by views into these, which stay
+    // valid since the set's nodes never move.
+    std::unordered_set<std::string> m_names;
+
+    std::unordered_map<std::string_view, Schema> m_schemas;
+    std::unordered_map<std::string_view, Collection> m_colls;
+
+    std::string_view intern(std::string_view name);
 };
 
 }  // namespace boutique
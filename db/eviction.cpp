@@ -0,0 +1,151 @@
+#include "eviction.hpp"
+
+#include <cassert>
+
+namespace boutique {
+
+namespace {
+
+// How many documents sampled eviction picks from. More gets closer to exact LRU/LFU, at the
+// cost of more random cache misses per eviction.
+const std::size_t SAMPLE_SIZE = 5;
+
+// New documents start with this use count so that they get a chance to be used again before
+// they're the first to go
+const std::uint32_t LFU_INITIAL_COUNT = 5;
+
+// How much less likely each use is to bump a high use count. With 10, a count of 255 takes on
+// the order of a million uses.
+const std::uint32_t LFU_LOG_FACTOR = 10;
+
+// Use counts go down by one for every 2^LFU_DECAY_SHIFT uses of the collection
+const std::uint32_t LFU_DECAY_SHIFT = 16;
+
+const std::uint32_t LFU_COUNT_MASK = 0xff;
+const std::uint32_t LFU_PERIOD_MASK = 0xffffffffu >> LFU_DECAY_SHIFT;
+
+std::uint32_t lfu_word(std::uint32_t period, std::uint32_t count) {
+    return (period << 8) | count;
+}
+
+}  // namespace
+
+EvictionTracker::EvictionTracker(EvictionPolicy policy) : m_policy{policy} {}
+
+EvictionPolicy EvictionTracker::policy() const { return m_policy; }
+
+void EvictionTracker::add() {
+    switch (m_policy) {
+        case EvictionPolicy::SAMPLED_LRU:
+            m_words.push_back(++m_clock);
+            break;
+
+        case EvictionPolicy::LFU:
+            m_words.push_back(lfu_word(m_clock >> LFU_DECAY_SHIFT, LFU_INITIAL_COUNT));
+            break;
+
+        case EvictionPolicy::CLOCK:
+        case EvictionPolicy::NONE:
+            m_words.push_back(0);
+            break;
+    }
+}
+
+void EvictionTracker::resize(std::size_t count) {
+    while (m_words.size() < count) {
+        add();
+    }
+}
+
+void EvictionTracker::remove(std::size_t value_index) {
+    m_words[value_index] = m_words.back();
+    m_words.pop_back();
+}
+
+std::size_t EvictionTracker::victim() {
+    assert(!m_words.empty());
+
+    if (m_policy == EvictionPolicy::CLOCK) {
+        // Every document the hand passes loses its second chance, so this takes at most one
+        // trip around
+        for (;;) {
+            if (m_hand >= m_words.size()) {
+                m_hand = 0;
+            }
+
+            if (m_words[m_hand] == 0) {
+                // The last document is about to be moved here, so the hand stays put to look
+                // at it next
+                return m_hand;
+            }
+
+            m_words[m_hand] = 0;
+            m_hand += 1;
+        }
+    }
+
+    std::size_t best = 0;
+    std::uint32_t best_score = 0;
+
+    for (std::size_t i = 0; i < SAMPLE_SIZE; ++i) {
+        auto value_index = static_cast<std::size_t>(next_random() % m_words.size());
+
+        // Higher scores go first
+        std::uint32_t score = 0;
+
+        if (m_policy == EvictionPolicy::SAMPLED_LRU) {
+            score = m_clock - m_words[value_index];
+        } else if (m_policy == EvictionPolicy::LFU) {
+            score = LFU_COUNT_MASK - lfu_count(m_words[value_index]);
+        }
+
+        if (i == 0 || score > best_score) {
+            best = value_index;
+            best_score = score;
+        }
+    }
+
+    return best;
+}
+
+std::size_t EvictionTracker::memory_usage() const {
+    return m_words.size() * sizeof(std::uint32_t);
+}
+
+std::uint64_t EvictionTracker::next_random() {
+    // xorshift64
+    m_rng ^= m_rng << 13;
+    m_rng ^= m_rng >> 7;
+    m_rng ^= m_rng << 17;
+
+    return m_rng;
+}
+
+std::uint32_t EvictionTracker::lfu_count(std::uint32_t word) const {
+    // Periods wrap around along with m_clock, so how many have passed is worked out modulo
+    // the number of them
+    auto elapsed = ((m_clock >> LFU_DECAY_SHIFT) - (word >> 8)) & LFU_PERIOD_MASK;
+    auto count = word & LFU_COUNT_MASK;
+
+    return elapsed >= count ? 0 : count - elapsed;
+}
+
+void EvictionTracker::touch_lfu(std::size_t value_index) {
+    m_clock += 1;
+
+    auto count = lfu_count(m_words[value_index]);
+
+    // Bumping the count gets less likely the higher it is, so it grows logarithmically with
+    // the number of uses
+    if (count < LFU_COUNT_MASK) {
+        auto base = count > LFU_INITIAL_COUNT ? count - LFU_INITIAL_COUNT : 0;
+
+        if (next_random() % (base * LFU_LOG_FACTOR + 1) == 0) {
+            count += 1;
+        }
+    }
+
+    m_words[value_index] = lfu_word(m_clock >> LFU_DECAY_SHIFT, count);
+}
+
+}  // namespace boutique
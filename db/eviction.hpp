@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace boutique {
+
+// What a collection does when putting a new document would take it over its memory limit (see
+// CollectionOptions::max_memory)
+enum class EvictionPolicy : std::uint8_t {
+    // Nothing is evicted, and puts of new documents fail instead
+    NONE,
+
+    // Evicts whichever of a few randomly sampled documents was used the longest ago
+    SAMPLED_LRU,
+
+    // Evicts whichever of a few randomly sampled documents has been used the least often. Use
+    // counts are logarithmic and decay over time, so documents which were popular once don't
+    // stick around forever.
+    LFU,
+
+    // Sweeps over the documents, evicting the first one which hasn't been used since the
+    // sweep last passed it (second chance)
+    CLOCK,
+};
+
+// Per-document bookkeeping for picking which document to evict, a 32-bit word per document by
+// value index, parallel to the collection's storage. Finding a document touches its word right
+// after the index hands back its value index, so it costs no extra pointer chasing.
+struct EvictionTracker {
+    explicit EvictionTracker(EvictionPolicy policy);
+
+    EvictionPolicy policy() const;
+
+    // A document was added after the last one
+    void add();
+
+    // Documents were added in bulk (e.g. Collection::map), so there are count of them now
+    void resize(std::size_t count);
+
+    // The document at value_index was used
+    void touch(std::size_t value_index) {
+        switch (m_policy) {
+            case EvictionPolicy::SAMPLED_LRU:
+                m_words[value_index] = ++m_clock;
+                break;
+
+            case EvictionPolicy::LFU:
+                touch_lfu(value_index);
+                break;
+
+            case EvictionPolicy::CLOCK:
+                m_words[value_index] = 1;
+                break;
+
+            case EvictionPolicy::NONE:
+                break;
+        }
+    }
+
+    // The document at value_index was removed and the last document moved into its place
+    void remove(std::size_t value_index);
+
+    // Value index of the document to evict next. There must be at least one.
+    std::size_t victim();
+
+    std::size_t memory_usage() const;
+
+private:
+    EvictionPolicy m_policy = EvictionPolicy::NONE;
+
+    // SAMPLED_LRU: the m_clock of the last use
+    // LFU: the decay period of the last use above a logarithmic use count in the low 8 bits
+    // CLOCK: whether it's been used since the hand last passed it
+    std::vector<std::uint32_t> m_words;
+
+    // Goes up by one per use. Wrapping around is fine since only differences between
+    // recent values matter.
+    std::uint32_t m_clock = 0;
+
+    std::uint64_t m_rng = 0x9e3779b97f4a7c15ull;
+
+    // Where CLOCK's sweep is up to
+    std::size_t m_hand = 0;
+
+    std::uint64_t next_random();
+
+    // LFU's use count for the word, after decaying it to now
+    std::uint32_t lfu_count(std::uint32_t word) const;
+
+    void touch_lfu(std::size_t value_index);
+};
+
+}  // namespace boutique
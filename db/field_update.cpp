@@ -0,0 +1,110 @@
+#include "field_update.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <type_traits>
+
+#include "core/overloaded_visitor.hpp"
+
+namespace boutique {
+
+namespace {
+
+// Whether value is the right size to go in the leaf
+bool fits(const LeafField& leaf, ConstBuffer value) {
+    if (const auto* s = std::get_if<StringType>(&leaf.type)) {
+        return value.len <= s->capacity;
+    }
+
+    return value.len == leaf.size;
+}
+
+bool is_number(const FieldType& type) {
+    return !std::holds_alternative<BoolType>(type) && !std::holds_alternative<StringType>(type) &&
+           !std::holds_alternative<AggregateType>(type);
+}
+
+template <typename T>
+void add(void* field, const void* delta) {
+    T a;
+    T b;
+
+    std::memcpy(&a, field, sizeof(T));
+    std::memcpy(&b, delta, sizeof(T));
+
+    if constexpr (std::is_integral_v<T>) {
+        // Unsigned arithmetic wraps around instead of overflowing
+        using U = std::make_unsigned_t<T>;
+
+        a = static_cast<T>(static_cast<U>(a) + static_cast<U>(b));
+    } else {
+        a += b;
+    }
+
+    std::memcpy(field, &a, sizeof(T));
+}
+
+}  // namespace
+
+bool can_apply(const LeafField& leaf, const FieldUpdate& update) {
+    switch (update.op) {
+        case FieldUpdate::Op::SET:
+            return fits(leaf, update.value);
+
+        case FieldUpdate::Op::ADD:
+            return is_number(leaf.type) && update.value.len == leaf.size;
+
+        case FieldUpdate::Op::COMPARE_AND_SET:
+            return fits(leaf, update.value) && fits(leaf, update.expected);
+    }
+
+    return false;
+}
+
+bool field_equals(const LeafField& leaf, const void* field, ConstBuffer value) {
+    if (std::holds_alternative<StringType>(leaf.type)) {
+        StringHeader header;
+        std::memcpy(&header, field, sizeof(header));
+
+        return header.len == value.len &&
+               std::memcmp(static_cast<const char*>(field) + sizeof(header), value.data,
+                           value.len) == 0;
+    }
+
+    return std::memcmp(field, value.data, leaf.size) == 0;
+}
+
+void apply(const LeafField& leaf, void* field, const FieldUpdate& update) {
+    assert(can_apply(leaf, update));
+
+    if (update.op == FieldUpdate::Op::ADD) {
+        std::visit(OverloadedVisitor{[&](auto type) {
+                                         using T = std::decay_t<decltype(type)>;
+
+                                         if constexpr (std::is_arithmetic_v<impl_type_t<T>>) {
+                                             add<impl_type_t<T>>(field, update.value.data);
+                                         }
+                                     },
+                                     [](BoolType) {}, [](const StringType&) {},
+                                     [](const AggregateType&) {}},
+                   leaf.type);
+        return;
+    }
+
+    if (std::holds_alternative<StringType>(leaf.type)) {
+        // The rest of the capacity is zeroed so that the document is the same as if it had
+        // been put with this string
+        StringHeader header{static_cast<std::uint32_t>(update.value.len)};
+
+        auto* chars = static_cast<char*>(field) + sizeof(header);
+
+        std::memcpy(field, &header, sizeof(header));
+        std::memcpy(chars, update.value.data, update.value.len);
+        std::memset(chars + update.value.len, 0, leaf.size - sizeof(header) - update.value.len);
+        return;
+    }
+
+    std::memcpy(field, update.value.data, leaf.size);
+}
+
+}  // namespace boutique
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+#include "core/const_buffer.hpp"
+#include "schema_layout.hpp"
+
+namespace boutique {
+
+// A change to one leaf field of a document (see Collection::update), found by its path (see
+// LeafField::path). Values are encoded the same way as in the document itself, apart from
+// strings, which are just their characters, without the length in front or the unused capacity
+// after them.
+struct FieldUpdate {
+    enum class Op : std::uint8_t {
+        // Sets the field to value
+        SET,
+
+        // Adds value to the field, which has to be a number. Integers wrap around.
+        ADD,
+
+        // Sets the field to value if it's currently expected, and fails the whole update
+        // otherwise. Floats are compared bit for bit.
+        COMPARE_AND_SET,
+    };
+
+    Op op = Op::SET;
+
+    std::string_view path;
+
+    ConstBuffer value;
+
+    // Only for COMPARE_AND_SET
+    ConstBuffer expected;
+};
+
+enum class UpdateResult : std::uint8_t {
+    SUCCESS,
+
+    // There's no document with the key
+    NOT_FOUND,
+
+    // A path isn't a leaf of the schema, is the key, or has a value of the wrong size or an op
+    // it can't take
+    INVALID,
+
+    // A COMPARE_AND_SET didn't find what it expected
+    COMPARE_FAILED,
+};
+
+// Whether the update can be applied to the leaf: its value (and expected) fit the leaf, and
+// its op works on the leaf's type
+bool can_apply(const LeafField& leaf, const FieldUpdate& update);
+
+// Whether the leaf's value at field (its place in a document or column) is value, encoded like
+// FieldUpdate::value
+bool field_equals(const LeafField& leaf, const void* field, ConstBuffer value);
+
+// Applies the update to the leaf's value at field. can_apply must be true.
+void apply(const LeafField& leaf, void* field, const FieldUpdate& update);
+
+}  // namespace boutique
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "core/const_buffer.hpp"
+#include "key_accessor.hpp"
+#include "storage.hpp"
+
+namespace boutique {
+
+// The data structure a Collection uses to map keys to documents
+enum class IndexType : std::uint8_t {
+    // Open addressing with linear probing over (hash, value index) buckets. Grows
+    // incrementally.
+    LINEAR_PROBE,
+
+    // Swiss table: a byte of metadata per slot which is probed 16 slots at a time with SIMD,
+    // plus 32-bit value indices. Smaller and faster, but grows all at once.
+    SWISS,
+};
+
+// Indexes only store hashes (or not even that) and value indices, so they go through this to
+// get at the keys themselves.
+struct IndexKeys {
+    Storage& storage;
+    const KeyAccessor& key;
+
+    ConstBuffer key_at(std::size_t value_index) const { return key.key(storage[value_index]); }
+    std::size_t hash_at(std::size_t value_index) const { return key.hash(key_at(value_index)); }
+};
+
+struct IndexStats {
+    // Number of slots/buckets in the index
+    std::size_t capacity = 0;
+
+    // Slots which held a key which has since been removed, and which lookups still have to
+    // probe past
+    std::size_t tombstone_count = 0;
+
+    std::size_t grow_count = 0;
+    std::size_t shrink_count = 0;
+
+    // Times the index was rebuilt at the same capacity to get rid of tombstones
+    std::size_t cleanup_count = 0;
+};
+
+// Returned by index lookups when the key isn't present
+constexpr std::size_t NO_POS = ~std::size_t{0};
+
+// With KeyHasher::STD, integer keys hash to themselves, so sequential keys would land in one
+// long run of adjacent slots. Indexes mix the hash before picking a slot from it. That only
+// matters for KeyHasher::STD; WYHASH hashes are already well mixed.
+inline std::size_t mix_hash(std::size_t h) {
+    return static_cast<std::size_t>((static_cast<std::uint64_t>(h) ^ (h >> 32)) *
+                                    0x9e3779b97f4a7c15ull);
+}
+
+}  // namespace boutique
@@ -0,0 +1,65 @@
+#include "key_accessor.hpp"
+
+#include <cassert>
+
+#include "core/overloaded_visitor.hpp"
+
+namespace boutique {
+
+namespace {
+
+template <KeyHasher H>
+std::size_t hash_string(ConstBuffer buf) {
+    return hash_key<H>(std::string_view{buf.data, buf.len});
+}
+
+template <KeyHasher H, typename T>
+std::size_t hash_value(ConstBuffer buf) {
+    assert(buf.len == sizeof(T));
+
+    return hash_key<H>(*reinterpret_cast<const T*>(buf.data));
+}
+
+}  // namespace
+
+KeyAccessor::KeyAccessor(const SchemaLayout& layout, KeyHasher hasher)
+    : m_key_offset{layout.key().offset} {
+    const bool wyhash = hasher == KeyHasher::WYHASH;
+
+    std::visit(
+        OverloadedVisitor{
+            [&](StringType s) {
+                m_max_len = s.capacity;
+
+                m_key_buffer_fn = [](const void* data, std::size_t key_offset) -> ConstBuffer {
+                    const auto* key = reinterpret_cast<const char*>(data) + key_offset;
+                    const auto* str_header = reinterpret_cast<const StringHeader*>(key);
+
+                    return {reinterpret_cast<const char*>(str_header) + sizeof(*str_header),
+                            str_header->len};
+                };
+
+                m_hash_fn = wyhash ? &hash_string<KeyHasher::WYHASH> : &hash_string<KeyHasher::STD>;
+            },
+            [](const AggregateType&) {
+                // Aggregate should never be the key field
+                assert(false);
+            },
+            [&](auto&& v) {
+                using T = typename ImplType<std::decay_t<decltype(v)>>::Type;
+
+                m_max_len = sizeof(T);
+
+                m_key_buffer_fn = [](const void* data, std::size_t key_offset) -> ConstBuffer {
+                    const auto* key = reinterpret_cast<const char*>(data) + key_offset;
+
+                    return {reinterpret_cast<const char*>(key), sizeof(T)};
+                };
+
+                m_hash_fn =
+                    wyhash ? &hash_value<KeyHasher::WYHASH, T> : &hash_value<KeyHasher::STD, T>;
+            }},
+        layout.key().type);
+}
+
+}  // namespace boutique
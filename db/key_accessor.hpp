@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+
+#include "core/const_buffer.hpp"
+#include "key_hash.hpp"
+#include "schema_layout.hpp"
+
+namespace boutique {
+
+// Knows how to find and hash the key field of documents with a particular schema. We cache
+// this per collection because dispatching on the key type for every lookup is a bottleneck.
+struct KeyAccessor {
+    explicit KeyAccessor(const SchemaLayout& layout, KeyHasher hasher = KeyHasher::WYHASH);
+
+    // If the key type is a string, this is the string's contents without the header
+    ConstBuffer key(const void* data) const { return m_key_buffer_fn(data, m_key_offset); }
+    std::size_t hash(ConstBuffer key) const { return m_hash_fn(key); }
+
+    // The longest key a document with this schema can have
+    std::size_t max_len() const { return m_max_len; }
+
+private:
+    std::size_t m_key_offset = 0;
+    std::size_t m_max_len = 0;
+
+    ConstBuffer (*m_key_buffer_fn)(const void* data, std::size_t key_offset) = nullptr;
+    std::size_t (*m_hash_fn)(ConstBuffer) = nullptr;
+};
+
+}  // namespace boutique
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <type_traits>
+
+namespace boutique {
+
+// How a collection hashes its keys, picked when it's created
+enum class KeyHasher : std::uint8_t {
+    // std::hash, which with libstdc++ is the identity for integers and MurmurHash2 for strings
+    STD,
+
+    // wyhash for strings, which takes 8 or 16 bytes at a time, and a full avalanche mix of the
+    // bits for everything else, so that sequential integers come out all over the place
+    WYHASH,
+};
+
+// Multiplies out to 128 bits and folds the halves together, which is most of what wyhash is
+inline std::uint64_t wymix(std::uint64_t a, std::uint64_t b) {
+    auto r = static_cast<unsigned __int128>(a) * b;
+
+    return static_cast<std::uint64_t>(r) ^ static_cast<std::uint64_t>(r >> 64);
+}
+
+// wyhash (final version 4, by Wang Yi, released into the public domain) with its default
+// secret
+inline std::uint64_t wyhash(const void* key, std::size_t len, std::uint64_t seed = 0) {
+    constexpr std::uint64_t SECRET[] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+                                        0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+    const auto read8 = [](const unsigned char* p) {
+        std::uint64_t v;
+        std::memcpy(&v, p, 8);
+        return v;
+    };
+
+    const auto read4 = [](const unsigned char* p) {
+        std::uint32_t v;
+        std::memcpy(&v, p, 4);
+        return static_cast<std::uint64_t>(v);
+    };
+
+    const auto* p = static_cast<const unsigned char*>(key);
+
+    seed ^= wymix(seed ^ SECRET[0], SECRET[1]);
+
+    std::uint64_t a = 0;
+    std::uint64_t b = 0;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = (static_cast<std::uint64_t>(p[0]) << 16) |
+                (static_cast<std::uint64_t>(p[len >> 1]) << 8) | p[len - 1];
+        }
+    } else {
+        auto i = len;
+
+        if (i >= 48) {
+            auto see1 = seed;
+            auto see2 = seed;
+
+            do {
+                seed = wymix(read8(p) ^ SECRET[1], read8(p + 8) ^ seed);
+                see1 = wymix(read8(p + 16) ^ SECRET[2], read8(p + 24) ^ see1);
+                see2 = wymix(read8(p + 32) ^ SECRET[3], read8(p + 40) ^ see2);
+
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+
+            seed ^= see1 ^ see2;
+        }
+
+        while (i > 16) {
+            seed = wymix(read8(p) ^ SECRET[1], read8(p + 8) ^ seed);
+
+            p += 16;
+            i -= 16;
+        }
+
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+
+    auto r = static_cast<unsigned __int128>(a ^ SECRET[1]) * (b ^ seed);
+
+    a = static_cast<std::uint64_t>(r);
+    b = static_cast<std::uint64_t>(r >> 64);
+
+    return wymix(a ^ SECRET[0] ^ len, b ^ SECRET[1]);
+}
+
+// The splitmix64 finalizer. Every input bit affects every output bit, and it's a bijection so
+// distinct integer keys never collide.
+inline std::uint64_t mix_bits(std::uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+
+    return x;
+}
+
+// How keys of each type are hashed. Anything which hashes keys itself (e.g. TypedCollection)
+// has to go through these so that the index sees the same hash either way.
+template <KeyHasher H>
+std::size_t hash_key(std::string_view key) {
+    if constexpr (H == KeyHasher::WYHASH) {
+        return wyhash(key.data(), key.size());
+    } else {
+        return std::hash<std::string_view>{}(key);
+    }
+}
+
+template <KeyHasher H, typename T>
+std::size_t hash_key(T key) {
+    static_assert(std::is_arithmetic_v<T> && sizeof(T) <= sizeof(std::uint64_t));
+
+    if constexpr (H == KeyHasher::WYHASH) {
+        // Keys are compared bytewise, so hashing the bytes is consistent with that
+        std::uint64_t bits = 0;
+        std::memcpy(&bits, &key, sizeof(key));
+
+        return mix_bits(bits);
+    } else {
+        return std::hash<T>{}(key);
+    }
+}
+
+}  // namespace boutique
@@ -0,0 +1,216 @@
+#include "linear_probe_index.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+const std::size_t MIN_BUCKET_COUNT = 32;
+
+// A grow happens once the collection has 1/1.4 as many documents as buckets, and the next one
+// happens after that many puts again, so this moves the old buckets over well before then.
+const std::size_t MIGRATE_BUCKETS_PER_OP = 16;
+
+// We shrink by half once fewer than this fraction of buckets are in use, which leaves the
+// index a quarter full; plenty of room either way before the next resize.
+const std::size_t SHRINK_DIVISOR = 8;
+
+}  // namespace
+
+namespace boutique {
+
+std::size_t LinearProbeIndex::find(const IndexKeys& keys, ConstBuffer key, std::size_t key_hash) {
+    return find(key_hash, [&](std::size_t value_index) {
+        auto data_key = keys.key_at(value_index);
+
+        return key.len == data_key.len && std::memcmp(data_key.data, key.data, key.len) == 0;
+    });
+}
+
+void LinearProbeIndex::prefetch(std::size_t key_hash) const {
+    if (m_buckets.empty()) {
+        return;
+    }
+
+    auto idx = mix_hash(bucket_hash(key_hash)) & (m_buckets.size() - 1);
+
+    __builtin_prefetch(m_buckets.data() + idx);
+}
+
+std::size_t LinearProbeIndex::value(std::size_t pos) const {
+    if (pos < m_buckets.size()) {
+        return m_buckets[pos].value_index;
+    }
+
+    return m_old_buckets[pos - m_buckets.size()].value_index;
+}
+
+void LinearProbeIndex::set_value(std::size_t pos, std::size_t value_index) {
+    bucket(pos).value_index = value_index;
+}
+
+void LinearProbeIndex::erase(const IndexKeys&, std::size_t pos) {
+    bucket(pos).key_hash = TOMBSTONE_KEY_HASH;
+
+    if (pos < m_buckets.size()) {
+        m_tombstone_count += 1;
+    }
+
+    m_count -= 1;
+
+    if (m_buckets.size() > MIN_BUCKET_COUNT && m_count < m_buckets.size() / SHRINK_DIVISOR) {
+        resize(m_buckets.size() / 2);
+        m_stats.shrink_count += 1;
+    }
+}
+
+bool LinearProbeIndex::insert(const IndexKeys& keys, std::size_t key_hash,
+                              std::size_t value_index) {
+    // Tombstones count towards the load factor since they make probes just as long
+    if (m_count + m_tombstone_count + 1 >= static_cast<std::size_t>(m_buckets.size() / 1.4)) {
+        if (m_tombstone_count > m_count) {
+            resize(m_buckets.size());
+            m_stats.cleanup_count += 1;
+        } else {
+            resize(std::max(m_buckets.size() * 2, MIN_BUCKET_COUNT));
+            m_stats.grow_count += 1;
+        }
+    }
+
+    auto* res = insert_internal(bucket_hash(key_hash));
+
+    if (!res) {
+        return false;
+    }
+
+    res->value_index = value_index;
+
+    m_count += 1;
+
+    return true;
+}
+
+bool LinearProbeIndex::build(Span<const std::size_t> key_hashes) {
+    assert(m_count == 0 && m_old_buckets.empty());
+
+    auto bucket_count = std::max(m_buckets.size(), MIN_BUCKET_COUNT);
+
+    // Same load factor insert keeps
+    while (key_hashes.size() + 1 >= static_cast<std::size_t>(bucket_count / 1.4)) {
+        bucket_count *= 2;
+    }
+
+    m_buckets = Buckets(bucket_count);
+    m_tombstone_count = 0;
+
+    for (std::size_t i = 0; i < key_hashes.size(); ++i) {
+        auto* res = insert_internal(bucket_hash(key_hashes.data[i]));
+
+        if (!res) {
+            return false;
+        }
+
+        res->value_index = i;
+        m_count += 1;
+    }
+
+    return true;
+}
+
+std::size_t LinearProbeIndex::memory_usage() const {
+    return (m_buckets.size() + m_old_buckets.size()) * sizeof(KeyValue);
+}
+
+IndexStats LinearProbeIndex::stats() const {
+    auto stats = m_stats;
+
+    stats.capacity = m_buckets.size();
+    stats.tombstone_count = m_tombstone_count;
+
+    return stats;
+}
+
+LinearProbeIndex::KeyValue& LinearProbeIndex::bucket(std::size_t pos) {
+    if (pos < m_buckets.size()) {
+        return m_buckets[pos];
+    }
+
+    return m_old_buckets[pos - m_buckets.size()];
+}
+
+void LinearProbeIndex::resize(std::size_t bucket_count) {
+    // Only happens if the last resize was very recent, e.g. a big batch of removes right
+    // after a grow.
+    migrate(m_old_buckets.size());
+
+    m_old_buckets = std::move(m_buckets);
+    m_buckets = Buckets(bucket_count);
+    m_migrate_pos = 0;
+
+    m_tombstone_count = 0;
+}
+
+void LinearProbeIndex::migrate_step() { migrate(MIGRATE_BUCKETS_PER_OP); }
+
+void LinearProbeIndex::migrate(std::size_t bucket_count) {
+    if (m_old_buckets.empty()) {
+        return;
+    }
+
+    auto end = std::min(m_old_buckets.size(), m_migrate_pos + bucket_count);
+
+    for (; m_migrate_pos < end; ++m_migrate_pos) {
+        auto& bucket = m_old_buckets[m_migrate_pos];
+
+        if (bucket.key_hash == EMPTY_KEY_HASH || bucket.key_hash == TOMBSTONE_KEY_HASH) {
+            continue;
+        }
+
+        // Keys are never in both tables, and we already have the hash, so moving a bucket
+        // doesn't have to look at the document at all.
+        auto* res = insert_internal(bucket.key_hash);
+
+        assert(res);
+
+        res->value_index = bucket.value_index;
+
+        // This has to be a tombstone rather than empty so that lookups of keys further along
+        // the probe chain which haven't been moved yet still find them.
+        bucket.key_hash = TOMBSTONE_KEY_HASH;
+    }
+
+    if (m_migrate_pos == m_old_buckets.size()) {
+        m_old_buckets = Buckets{};
+        m_migrate_pos = 0;
+    }
+}
+
+LinearProbeIndex::KeyValue* LinearProbeIndex::insert_internal(std::size_t key_hash) {
+    auto idx = mix_hash(key_hash) & (m_buckets.size() - 1);
+    auto orig_idx = idx;
+
+    for (;;) {
+        auto& bucket = m_buckets[idx];
+
+        if (bucket.key_hash == TOMBSTONE_KEY_HASH) {
+            m_tombstone_count -= 1;
+        }
+
+        if (bucket.key_hash == EMPTY_KEY_HASH || bucket.key_hash == TOMBSTONE_KEY_HASH) {
+            bucket.key_hash = key_hash;
+
+            return &bucket;
+        }
+
+        idx += 1;
+        idx &= (m_buckets.size() - 1);
+
+        // We wrapped around, insert failed
+        if (idx == orig_idx) {
+            return nullptr;
+        }
+    }
+}
+
+}  // namespace boutique
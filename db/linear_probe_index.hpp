@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "core/const_buffer.hpp"
+#include "core/span.hpp"
+#include "core/zeroed_allocator.hpp"
+#include "index.hpp"
+
+namespace boutique {
+
+// Positions returned by find are only valid until the next call to find, erase or insert
+struct LinearProbeIndex {
+    std::size_t find(const IndexKeys& keys, ConstBuffer key, std::size_t key_hash);
+
+    // Same as above, except the key is compared by calling key_equals with the value index of
+    // each candidate. Callers that know the key type at compile time get that inlined.
+    template <typename KeyEquals>
+    std::size_t find(std::size_t key_hash, KeyEquals&& key_equals);
+
+    // Starts loading the bucket that a find for the hash would start at
+    void prefetch(std::size_t key_hash) const;
+
+    std::size_t value(std::size_t pos) const;
+    void set_value(std::size_t pos, std::size_t value_index);
+
+    void erase(const IndexKeys& keys, std::size_t pos);
+
+    // The key must not already be in the index. Returns false if there was no room for it.
+    bool insert(const IndexKeys& keys, std::size_t key_hash, std::size_t value_index);
+
+    // Fills an empty index with value index i for each key_hashes[i], sized up front so that it
+    // never grows along the way and without looking at any keys. The keys must all be
+    // different. Returns false if there's no room for them.
+    bool build(Span<const std::size_t> key_hashes);
+
+    std::size_t memory_usage() const;
+    IndexStats stats() const;
+
+private:
+    // Bucket hashes with special meanings. Key hashes which collide with these are nudged off
+    // of them (see bucket_hash); the extra collisions that causes are resolved by comparing
+    // keys, same as any other.
+    static constexpr std::size_t EMPTY_KEY_HASH = 0;
+    static constexpr std::size_t TOMBSTONE_KEY_HASH = ~std::size_t{0};
+
+    struct KeyValue {
+        std::size_t key_hash;
+        std::size_t value_index;
+    };
+
+    // Growing doesn't have to zero the new buckets up front this way
+    using Buckets = std::vector<KeyValue, ZeroedAllocator<KeyValue>>;
+
+    std::size_t m_count = 0;
+
+    // Only counts tombstones in m_buckets; the old buckets are going away anyway
+    std::size_t m_tombstone_count = 0;
+
+    IndexStats m_stats;
+
+    Buckets m_buckets;
+
+    // When we resize, the old buckets are moved into m_buckets a few at a time by each find
+    // rather than all at once, so that no single operation has to pay for rehashing the whole
+    // collection. Until they've all been moved, lookups check both. Positions past the end of
+    // m_buckets refer to these.
+    Buckets m_old_buckets;
+    std::size_t m_migrate_pos = 0;
+
+    KeyValue& bucket(std::size_t pos);
+
+    // Starts moving everything into a new set of buckets. This is how we grow and shrink, and
+    // also how tombstones get cleaned up, since they are left behind.
+    void resize(std::size_t bucket_count);
+    void migrate(std::size_t bucket_count);
+
+    // What each find moves over
+    void migrate_step();
+
+    template <typename KeyEquals>
+    static std::size_t find_internal(const Buckets& buckets, std::size_t key_hash,
+                                     KeyEquals& key_equals);
+
+    // Claims a bucket in m_buckets for the hash without checking whether the key is already
+    // present
+    KeyValue* insert_internal(std::size_t key_hash);
+
+    // What we store for a key hash
+    static std::size_t bucket_hash(std::size_t key_hash) {
+        if (key_hash == EMPTY_KEY_HASH) {
+            return key_hash + 1;
+        }
+
+        if (key_hash == TOMBSTONE_KEY_HASH) {
+            return key_hash - 1;
+        }
+
+        return key_hash;
+    }
+};
+
+template <typename KeyEquals>
+std::size_t LinearProbeIndex::find(std::size_t key_hash, KeyEquals&& key_equals) {
+    migrate_step();
+
+    key_hash = bucket_hash(key_hash);
+
+    auto pos = find_internal(m_buckets, key_hash, key_equals);
+
+    if (pos != NO_POS) {
+        return pos;
+    }
+
+    pos = find_internal(m_old_buckets, key_hash, key_equals);
+
+    if (pos != NO_POS) {
+        return m_buckets.size() + pos;
+    }
+
+    return NO_POS;
+}
+
+template <typename KeyEquals>
+std::size_t LinearProbeIndex::find_internal(const Buckets& buckets, std::size_t key_hash,
+                                            KeyEquals& key_equals) {
+    if (buckets.empty()) {
+        return NO_POS;
+    }
+
+    auto idx = mix_hash(key_hash) & (buckets.size() - 1);
+    auto orig_idx = idx;
+
+    for (;;) {
+        const auto& bucket = buckets[idx];
+
+        if (bucket.key_hash == EMPTY_KEY_HASH) {
+            return NO_POS;
+        }
+
+        if (bucket.key_hash == key_hash && key_equals(bucket.value_index)) {
+            return idx;
+        }
+
+        idx += 1;
+        idx &= (buckets.size() - 1);
+
+        if (idx == orig_idx) {
+            return NO_POS;
+        }
+    }
+}
+
+}  // namespace boutique
@@ -0,0 +1,110 @@
+#include "projection.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+namespace boutique {
+
+namespace {
+
+std::size_t hash_paths(Span<const std::string_view> paths) {
+    std::size_t hash = paths.size();
+
+    for (auto path : paths) {
+        hash ^= std::hash<std::string_view>{}(path) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    }
+
+    return hash;
+}
+
+}  // namespace
+
+Projection::Projection(const SchemaLayout& layout, Span<const std::string_view> paths) {
+    m_paths.reserve(paths.size());
+
+    for (auto path : paths) {
+        m_paths.emplace_back(path);
+
+        Range range;
+
+        if (const auto* leaf = layout.find(path)) {
+            range = {leaf->offset, leaf->size};
+        } else {
+            // An aggregate's leaves are all next to each other, so it's everything from the
+            // first of them to the end of the last
+            const auto& leaves = layout.leaves();
+
+            auto in_aggregate = [&](const LeafField& leaf) {
+                return leaf.path.size() > path.size() && leaf.path[path.size()] == '.' &&
+                       std::string_view{leaf.path}.substr(0, path.size()) == path;
+            };
+
+            auto first = std::find_if(leaves.begin(), leaves.end(), in_aggregate);
+
+            if (path.empty() || first == leaves.end()) {
+                m_valid = false;
+                continue;
+            }
+
+            auto last = std::find_if_not(first, leaves.end(), in_aggregate) - 1;
+
+            range = {first->offset, last->offset + last->size - first->offset};
+        }
+
+        if (!m_ranges.empty() &&
+            m_ranges.back().offset + m_ranges.back().size == range.offset) {
+            m_ranges.back().size += range.size;
+        } else {
+            m_ranges.push_back(range);
+        }
+
+        m_size += range.size;
+    }
+}
+
+bool Projection::valid() const { return m_valid; }
+
+bool Projection::matches(Span<const std::string_view> paths) const {
+    return std::equal(m_paths.begin(), m_paths.end(), paths.begin(), paths.end());
+}
+
+std::size_t Projection::size() const { return m_size; }
+
+void Projection::gather(const void* doc, void* out) const {
+    const auto* src = static_cast<const char*>(doc);
+    auto* dest = static_cast<char*>(out);
+
+    for (const auto& range : m_ranges) {
+        std::memcpy(dest, src + range.offset, range.size);
+        dest += range.size;
+    }
+}
+
+const Projection* ProjectionCache::find(const SchemaLayout& layout,
+                                        Span<const std::string_view> paths) {
+    auto hash = hash_paths(paths);
+
+    for (const auto& entry : m_entries) {
+        if (entry.hash == hash && entry.projection.matches(paths)) {
+            return entry.projection.valid() ? &entry.projection : nullptr;
+        }
+    }
+
+    // Invalid projections are kept too, so that a client asking for a field which doesn't
+    // exist over and over doesn't have it compiled every time
+    Entry* entry = nullptr;
+
+    if (m_entries.size() < MAX_SIZE) {
+        entry = &m_entries.emplace_back(Entry{hash, Projection{layout, paths}});
+    } else {
+        entry = &m_entries[m_next];
+        *entry = Entry{hash, Projection{layout, paths}};
+
+        m_next = (m_next + 1) % MAX_SIZE;
+    }
+
+    return entry->projection.valid() ? &entry->projection : nullptr;
+}
+
+}  // namespace boutique
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "core/span.hpp"
+#include "schema_layout.hpp"
+
+namespace boutique {
+
+// Some of the fields of a document, given by their paths (see LeafField::path), compiled down
+// to the byte ranges they're at so that reading them out of a document is just a few copies.
+// A path can also name an aggregate, which takes all of the fields inside it.
+//
+// Projected documents are the fields one after another in the order they were asked for, each
+// encoded the same way as in the document, with no padding between them.
+struct Projection {
+    Projection(const SchemaLayout& layout, Span<const std::string_view> paths);
+
+    // False if any of the paths isn't a field of the schema
+    bool valid() const;
+
+    // Whether this was compiled from exactly these paths
+    bool matches(Span<const std::string_view> paths) const;
+
+    // Size of a projected document
+    std::size_t size() const;
+
+    // Copies the fields of doc, which must have the schema this was compiled against, to out,
+    // which must have room for size() bytes
+    void gather(const void* doc, void* out) const;
+
+private:
+    struct Range {
+        std::size_t offset = 0;
+        std::size_t size = 0;
+    };
+
+    std::vector<std::string> m_paths;
+
+    // Ranges which turn out to be next to each other in the document are merged, so asking
+    // for neighbouring fields costs one copy
+    std::vector<Range> m_ranges;
+    std::size_t m_size = 0;
+
+    bool m_valid = true;
+};
+
+// Projections which have been compiled for a collection, so that clients asking for the same
+// fields over and over don't have the paths looked up every time. Finding one that's already
+// been compiled doesn't allocate.
+struct ProjectionCache {
+    // How many projections are kept. Past this, the oldest is thrown away to make room.
+    static constexpr std::size_t MAX_SIZE = 64;
+
+    // The projection of the given paths, compiling it if it isn't cached, or nullptr if it
+    // isn't valid. It's only good until the next call.
+    const Projection* find(const SchemaLayout& layout, Span<const std::string_view> paths);
+
+private:
+    struct Entry {
+        std::size_t hash = 0;
+        Projection projection;
+    };
+
+    std::vector<Entry> m_entries;
+
+    // Where the next projection goes once there are MAX_SIZE of them
+    std::size_t m_next = 0;
+};
+
+}  // namespace boutique
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+#include "core/tag.hpp"
+#include "schema.hpp"
+#include "schema_layout.hpp"
+
+// Derives a schema from a C++ struct so it can be stored without writing the schema out by
+// hand. Goes next to the struct, in the same namespace:
+//
+//     struct Account {
+//         std::uint64_t id;
+//         boutique::FixedString<28> name;
+//         std::int64_t balance;
+//     };
+//
+//     BOUTIQUE_REFLECT(Account, id, name, balance)
+//
+// Every member has to be listed, in declaration order. Members can be integers, bool, float,
+// double, FixedString or other reflected structs.
+#define BOUTIQUE_REFLECT(Type, ...)                                                    \
+    inline auto boutique_reflect(boutique::Tag<Type>) {                                \
+        using Reflected = Type;                                                        \
+        return std::make_tuple(BOUTIQUE_FOR_EACH(BOUTIQUE_REFLECT_FIELD, __VA_ARGS__)); \
+    }
+
+#define BOUTIQUE_REFLECT_FIELD(name) boutique::member_field(#name, &Reflected::name)
+
+#define BOUTIQUE_FOR_EACH_1(m, x) m(x)
+#define BOUTIQUE_FOR_EACH_2(m, x, ...) m(x), BOUTIQUE_FOR_EACH_1(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_3(m, x, ...) m(x), BOUTIQUE_FOR_EACH_2(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_4(m, x, ...) m(x), BOUTIQUE_FOR_EACH_3(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_5(m, x, ...) m(x), BOUTIQUE_FOR_EACH_4(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_6(m, x, ...) m(x), BOUTIQUE_FOR_EACH_5(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_7(m, x, ...) m(x), BOUTIQUE_FOR_EACH_6(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_8(m, x, ...) m(x), BOUTIQUE_FOR_EACH_7(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_9(m, x, ...) m(x), BOUTIQUE_FOR_EACH_8(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_10(m, x, ...) m(x), BOUTIQUE_FOR_EACH_9(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_11(m, x, ...) m(x), BOUTIQUE_FOR_EACH_10(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_12(m, x, ...) m(x), BOUTIQUE_FOR_EACH_11(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_13(m, x, ...) m(x), BOUTIQUE_FOR_EACH_12(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_14(m, x, ...) m(x), BOUTIQUE_FOR_EACH_13(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_15(m, x, ...) m(x), BOUTIQUE_FOR_EACH_14(m, __VA_ARGS__)
+#define BOUTIQUE_FOR_EACH_16(m, x, ...) m(x), BOUTIQUE_FOR_EACH_15(m, __VA_ARGS__)
+
+#define BOUTIQUE_FOR_EACH_PICK(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, \
+                               _16, name, ...)                                                   \
+    name
+
+#define BOUTIQUE_FOR_EACH(m, ...)                                                             \
+    BOUTIQUE_FOR_EACH_PICK(__VA_ARGS__, BOUTIQUE_FOR_EACH_16, BOUTIQUE_FOR_EACH_15,           \
+                           BOUTIQUE_FOR_EACH_14, BOUTIQUE_FOR_EACH_13, BOUTIQUE_FOR_EACH_12,  \
+                           BOUTIQUE_FOR_EACH_11, BOUTIQUE_FOR_EACH_10, BOUTIQUE_FOR_EACH_9,   \
+                           BOUTIQUE_FOR_EACH_8, BOUTIQUE_FOR_EACH_7, BOUTIQUE_FOR_EACH_6,     \
+                           BOUTIQUE_FOR_EACH_5, BOUTIQUE_FOR_EACH_4, BOUTIQUE_FOR_EACH_3,     \
+                           BOUTIQUE_FOR_EACH_2, BOUTIQUE_FOR_EACH_1)                          \
+    (m, __VA_ARGS__)
+
+namespace boutique {
+
+// Laid out the same as a StringType field with the given capacity
+template <std::size_t N>
+struct FixedString {
+    // Otherwise the struct would have padding at the end that the schema doesn't
+    static_assert(N % alignof(StringHeader) == 0,
+                  "FixedString capacity must be a multiple of the header's alignment");
+
+    static constexpr std::size_t CAPACITY = N;
+
+    StringHeader header;
+    char data[N];
+
+    FixedString() = default;
+
+    // Truncated to the capacity
+    FixedString(std::string_view s) { *this = s; }
+    FixedString(const char* s) : FixedString{std::string_view{s}} {}
+
+    FixedString& operator=(std::string_view s) {
+        header.len = static_cast<std::uint32_t>(std::min(s.size(), N));
+        std::memcpy(data, s.data(), header.len);
+
+        return *this;
+    }
+
+    std::string_view view() const { return {data, header.len}; }
+};
+
+template <typename T>
+struct IsFixedString : std::false_type {};
+
+template <std::size_t N>
+struct IsFixedString<FixedString<N>> : std::true_type {};
+
+template <typename C, typename M>
+struct MemberField {
+    using Type = M;
+
+    const char* name;
+    M C::*ptr;
+};
+
+template <typename C, typename M>
+MemberField<C, M> member_field(const char* name, M C::*ptr) {
+    return {name, ptr};
+}
+
+template <typename T, typename = void>
+struct IsReflected : std::false_type {};
+
+template <typename T>
+struct IsReflected<T, std::void_t<decltype(boutique_reflect(Tag<T>{}))>> : std::true_type {};
+
+template <typename T>
+constexpr bool is_reflected_v = IsReflected<T>::value;
+
+// Calls fn with each of T's MemberFields in order
+template <typename T, typename Fn>
+void for_each_member(Fn&& fn) {
+    std::apply([&](const auto&... fields) { (fn(fields), ...); }, boutique_reflect(Tag<T>{}));
+}
+
+template <typename C, typename M>
+std::size_t member_offset(M C::*ptr) {
+    // There's no portable offsetof for member pointers; this is what it boils down to anyway
+    alignas(C) unsigned char buf[sizeof(C)];
+
+    const auto* obj = reinterpret_cast<const C*>(buf);
+
+    return reinterpret_cast<const unsigned char*>(&(obj->*ptr)) - buf;
+}
+
+template <typename T>
+AggregateType reflect_fields();
+
+template <typename T>
+FieldType reflect_field_type() {
+    if constexpr (std::is_same_v<T, bool>) {
+        return BoolType{};
+    } else if constexpr (std::is_same_v<T, std::uint8_t>) {
+        return UInt8Type{};
+    } else if constexpr (std::is_same_v<T, std::uint16_t>) {
+        return UInt16Type{};
+    } else if constexpr (std::is_same_v<T, std::uint32_t>) {
+        return UInt32Type{};
+    } else if constexpr (std::is_same_v<T, std::uint64_t>) {
+        return UInt64Type{};
+    } else if constexpr (std::is_same_v<T, std::int8_t>) {
+        return Int8Type{};
+    } else if constexpr (std::is_same_v<T, std::int16_t>) {
+        return Int16Type{};
+    } else if constexpr (std::is_same_v<T, std::int32_t>) {
+        return Int32Type{};
+    } else if constexpr (std::is_same_v<T, std::int64_t>) {
+        return Int64Type{};
+    } else if constexpr (std::is_same_v<T, float>) {
+        return Float32Type{};
+    } else if constexpr (std::is_same_v<T, double>) {
+        return Float64Type{};
+    } else if constexpr (IsFixedString<T>::value) {
+        return StringType{T::CAPACITY};
+    } else {
+        static_assert(is_reflected_v<T>, "Member type has no schema equivalent");
+        return reflect_fields<T>();
+    }
+}
+
+template <typename T>
+AggregateType reflect_fields() {
+    AggregateType fields;
+
+    for_each_member<T>([&](const auto& field) {
+        using M = typename std::decay_t<decltype(field)>::Type;
+
+        fields.push_back({field.name, reflect_field_type<M>()});
+    });
+
+    return fields;
+}
+
+// The schema of T with the member Key (e.g. &Account::id) as its key
+template <typename T, auto Key>
+Schema reflect_schema() {
+    Schema schema{reflect_fields<T>(), 0};
+
+    std::uint32_t i = 0;
+    bool found = false;
+
+    for_each_member<T>([&](const auto& field) {
+        if constexpr (std::is_same_v<decltype(field.ptr), decltype(Key)>) {
+            if (field.ptr == Key) {
+                schema.key_field_index = i;
+                found = true;
+            }
+        }
+
+        i += 1;
+    });
+
+    assert(found);
+
+    return schema;
+}
+
+// Whether the compiler laid T out the same way the schema does, which it won't if e.g. a
+// member was left out of BOUTIQUE_REFLECT
+template <typename T>
+bool matches_layout(const SchemaLayout& layout, const std::string& prefix = {},
+                    std::size_t base = 0) {
+    if (prefix.empty() && (sizeof(T) != layout.size() || alignof(T) != layout.alignment())) {
+        return false;
+    }
+
+    bool matches = true;
+
+    for_each_member<T>([&](const auto& field) {
+        using M = typename std::decay_t<decltype(field)>::Type;
+
+        auto path = prefix.empty() ? std::string{field.name} : prefix + "." + field.name;
+        auto offset = base + member_offset(field.ptr);
+
+        if constexpr (is_reflected_v<M>) {
+            matches = matches && matches_layout<M>(layout, path, offset);
+        } else {
+            const auto* leaf = layout.find(path);
+
+            matches = matches && leaf && leaf->offset == offset && leaf->size == sizeof(M);
+        }
+    });
+
+    return matches;
+}
+
+}  // namespace boutique
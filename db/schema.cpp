@@ -41,7 +41,10 @@ std::size_t size(const FieldType& type) {
 }
 
 std::size_t size(const AggregateType& agg) {
-    return offset(agg, agg.size() - 1) + size(agg.back().type);
+    const auto a = alignment(agg);
+
+    // Pad the end so that the next element of an array of these would be aligned too
+    return (offset(agg, agg.size() - 1) + size(agg.back().type) + a - 1) & ~(a - 1);
 }
 
 std::size_t size(const Schema& schema) { return size(schema.fields); }
@@ -57,10 +60,7 @@ std::size_t offset(const AggregateType& agg, std::uint32_t field_index) {
 
         // Pad such that the field is appropriately aligned
         const auto a = alignment(field.type);
-
-        // Align to the field type's requirement
-        offset += (offset % a);
-        offset &= ~(a - 1);
+        offset = (offset + a - 1) & ~(a - 1);
 
         if (i == field_index) {
             break;
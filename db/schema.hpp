@@ -119,6 +119,7 @@ std::size_t size(const FieldType& type);
 std::size_t size(const AggregateType& agg);
 std::size_t size(const Schema& schema);
 
+// These walk every field before the given one, so use a SchemaLayout for anything hot
 std::size_t offset(const AggregateType& agg, std::uint32_t field_index);
 std::size_t offset(const Schema& schema, std::uint32_t field_index);
 
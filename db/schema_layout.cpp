@@ -0,0 +1,101 @@
+#include "schema_layout.hpp"
+
+#include <cassert>
+
+namespace boutique {
+
+namespace {
+
+// Lays out the fields of agg starting at base, which must already be aligned for it. Returns
+// the offset just past the last field.
+std::size_t add_leaves(const AggregateType& agg, const std::string& prefix, std::size_t base,
+                       std::vector<LeafField>& out) {
+    auto offset = base;
+
+    for (const auto& field : agg) {
+        const auto a = alignment(field.type);
+
+        offset = (offset + a - 1) & ~(a - 1);
+
+        auto path = prefix.empty() ? field.name : prefix + "." + field.name;
+
+        if (const auto* nested = std::get_if<AggregateType>(&field.type)) {
+            auto end = add_leaves(*nested, path, offset, out);
+
+            // Nested aggregates are padded out to their alignment, same as size() does
+            offset += ((end - offset) + a - 1) & ~(a - 1);
+        } else {
+            auto field_size = size(field.type);
+
+            out.push_back({std::move(path), field.type, offset, field_size});
+
+            offset += field_size;
+        }
+    }
+
+    return offset;
+}
+
+}  // namespace
+
+SchemaLayout::SchemaLayout(const Schema& schema) : m_alignment{boutique::alignment(schema)} {
+    auto end = add_leaves(schema.fields, {}, 0, m_leaves);
+
+    m_size = (end + m_alignment - 1) & ~(m_alignment - 1);
+
+    assert(m_size == boutique::size(schema));
+
+    index_paths();
+
+    const auto* key = find(schema.fields[schema.key_field_index].name);
+
+    assert(key);
+
+    m_key_leaf_index = key - m_leaves.data();
+}
+
+SchemaLayout::SchemaLayout(const SchemaLayout& other)
+    : m_size{other.m_size},
+      m_alignment{other.m_alignment},
+      m_leaves{other.m_leaves},
+      m_key_leaf_index{other.m_key_leaf_index} {
+    index_paths();
+}
+
+SchemaLayout& SchemaLayout::operator=(const SchemaLayout& other) {
+    if (this != &other) {
+        m_size = other.m_size;
+        m_alignment = other.m_alignment;
+        m_leaves = other.m_leaves;
+        m_key_leaf_index = other.m_key_leaf_index;
+
+        index_paths();
+    }
+
+    return *this;
+}
+
+std::size_t SchemaLayout::size() const { return m_size; }
+std::size_t SchemaLayout::alignment() const { return m_alignment; }
+
+const std::vector<LeafField>& SchemaLayout::leaves() const { return m_leaves; }
+
+const LeafField* SchemaLayout::find(std::string_view path) const {
+    auto found = m_paths.find(path);
+
+    return found == m_paths.end() ? nullptr : &m_leaves[found->second];
+}
+
+const LeafField& SchemaLayout::key() const { return m_leaves[m_key_leaf_index]; }
+std::size_t SchemaLayout::key_leaf_index() const { return m_key_leaf_index; }
+
+void SchemaLayout::index_paths() {
+    m_paths.clear();
+    m_paths.reserve(m_leaves.size());
+
+    for (std::uint32_t i = 0; i < m_leaves.size(); ++i) {
+        m_paths.emplace(m_leaves[i].path, i);
+    }
+}
+
+}  // namespace boutique
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "schema.hpp"
+
+namespace boutique {
+
+// A field which isn't an aggregate, found by flattening out all of the nested aggregates
+struct LeafField {
+    // Names of the enclosing aggregate fields and then this one, separated by '.'
+    std::string path;
+
+    // Never an AggregateType
+    FieldType type;
+
+    // Relative to the start of the document
+    std::size_t offset = 0;
+    std::size_t size = 0;
+};
+
+// A schema compiled down to where each of its fields lives in a document. Computing that from
+// the schema itself means walking every field that comes before the one we want (recursing into
+// aggregates on the way), so anything that touches fields per document should build one of
+// these up front and look fields up in it instead.
+struct SchemaLayout {
+    explicit SchemaLayout(const Schema& schema);
+
+    SchemaLayout(const SchemaLayout& other);
+    SchemaLayout& operator=(const SchemaLayout& other);
+
+    // Moving keeps the leaves where they are, so m_paths still points at them
+    SchemaLayout(SchemaLayout&& other) = default;
+    SchemaLayout& operator=(SchemaLayout&& other) = default;
+
+    // Same as size(schema) and alignment(schema)
+    std::size_t size() const;
+    std::size_t alignment() const;
+
+    // In the order they appear in the document
+    const std::vector<LeafField>& leaves() const;
+
+    // The leaf with the given path, or nullptr if there isn't one. Doesn't allocate, so it's
+    // fine to call per request.
+    const LeafField* find(std::string_view path) const;
+
+    // The key is always a top-level leaf
+    const LeafField& key() const;
+    std::size_t key_leaf_index() const;
+
+private:
+    std::size_t m_size = 0;
+    std::size_t m_alignment = 0;
+
+    std::vector<LeafField> m_leaves;
+    std::size_t m_key_leaf_index = 0;
+
+    // Maps paths (viewing the ones in m_leaves) to indices into m_leaves
+    std::unordered_map<std::string_view, std::uint32_t> m_paths;
+
+    void index_paths();
+};
+
+}  // namespace boutique
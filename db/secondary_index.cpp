@@ -0,0 +1,269 @@
+#include "secondary_index.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <type_traits>
+
+#include "core/overloaded_visitor.hpp"
+
+namespace boutique {
+
+namespace {
+
+// Roughly what each value costs the map on top of its key and postings: a node's pointers,
+// or a hash node and its bucket
+const std::size_t NODE_OVERHEAD = 4 * sizeof(void*);
+
+enum class Encoding : std::uint8_t { UNSIGNED, SIGNED, FLOAT, STRING };
+
+template <typename T>
+std::uint64_t load(const void* bytes) {
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+
+    return value;
+}
+
+Encoding encoding(const LeafField& leaf) {
+    return std::visit(
+        OverloadedVisitor{[](const StringType&) { return Encoding::STRING; },
+                          [](Float32Type) { return Encoding::FLOAT; },
+                          [](Float64Type) { return Encoding::FLOAT; },
+                          [](const AggregateType&) { return Encoding::UNSIGNED; },
+                          [](auto type) {
+                              using T = impl_type_t<decltype(type)>;
+
+                              return std::is_signed_v<T> ? Encoding::SIGNED : Encoding::UNSIGNED;
+                          }},
+        leaf.type);
+}
+
+// Encodes a value given like FieldUpdate::value
+void encode_value(const LeafField& leaf, ConstBuffer value, std::string& out) {
+    auto enc = encoding(leaf);
+
+    if (enc == Encoding::STRING) {
+        out.assign(value.data, value.len);
+        return;
+    }
+
+    std::uint64_t bits = 0;
+
+    switch (leaf.size) {
+        case 1:
+            bits = load<std::uint8_t>(value.data);
+            break;
+
+        case 2:
+            bits = load<std::uint16_t>(value.data);
+            break;
+
+        case 4:
+            bits = load<std::uint32_t>(value.data);
+            break;
+
+        case 8:
+            bits = load<std::uint64_t>(value.data);
+            break;
+
+        default:
+            assert(false);
+    }
+
+    auto bit_count = leaf.size * 8;
+    auto sign = std::uint64_t{1} << (bit_count - 1);
+
+    if (enc == Encoding::SIGNED) {
+        // Negative numbers go below positive ones, and two's complement orders each of them
+        // the right way already
+        bits ^= sign;
+    } else if (enc == Encoding::FLOAT) {
+        // Same for floats, except negative ones are ordered backwards since they're sign and
+        // magnitude
+        auto mask = bit_count == 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << bit_count) - 1;
+
+        bits = (bits & sign) ? ~bits & mask : bits | sign;
+    }
+
+    out.resize(leaf.size);
+
+    for (std::size_t i = 0; i < leaf.size; ++i) {
+        out[i] = static_cast<char>(bits >> (8 * (leaf.size - 1 - i)));
+    }
+}
+
+}  // namespace
+
+bool can_index(const FieldType& type) { return !std::holds_alternative<AggregateType>(type); }
+
+void encode_index_key(const LeafField& leaf, const void* field, std::string& out) {
+    if (!std::holds_alternative<StringType>(leaf.type)) {
+        encode_value(leaf, {static_cast<const char*>(field), leaf.size}, out);
+        return;
+    }
+
+    StringHeader header;
+    std::memcpy(&header, field, sizeof(header));
+
+    // A document could have been put with a length past the capacity
+    auto len = std::min<std::size_t>(header.len, leaf.size - sizeof(header));
+
+    out.assign(static_cast<const char*>(field) + sizeof(header), len);
+}
+
+SecondaryIndex::SecondaryIndex(LeafField leaf, std::size_t leaf_index, SecondaryIndexType type)
+    : m_leaf{std::move(leaf)}, m_leaf_index{leaf_index}, m_type{type} {
+    assert(can_index(m_leaf.type));
+
+    if (m_type == SecondaryIndexType::ORDERED) {
+        m_values.emplace<std::map<std::string, Postings>>();
+    }
+}
+
+const LeafField& SecondaryIndex::leaf() const { return m_leaf; }
+
+std::size_t SecondaryIndex::leaf_index() const { return m_leaf_index; }
+
+SecondaryIndexType SecondaryIndex::type() const { return m_type; }
+
+void SecondaryIndex::add(std::size_t value_index, const void* field) {
+    encode_index_key(m_leaf, field, m_key);
+
+    auto& postings = std::visit([&](auto& values) -> Postings& { return values[m_key]; },
+                                m_values);
+
+    if (m_positions.size() <= value_index) {
+        m_positions.resize(value_index + 1);
+    }
+
+    m_positions[value_index] = postings.size();
+    postings.push_back(value_index);
+}
+
+void SecondaryIndex::change(std::size_t value_index, const void* old_field,
+                            const void* new_field) {
+    if (std::memcmp(old_field, new_field, m_leaf.size) == 0) {
+        return;
+    }
+
+    encode_index_key(m_leaf, old_field, m_key);
+    unlink(value_index);
+
+    add(value_index, new_field);
+}
+
+void SecondaryIndex::remove(std::size_t value_index, const void* field, std::size_t last_index,
+                            const void* last_field) {
+    encode_index_key(m_leaf, field, m_key);
+    unlink(value_index);
+
+    if (value_index != last_index) {
+        // The last document keeps its place in its postings, it just goes by a new value index
+        encode_index_key(m_leaf, last_field, m_key);
+
+        auto position = m_positions[last_index];
+
+        std::visit([&](auto& values) { values.find(m_key)->second[position] = value_index; },
+                   m_values);
+
+        m_positions[value_index] = position;
+    }
+
+    m_positions.pop_back();
+}
+
+bool SecondaryIndex::fits(ConstBuffer value) const {
+    if (std::holds_alternative<StringType>(m_leaf.type)) {
+        return value.len <= m_leaf.size - sizeof(StringHeader);
+    }
+
+    return value.len == m_leaf.size;
+}
+
+void SecondaryIndex::find(ConstBuffer value, FunctionView<bool(std::size_t value_index)> fn) {
+    assert(fits(value));
+
+    encode_value(m_leaf, value, m_key);
+
+    std::visit(
+        [&](auto& values) {
+            auto found = values.find(m_key);
+
+            if (found == values.end()) {
+                return;
+            }
+
+            for (auto value_index : found->second) {
+                if (!fn(value_index)) {
+                    return;
+                }
+            }
+        },
+        m_values);
+}
+
+void SecondaryIndex::find_range(ConstBuffer min, ConstBuffer max,
+                                FunctionView<bool(std::size_t value_index)> fn) {
+    assert(m_type == SecondaryIndexType::ORDERED);
+    assert((min.len == 0 || fits(min)) && (max.len == 0 || fits(max)));
+
+    auto& values = std::get<std::map<std::string, Postings>>(m_values);
+
+    auto iter = values.begin();
+
+    if (min.len != 0) {
+        encode_value(m_leaf, min, m_key);
+        iter = values.lower_bound(m_key);
+    }
+
+    if (max.len != 0) {
+        encode_value(m_leaf, max, m_max_key);
+    }
+
+    for (; iter != values.end(); ++iter) {
+        if (max.len != 0 && iter->first > m_max_key) {
+            return;
+        }
+
+        for (auto value_index : iter->second) {
+            if (!fn(value_index)) {
+                return;
+            }
+        }
+    }
+}
+
+std::size_t SecondaryIndex::memory_usage() const {
+    auto value_count = std::visit([](const auto& values) { return values.size(); }, m_values);
+
+    return value_count * (sizeof(std::string) + sizeof(Postings) + NODE_OVERHEAD + m_leaf.size) +
+           m_positions.size() * 2 * sizeof(std::size_t);
+}
+
+void SecondaryIndex::unlink(std::size_t value_index) {
+    std::visit(
+        [&](auto& values) {
+            auto found = values.find(m_key);
+
+            assert(found != values.end());
+
+            auto& postings = found->second;
+            auto position = m_positions[value_index];
+
+            // The last document in the postings takes this one's place
+            auto moved = postings.back();
+
+            postings[position] = moved;
+            m_positions[moved] = position;
+
+            postings.pop_back();
+
+            if (postings.empty()) {
+                values.erase(found);
+            }
+        },
+        m_values);
+}
+
+}  // namespace boutique
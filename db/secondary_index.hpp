@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "core/const_buffer.hpp"
+#include "core/function_view.hpp"
+#include "schema_layout.hpp"
+
+namespace boutique {
+
+enum class SecondaryIndexType : std::uint8_t {
+    // Finds documents with a given value of the field
+    HASH,
+
+    // Same as HASH, and also finds documents whose field is in a range of values, in order
+    ORDERED,
+};
+
+// Whether a field of the given type can have a secondary index, i.e. it's a scalar or a string
+bool can_index(const FieldType& type);
+
+// Encodes the leaf's value at field (its place in a document) the way secondary indexes store
+// it, so that comparing two encoded values as bytes orders them like the values themselves (see
+// SecondaryIndex). The leaf must be one that can_index.
+void encode_index_key(const LeafField& leaf, const void* field, std::string& out);
+
+// Maps values of one leaf field to the value indices of the documents which have them, so that
+// documents can be found by a field other than their key without looking at all of them. Like
+// EvictionTracker, it's kept parallel to the collection's storage and told about every document
+// that's added, changed or moved.
+//
+// Values are stored encoded so that comparing them as bytes orders them the same way as the
+// values themselves (e.g. integers are big-endian, with the sign bit flipped if they're
+// signed). Floats are compared bit for bit, so 0.0 and -0.0 aren't equal.
+struct SecondaryIndex {
+    // leaf_index is where leaf is in SchemaLayout::leaves
+    SecondaryIndex(LeafField leaf, std::size_t leaf_index, SecondaryIndexType type);
+
+    const LeafField& leaf() const;
+    std::size_t leaf_index() const;
+    SecondaryIndexType type() const;
+
+    // The document at value_index was added, and its value of the field is at field (its
+    // place in the document or column)
+    void add(std::size_t value_index, const void* field);
+
+    // The field of the document at value_index is going (or just went) from old_field to
+    // new_field
+    void change(std::size_t value_index, const void* old_field, const void* new_field);
+
+    // The document at value_index is being removed, and the last document (at last_index) moved
+    // into its place, the same way Storage::remove does it
+    void remove(std::size_t value_index, const void* field, std::size_t last_index,
+                const void* last_field);
+
+    // Whether value is the right size for the field. Values are encoded like
+    // FieldUpdate::value, so strings are just their characters.
+    bool fits(ConstBuffer value) const;
+
+    // Calls fn with the value index of each document whose field is value, until it returns
+    // false. value must fit.
+    void find(ConstBuffer value, FunctionView<bool(std::size_t value_index)> fn);
+
+    // Same as find for documents whose field is between min and max (inclusive), in order of
+    // their values. Leaving min or max empty leaves that end open. Only for ORDERED indexes.
+    void find_range(ConstBuffer min, ConstBuffer max,
+                    FunctionView<bool(std::size_t value_index)> fn);
+
+    // An estimate, since the maps don't say how much they've allocated
+    std::size_t memory_usage() const;
+
+private:
+    // Value indices of the documents with a value, in no particular order
+    using Postings = std::vector<std::size_t>;
+
+    LeafField m_leaf;
+    std::size_t m_leaf_index = 0;
+    SecondaryIndexType m_type;
+
+    std::variant<std::unordered_map<std::string, Postings>, std::map<std::string, Postings>>
+        m_values;
+
+    // Where each document is in the postings of its value, by value index, so that removing
+    // one doesn't mean searching for it
+    std::vector<std::size_t> m_positions;
+
+    // Encoded values are built here, so looking one up only allocates until these are big
+    // enough
+    std::string m_key;
+    std::string m_max_key;
+
+    // Takes the document at value_index out of the postings of m_key
+    void unlink(std::size_t value_index);
+};
+
+}  // namespace boutique
@@ -1,51 +1,133 @@
 #include "storage.hpp"
 
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <new>
+#include <system_error>
 
 namespace {
 
-constexpr std::size_t init_cap = 16;
+// Full size chunks are huge page sized and aligned so that a chunk can be backed by a single
+// TLB entry
+const std::size_t CHUNK_SIZE = 2 * 1024 * 1024;
+
+std::size_t docs_shift(std::size_t doc_size, std::size_t chunk_size) {
+    std::size_t shift = 0;
+
+    while (doc_size << (shift + 1) <= chunk_size) {
+        shift += 1;
+    }
 
+    return shift;
 }
 
+}  // namespace
+
 namespace boutique {
 
-Storage::Storage(std::size_t doc_size) : m_doc_size{doc_size} {}
+Storage::Storage(std::size_t doc_size, std::size_t first_chunk_size)
+    : m_doc_size{doc_size},
+      m_first_shift{docs_shift(doc_size, std::min(first_chunk_size, CHUNK_SIZE))},
+      m_chunk_shift{docs_shift(doc_size, CHUNK_SIZE)},
+      m_growing_chunk_count{m_chunk_shift - m_first_shift + 1} {}
 
 void* Storage::put(const void* elem_data) {
-    while (m_data.size() < m_doc_size * (m_count + 1)) {
-        m_data.resize(std::max(m_data.size() * 2, m_doc_size * init_cap));
+    if (m_count == capacity()) {
+        auto len = next_chunk_size();
+
+        if (len < m_doc_size << m_chunk_shift) {
+            m_chunks.emplace_back(static_cast<char*>(::operator new(len)));
+        } else {
+            auto* chunk = static_cast<char*>(::operator new(len, std::align_val_t{CHUNK_SIZE}));
+
+#ifdef __linux__
+            // Only a hint, and the chunk is usable either way
+            madvise(chunk, len, MADV_HUGEPAGE);
+#endif
+
+            m_chunks.emplace_back(chunk, ChunkDeleter{false, true});
+        }
     }
 
-    // Check that the resulting data pointer is maximally aligned
-    assert(reinterpret_cast<std::uintptr_t>(m_data.data()) % alignof(std::max_align_t) == 0);
+    auto* dest = (*this)[m_count];
 
-    std::memcpy(m_data.data() + m_doc_size * m_count, elem_data, m_doc_size);
+    std::memcpy(dest, elem_data, m_doc_size);
     m_count += 1;
 
-    return m_data.data() + m_doc_size * (m_count - 1);
+    return dest;
 }
 
 void Storage::remove(const void* elem_ptr) {
     assert(m_count > 0);
-    assert((reinterpret_cast<const char*>(elem_ptr) - m_data.data()) / m_doc_size < m_count);
 
-    const void* last_elem_ptr = m_data.data() + m_doc_size * (m_count - 1);
+    const void* last_elem_ptr = (*this)[m_count - 1];
 
     if (elem_ptr != last_elem_ptr) {
         std::memcpy(const_cast<void*>(elem_ptr), last_elem_ptr, m_doc_size);
     }
 
     m_count -= 1;
+
+    // We keep one empty chunk around so that alternating puts and removes at a chunk boundary
+    // don't allocate and free a chunk every time.
+    auto chunks_in_use = m_count == 0 ? 0 : chunk_index(m_count - 1) + 1;
+
+    if (m_chunks.size() > chunks_in_use + 1) {
+        m_chunks.resize(chunks_in_use + 1);
+        m_shrink_count += 1;
+    }
 }
 
 void Storage::clear() { m_count = 0; }
 
-void* Storage::operator[](std::ptrdiff_t index) {
-    return reinterpret_cast<void*>(m_data.data() + index * m_doc_size);
+void Storage::map(int fd, std::uint64_t offset, std::size_t count) {
+    assert(m_count == 0 && m_chunks.empty());
+
+    if (count == 0) {
+        return;
+    }
+
+    auto chunk_count = chunk_index(count - 1) + 1;
+
+    auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+
+    auto len = chunk_start(chunk_count) * m_doc_size;
+    auto file_len = (count * m_doc_size + page_size - 1) / page_size * page_size;
+
+    // The last chunk has room past the end of the documents, which comes from an anonymous
+    // mapping rather than the file; pages entirely past the end of a file can't be touched.
+    auto* mapping = static_cast<char*>(
+        mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+    if (mapping == MAP_FAILED) {
+        throw std::system_error{errno, std::generic_category(), "Failed to map storage"};
+    }
+
+    m_mapping = std::unique_ptr<char, MappingDeleter>{mapping, MappingDeleter{len}};
+
+    if (mmap(mapping, std::min(file_len, len), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+             fd, static_cast<off_t>(offset)) == MAP_FAILED) {
+        throw std::system_error{errno, std::generic_category(), "Failed to map storage"};
+    }
+
+    for (std::size_t i = 0; i < chunk_count; ++i) {
+        m_chunks.emplace_back(mapping + chunk_start(i) * m_doc_size, ChunkDeleter{true});
+    }
+
+    m_count = count;
+}
+
+std::size_t Storage::run_length(std::size_t index) const {
+    assert(index < m_count);
+
+    return std::min(m_count, chunk_start(chunk_index(index) + 1)) - index;
 }
 
 bool Storage::empty() const { return m_count == 0; }
@@ -54,4 +136,32 @@ std::size_t Storage::count() const { return m_count; }
 
 std::size_t Storage::doc_size() const { return m_doc_size; }
 
+std::size_t Storage::capacity() const { return chunk_start(m_chunks.size()); }
+
+std::size_t Storage::memory_usage() const { return capacity() * m_doc_size; }
+
+std::size_t Storage::next_chunk_size() const {
+    if (m_count < capacity()) {
+        return 0;
+    }
+
+    return (chunk_start(m_chunks.size() + 1) - chunk_start(m_chunks.size())) * m_doc_size;
+}
+
+std::size_t Storage::shrink_count() const { return m_shrink_count; }
+
+void Storage::ChunkDeleter::operator()(char* chunk) const {
+    if (mapped) {
+        return;
+    }
+
+    if (aligned) {
+        ::operator delete(chunk, std::align_val_t{CHUNK_SIZE});
+    } else {
+        ::operator delete(chunk);
+    }
+}
+
+void Storage::MappingDeleter::operator()(char* mapping) const { munmap(mapping, len); }
+
 }  // namespace boutique
@@ -1,33 +1,126 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 namespace boutique {
 
+// Documents are stored in chunks, so growing is just allocating another chunk. Existing
+// documents are never copied when we grow, and pointers to them stay valid until they're
+// removed (or moved into a removed document's place).
+//
+// The first chunk is a page, and each one after it doubles the capacity until they reach the
+// huge page size, after which they're all that size. That way a collection holding a handful
+// of documents doesn't pay for a whole huge page.
 struct Storage {
-    Storage(std::size_t doc_size);
+    // Bytes in the first chunk, unless a document is bigger than that
+    static constexpr std::size_t FIRST_CHUNK_SIZE = 4096;
+
+    // first_chunk_size is for storages which only hold part of each document (see
+    // ColumnarStorage), so that together they start out at FIRST_CHUNK_SIZE
+    explicit Storage(std::size_t doc_size, std::size_t first_chunk_size = FIRST_CHUNK_SIZE);
 
     void* put(const void* elem_data);
     void remove(const void* elem_ptr);
     void clear();
 
-    void* operator[](std::ptrdiff_t index);
+    // Makes the documents the count of them at offset in the file fd, without reading them.
+    // They're mapped privately, so they're only read in as they're touched and changing them
+    // doesn't change the file. offset must be a multiple of the page size, and the storage must
+    // be empty. Throws if mapping fails.
+    void map(int fd, std::uint64_t offset, std::size_t count);
+
+    void* operator[](std::ptrdiff_t index) {
+        auto i = static_cast<std::size_t>(index);
+        auto chunk = chunk_index(i);
+
+        return m_chunks[chunk].get() + (i - chunk_start(chunk)) * m_doc_size;
+    }
+
+    // How many documents starting at the given one are contiguous in memory
+    std::size_t run_length(std::size_t index) const;
 
     bool empty() const;
     std::size_t count() const;
     std::size_t doc_size() const;
 
+    // Number of documents which fit before we have to grow
+    std::size_t capacity() const;
+
+    // Bytes allocated for documents, including free space at the end and the spare chunk
+    // remove keeps around
+    std::size_t memory_usage() const;
+
+    // Bytes the next put allocates, or 0 if there's room for it already
+    std::size_t next_chunk_size() const;
+
+    // Times remove has given memory back
+    std::size_t shrink_count() const;
+
 private:
+    struct ChunkDeleter {
+        // Chunks which point into m_mapping go away with it
+        bool mapped = false;
+
+        // Full size chunks are aligned to the huge page size
+        bool aligned = false;
+
+        void operator()(char* chunk) const;
+    };
+
+    struct MappingDeleter {
+        std::size_t len;
+
+        void operator()(char* mapping) const;
+    };
+
     std::size_t m_doc_size = 0;
 
-    // TODO Make the implementation similar to deque so that we have
-    // amortized O(1) put.
+    // Every chunk holds a power of 2 documents: 1 << m_first_shift in the first one, then
+    // doubling up to 1 << m_chunk_shift. Past the growing chunks, finding a document's chunk is
+    // a shift.
+    std::size_t m_first_shift = 0;
+    std::size_t m_chunk_shift = 0;
+
+    // How many chunks it takes to reach the full size, including the first full size one
+    std::size_t m_growing_chunk_count = 1;
+
+    // Set by map. Its chunks aren't given back if the storage shrinks, only once it's gone.
+    std::unique_ptr<char, MappingDeleter> m_mapping;
+
+    std::vector<std::unique_ptr<char[], ChunkDeleter>> m_chunks;
+    std::size_t m_count = 0;
+
+    std::size_t m_shrink_count = 0;
+
+    // The chunk the document at index i is in
+    std::size_t chunk_index(std::size_t i) const {
+        if (i >> m_chunk_shift) {
+            return m_growing_chunk_count - 1 + (i >> m_chunk_shift);
+        }
+
+        if (!(i >> m_first_shift)) {
+            return 0;
+        }
+
+        // Each growing chunk after the first starts at a power of 2, which is the top bit of
+        // every index in it
+        auto top_bit = static_cast<std::size_t>(63 - __builtin_clzll(i));
+
+        return top_bit - m_first_shift + 1;
+    }
+
+    // Index of the first document in the given chunk, which is also how many documents fit in
+    // the chunks before it
+    std::size_t chunk_start(std::size_t chunk) const {
+        if (chunk >= m_growing_chunk_count) {
+            return (chunk - m_growing_chunk_count + 1) << m_chunk_shift;
+        }
 
-    // HACK We depend on the fact that vector uses operator new under the hood
-    // and assume the data will be sufficiently aligned.
-    std::vector<char> m_data;
-    size_t m_count = 0;
+        return chunk == 0 ? 0 : std::size_t{1} << (m_first_shift + chunk - 1);
+    }
 };
 
 }  // namespace boutique
@@ -0,0 +1,200 @@
+#include "swiss_index.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Same as LinearProbeIndex; shrinking by half below this leaves the table a quarter full
+const std::size_t SHRINK_DIVISOR = 8;
+
+}  // namespace
+
+namespace boutique {
+
+std::size_t SwissIndex::find(const IndexKeys& keys, ConstBuffer key, std::size_t key_hash) {
+    return find(key_hash, [&](std::size_t value_index) {
+        auto data_key = keys.key_at(value_index);
+
+        return key.len == data_key.len && std::memcmp(data_key.data, key.data, key.len) == 0;
+    });
+}
+
+void SwissIndex::prefetch(std::size_t key_hash) const {
+    if (m_capacity == 0) {
+        return;
+    }
+
+    auto pos = h1(mix_hash(key_hash)) & (m_capacity - 1);
+
+    __builtin_prefetch(m_ctrl.data() + pos);
+    __builtin_prefetch(m_values.data() + pos);
+}
+
+std::size_t SwissIndex::value(std::size_t pos) const { return m_values[pos]; }
+
+void SwissIndex::set_value(std::size_t pos, std::size_t value_index) {
+    assert(value_index <= std::numeric_limits<std::uint32_t>::max());
+
+    m_values[pos] = static_cast<std::uint32_t>(value_index);
+}
+
+void SwissIndex::erase(const IndexKeys& keys, std::size_t pos) {
+    auto slot_mask = m_capacity - 1;
+
+    // If there were never GROUP_SIZE full slots in a row around this one, then no probe ever
+    // continued past it because of it, so it can go straight back to being empty instead of
+    // leaving a tombstone behind.
+    auto empty_before = match(m_ctrl.data() + ((pos - GROUP_SIZE) & slot_mask), EMPTY);
+    auto empty_after = match(m_ctrl.data() + pos, EMPTY);
+
+    bool was_never_full = empty_before != 0 && empty_after != 0 &&
+                          static_cast<std::size_t>(__builtin_ctz(empty_after) +
+                                                   (__builtin_clz(empty_before) - 16)) <
+                              GROUP_SIZE;
+
+    if (was_never_full) {
+        set_ctrl(pos, EMPTY);
+    } else {
+        set_ctrl(pos, DELETED);
+        m_deleted_count += 1;
+    }
+
+    m_count -= 1;
+
+    if (m_capacity > GROUP_SIZE && m_count < m_capacity / SHRINK_DIVISOR) {
+        rehash(keys, m_capacity / 2);
+        m_stats.shrink_count += 1;
+    }
+}
+
+bool SwissIndex::insert(const IndexKeys& keys, std::size_t key_hash, std::size_t value_index) {
+    if (value_index > std::numeric_limits<std::uint32_t>::max()) {
+        return false;
+    }
+
+    // Max load factor of 7/8, counting deleted slots since they lengthen probes just the same
+    if ((m_count + m_deleted_count + 1) * 8 > m_capacity * 7) {
+        if (m_count + 1 <= m_capacity * 7 / 16) {
+            // Mostly tombstones, so we can get rid of them without growing
+            rehash(keys, m_capacity);
+            m_stats.cleanup_count += 1;
+        } else {
+            rehash(keys, std::max(m_capacity * 2, GROUP_SIZE));
+            m_stats.grow_count += 1;
+        }
+    }
+
+    auto mixed = mix_hash(key_hash);
+    auto slot = find_insert_slot(mixed);
+
+    if (m_ctrl[slot] == DELETED) {
+        m_deleted_count -= 1;
+    }
+
+    set_ctrl(slot, h2(mixed));
+    m_values[slot] = static_cast<std::uint32_t>(value_index);
+
+    m_count += 1;
+
+    return true;
+}
+
+bool SwissIndex::build(Span<const std::size_t> key_hashes) {
+    assert(m_count == 0);
+
+    if (key_hashes.size() > std::size_t{std::numeric_limits<std::uint32_t>::max()} + 1) {
+        return false;
+    }
+
+    auto capacity = std::max(m_capacity, GROUP_SIZE);
+
+    // Same load factor insert keeps
+    while ((key_hashes.size() + 1) * 8 > capacity * 7) {
+        capacity *= 2;
+    }
+
+    m_capacity = capacity;
+    m_deleted_count = 0;
+
+    m_ctrl.assign(m_capacity + GROUP_SIZE, EMPTY);
+    m_values = decltype(m_values)(m_capacity);
+
+    for (std::size_t i = 0; i < key_hashes.size(); ++i) {
+        auto mixed = mix_hash(key_hashes.data[i]);
+        auto slot = find_insert_slot(mixed);
+
+        set_ctrl(slot, h2(mixed));
+        m_values[slot] = static_cast<std::uint32_t>(i);
+    }
+
+    m_count = key_hashes.size();
+
+    return true;
+}
+
+std::size_t SwissIndex::memory_usage() const {
+    return m_ctrl.size() * sizeof(std::int8_t) + m_values.size() * sizeof(std::uint32_t);
+}
+
+IndexStats SwissIndex::stats() const {
+    auto stats = m_stats;
+
+    stats.capacity = m_capacity;
+    stats.tombstone_count = m_deleted_count;
+
+    return stats;
+}
+
+void SwissIndex::rehash(const IndexKeys& keys, std::size_t capacity) {
+    auto old_ctrl = std::move(m_ctrl);
+    auto old_values = std::move(m_values);
+    auto old_capacity = m_capacity;
+
+    m_capacity = capacity;
+    m_deleted_count = 0;
+
+    m_ctrl.assign(m_capacity + GROUP_SIZE, EMPTY);
+    m_values = decltype(m_values)(m_capacity);
+
+    for (std::size_t i = 0; i < old_capacity; ++i) {
+        if (old_ctrl[i] < 0) {
+            continue;
+        }
+
+        // Unlike LinearProbeIndex we don't keep the hashes around, so we have to go back to
+        // the keys for them.
+        auto mixed = mix_hash(keys.hash_at(old_values[i]));
+        auto slot = find_insert_slot(mixed);
+
+        set_ctrl(slot, h2(mixed));
+        m_values[slot] = old_values[i];
+    }
+}
+
+void SwissIndex::set_ctrl(std::size_t slot, std::int8_t ctrl) {
+    m_ctrl[slot] = ctrl;
+
+    if (slot < GROUP_SIZE) {
+        m_ctrl[m_capacity + slot] = ctrl;
+    }
+}
+
+std::size_t SwissIndex::find_insert_slot(std::size_t mixed_hash) const {
+    auto slot_mask = m_capacity - 1;
+    auto pos = h1(mixed_hash) & slot_mask;
+
+    for (std::size_t step = GROUP_SIZE;; step += GROUP_SIZE) {
+        auto mask = match_empty_or_deleted(m_ctrl.data() + pos);
+
+        if (mask != 0) {
+            return (pos + __builtin_ctz(mask)) & slot_mask;
+        }
+
+        pos = (pos + step) & slot_mask;
+    }
+}
+
+}  // namespace boutique
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "core/const_buffer.hpp"
+#include "core/span.hpp"
+#include "core/zeroed_allocator.hpp"
+#include "index.hpp"
+
+namespace boutique {
+
+// Open addressing where each slot has a control byte holding 7 bits of its key's hash (or a
+// marker for empty/deleted). Lookups compare a whole group of 16 control bytes against the
+// hash at once and only look at keys whose bits match, so most probes never touch anything
+// but the control bytes. Slots themselves are just 32-bit value indices.
+//
+// Positions returned by find are only valid until the next call to erase or insert.
+struct SwissIndex {
+    std::size_t find(const IndexKeys& keys, ConstBuffer key, std::size_t key_hash);
+
+    // Same as above, except the key is compared by calling key_equals with the value index of
+    // each candidate. Callers that know the key type at compile time get that inlined.
+    template <typename KeyEquals>
+    std::size_t find(std::size_t key_hash, KeyEquals&& key_equals);
+
+    // Starts loading the group (and value) that a find for the hash would start at
+    void prefetch(std::size_t key_hash) const;
+
+    std::size_t value(std::size_t pos) const;
+    void set_value(std::size_t pos, std::size_t value_index);
+
+    void erase(const IndexKeys& keys, std::size_t pos);
+
+    // The key must not already be in the index. Returns false if the value index doesn't fit
+    // into 32 bits.
+    bool insert(const IndexKeys& keys, std::size_t key_hash, std::size_t value_index);
+
+    // Fills an empty index with value index i for each key_hashes[i], sized up front so that it
+    // never grows along the way and without looking at any keys. The keys must all be
+    // different. Returns false if there's no room for them.
+    bool build(Span<const std::size_t> key_hashes);
+
+    std::size_t memory_usage() const;
+    IndexStats stats() const;
+
+private:
+    static constexpr std::size_t GROUP_SIZE = 16;
+
+    static constexpr std::int8_t EMPTY = -128;
+    static constexpr std::int8_t DELETED = -2;
+
+    std::size_t m_count = 0;
+    std::size_t m_deleted_count = 0;
+
+    IndexStats m_stats;
+
+    // Always a power of 2 no smaller than a group, or 0
+    std::size_t m_capacity = 0;
+
+    // The first group's worth of control bytes are mirrored past the end so that a group can
+    // be loaded starting at any slot.
+    std::vector<std::int8_t> m_ctrl;
+    std::vector<std::uint32_t, ZeroedAllocator<std::uint32_t>> m_values;
+
+    // Rebuilds the table with the given capacity, which also clears out deleted slots
+    void rehash(const IndexKeys& keys, std::size_t capacity);
+
+    void set_ctrl(std::size_t slot, std::int8_t ctrl);
+
+    // First empty or deleted slot in the hash's probe sequence
+    std::size_t find_insert_slot(std::size_t mixed_hash) const;
+
+    static std::size_t h1(std::size_t mixed) { return mixed >> 7; }
+    static std::int8_t h2(std::size_t mixed) { return static_cast<std::int8_t>(mixed >> (64 - 7)); }
+
+    // These return a mask with bit i set if control byte i of the group matches
+    static std::uint32_t match(const std::int8_t* ctrl, std::int8_t value);
+    static std::uint32_t match_empty_or_deleted(const std::int8_t* ctrl);
+};
+
+template <typename KeyEquals>
+std::size_t SwissIndex::find(std::size_t key_hash, KeyEquals&& key_equals) {
+    if (m_capacity == 0) {
+        return NO_POS;
+    }
+
+    auto mixed = mix_hash(key_hash);
+    auto tag = h2(mixed);
+
+    auto slot_mask = m_capacity - 1;
+    auto pos = h1(mixed) & slot_mask;
+
+    // The value is almost always in the first group, so start fetching it alongside the
+    // control bytes rather than waiting until they've been matched.
+    __builtin_prefetch(m_values.data() + pos);
+
+    // Triangular probing over groups, which visits every group once the table has wrapped
+    for (std::size_t step = GROUP_SIZE;; step += GROUP_SIZE) {
+        const auto* group = m_ctrl.data() + pos;
+
+        for (auto mask = match(group, tag); mask != 0; mask &= mask - 1) {
+            auto slot = (pos + __builtin_ctz(mask)) & slot_mask;
+
+            if (key_equals(static_cast<std::size_t>(m_values[slot]))) {
+                return slot;
+            }
+        }
+
+        if (match(group, EMPTY) != 0) {
+            return NO_POS;
+        }
+
+        pos = (pos + step) & slot_mask;
+    }
+}
+
+#ifdef __SSE2__
+
+inline std::uint32_t SwissIndex::match(const std::int8_t* ctrl, std::int8_t value) {
+    auto group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+
+    return static_cast<std::uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value))));
+}
+
+// EMPTY and DELETED are the only control bytes with the high bit set
+inline std::uint32_t SwissIndex::match_empty_or_deleted(const std::int8_t* ctrl) {
+    auto group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(group));
+}
+
+#else
+
+inline std::uint32_t SwissIndex::match(const std::int8_t* ctrl, std::int8_t value) {
+    std::uint32_t mask = 0;
+
+    for (std::size_t i = 0; i < GROUP_SIZE; ++i) {
+        mask |= static_cast<std::uint32_t>(ctrl[i] == value) << i;
+    }
+
+    return mask;
+}
+
+inline std::uint32_t SwissIndex::match_empty_or_deleted(const std::int8_t* ctrl) {
+    std::uint32_t mask = 0;
+
+    for (std::size_t i = 0; i < GROUP_SIZE; ++i) {
+        mask |= static_cast<std::uint32_t>(ctrl[i] < 0) << i;
+    }
+
+    return mask;
+}
+
+#endif
+
+}  // namespace boutique
@@ -1,11 +1,25 @@
+#include <atomic>
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "collection.hpp"
+#include "columnar_storage.hpp"
+#include "concurrent_collection.hpp"
 #include "database.hpp"
+#include "eviction.hpp"
+#include "field_update.hpp"
 #include "schema.hpp"
+#include "schema_layout.hpp"
+#include "secondary_index.hpp"
 #include "storage.hpp"
+#include "timing_wheel.hpp"
+#include "typed_collection.hpp"
 
 struct User {
     std::uint64_t id;
@@ -14,6 +28,1266 @@ struct User {
     std::int64_t balance;
 };
 
+namespace {
+
+struct Address {
+    std::uint16_t number;
+    boutique::FixedString<20> street;
+};
+
+BOUTIQUE_REFLECT(Address, number, street)
+
+struct Customer {
+    std::uint64_t id;
+    boutique::FixedString<12> name;
+    Address address;
+    bool active;
+};
+
+BOUTIQUE_REFLECT(Customer, id, name, address, active)
+
+struct Pair {
+    std::uint64_t key;
+    std::uint64_t value;
+};
+
+void test_concurrent_collection() {
+    using namespace boutique;
+
+    ConcurrentCollection coll{Schema{{{"key", UInt64Type{}}, {"value", UInt64Type{}}}}, 4};
+
+    auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    // Key 0 hashes to 0 which is what marks an empty bucket internally
+    for (std::uint64_t i = 0; i < 1000; ++i) {
+        Pair p{i, i};
+        coll.put(&p);
+    }
+
+    assert(coll.count() == 1000);
+
+    Pair p;
+
+    assert(coll.find(key_buf(0), &p) && p.value == 0);
+    assert(coll.find(key_buf(999), &p) && p.value == 999);
+    assert(!coll.find(key_buf(1000), &p));
+
+    for (std::uint64_t i = 0; i < 1000; i += 2) {
+        assert(coll.remove(key_buf(i)));
+    }
+
+    assert(!coll.remove(key_buf(0)));
+    assert(coll.count() == 500);
+
+    for (std::uint64_t i = 0; i < 1000; ++i) {
+        assert(coll.find(key_buf(i), &p) == (i % 2 == 1));
+    }
+
+    {
+        ConcurrentCollection one_segment{coll.schema(), 1};
+
+        for (std::uint64_t i = 0; i < 1000; ++i) {
+            Pair p{i, i};
+            one_segment.put(&p);
+        }
+
+        // Overwriting moves the rest of the old table over, and with nobody reading, every
+        // table before the current one gets freed
+        for (std::uint64_t i = 0; i < 1000; ++i) {
+            Pair p{i, i + 1};
+            one_segment.put(&p);
+        }
+
+        assert(one_segment.count() == 1000);
+        assert(one_segment.memory_usage() == 2048 * (sizeof(std::size_t) + sizeof(Pair)));
+
+        for (std::uint64_t i = 0; i < 1000; ++i) {
+            assert(one_segment.find(key_buf(i), &p) && p.value == i + 1);
+        }
+    }
+
+    // Writers keep value == key * 2 for their keys, so if readers ever see anything else they
+    // read a document halfway through a write.
+    const int THREAD_COUNT = 4;
+    const std::uint64_t KEYS_PER_WRITER = 10'000;
+
+    std::atomic<bool> done{false};
+    std::atomic<int> torn_reads{0};
+
+    std::vector<std::thread> readers;
+
+    for (int i = 0; i < THREAD_COUNT; ++i) {
+        readers.emplace_back([&, i] {
+            Pair p;
+
+            for (std::uint64_t k = i; !done.load(std::memory_order_relaxed); ++k) {
+                auto key = 10'000 + k % (THREAD_COUNT * KEYS_PER_WRITER);
+
+                if (coll.find(key_buf(key), &p) && (p.key != key || p.value != key * 2)) {
+                    torn_reads += 1;
+                }
+            }
+        });
+    }
+
+    std::vector<std::thread> writers;
+
+    for (int i = 0; i < THREAD_COUNT; ++i) {
+        writers.emplace_back([&, i] {
+            auto begin = 10'000 + i * KEYS_PER_WRITER;
+
+            for (int round = 0; round < 3; ++round) {
+                for (auto k = begin; k < begin + KEYS_PER_WRITER; ++k) {
+                    Pair p{k, k * 2};
+                    coll.put(&p);
+                }
+
+                for (auto k = begin; k < begin + KEYS_PER_WRITER; k += 3) {
+                    coll.remove(key_buf(k));
+                }
+            }
+        });
+    }
+
+    for (auto& writer : writers) {
+        writer.join();
+    }
+
+    done = true;
+
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    assert(torn_reads == 0);
+
+    for (std::uint64_t k = 10'000; k < 10'000 + THREAD_COUNT * KEYS_PER_WRITER; ++k) {
+        assert(coll.find(key_buf(k), &p) == ((k - 10'000) % KEYS_PER_WRITER % 3 != 0));
+    }
+}
+
+void test_index(boutique::IndexType index_type) {
+    using namespace boutique;
+
+    Collection coll{Schema{{{"key", UInt64Type{}}, {"value", UInt64Type{}}}}, {index_type}};
+
+    assert(coll.index_type() == index_type);
+
+    auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    const std::uint64_t KEY_COUNT = 10'000;
+
+    for (std::uint64_t i = 1; i <= KEY_COUNT; ++i) {
+        Pair p{i, i};
+        coll.put(&p);
+    }
+
+    auto memory_usage = coll.index_memory_usage();
+
+    // Churn through many more keys than are ever live at once
+    for (std::uint64_t i = KEY_COUNT + 1; i <= KEY_COUNT * 20; ++i) {
+        coll.remove(key_buf(i - KEY_COUNT));
+
+        Pair p{i, i * 2};
+        coll.put(&p);
+    }
+
+    assert(coll.count() == KEY_COUNT);
+
+    for (std::uint64_t i = 1; i <= KEY_COUNT * 20; ++i) {
+        auto* found = static_cast<const Pair*>(coll.find(key_buf(i)));
+
+        if (i <= KEY_COUNT * 19) {
+            assert(!found);
+        } else {
+            assert(found && found->value == i * 2);
+        }
+    }
+
+    // Deleted slots get reused or cleaned up rather than making the index grow
+    assert(coll.index_memory_usage() <= memory_usage * 2);
+
+    auto stats = coll.stats();
+
+    assert(stats.count == KEY_COUNT);
+
+    // The swiss index can usually mark removed slots empty right away, but linear probing
+    // always leaves tombstones which have to be cleaned up
+    if (index_type == IndexType::LINEAR_PROBE) {
+        assert(stats.index.cleanup_count > 0);
+    }
+
+    assert(stats.index.tombstone_count < stats.index.capacity / 2);
+
+    // Removing most documents shrinks the index
+    for (std::uint64_t i = KEY_COUNT * 19 + 1; i <= KEY_COUNT * 20 - 100; ++i) {
+        coll.remove(key_buf(i));
+    }
+
+    auto shrunk_stats = coll.stats();
+
+    assert(shrunk_stats.count == 100);
+    assert(shrunk_stats.index.shrink_count > 0);
+    assert(shrunk_stats.index.capacity < stats.index.capacity / 8);
+
+    for (std::uint64_t i = KEY_COUNT * 20 - 99; i <= KEY_COUNT * 20; ++i) {
+        auto* found = static_cast<const Pair*>(coll.find(key_buf(i)));
+
+        assert(found && found->value == i * 2);
+    }
+
+    // More keys than find_many prefetches at once, with a removed one in the middle
+    std::uint64_t batch_keys[40];
+    ConstBuffer batch[40];
+    void* batch_found[40];
+
+    for (std::uint64_t i = 0; i < 40; ++i) {
+        batch_keys[i] = KEY_COUNT * 20 - 39 + i;
+        batch[i] = key_buf(batch_keys[i]);
+    }
+
+    batch_keys[20] = 1;
+
+    coll.find_many({batch, 40}, batch_found);
+
+    for (std::uint64_t i = 0; i < 40; ++i) {
+        auto* found = static_cast<const Pair*>(batch_found[i]);
+
+        if (i == 20) {
+            assert(!found);
+        } else {
+            assert(found && found->value == batch_keys[i] * 2);
+        }
+    }
+}
+
+// Changes keys while a grow of the linear probe index is still moving the old buckets over,
+// so most of them are only in the old ones
+void test_index_migration() {
+    using namespace boutique;
+
+    Collection coll{Schema{{{"key", UInt64Type{}}, {"value", UInt64Type{}}}},
+                    {IndexType::LINEAR_PROBE}};
+
+    auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    // The old buckets count towards memory usage until they've all been moved
+    auto migrating = [&] {
+        return coll.index_memory_usage() > coll.stats().index.capacity * 2 * sizeof(std::size_t);
+    };
+
+    const std::uint64_t MIN_KEY_COUNT = 40'000;
+
+    std::uint64_t key_count = 0;
+
+    while (key_count < MIN_KEY_COUNT || !migrating()) {
+        key_count += 1;
+
+        Pair p{key_count, key_count};
+        coll.put(&p);
+    }
+
+    // Each of these moves a few buckets over, so this is nowhere near enough to finish
+    const std::uint64_t CHANGE_COUNT = 300;
+
+    for (std::uint64_t i = 1; i <= CHANGE_COUNT; ++i) {
+        // Put over a key that hasn't moved yet, after a remove has left a tombstone that a
+        // blind insert could claim
+        coll.remove(key_buf(i));
+        assert(!coll.find(key_buf(i)));
+
+        Pair p{i, i * 2};
+        coll.put(&p);
+
+        std::uint64_t other = key_count - i + 1;
+
+        Pair q{other, other * 2};
+        coll.put(&q);
+
+        auto* found = static_cast<const Pair*>(coll.find(key_buf(other)));
+
+        assert(found && found->value == other * 2);
+    }
+
+    assert(migrating());
+    assert(coll.count() == key_count);
+
+    std::vector<std::uint64_t> keys;
+
+    coll.for_each_run([&](const void* docs, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            keys.push_back(static_cast<const Pair*>(docs)[i].key);
+        }
+    });
+
+    std::sort(keys.begin(), keys.end());
+
+    assert(keys.size() == key_count);
+    assert(std::adjacent_find(keys.begin(), keys.end()) == keys.end());
+
+    for (std::uint64_t i = 1; i <= key_count; ++i) {
+        auto* found = static_cast<const Pair*>(coll.find(key_buf(i)));
+
+        bool changed = i <= CHANGE_COUNT || i > key_count - CHANGE_COUNT;
+
+        assert(found && found->value == (changed ? i * 2 : i));
+    }
+
+    // A duplicate would still be found after its key was removed once
+    for (std::uint64_t i = 1; i <= key_count; ++i) {
+        coll.remove(key_buf(i));
+        assert(!coll.find(key_buf(i)));
+    }
+
+    assert(coll.count() == 0);
+}
+
+void test_hashers() {
+    using namespace boutique;
+
+    // Test vectors from the reference implementation
+    assert(wyhash("", 0, 0) == 0x93228a4de0eec5a2ull);
+    assert(wyhash("a", 1, 1) == 0xc5bac3db178713c4ull);
+    assert(wyhash("abc", 3, 2) == 0xa97f2f7b1d9b3314ull);
+    assert(wyhash("message digest", 14, 3) == 0x786d1f1df3801df4ull);
+    assert(wyhash("abcdefghijklmnopqrstuvwxyz", 26, 4) == 0xdca5a8138ad37c87ull);
+
+    // Sequential keys don't come out sequential
+    assert(hash_key<KeyHasher::STD>(std::uint64_t{2}) == 2);
+    assert(hash_key<KeyHasher::WYHASH>(std::uint64_t{2}) -
+               hash_key<KeyHasher::WYHASH>(std::uint64_t{1}) !=
+           1);
+
+    auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    // With std::hash, 0 and ~0 hash to the values linear probing uses for empty and deleted
+    // buckets, and their neighbours collide with them once they're nudged off of those
+    const std::uint64_t keys[] = {0, ~0ull, 1, ~0ull - 1, 2};
+
+    for (auto hasher : {KeyHasher::STD, KeyHasher::WYHASH}) {
+        for (auto index_type : {IndexType::LINEAR_PROBE, IndexType::SWISS}) {
+            Collection coll{Schema{{{"key", UInt64Type{}}, {"value", UInt64Type{}}}},
+                            {index_type, StorageLayout::ROW, hasher}};
+
+            assert(coll.hasher() == hasher);
+
+            for (auto key : keys) {
+                Pair p{key, key};
+                assert(coll.put(&p));
+            }
+
+            assert(coll.count() == 5);
+
+            for (auto key : keys) {
+                auto* found = static_cast<const Pair*>(coll.find(key_buf(key)));
+                assert(found && found->value == key);
+            }
+
+            coll.remove(key_buf(0));
+            coll.remove(key_buf(~0ull));
+
+            assert(!coll.find(key_buf(0)));
+            assert(!coll.find(key_buf(~0ull)));
+
+            for (std::size_t i = 2; i < 5; ++i) {
+                assert(coll.find(key_buf(keys[i])));
+            }
+
+            Pair p{0, 7};
+            coll.put(&p);
+
+            assert(static_cast<const Pair*>(coll.find(key_buf(0)))->value == 7);
+            assert(coll.count() == 4);
+        }
+    }
+}
+
+void test_schema_layout() {
+    using namespace boutique;
+
+    struct Inner {
+        std::uint8_t flag;
+        std::uint32_t count;
+    };
+
+    struct Record {
+        std::uint8_t kind;
+        Inner inner;
+        std::uint16_t tag;
+        std::uint64_t id;
+        std::uint8_t last;
+    };
+
+    Schema record_schema{{{"kind", UInt8Type{}},
+                          {"inner", AggregateType{{"flag", UInt8Type{}}, {"count", UInt32Type{}}}},
+                          {"tag", UInt16Type{}},
+                          {"id", UInt64Type{}},
+                          {"last", UInt8Type{}}},
+                         3};
+
+    // Same padding as the equivalent C++ struct, including at the end
+    assert(size(record_schema) == sizeof(Record));
+    assert(offset(record_schema, 1) == offsetof(Record, inner));
+    assert(offset(record_schema, 2) == offsetof(Record, tag));
+
+    SchemaLayout layout{record_schema};
+
+    assert(layout.size() == sizeof(Record));
+    assert(layout.alignment() == alignof(Record));
+    assert(layout.leaves().size() == 6);
+
+    assert(layout.find("inner.flag")->offset == offsetof(Record, inner.flag));
+    assert(layout.find("inner.count")->offset == offsetof(Record, inner.count));
+    assert(layout.find("tag")->offset == offsetof(Record, tag));
+    assert(layout.find("last")->offset == offsetof(Record, last));
+    assert(layout.find("last")->size == 1);
+
+    // Aggregates themselves aren't leaves
+    assert(!layout.find("inner"));
+    assert(!layout.find("missing"));
+
+    assert(layout.key().path == "id" && layout.key().offset == offsetof(Record, id));
+    assert(layout.key_leaf_index() == 4);
+}
+
+void test_columnar() {
+    using namespace boutique;
+
+    struct Point {
+        double x;
+        double y;
+    };
+
+    struct Shape {
+        std::uint32_t name_len;
+        char name[4];
+        Point pos;
+        std::uint64_t sides;
+    };
+
+    Schema point_schema{{{"x", Float64Type{}}, {"y", Float64Type{}}}};
+    Schema shape_schema{{{"name", StringType{4}},
+                         {"pos", AggregateType{point_schema.fields}},
+                         {"sides", UInt64Type{}}}};
+
+    SchemaLayout layout{shape_schema};
+    const auto& leaves = layout.leaves();
+
+    assert(leaves.size() == 4);
+    assert(leaves[1].path == "pos.x" && leaves[1].offset == offsetof(Shape, pos.x));
+    assert(leaves[2].path == "pos.y" && leaves[2].offset == offsetof(Shape, pos.y));
+    assert(leaves[3].path == "sides" && leaves[3].offset == offsetof(Shape, sides));
+
+    // A single document costs about a page across all of the columns, not one per column
+    {
+        ColumnarStorage columns{layout};
+
+        Shape shape{};
+
+        columns.put(&shape);
+
+        std::size_t bytes = 0;
+
+        for (std::size_t i = 0; i < leaves.size(); ++i) {
+            assert(columns.column(i).capacity() >= 1);
+
+            bytes += columns.column(i).capacity() * leaves[i].size;
+        }
+
+        assert(bytes <= Storage::FIRST_CHUNK_SIZE);
+    }
+
+    Collection coll{shape_schema, {IndexType::SWISS, StorageLayout::COLUMNAR}};
+
+    assert(coll.layout() == StorageLayout::COLUMNAR);
+    assert(coll.doc_size() == sizeof(Shape));
+
+    const int SHAPE_COUNT = 1000;
+
+    for (int i = 0; i < SHAPE_COUNT; ++i) {
+        auto s = std::to_string(i);
+
+        Shape shape{};
+
+        shape.name_len = s.size();
+        std::memcpy(shape.name, s.data(), s.size());
+        shape.pos = {static_cast<double>(i), static_cast<double>(-i)};
+        shape.sides = i;
+
+        coll.put(&shape);
+    }
+
+    auto* found = static_cast<const Shape*>(coll.find(as_const_buffer("123")));
+
+    assert(found && found->pos.x == 123 && found->pos.y == -123 && found->sides == 123);
+
+    for (int i = 0; i < SHAPE_COUNT; i += 2) {
+        auto s = std::to_string(i);
+        coll.remove(ConstBuffer{s.data(), s.size()});
+    }
+
+    assert(coll.count() == SHAPE_COUNT / 2);
+    assert(!coll.find(as_const_buffer("122")));
+
+    found = static_cast<const Shape*>(coll.find(as_const_buffer("999")));
+
+    assert(found && std::string(found->name, found->name_len) == "999" && found->sides == 999);
+
+    // Every document found in a batch gets its own row
+    ConstBuffer batch[] = {as_const_buffer("997"), as_const_buffer("998"), as_const_buffer("999")};
+    void* batch_found[3];
+
+    coll.find_many({batch, 3}, batch_found);
+
+    assert(static_cast<const Shape*>(batch_found[0])->sides == 997);
+    assert(!batch_found[1]);
+    assert(static_cast<const Shape*>(batch_found[2])->sides == 999);
+
+    // Sum two columns in lockstep
+    std::uint64_t sides_sum = 0;
+    double x_sum = 0;
+
+    for (std::size_t i = 0; i < coll.count();) {
+        auto sides = coll.column_run(3, i);
+        auto x = coll.column_run(1, i);
+
+        auto n = std::min(sides.count, x.count);
+
+        for (std::size_t j = 0; j < n; ++j) {
+            sides_sum += static_cast<const std::uint64_t*>(sides.values)[j];
+            x_sum += static_cast<const double*>(x.values)[j];
+        }
+
+        i += n;
+    }
+
+    // Sum of the odd numbers below SHAPE_COUNT
+    assert(sides_sum == (SHAPE_COUNT / 2) * (SHAPE_COUNT / 2));
+    assert(x_sum == static_cast<double>(sides_sum));
+}
+
+void test_typed_collection(boutique::IndexType index_type) {
+    using namespace boutique;
+
+    auto schema = reflect_schema<Customer, &Customer::id>();
+
+    assert(schema.fields.size() == 4);
+    assert(schema.fields[1].name == "name");
+    assert(std::get<StringType>(schema.fields[1].type).capacity == 12);
+    assert(std::holds_alternative<AggregateType>(schema.fields[2].type));
+    assert(schema.key_field_index == 0);
+
+    SchemaLayout layout{schema};
+
+    assert(matches_layout<Customer>(layout));
+    assert(layout.find("address.street")->offset == offsetof(Customer, address.street));
+
+    TypedCollection<Customer, &Customer::id> by_id{index_type};
+
+    const std::uint64_t CUSTOMER_COUNT = 1000;
+
+    // Includes key 0
+    for (std::uint64_t i = 0; i < CUSTOMER_COUNT; ++i) {
+        Customer c{i, "", {static_cast<std::uint16_t>(i), "Main St"}, i % 2 == 0};
+        c.name = std::to_string(i);
+
+        assert(by_id.put(c));
+    }
+
+    assert(by_id.count() == CUSTOMER_COUNT);
+
+    for (std::uint64_t i = 0; i < CUSTOMER_COUNT; ++i) {
+        auto* c = by_id.find(i);
+
+        assert(c && c->id == i);
+        assert(c->name.view() == std::to_string(i));
+        assert(c->address.street.view() == "Main St");
+
+        // The type-erased collection underneath sees the same documents
+        assert(by_id.collection().find({reinterpret_cast<const char*>(&i), sizeof(i)}) == c);
+    }
+
+    assert(!by_id.find(CUSTOMER_COUNT));
+
+    Customer updated{5, "five", {5, "Side St"}, false};
+
+    assert(by_id.put(updated)->address.street.view() == "Side St");
+    assert(by_id.count() == CUSTOMER_COUNT);
+
+    for (std::uint64_t i = 1; i < CUSTOMER_COUNT; i += 2) {
+        by_id.remove(i);
+    }
+
+    for (std::uint64_t i = 0; i < CUSTOMER_COUNT; ++i) {
+        auto* c = by_id.find(i);
+
+        assert((c != nullptr) == (i % 2 == 0));
+        assert(!c || c->id == i);
+    }
+
+    // String keys are looked up by string_view
+    TypedCollection<Customer, &Customer::name> by_name{index_type};
+
+    for (std::uint64_t i = 0; i < CUSTOMER_COUNT; ++i) {
+        Customer c{i, "", {}, true};
+        c.name = "c" + std::to_string(i);
+
+        by_name.put(c);
+    }
+
+    assert(by_name.find("c123")->id == 123);
+    assert(!by_name.find("c"));
+
+    by_name.remove("c123");
+
+    assert(!by_name.find("c123"));
+    assert(by_name.find("c124")->id == 124);
+    assert(by_name.count() == CUSTOMER_COUNT - 1);
+}
+
+void test_timing_wheel() {
+    using namespace boutique;
+
+    const std::uint64_t START = 1'000'000;
+
+    TimingWheel wheel{START};
+
+    // Deadlines spread over every level, a few which have already passed, and one beyond the
+    // top level
+    std::vector<std::uint64_t> deadlines;
+
+    for (std::uint64_t i = 0; i < 20; ++i) {
+        deadlines.push_back(START - i);
+    }
+
+    for (std::uint64_t i = 0; i < 10'000; ++i) {
+        deadlines.push_back(START + 1 + (i * i * 7919) % 20'000'000);
+    }
+
+    deadlines.push_back(START + (std::uint64_t{1} << 36) + 5);
+
+    for (std::size_t i = 0; i < deadlines.size(); ++i) {
+        wheel.add(deadlines[i], i);
+    }
+
+    assert(wheel.size() == deadlines.size());
+
+    std::vector<bool> expired(deadlines.size());
+    std::size_t expired_count = 0;
+
+    const auto advance = [&](std::uint64_t now, std::size_t max_count) {
+        return wheel.advance(
+            now,
+            [&](std::uint64_t id) {
+                assert(!expired[id] && deadlines[id] <= now);
+
+                expired[id] = true;
+                expired_count += 1;
+            },
+            max_count);
+    };
+
+    const auto advance_to = [&](std::uint64_t now) {
+        while (!advance(now, 100)) {
+        }
+
+        for (std::size_t i = 0; i < deadlines.size(); ++i) {
+            assert(expired[i] == (deadlines[i] <= now));
+        }
+    };
+
+    // Passed deadlines come due on the next advance, but no more than max_count at a time
+    assert(!advance(START, 5));
+    assert(expired_count == 5);
+
+    advance_to(START);
+
+    assert(expired_count == 20);
+
+    for (std::uint64_t now = START; now < START + 20'000'000; now += 333'333) {
+        advance_to(now);
+    }
+
+    advance_to(START + 20'000'000);
+
+    assert(wheel.size() == 1);
+
+    advance_to(START + (std::uint64_t{1} << 36) + 4);
+    advance_to(START + (std::uint64_t{1} << 36) + 5);
+
+    assert(wheel.size() == 0);
+    assert(expired_count == deadlines.size());
+}
+
+void test_expiry(boutique::IndexType index_type) {
+    using namespace boutique;
+
+    Schema schema{{{"key", UInt64Type{}}, {"value", UInt64Type{}}}};
+
+    auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    for (auto layout : {StorageLayout::ROW, StorageLayout::COLUMNAR}) {
+        Collection coll{schema, {index_type, layout}};
+
+        const std::uint64_t COUNT = 10'000;
+
+        auto now = unix_time_ms();
+
+        // Odd keys have already expired, and a quarter of the even ones expire an hour from now
+        for (std::uint64_t i = 0; i < COUNT; ++i) {
+            Pair p{i, i};
+
+            if (i % 2 == 1) {
+                assert(coll.put(&p, now - 1));
+            } else if (i % 4 == 0) {
+                assert(coll.put(&p, now + 60 * 60 * 1000));
+            } else {
+                assert(coll.put(&p));
+            }
+        }
+
+        assert(coll.count() == COUNT);
+
+        // Expired documents aren't found, but they stay where they are until they're reaped,
+        // so that finding one never moves another document out from under its caller
+        const auto* last = coll.find(key_buf(COUNT - 2));
+
+        assert(!coll.find(key_buf(1)));
+        assert(coll.count() == COUNT);
+        assert(coll.find(key_buf(COUNT - 2)) == last);
+
+        std::vector<std::uint64_t> key_values(COUNT);
+        std::vector<ConstBuffer> keys(COUNT);
+        std::vector<void*> found(COUNT);
+
+        for (std::uint64_t i = 0; i < COUNT; ++i) {
+            key_values[i] = i;
+            keys[i] = key_buf(key_values[i]);
+        }
+
+        coll.find_many({keys.data(), keys.size()}, found.data());
+
+        for (std::uint64_t i = 0; i < COUNT; ++i) {
+            assert((found[i] != nullptr) == (i % 2 == 0));
+        }
+
+        // Reaping is done in slices of however many are asked for
+        assert(!coll.expire(now, 100));
+        assert(coll.count() == COUNT - 100);
+
+        while (!coll.expire(now, 100)) {
+        }
+
+        assert(coll.count() == COUNT / 2);
+
+        // A plain put takes the expiry away, and one with an expiry gives it back
+        Pair p{0, 100};
+
+        assert(coll.put(&p));
+        assert(coll.put(&p, now - 1) && !coll.find(key_buf(0)));
+
+        p.key = 4;
+
+        assert(coll.put(&p));
+
+        while (!coll.expire(now + 2 * 60 * 60 * 1000, 100)) {
+        }
+
+        // Everything left expires, besides key 4 and the ones which never had an expiry
+        assert(coll.count() == COUNT / 4 + 1);
+        assert(coll.find(key_buf(4)) && coll.find(key_buf(2)) && !coll.find(key_buf(8)));
+
+        auto times = coll.expiry_times();
+
+        assert(times.size() == coll.count());
+        assert(std::all_of(times.begin(), times.end(), [](auto t) { return t == 0; }));
+    }
+}
+
+// Documents count for all of the storage allocated for them, not just their own bytes
+void test_memory_usage(boutique::StorageLayout layout) {
+    using namespace boutique;
+
+    Collection coll{Schema{{{"key", UInt64Type{}}, {"value", UInt64Type{}}}},
+                    {IndexType::LINEAR_PROBE, layout}};
+
+    // Both fields are the same size, so every column has the same capacity as the key's
+    auto storage_usage = [&] { return coll.memory_usage() - coll.index_memory_usage(); };
+    auto allocated = [&] { return coll.stats().storage_capacity * coll.doc_size(); };
+
+    Pair p{0, 0};
+    coll.put(&p);
+
+    assert(coll.stats().storage_capacity > 1);
+    assert(storage_usage() == allocated());
+
+    const std::uint64_t KEY_COUNT = 100'000;
+
+    for (std::uint64_t i = 1; i < KEY_COUNT; ++i) {
+        p = {i, i};
+        coll.put(&p);
+    }
+
+    assert(storage_usage() == allocated());
+    assert(allocated() >= KEY_COUNT * coll.doc_size());
+
+    // Shrinking keeps a spare chunk, which still counts
+    auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    for (std::uint64_t i = 10; i < KEY_COUNT; ++i) {
+        coll.remove(key_buf(i));
+    }
+
+    assert(coll.stats().storage_shrink_count > 0);
+    assert(coll.stats().storage_capacity > coll.count());
+    assert(storage_usage() == allocated());
+}
+
+void test_eviction(boutique::EvictionPolicy policy) {
+    using namespace boutique;
+
+    Schema schema{{{"key", UInt64Type{}}, {"value", UInt64Type{}}}};
+
+    auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    const std::size_t MAX_MEMORY = 256 * 1024;
+    const std::uint64_t KEY_COUNT = 100'000;
+    const std::uint64_t HOT_COUNT = 100;
+
+    Collection coll{schema, {IndexType::SWISS, StorageLayout::ROW, KeyHasher::WYHASH,
+                             MAX_MEMORY, policy}};
+
+    assert(coll.eviction_policy() == policy && coll.max_memory() == MAX_MEMORY);
+
+    // Far more keys than fit, with a few hot ones which are looked up between every put
+    for (std::uint64_t i = 0; i < KEY_COUNT; ++i) {
+        Pair p{i, i};
+
+        if (policy == EvictionPolicy::NONE) {
+            if (!coll.put(&p)) {
+                break;
+            }
+
+            continue;
+        }
+
+        assert(coll.put(&p));
+
+        assert(coll.find(key_buf(i % HOT_COUNT)));
+
+        // Only the index growing can take it over the limit, and only until the following puts
+        // have evicted enough
+        assert(coll.memory_usage() <= MAX_MEMORY + coll.index_memory_usage() / 2);
+    }
+
+    auto stats = coll.stats();
+
+    assert(stats.memory_usage <= MAX_MEMORY);
+    assert(stats.count > 0 && stats.count < KEY_COUNT);
+
+    if (policy == EvictionPolicy::NONE) {
+        // New documents are turned away, but existing ones can still be overwritten
+        assert(stats.eviction_count == 0);
+
+        Pair p{KEY_COUNT, 0};
+
+        assert(!coll.put(&p));
+
+        p.key = 0;
+
+        assert(coll.put(&p));
+        return;
+    }
+
+    assert(stats.eviction_count == KEY_COUNT - stats.count);
+    assert(stats.hit_count == KEY_COUNT && stats.miss_count == 0);
+
+    // The hot keys were never the ones picked
+    for (std::uint64_t i = 0; i < HOT_COUNT; ++i) {
+        assert(coll.find(key_buf(i)));
+    }
+
+    // Everything the tracker knows about has to stay in step with storage through removes
+    for (std::uint64_t i = 0; i < KEY_COUNT; i += 3) {
+        coll.remove(key_buf(i));
+    }
+
+    for (std::uint64_t i = KEY_COUNT; i < KEY_COUNT * 2; ++i) {
+        Pair p{i, i};
+        assert(coll.put(&p));
+    }
+
+    assert(coll.memory_usage() <= MAX_MEMORY);
+    assert(!coll.find(key_buf(KEY_COUNT * 3)));
+    assert(coll.stats().miss_count == 1);
+}
+
+void test_update(boutique::StorageLayout layout) {
+    using namespace boutique;
+
+    Collection coll{reflect_schema<Customer, &Customer::id>(), {IndexType::SWISS, layout}};
+
+    for (std::uint64_t i = 0; i < 100; ++i) {
+        Customer c{i, "someone", {static_cast<std::uint16_t>(i), "Main St"}, true};
+        assert(coll.put(&c));
+    }
+
+    const auto get = [&](std::uint64_t id) {
+        Customer c;
+        std::memcpy(&c, coll.find({reinterpret_cast<const char*>(&id), sizeof(id)}), sizeof(c));
+        return c;
+    };
+
+    const auto update = [&](std::uint64_t id, std::initializer_list<FieldUpdate> updates) {
+        return coll.update({reinterpret_cast<const char*>(&id), sizeof(id)},
+                           {updates.begin(), updates.size()});
+    };
+
+    const auto bytes = [](const auto& value) {
+        return ConstBuffer{reinterpret_cast<const char*>(&value), sizeof(value)};
+    };
+
+    const bool yes = true;
+    const bool no = false;
+
+    std::uint16_t three = 3;
+    std::uint16_t max = 0xffff;
+
+    // Nested fields are found by path, and only the named ones change
+    assert(update(7, {{FieldUpdate::Op::SET, "name", as_const_buffer("alice")},
+                      {FieldUpdate::Op::ADD, "address.number", bytes(three)},
+                      {FieldUpdate::Op::COMPARE_AND_SET, "active", bytes(no), bytes(yes)}}) ==
+           UpdateResult::SUCCESS);
+
+    auto c = get(7);
+
+    assert(c.id == 7 && c.name.view() == "alice" && c.address.number == 10);
+    assert(c.address.street.view() == "Main St" && !c.active);
+
+    // A shorter string leaves nothing of the longer one behind
+    assert(update(7, {{FieldUpdate::Op::SET, "name", as_const_buffer("al")}}) ==
+           UpdateResult::SUCCESS);
+    assert(get(7).name.view() == "al" && get(7).name.data[2] == 0);
+
+    // Integers wrap around
+    assert(update(8, {{FieldUpdate::Op::ADD, "address.number", bytes(max)}}) ==
+           UpdateResult::SUCCESS);
+    assert(get(8).address.number == 7);
+
+    // A comparison which fails stops the rest of the update from happening too
+    assert(update(9, {{FieldUpdate::Op::SET, "name", as_const_buffer("bob")},
+                      {FieldUpdate::Op::COMPARE_AND_SET, "name", as_const_buffer("carol"),
+                       as_const_buffer("nobody")}}) == UpdateResult::COMPARE_FAILED);
+    assert(update(9, {{FieldUpdate::Op::COMPARE_AND_SET, "active", bytes(no), bytes(no)}}) ==
+           UpdateResult::COMPARE_FAILED);
+    assert(get(9).name.view() == "someone" && get(9).active);
+
+    assert(update(9, {{FieldUpdate::Op::COMPARE_AND_SET, "name", as_const_buffer("carol"),
+                       as_const_buffer("someone")}}) == UpdateResult::SUCCESS);
+    assert(get(9).name.view() == "carol");
+
+    // So does anything which doesn't fit its field, even if it comes after a valid one
+    std::uint32_t wrong_size = 1;
+
+    for (auto invalid : {FieldUpdate{FieldUpdate::Op::SET, "address", bytes(three)},
+                         FieldUpdate{FieldUpdate::Op::SET, "nope", bytes(three)},
+                         FieldUpdate{FieldUpdate::Op::SET, "id", bytes(c.id)},
+                         FieldUpdate{FieldUpdate::Op::SET, "address.number", bytes(wrong_size)},
+                         FieldUpdate{FieldUpdate::Op::SET, "name",
+                                     as_const_buffer("too long to fit")},
+                         FieldUpdate{FieldUpdate::Op::ADD, "active", bytes(yes)},
+                         FieldUpdate{FieldUpdate::Op::ADD, "name", as_const_buffer("x")}}) {
+        assert(update(10, {{FieldUpdate::Op::SET, "name", as_const_buffer("dave")}, invalid}) ==
+               UpdateResult::INVALID);
+    }
+
+    assert(get(10).name.view() == "someone");
+
+    assert(update(1000, {{FieldUpdate::Op::SET, "name", as_const_buffer("x")}}) ==
+           UpdateResult::NOT_FOUND);
+}
+
+void test_projection(boutique::StorageLayout layout) {
+    using namespace boutique;
+
+    Collection coll{reflect_schema<Customer, &Customer::id>(), {IndexType::SWISS, layout}};
+
+    for (std::uint64_t i = 0; i < 100; ++i) {
+        Customer c{i, "someone", {static_cast<std::uint16_t>(i), "Main St"}, i % 2 == 0};
+        assert(coll.put(&c));
+    }
+
+    std::uint64_t id = 42;
+
+    const auto* doc = static_cast<const char*>(coll.find({reinterpret_cast<const char*>(&id),
+                                                          sizeof(id)}));
+
+    Customer c;
+    std::memcpy(&c, doc, sizeof(c));
+
+    char out[sizeof(Customer)] = {};
+
+    // Fields come out in the order they were asked for, with no padding between them
+    std::string_view fields[] = {"active", "address.number"};
+
+    const auto* projection = coll.projection(fields);
+
+    assert(projection && projection->size() == sizeof(bool) + sizeof(std::uint16_t));
+
+    projection->gather(doc, out);
+
+    std::uint16_t number;
+    std::memcpy(&number, out + 1, sizeof(number));
+
+    assert(out[0] == 1 && number == 42);
+
+    // The same fields get the same compiled projection back
+    assert(coll.projection(fields) == projection);
+
+    // An aggregate takes all of its fields, and neighbouring fields come out as one run
+    std::string_view neighbours[] = {"name", "address"};
+
+    projection = coll.projection(neighbours);
+
+    auto name_offset = offsetof(Customer, name);
+    auto address_end = offsetof(Customer, address.street) + sizeof(c.address.street);
+
+    assert(projection && projection->size() == address_end - name_offset);
+
+    projection->gather(doc, out);
+
+    assert(std::memcmp(out, doc + name_offset, projection->size()) == 0);
+
+    for (std::string_view invalid : {"nope", "addr", "address.", ""}) {
+        std::string_view paths[] = {"name", invalid};
+
+        assert(!coll.projection(paths));
+    }
+
+    // Old projections make room for new ones once there are enough of them
+    std::vector<std::string> names;
+
+    for (std::size_t i = 0; i < ProjectionCache::MAX_SIZE * 2; ++i) {
+        names.push_back("missing" + std::to_string(i));
+    }
+
+    for (const auto& name : names) {
+        std::string_view paths[] = {name};
+
+        assert(!coll.projection(paths));
+    }
+
+    assert(coll.projection(fields) && coll.projection(fields)->size() == 3);
+}
+
+void test_secondary_index(boutique::StorageLayout layout) {
+    using namespace boutique;
+
+    Collection coll{reflect_schema<Customer, &Customer::id>(), {IndexType::SWISS, layout}};
+
+    const std::uint64_t CUSTOMER_COUNT = 1000;
+
+    const auto customer = [](std::uint64_t id, std::uint64_t group) {
+        Customer c{id, "", {static_cast<std::uint16_t>(id), "Main St"}, true};
+        c.name = "group" + std::to_string(group);
+
+        return c;
+    };
+
+    // Documents which are already there get indexed along with the ones put afterwards
+    for (std::uint64_t i = 0; i < CUSTOMER_COUNT / 2; ++i) {
+        auto c = customer(i, i % 10);
+        assert(coll.put(&c));
+    }
+
+    assert(coll.create_index("name", SecondaryIndexType::HASH));
+    assert(coll.create_index("address.number", SecondaryIndexType::ORDERED));
+    assert(coll.create_index("name", SecondaryIndexType::HASH));
+    assert(!coll.create_index("address", SecondaryIndexType::HASH));
+    assert(!coll.create_index("nope", SecondaryIndexType::ORDERED));
+    assert(coll.secondary_indexes().size() == 2);
+
+    for (std::uint64_t i = CUSTOMER_COUNT / 2; i < CUSTOMER_COUNT; ++i) {
+        auto c = customer(i, i % 10);
+        assert(coll.put(&c));
+    }
+
+    const auto key_buf = [](const std::uint64_t& id) {
+        return ConstBuffer{reinterpret_cast<const char*>(&id), sizeof(id)};
+    };
+
+    const auto number_buf = [](const std::uint16_t& number) {
+        return ConstBuffer{reinterpret_cast<const char*>(&number), sizeof(number)};
+    };
+
+    // Moves documents around with every way there is of changing them
+    for (std::uint64_t i = 0; i < CUSTOMER_COUNT; i += 7) {
+        coll.remove(key_buf(i));
+    }
+
+    for (std::uint64_t i = 1; i < CUSTOMER_COUNT; i += 5) {
+        auto c = customer(i, i % 3);
+        c.address.number = static_cast<std::uint16_t>(i * 3);
+
+        coll.put(&c);
+    }
+
+    for (std::uint64_t i = 2; i < CUSTOMER_COUNT; i += 11) {
+        coll.update(key_buf(i), {{FieldUpdate{FieldUpdate::Op::SET, "name",
+                                              as_const_buffer("renamed")}}});
+    }
+
+    coll.remove(key_buf(CUSTOMER_COUNT - 1));
+
+    // Everything the indexes find has to match what a scan finds
+    const auto scan = [&](auto&& pred) {
+        std::vector<std::uint64_t> ids;
+
+        coll.for_each_run([&](const void* docs, std::size_t count) {
+            for (std::size_t i = 0; i < count; ++i) {
+                Customer c;
+                std::memcpy(&c, static_cast<const char*>(docs) + i * sizeof(Customer), sizeof(c));
+
+                if (pred(c)) {
+                    ids.push_back(c.id);
+                }
+            }
+        });
+
+        std::sort(ids.begin(), ids.end());
+
+        return ids;
+    };
+
+    for (std::string_view name : {"group0", "group1", "group9", "renamed", "nobody"}) {
+        std::vector<std::uint64_t> ids;
+
+        assert(coll.find_equal("name", as_const_buffer(name), [&](const void* doc) {
+            ids.push_back(static_cast<const Customer*>(doc)->id);
+            return true;
+        }));
+
+        std::sort(ids.begin(), ids.end());
+
+        assert(ids == scan([&](const Customer& c) { return c.name.view() == name; }));
+    }
+
+    std::uint16_t min = 100;
+    std::uint16_t max = 300;
+
+    std::vector<std::uint16_t> numbers;
+    std::vector<std::uint64_t> ids;
+
+    assert(coll.find_range("address.number", number_buf(min), number_buf(max),
+                           [&](const void* doc) {
+                               const auto* c = static_cast<const Customer*>(doc);
+
+                               numbers.push_back(c->address.number);
+                               ids.push_back(c->id);
+                               return true;
+                           }));
+
+    assert(std::is_sorted(numbers.begin(), numbers.end()));
+    assert(numbers.front() == min && numbers.back() == max);
+
+    std::sort(ids.begin(), ids.end());
+
+    assert(ids == scan([&](const Customer& c) {
+               return c.address.number >= min && c.address.number <= max;
+           }));
+
+    // An open end takes everything past the other one, and fn can stop early
+    std::size_t seen = 0;
+
+    assert(coll.find_range("address.number", number_buf(max), {}, [&](const void* doc) {
+        assert(static_cast<const Customer*>(doc)->address.number >= max);
+        return ++seen < 3;
+    }));
+
+    assert(seen == 3);
+
+    // Ordered indexes find single values too, but hash ones can't do ranges
+    assert(coll.find_equal("address.number", number_buf(max), [](const void*) { return true; }));
+    assert(!coll.find_range("name", {}, {}, [](const void*) { return true; }));
+    assert(!coll.find_equal("active", as_const_buffer("x"), [](const void*) { return true; }));
+    assert(!coll.find_equal("name", as_const_buffer("longer than the name can be"),
+                            [](const void*) { return true; }));
+    assert(!coll.find_equal("address.number", as_const_buffer("x"),
+                            [](const void*) { return true; }));
+
+    assert(coll.memory_usage() > coll.count() * coll.doc_size() + coll.index_memory_usage());
+}
+
+// Signed integers and floats come out of ordered indexes in numeric order, negative ones
+// included
+void test_secondary_index_order() {
+    using namespace boutique;
+
+    struct Account {
+        std::uint64_t id;
+        std::int32_t balance;
+        float rate;
+        double score;
+    };
+
+    Collection coll{Schema{{{"id", UInt64Type{}},
+                            {"balance", Int32Type{}},
+                            {"rate", Float32Type{}},
+                            {"score", Float64Type{}}}}};
+
+    for (auto path : {"balance", "rate", "score"}) {
+        assert(coll.create_index(path, SecondaryIndexType::ORDERED));
+    }
+
+    for (std::int32_t i = -50; i < 50; ++i) {
+        Account a{static_cast<std::uint64_t>(i + 50), i * 1000, i * 0.5f, i * -2.25};
+        assert(coll.put(&a));
+    }
+
+    const auto check_sorted = [&](const char* path, auto value_of) {
+        std::vector<double> values;
+
+        coll.find_range(path, {}, {}, [&](const void* doc) {
+            values.push_back(value_of(*static_cast<const Account*>(doc)));
+            return true;
+        });
+
+        assert(values.size() == 100 && std::is_sorted(values.begin(), values.end()));
+    };
+
+    check_sorted("balance", [](const Account& a) { return a.balance; });
+    check_sorted("rate", [](const Account& a) { return a.rate; });
+    check_sorted("score", [](const Account& a) { return a.score; });
+
+    std::int32_t min = -3000;
+    std::int32_t max = 2000;
+    std::size_t count = 0;
+
+    coll.find_range("balance", {reinterpret_cast<const char*>(&min), sizeof(min)},
+                    {reinterpret_cast<const char*>(&max), sizeof(max)}, [&](const void*) {
+                        count += 1;
+                        return true;
+                    });
+
+    assert(count == 6);
+}
+
+}  // namespace
+
 int main(int argc, char** argv) {
     using namespace boutique;
 
@@ -40,6 +1314,9 @@ int main(int argc, char** argv) {
 
     assert(coord_coll.count() == 1);
 
+    // A single document only takes up a page rather than a whole chunk
+    assert(coord_coll.capacity() * sizeof(Coord) <= 4096);
+
     Coord r;
 
     std::memcpy(&r, coord_coll[0], size(coord_schema));
@@ -65,13 +1342,50 @@ int main(int argc, char** argv) {
 
     assert(coord_coll.count() == 0);
 
-    for (int i = 0; i < 1'000'000; ++i) {
+    c.lat = 0;
+
+    auto* first = coord_coll.put(&c);
+
+    for (int i = 1; i < 1'000'000; ++i) {
         c.lat = static_cast<double>(i);
         coord_coll.put(&c);
     }
 
     assert(coord_coll.count() == 1'000'000);
 
+    // Growing never moves existing documents
+    assert(coord_coll[0] == first);
+    assert(static_cast<Coord*>(first)->lat == 0);
+
+    // Every document is where it was put, across the chunks that grow and the full size ones,
+    // and runs stop at the end of each chunk
+    std::size_t run_count = 0;
+
+    for (std::size_t i = 0; i < coord_coll.count();) {
+        auto len = coord_coll.run_length(i);
+        auto* run = static_cast<const Coord*>(coord_coll[i]);
+
+        for (std::size_t j = 0; j < len; ++j) {
+            assert(run[j].lat == static_cast<double>(i + j));
+            assert(coord_coll[i + j] == &run[j]);
+        }
+
+        i += len;
+        run_count += 1;
+    }
+
+    assert(run_count > 1 && run_count < coord_coll.count() / 1000);
+
+    auto capacity = coord_coll.capacity();
+
+    while (coord_coll.count() > 10) {
+        coord_coll.remove(coord_coll[coord_coll.count() - 1]);
+    }
+
+    assert(coord_coll.shrink_count() > 0);
+    assert(coord_coll.capacity() < capacity / 2);
+    assert(coord_coll[0] == first);
+
     Collection user_coll{user_schema};
 
     std::uint64_t id = 1;
@@ -91,7 +1405,7 @@ int main(int argc, char** argv) {
         user_coll.put(&user);
     }
 
-    auto* found = user_coll.find(ConstBuffer{"1"});
+    auto* found = user_coll.find(as_const_buffer("1"));
 
     assert(found);
 
@@ -102,11 +1416,11 @@ int main(int argc, char** argv) {
 
     assert(user_coll.count() == 50);
 
-    found = user_coll.find(ConstBuffer{"2"});
+    found = user_coll.find(as_const_buffer("2"));
 
     assert(!found);
 
-    found = user_coll.find(ConstBuffer{"73"});
+    found = user_coll.find(as_const_buffer("73"));
 
     assert(found);
 
@@ -129,7 +1443,7 @@ int main(int argc, char** argv) {
         user_coll.put(&user);
     }
 
-    found = user_coll.find(ConstBuffer{"20"});
+    found = user_coll.find(as_const_buffer("20"));
 
     assert(found);
 
@@ -141,5 +1455,42 @@ int main(int argc, char** argv) {
     assert(db.schema("User") == &db_user_schema);
     assert(db.collection("users") == &db_user_coll);
 
+    test_index(IndexType::LINEAR_PROBE);
+    test_index(IndexType::SWISS);
+    test_index_migration();
+
+    test_hashers();
+
+    test_schema_layout();
+    test_columnar();
+
+    test_typed_collection(IndexType::LINEAR_PROBE);
+    test_typed_collection(IndexType::SWISS);
+
+    test_concurrent_collection();
+
+    test_timing_wheel();
+
+    test_expiry(IndexType::LINEAR_PROBE);
+    test_expiry(IndexType::SWISS);
+
+    test_update(StorageLayout::ROW);
+    test_update(StorageLayout::COLUMNAR);
+
+    test_projection(StorageLayout::ROW);
+    test_projection(StorageLayout::COLUMNAR);
+
+    test_secondary_index(StorageLayout::ROW);
+    test_secondary_index(StorageLayout::COLUMNAR);
+    test_secondary_index_order();
+
+    test_memory_usage(StorageLayout::ROW);
+    test_memory_usage(StorageLayout::COLUMNAR);
+
+    for (auto policy : {EvictionPolicy::NONE, EvictionPolicy::SAMPLED_LRU, EvictionPolicy::LFU,
+                        EvictionPolicy::CLOCK}) {
+        test_eviction(policy);
+    }
+
     return 0;
 }
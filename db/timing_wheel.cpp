@@ -0,0 +1,137 @@
+#include "timing_wheel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace boutique {
+
+std::uint64_t unix_time_ms() {
+    using namespace std::chrono;
+
+    return static_cast<std::uint64_t>(
+        duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+}
+
+TimingWheel::TimingWheel(std::uint64_t start) : m_now{start} {}
+
+void TimingWheel::add(std::uint64_t deadline, std::uint64_t id) {
+    place({deadline, id});
+    m_size += 1;
+}
+
+bool TimingWheel::advance(std::uint64_t now, FunctionView<void(std::uint64_t id)> fn,
+                          std::size_t max_count) {
+    std::size_t count = 0;
+
+    for (;;) {
+        while (!m_due.empty()) {
+            if (count == max_count) {
+                return false;
+            }
+
+            auto id = m_due.back().id;
+
+            m_due.pop_back();
+            m_size -= 1;
+            count += 1;
+
+            fn(id);
+        }
+
+        if (m_now >= now) {
+            return true;
+        }
+
+        // No need to go through the ticks one by one if nothing's waiting for them
+        if (m_size == 0) {
+            m_now = now;
+            return true;
+        }
+
+        // Nothing comes due until a slot on the lowest level with anything in it rolls over
+        std::size_t lowest = 0;
+
+        while (m_level_sizes[lowest] == 0) {
+            lowest += 1;
+        }
+
+        auto skip_to = std::min(now, m_now | ((std::uint64_t{1} << (LEVEL_BITS * lowest)) - 1));
+
+        if (skip_to > m_now) {
+            m_now = skip_to;
+            continue;
+        }
+
+        tick();
+    }
+}
+
+std::size_t TimingWheel::size() const { return m_size; }
+
+void TimingWheel::place(const Entry& entry) {
+    if (entry.deadline <= m_now) {
+        m_due.push_back(entry);
+        return;
+    }
+
+    // The lowest level whose current rotation the deadline falls in, i.e. where everything
+    // above that level's bits matches now
+    for (std::size_t level = 0; level < LEVEL_COUNT; ++level) {
+        auto shift = LEVEL_BITS * (level + 1);
+
+        if (entry.deadline >> shift == m_now >> shift) {
+            auto slot = (entry.deadline >> (LEVEL_BITS * level)) & (SLOT_COUNT - 1);
+
+            m_levels[level][slot].push_back(entry);
+            m_level_sizes[level] += 1;
+            return;
+        }
+    }
+
+    m_overflow.push_back(entry);
+    m_level_sizes[LEVEL_COUNT] += 1;
+}
+
+void TimingWheel::tick() {
+    m_now += 1;
+
+    // Every level whose slot just rolled over (and the overflow list past the top) gets spread
+    // over the levels below it, starting from the top so that entries which move down more than
+    // one level are still there when the level they land in is spread out in turn.
+    std::size_t rolled = 0;
+
+    while (rolled < LEVEL_COUNT &&
+           (m_now & ((std::uint64_t{1} << (LEVEL_BITS * (rolled + 1))) - 1)) == 0) {
+        rolled += 1;
+    }
+
+    for (auto level = rolled; level > 0; --level) {
+        auto& slot = level == LEVEL_COUNT
+                         ? m_overflow
+                         : m_levels[level][(m_now >> (LEVEL_BITS * level)) & (SLOT_COUNT - 1)];
+
+        auto entries = std::move(slot);
+
+        slot.clear();
+        m_level_sizes[level] -= entries.size();
+
+        for (const auto& entry : entries) {
+            place(entry);
+        }
+    }
+
+    // Everything in the current bottom slot is due this tick
+    auto& slot = m_levels[0][m_now & (SLOT_COUNT - 1)];
+
+    m_level_sizes[0] -= slot.size();
+
+    if (m_due.empty()) {
+        std::swap(m_due, slot);
+    } else {
+        m_due.insert(m_due.end(), slot.begin(), slot.end());
+        slot.clear();
+    }
+}
+
+}  // namespace boutique
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "core/function_view.hpp"
+
+namespace boutique {
+
+// Milliseconds since the Unix epoch, which is what document expiry times are given in. It's
+// the wall clock rather than a monotonic one so that expiry times still mean something after a
+// restart.
+std::uint64_t unix_time_ms();
+
+// Hierarchical timing wheel (Varghese & Lauck) of ids to expire at given ticks. Each level is
+// a ring of slots, and a slot on level k covers 64^k ticks. An entry goes in the slot on the
+// lowest level which its deadline is in the current rotation of, so adding one is O(1), and
+// when the wheel reaches a slot on a higher level its entries are spread over the levels below.
+// Each entry is moved at most once per level on its way down, so expiring one is O(1) too,
+// however many there are. Ticks where nothing can come due are skipped rather than stepped
+// through.
+//
+// Deadlines more than 64^6 ticks (about 2 years of milliseconds) away wait in a list of their
+// own until the top level comes back around.
+struct TimingWheel {
+    // Deadlines are in ticks, and start is the current one
+    explicit TimingWheel(std::uint64_t start);
+
+    // Deadlines which have already passed are expired by the next advance
+    void add(std::uint64_t deadline, std::uint64_t id);
+
+    // Moves the wheel up to tick now and calls fn with the id of each entry whose deadline it
+    // passes. Stops after max_count of them and returns false if there are more, in which case
+    // calling it again carries on from there.
+    bool advance(std::uint64_t now, FunctionView<void(std::uint64_t id)> fn,
+                 std::size_t max_count);
+
+    // Entries which haven't been handed to fn yet
+    std::size_t size() const;
+
+private:
+    static constexpr std::size_t LEVEL_BITS = 6;
+    static constexpr std::size_t SLOT_COUNT = std::size_t{1} << LEVEL_BITS;
+    static constexpr std::size_t LEVEL_COUNT = 6;
+
+    struct Entry {
+        std::uint64_t deadline = 0;
+        std::uint64_t id = 0;
+    };
+
+    using Slot = std::vector<Entry>;
+
+    // Entries due at or before this tick have been moved into m_due (or handed out already)
+    std::uint64_t m_now = 0;
+    std::size_t m_size = 0;
+
+    std::array<std::array<Slot, SLOT_COUNT>, LEVEL_COUNT> m_levels;
+    Slot m_overflow;
+
+    // Entries on each level, with the overflow list last, so that advance can skip over
+    // stretches of ticks where nothing can come due
+    std::array<std::size_t, LEVEL_COUNT + 1> m_level_sizes{};
+
+    // Passed deadlines which advance hasn't gotten to yet
+    Slot m_due;
+
+    // Puts the entry where it belongs relative to m_now
+    void place(const Entry& entry);
+
+    // Moves m_now forward by one tick
+    void tick();
+};
+
+}  // namespace boutique
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+
+#include "collection.hpp"
+#include "key_hash.hpp"
+#include "reflect.hpp"
+
+namespace boutique {
+
+template <typename T>
+struct MemberPointerTraits;
+
+template <typename C, typename M>
+struct MemberPointerTraits<M C::*> {
+    using Class = C;
+    using Member = M;
+};
+
+// A collection of T (see BOUTIQUE_REFLECT) keyed on the member Key, for embedding. Keys are
+// passed as their own type rather than as bytes, and hashing and comparing them is compiled in
+// rather than done through the function pointers a Collection has to use, so lookups are
+// inlined all the way down to the index probe.
+//
+// It's a Collection underneath with the schema derived from T, so anything which works on
+// schemas can still get at it through collection().
+template <typename T, auto Key, KeyHasher H = KeyHasher::WYHASH>
+struct TypedCollection {
+    static_assert(std::is_trivially_copyable_v<T>, "Documents are copied around as bytes");
+    static_assert(std::is_same_v<typename MemberPointerTraits<decltype(Key)>::Class, T>,
+                  "Key must be a member of T");
+
+    using KeyMember = typename MemberPointerTraits<decltype(Key)>::Member;
+
+    // String keys are looked up by string_view
+    using KeyType =
+        std::conditional_t<IsFixedString<KeyMember>::value, std::string_view, KeyMember>;
+
+    explicit TypedCollection(IndexType index_type = IndexType::LINEAR_PROBE)
+        : m_coll{reflect_schema<T, Key>(), {index_type, StorageLayout::ROW, H}} {
+        assert(matches_layout<T>(m_coll.schema_layout()));
+    }
+
+    // Returns nullptr if there was no room for it
+    T* put(const T& doc) {
+        auto key = key_of(doc);
+
+        return static_cast<T*>(m_coll.put_hashed(&doc, hash_key<H>(key), equals(key)));
+    }
+
+    T* find(KeyType key) {
+        return static_cast<T*>(m_coll.find_hashed(hash_key<H>(key), equals(key)));
+    }
+
+    void remove(KeyType key) {
+        m_coll.remove_hashed(hash_key<H>(key), equals(key), [](const void* doc) {
+            return hash_key<H>(key_of(*static_cast<const T*>(doc)));
+        });
+    }
+
+    std::size_t count() const { return m_coll.count(); }
+
+    Collection& collection() { return m_coll; }
+    const Collection& collection() const { return m_coll; }
+
+private:
+    Collection m_coll;
+
+    static KeyType key_of(const T& doc) {
+        if constexpr (IsFixedString<KeyMember>::value) {
+            return (doc.*Key).view();
+        } else {
+            return doc.*Key;
+        }
+    }
+
+    static auto equals(KeyType key) {
+        return [key](const void* doc) { return key_of(*static_cast<const T*>(doc)) == key; };
+    }
+};
+
+}  // namespace boutique
@@ -0,0 +1,113 @@
+#include <sys/resource.h>
+#include <sys/select.h>
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "context.hpp"
+#include "socket.hpp"
+#include "unix_utils.hpp"
+#include "uring_backend.hpp"
+
+namespace {
+
+const int WAKEUP_COUNT = 20'000;
+
+void raise_fd_limit() {
+    rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        boutique::throw_errno("Failed to get fd limit");
+    }
+
+    limit.rlim_cur = limit.rlim_max;
+
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        boutique::throw_errno("Failed to set fd limit");
+    }
+}
+
+// Measures the cost of waking up for a single active socket while idle_count other sockets
+// have a recv in flight.
+void bench_wakeups(boutique::IOContext::Backend backend, const char* backend_name,
+                   int idle_count) {
+    using namespace boutique;
+
+    IOContext ctx{backend};
+
+    // Reserve up front since the context holds on to pointers to these
+    std::vector<Socket> idle;
+    idle.reserve(idle_count + 1);
+
+    static char idle_buf[16];
+
+    for (int i = 0; i < idle_count; i += 2) {
+        auto [a, b] = Socket::pair();
+
+        idle.emplace_back(std::move(a));
+        idle.emplace_back(std::move(b));
+    }
+
+    for (auto& socket : idle) {
+        ctx.async_recv(socket, idle_buf, sizeof(idle_buf), [](int) { assert(false); });
+    }
+
+    auto [active, peer] = Socket::pair();
+
+    char buf[1] = {'x'};
+    int wakeups = 0;
+
+    IOContext::IntFn recv_handler = [&](int res) {
+        assert(res == 1);
+
+        wakeups += 1;
+
+        if (wakeups == WAKEUP_COUNT) {
+            ctx.stop();
+            return;
+        }
+
+        peer.send(buf, sizeof(buf));
+        ctx.async_recv(active, buf, sizeof(buf), recv_handler);
+    };
+
+    ctx.async_recv(active, buf, sizeof(buf), recv_handler);
+    peer.send(buf, sizeof(buf));
+
+    auto prev_time = std::chrono::high_resolution_clock::now();
+
+    ctx.run();
+
+    auto new_time = std::chrono::high_resolution_clock::now();
+
+    std::cout << backend_name << " with " << idle.size() << " idle sockets: "
+              << std::chrono::duration_cast<std::chrono::nanoseconds>(new_time - prev_time)
+                         .count() /
+                     WAKEUP_COUNT
+              << "ns per wakeup.\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    using namespace boutique;
+
+    raise_fd_limit();
+
+    for (int idle_count : {0, 100, 1'000, 10'000}) {
+        // select can't deal with fds >= FD_SETSIZE at all
+        if (idle_count + 16 < FD_SETSIZE) {
+            bench_wakeups(IOContext::Backend::SELECT, "select", idle_count);
+        }
+
+        bench_wakeups(IOContext::Backend::EPOLL, "epoll", idle_count);
+
+        if (UringBackend::supported()) {
+            bench_wakeups(IOContext::Backend::IO_URING, "io_uring", idle_count);
+        }
+    }
+
+    return 0;
+}
@@ -1,7 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
-#include <vector>
+#include <memory>
 
 namespace boutique {
 
@@ -12,60 +13,49 @@ struct IOContext {
     using IntFn = std::function<void(int)>;
     using SocketFn = std::function<void(Socket)>;
 
-    void async_recv(Socket& socket, char* buf, size_t maxlen, IntFn fn);
-    void async_send(Socket& socket, const char* buf, size_t maxlen, IntFn fn);
-    void async_accept(Socket& socket, SocketFn fn);
-
-    void async_wait(Timer& timer, IntFn fn);
-
-    void run();
-
-    void stop();
-
-private:
-    struct RecvOp {
-        Socket* socket = nullptr;
-        char* buf = nullptr;
-        size_t maxlen = 0;
+    enum class Backend : std::uint8_t {
+        // Rebuilds fd_sets every iteration, so wakeup cost scales with the number of
+        // operations in flight. Cannot handle fds >= FD_SETSIZE.
+        SELECT,
 
-        IntFn fn;
+        // Registers each fd once and keeps per-fd operation queues, so wakeup cost scales
+        // with the number of ready fds.
+        EPOLL,
 
-        bool complete = false;
+        // Batches submissions and completions so that a whole loop iteration costs a single
+        // syscall. Falls back to EPOLL on kernels which don't support it.
+        IO_URING,
     };
 
-    struct SendOp {
-        Socket* socket = nullptr;
-        const char* buf = nullptr;
-        size_t maxlen = 0;
+    explicit IOContext(Backend backend = Backend::IO_URING);
 
-        IntFn fn;
+    IOContext(IOContext&& other);
+    IOContext& operator=(IOContext&& other);
 
-        bool complete = false;
-    };
+    IOContext(const IOContext& other) = delete;
+    IOContext& operator=(const IOContext& other) = delete;
 
-    struct AcceptOp {
-        Socket* socket = nullptr;
+    ~IOContext();
 
-        SocketFn fn;
+    void async_recv(Socket& socket, char* buf, size_t maxlen, IntFn fn);
+    void async_send(Socket& socket, const char* buf, size_t maxlen, IntFn fn);
+    void async_accept(Socket& socket, SocketFn fn);
 
-        bool complete = false;
-    };
+    void async_wait(Timer& timer, IntFn fn);
 
-    struct WaitOp {
-        Timer* timer = nullptr;
+    void run();
 
-        IntFn fn;
+    void stop();
 
-        bool complete = false;
-    };
+    // The backend actually in use, which may differ from the requested one
+    Backend backend() const;
+
+private:
+    struct Impl;
 
     bool m_stop = false;
 
-    // TODO Maybe use a variant instead
-    std::vector<RecvOp> m_recv;
-    std::vector<SendOp> m_send;
-    std::vector<AcceptOp> m_accept;
-    std::vector<WaitOp> m_wait;
+    std::unique_ptr<Impl> m_impl;
 };
 
 }  // namespace boutique
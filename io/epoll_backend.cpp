@@ -0,0 +1,287 @@
+#include "epoll_backend.hpp"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cassert>
+
+#include "core/overloaded_visitor.hpp"
+#include "socket.hpp"
+#include "timer.hpp"
+#include "unix_utils.hpp"
+
+namespace {
+
+const int MAX_EVENTS = 256;
+
+}  // namespace
+
+namespace boutique {
+
+EpollBackend::EpollBackend() {
+    m_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (m_fd < 0) {
+        throw_errno("Failed to create epoll instance");
+    }
+}
+
+EpollBackend::~EpollBackend() {
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+void EpollBackend::async_recv(Socket& socket, char* buf, size_t maxlen, IOContext::IntFn fn) {
+    assert(fn);
+
+    enqueue_op(socket.fd(), &socket, RecvOp{&socket, buf, maxlen, std::move(fn)}, false);
+}
+
+void EpollBackend::async_send(Socket& socket, const char* buf, size_t maxlen,
+                              IOContext::IntFn fn) {
+    assert(fn);
+
+    enqueue_op(socket.fd(), &socket, SendOp{&socket, buf, maxlen, std::move(fn)}, true);
+}
+
+void EpollBackend::async_accept(Socket& socket, IOContext::SocketFn fn) {
+    assert(fn);
+
+    enqueue_op(socket.fd(), &socket, AcceptOp{&socket, std::move(fn)}, false);
+}
+
+void EpollBackend::async_wait(Timer& timer, IOContext::IntFn fn) {
+    assert(fn);
+
+    enqueue_op(timer.fd(), &timer, WaitOp{&timer, std::move(fn)}, false);
+}
+
+void EpollBackend::run(const bool& stop) {
+    epoll_event events[MAX_EVENTS];
+
+    // Swapped with m_ready every iteration so that callbacks can mark fds ready for the next
+    // iteration while we walk this one.
+    std::vector<int> ready;
+
+    while (!stop) {
+        // If there's still work we know we can do without waiting, just poll for new events
+        int timeout = m_ready.empty() ? -1 : 0;
+
+        // TODO Receive timeout
+        int count = epoll_wait(m_fd, events, MAX_EVENTS, timeout);
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            throw_errno("Failed to wait on epoll instance");
+        }
+
+        for (int i = 0; i < count; ++i) {
+            auto fd = events[i].data.fd;
+            auto flags = events[i].events;
+
+            auto& state = m_fds[fd];
+
+            if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                state.readable = true;
+            }
+
+            if (flags & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+                state.writable = true;
+            }
+
+            if ((state.readable && !state.read_ops.empty()) ||
+                (state.writable && !state.write_ops.empty())) {
+                mark_ready(fd);
+            }
+        }
+
+        ready.clear();
+        std::swap(ready, m_ready);
+
+        for (auto fd : ready) {
+            process_ready(fd);
+        }
+    }
+}
+
+EpollBackend::FdState& EpollBackend::fd_state(int fd, const void* owner) {
+    assert(fd >= 0);
+
+    if (static_cast<std::size_t>(fd) >= m_fds.size()) {
+        m_fds.resize(fd + 1);
+    }
+
+    auto& state = m_fds[fd];
+
+    if (state.owner == owner) {
+        return state;
+    }
+
+    epoll_event ev{};
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        // Same file, different Socket object (e.g. it was moved)
+        if (errno != EEXIST) {
+            throw_errno("Failed to add fd to epoll instance");
+        }
+    } else {
+        // The fd wasn't registered, so anything we had for it belonged to a file that has
+        // since been closed. The kernel reports the current readiness of the new file on the
+        // next wait.
+        state.readable = false;
+        state.writable = false;
+
+        state.read_ops.clear();
+        state.write_ops.clear();
+    }
+
+    state.owner = owner;
+
+    return state;
+}
+
+void EpollBackend::enqueue_op(int fd, const void* owner, Op op, bool write) {
+    auto& state = fd_state(fd, owner);
+
+    if (write) {
+        state.write_ops.emplace_back(std::move(op));
+
+        if (state.writable) {
+            mark_ready(fd);
+        }
+    } else {
+        state.read_ops.emplace_back(std::move(op));
+
+        if (state.readable) {
+            mark_ready(fd);
+        }
+    }
+}
+
+void EpollBackend::mark_ready(int fd) {
+    auto& state = m_fds[fd];
+
+    if (state.queued) {
+        return;
+    }
+
+    state.queued = true;
+    m_ready.push_back(fd);
+}
+
+bool EpollBackend::perform(int fd, Op& op) {
+    // Callbacks may queue operations on new fds and so resize m_fds, which is why we don't
+    // hold on to a reference to the fd state across them.
+    return std::visit(
+        OverloadedVisitor{
+            [&](RecvOp& op) {
+                auto res = op.socket->try_recv(op.buf, static_cast<int>(op.maxlen));
+
+                if (!res) {
+                    return false;
+                }
+
+                // A short read means we drained the socket, and any data arriving after this
+                // will trigger another edge. We stay readable on EOF since every subsequent
+                // read will complete immediately.
+                if (*res > 0 && static_cast<std::size_t>(*res) < op.maxlen) {
+                    m_fds[fd].readable = false;
+                }
+
+                op.fn(*res);
+                return true;
+            },
+            [&](SendOp& op) {
+                auto res = op.socket->try_send(op.buf, static_cast<int>(op.maxlen));
+
+                if (!res) {
+                    return false;
+                }
+
+                // Same reasoning as above: the send buffer is full.
+                if (static_cast<std::size_t>(*res) < op.maxlen) {
+                    m_fds[fd].writable = false;
+                }
+
+                op.fn(*res);
+                return true;
+            },
+            [&](AcceptOp& op) {
+                auto socket = op.socket->accept();
+
+                if (!socket) {
+                    return false;
+                }
+
+                // The accepted fd may be a reused one that we hold stale state for, and the
+                // Socket that ends up owning it may even live at the same address as the old
+                // one. Forget the owner so that the fd gets registered again.
+                if (static_cast<std::size_t>(socket->fd()) < m_fds.size()) {
+                    m_fds[socket->fd()].owner = nullptr;
+                }
+
+                op.fn(std::move(*socket));
+                return true;
+            },
+            [&](WaitOp& op) {
+                auto expire_count = op.timer->expire_count();
+
+                if (expire_count == 0) {
+                    return false;
+                }
+
+                // Reading a timerfd resets it, so there's nothing left until the next edge
+                m_fds[fd].readable = false;
+
+                op.fn(expire_count);
+                return true;
+            }},
+        op);
+}
+
+void EpollBackend::process_ready(int fd) {
+    m_fds[fd].queued = false;
+
+    for (bool write : {false, true}) {
+        // Only perform the operations which were queued before we started; anything queued by
+        // the callbacks below waits for the next iteration so one busy fd can't starve the rest.
+        auto budget = write ? m_fds[fd].write_ops.size() : m_fds[fd].read_ops.size();
+
+        for (; budget > 0; --budget) {
+            auto& state = m_fds[fd];
+            auto& ops = write ? state.write_ops : state.read_ops;
+            auto& ready = write ? state.writable : state.readable;
+
+            if (!ready || ops.empty()) {
+                break;
+            }
+
+            auto op = std::move(ops.front());
+            ops.erase(ops.begin());
+
+            if (!perform(fd, op)) {
+                // No callback was invoked, so the references above are still valid
+                ready = false;
+                ops.insert(ops.begin(), std::move(op));
+                break;
+            }
+        }
+    }
+
+    auto& state = m_fds[fd];
+
+    if ((state.readable && !state.read_ops.empty()) ||
+        (state.writable && !state.write_ops.empty())) {
+        mark_ready(fd);
+    }
+}
+
+}  // namespace boutique
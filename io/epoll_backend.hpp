@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <variant>
+#include <vector>
+
+#include "context.hpp"
+
+namespace boutique {
+
+// Edge-triggered epoll backend. Every fd is registered once (EPOLLIN | EPOLLOUT | EPOLLET) and
+// we remember which directions are ready until an operation tells us otherwise (would block or
+// a short read/write). Operations are queued per fd, so a wakeup only touches fds that are both
+// ready and have operations waiting on them.
+struct EpollBackend {
+    EpollBackend();
+
+    EpollBackend(const EpollBackend& other) = delete;
+    EpollBackend& operator=(const EpollBackend& other) = delete;
+
+    ~EpollBackend();
+
+    void async_recv(Socket& socket, char* buf, size_t maxlen, IOContext::IntFn fn);
+    void async_send(Socket& socket, const char* buf, size_t maxlen, IOContext::IntFn fn);
+    void async_accept(Socket& socket, IOContext::SocketFn fn);
+
+    void async_wait(Timer& timer, IOContext::IntFn fn);
+
+    // Runs until stop is set by one of the callbacks
+    void run(const bool& stop);
+
+private:
+    struct RecvOp {
+        Socket* socket = nullptr;
+        char* buf = nullptr;
+        size_t maxlen = 0;
+
+        IOContext::IntFn fn;
+    };
+
+    struct SendOp {
+        Socket* socket = nullptr;
+        const char* buf = nullptr;
+        size_t maxlen = 0;
+
+        IOContext::IntFn fn;
+    };
+
+    struct AcceptOp {
+        Socket* socket = nullptr;
+
+        IOContext::SocketFn fn;
+    };
+
+    struct WaitOp {
+        Timer* timer = nullptr;
+
+        IOContext::IntFn fn;
+    };
+
+    using Op = std::variant<RecvOp, SendOp, AcceptOp, WaitOp>;
+
+    struct FdState {
+        // The Socket/Timer which registered this fd. If a different object shows up with
+        // the same fd, the original was closed and the fd reused, so we register it again.
+        const void* owner = nullptr;
+
+        bool readable = false;
+        bool writable = false;
+
+        // Whether this fd is already in m_ready
+        bool queued = false;
+
+        // These are almost always of size 0 or 1, so a vector is cheaper than a deque here
+        std::vector<Op> read_ops;
+        std::vector<Op> write_ops;
+    };
+
+    int m_fd = -1;
+
+    // Indexed by fd, since the kernel hands out the lowest available fd these stay dense
+    std::vector<FdState> m_fds;
+
+    // Fds which are ready and have operations waiting on them
+    std::vector<int> m_ready;
+
+    FdState& fd_state(int fd, const void* owner);
+
+    void enqueue_op(int fd, const void* owner, Op op, bool write);
+    void mark_ready(int fd);
+
+    // Returns false if the op would block, in which case it is left untouched. Otherwise
+    // the op's callback has been invoked.
+    bool perform(int fd, Op& op);
+
+    void process_ready(int fd);
+};
+
+}  // namespace boutique
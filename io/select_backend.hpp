@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+
+#include "context.hpp"
+
+namespace boutique {
+
+struct SelectBackend {
+    void async_recv(Socket& socket, char* buf, size_t maxlen, IOContext::IntFn fn);
+    void async_send(Socket& socket, const char* buf, size_t maxlen, IOContext::IntFn fn);
+    void async_accept(Socket& socket, IOContext::SocketFn fn);
+
+    void async_wait(Timer& timer, IOContext::IntFn fn);
+
+    // Runs until stop is set by one of the callbacks
+    void run(const bool& stop);
+
+private:
+    struct RecvOp {
+        Socket* socket = nullptr;
+        char* buf = nullptr;
+        size_t maxlen = 0;
+
+        IOContext::IntFn fn;
+
+        bool complete = false;
+    };
+
+    struct SendOp {
+        Socket* socket = nullptr;
+        const char* buf = nullptr;
+        size_t maxlen = 0;
+
+        IOContext::IntFn fn;
+
+        bool complete = false;
+    };
+
+    struct AcceptOp {
+        Socket* socket = nullptr;
+
+        IOContext::SocketFn fn;
+
+        bool complete = false;
+    };
+
+    struct WaitOp {
+        Timer* timer = nullptr;
+
+        IOContext::IntFn fn;
+
+        bool complete = false;
+    };
+
+    // TODO Maybe use a variant instead
+    std::vector<RecvOp> m_recv;
+    std::vector<SendOp> m_send;
+    std::vector<AcceptOp> m_accept;
+    std::vector<WaitOp> m_wait;
+};
+
+}  // namespace boutique
@@ -6,14 +6,48 @@
 #include <netinet/tcp.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <stdexcept>
 #include <system_error>
 #include <utility>
 
 #include "unix_utils.hpp"
 
+namespace {
+
+std::optional<int> recv_impl(int fd, char* buf, int maxlen, int flags) {
+    int r = ::recv(fd, buf, maxlen, flags);
+
+    if (r < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            return std::nullopt;
+        }
+
+        boutique::throw_errno("Failed to read from socket");
+    }
+
+    return r;
+}
+
+std::optional<int> send_impl(int fd, const char* buf, int maxlen, int flags) {
+    int r = ::send(fd, buf, maxlen, flags);
+
+    if (r < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            return std::nullopt;
+        }
+
+        boutique::throw_errno("Failed to send to socket");
+    }
+
+    return r;
+}
+
+}  // namespace
+
 namespace boutique {
 
 Socket::Socket(int fd) : m_fd{fd} {}
@@ -89,6 +123,16 @@ Socket::Socket(const ConnectParams& params) {
     m_fd = fd;
 }
 
+std::pair<Socket, Socket> Socket::pair() {
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) {
+        throw_errno("Failed to create socket pair");
+    }
+
+    return {Socket{fds[0]}, Socket{fds[1]}};
+}
+
 Socket::Socket(Socket&& other) : m_fd{std::exchange(other.m_fd, -1)} {}
 
 Socket& Socket::operator=(Socket&& other) {
@@ -102,6 +146,11 @@ Socket::~Socket() {
     }
 }
 
+void Socket::shutdown_send() {
+    // Fails if the peer already reset the connection, which leaves nothing to shut down
+    ::shutdown(m_fd, SHUT_WR);
+}
+
 std::optional<Socket> Socket::accept() {
     sockaddr_in addr;
     socklen_t addrlen = sizeof(addr);
@@ -119,26 +168,40 @@ std::optional<Socket> Socket::accept() {
     return Socket{fd};
 }
 
-int Socket::recv(char* buf, int maxlen) {
-    int r = ::recv(m_fd, buf, maxlen, 0);
+int Socket::recv(char* buf, int maxlen) { return recv_impl(m_fd, buf, maxlen, 0).value_or(0); }
 
-    if (r < 0) {
-        if (errno == EWOULDBLOCK || errno == EAGAIN) {
-            return 0;
-        }
+int Socket::send(const char* buf, int maxlen) {
+    return send_impl(m_fd, buf, maxlen, 0).value_or(0);
+}
 
-        throw_errno("Failed to read from socket");
-    }
+std::optional<int> Socket::try_recv(char* buf, int maxlen) {
+    return recv_impl(m_fd, buf, maxlen, MSG_DONTWAIT);
+}
 
-    return r;
+std::optional<int> Socket::try_send(const char* buf, int maxlen) {
+    return send_impl(m_fd, buf, maxlen, MSG_DONTWAIT);
 }
 
-int Socket::send(const char* buf, int maxlen) {
-    int r = ::send(m_fd, buf, maxlen, 0);
+std::optional<int> Socket::try_sendv(const ConstBuffer* bufs, std::size_t count) {
+    iovec iov[MAX_SENDV_BUFFERS];
+
+    count = std::min(count, MAX_SENDV_BUFFERS);
+
+    for (std::size_t i = 0; i < count; ++i) {
+        iov[i].iov_base = const_cast<char*>(bufs[i].data);
+        iov[i].iov_len = bufs[i].len;
+    }
+
+    msghdr msg{};
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    auto r = static_cast<int>(::sendmsg(m_fd, &msg, MSG_DONTWAIT));
 
     if (r < 0) {
         if (errno == EWOULDBLOCK || errno == EAGAIN) {
-            return 0;
+            return std::nullopt;
         }
 
         throw_errno("Failed to send to socket");
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <cstddef>
 #include <optional>
+#include <utility>
+
+#include "core/const_buffer.hpp"
 
 namespace boutique {
 
@@ -19,6 +23,9 @@ struct Socket {
     explicit Socket(const ListenParams& params);
     explicit Socket(const ConnectParams& params);
 
+    // Creates a pair of connected, non-blocking unix domain sockets
+    static std::pair<Socket, Socket> pair();
+
     Socket(Socket&& other);
     Socket& operator=(Socket&& other);
 
@@ -32,6 +39,24 @@ struct Socket {
     int recv(char* buf, int maxlen);
     int send(const char* buf, int maxlen);
 
+    // Same as above, but these never block (even if the socket is blocking) and return
+    // std::nullopt if they would rather than conflating it with a 0-length read (i.e. the
+    // peer closed the connection).
+    std::optional<int> try_recv(char* buf, int maxlen);
+    std::optional<int> try_send(const char* buf, int maxlen);
+
+    // Most buffers try_sendv will send at once
+    static constexpr std::size_t MAX_SENDV_BUFFERS = 64;
+
+    // Sends the buffers one after the other with a single sendmsg, so they don't have to be
+    // copied into one first. Like try_send, this never blocks. Only the first
+    // MAX_SENDV_BUFFERS of them are sent.
+    std::optional<int> try_sendv(const ConstBuffer* bufs, std::size_t count);
+
+    // Sends the peer an end of stream once everything sent before this has gone out. Anything
+    // sent after fails.
+    void shutdown_send();
+
     int fd() const;
 
     void set_non_blocking(bool enabled);
@@ -8,10 +8,12 @@
 #include "socket.hpp"
 #include "timer.hpp"
 
-int main(int argc, char** argv) {
+namespace {
+
+void test_context(boutique::IOContext::Backend backend) {
     using namespace boutique;
 
-    IOContext ctx;
+    IOContext ctx{backend};
 
     Timer::Params params;
 
@@ -64,6 +66,36 @@ int main(int argc, char** argv) {
     });
 
     ctx.run();
+}
+
+void test_sendv() {
+    using namespace boutique;
+
+    auto [a, b] = Socket::pair();
+
+    ConstBuffer bufs[] = {ConstBuffer{"head", 4}, ConstBuffer{}, ConstBuffer{"body", 4}};
+
+    assert(a.try_sendv(bufs, 3) == 8);
+
+    char buf[16];
+
+    assert(b.try_recv(buf, sizeof(buf)) == 8);
+    assert(std::memcmp(buf, "headbody", 8) == 0);
+
+    // Nothing left to read
+    assert(!b.try_recv(buf, sizeof(buf)));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    using namespace boutique;
+
+    test_context(IOContext::Backend::SELECT);
+    test_context(IOContext::Backend::EPOLL);
+    test_context(IOContext::Backend::IO_URING);
+
+    test_sendv();
 
     return 0;
 }
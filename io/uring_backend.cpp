@@ -0,0 +1,499 @@
+#include "uring_backend.hpp"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "core/overloaded_visitor.hpp"
+#include "socket.hpp"
+#include "timer.hpp"
+#include "unix_utils.hpp"
+
+namespace {
+
+const unsigned RING_ENTRIES = 1024;
+
+int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(
+        syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+template <typename T>
+T* ring_field(void* ring, std::uint32_t offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+[[noreturn]] void throw_res(int res, const char* what) {
+    errno = -res;
+    boutique::throw_errno(what);
+}
+
+}  // namespace
+
+namespace boutique {
+
+bool UringBackend::supported() {
+    static const bool result = [] {
+        io_uring_params params{};
+
+        int fd = io_uring_setup(2, &params);
+
+        if (fd < 0) {
+            return false;
+        }
+
+        // We need a single mmap for both rings, and the opcodes below
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+            close(fd);
+            return false;
+        }
+
+        const std::size_t op_count = 256;
+
+        std::vector<char> probe_buf(sizeof(io_uring_probe) +
+                                    op_count * sizeof(io_uring_probe_op));
+        auto* probe = reinterpret_cast<io_uring_probe*>(probe_buf.data());
+
+        bool ok = io_uring_register(fd, IORING_REGISTER_PROBE, probe, op_count) >= 0;
+
+        close(fd);
+
+        if (!ok) {
+            return false;
+        }
+
+        for (auto op : {IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ACCEPT, IORING_OP_READ,
+                        IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL}) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+
+        return true;
+    }();
+
+    return result;
+}
+
+UringBackend::UringBackend() {
+    io_uring_params params{};
+
+    m_fd = io_uring_setup(RING_ENTRIES, &params);
+
+    if (m_fd < 0) {
+        throw_errno("Failed to set up io_uring");
+    }
+
+    assert(params.features & IORING_FEAT_SINGLE_MMAP);
+
+    m_ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(std::uint32_t),
+                           params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+
+    m_ring_ptr = mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_fd, IORING_OFF_SQ_RING);
+
+    if (m_ring_ptr == MAP_FAILED) {
+        close(m_fd);
+        throw_errno("Failed to map io_uring rings");
+    }
+
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    void* sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_fd, IORING_OFF_SQES);
+
+    if (sqes == MAP_FAILED) {
+        munmap(m_ring_ptr, m_ring_size);
+        close(m_fd);
+        throw_errno("Failed to map io_uring SQEs");
+    }
+
+    m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+    m_sq_head = ring_field<std::uint32_t>(m_ring_ptr, params.sq_off.head);
+    m_sq_tail = ring_field<std::uint32_t>(m_ring_ptr, params.sq_off.tail);
+    m_sq_mask = *ring_field<std::uint32_t>(m_ring_ptr, params.sq_off.ring_mask);
+    m_sq_entries = *ring_field<std::uint32_t>(m_ring_ptr, params.sq_off.ring_entries);
+
+    m_cq_head = ring_field<std::uint32_t>(m_ring_ptr, params.cq_off.head);
+    m_cq_tail = ring_field<std::uint32_t>(m_ring_ptr, params.cq_off.tail);
+    m_cq_mask = *ring_field<std::uint32_t>(m_ring_ptr, params.cq_off.ring_mask);
+    m_cqes = ring_field<io_uring_cqe>(m_ring_ptr, params.cq_off.cqes);
+
+    // We always fill SQEs in ring order, so the indirection array is just the identity
+    auto* array = ring_field<std::uint32_t>(m_ring_ptr, params.sq_off.array);
+
+    for (std::uint32_t i = 0; i < m_sq_entries; ++i) {
+        array[i] = i;
+    }
+
+    m_sq_local_tail = *m_sq_tail;
+}
+
+UringBackend::~UringBackend() {
+    cancel_all();
+
+    munmap(m_sqes, m_sqes_size);
+    munmap(m_ring_ptr, m_ring_size);
+    close(m_fd);
+}
+
+void UringBackend::async_recv(Socket& socket, char* buf, size_t maxlen, IOContext::IntFn fn) {
+    assert(fn);
+
+    enqueue_op(socket.fd(), false, RecvOp{buf, maxlen, std::move(fn)});
+}
+
+void UringBackend::async_send(Socket& socket, const char* buf, size_t maxlen,
+                              IOContext::IntFn fn) {
+    assert(fn);
+
+    enqueue_op(socket.fd(), true, SendOp{buf, maxlen, std::move(fn)});
+}
+
+void UringBackend::async_accept(Socket& socket, IOContext::SocketFn fn) {
+    assert(fn);
+
+    enqueue_op(socket.fd(), false, AcceptOp{std::move(fn)});
+}
+
+void UringBackend::async_wait(Timer& timer, IOContext::IntFn fn) {
+    assert(fn);
+
+    enqueue_op(timer.fd(), false, WaitOp{std::move(fn)});
+}
+
+void UringBackend::run(const bool& stop) {
+    while (!stop) {
+        enter(1);
+        reap();
+    }
+}
+
+void UringBackend::enqueue_op(int fd, bool write, Op op) {
+    auto index = alloc_slot();
+    auto& slot = m_slots[index];
+
+    slot.op = std::move(op);
+    slot.fd = fd;
+    slot.write = write;
+
+    auto& state = fd_state(fd);
+    auto& in_flight = write ? state.write_in_flight : state.read_in_flight;
+
+    if (in_flight != NO_SLOT) {
+        (write ? state.write_queue : state.read_queue).push_back(index);
+        return;
+    }
+
+    in_flight = index;
+    prepare_sqe(index);
+}
+
+std::uint32_t UringBackend::alloc_slot() {
+    if (!m_free_slots.empty()) {
+        auto index = m_free_slots.back();
+        m_free_slots.pop_back();
+
+        return index;
+    }
+
+    m_slots.emplace_back();
+    return static_cast<std::uint32_t>(m_slots.size() - 1);
+}
+
+void UringBackend::free_slot(std::uint32_t index) {
+    auto& slot = m_slots[index];
+
+    slot.op = std::monostate{};
+    slot.fd = -1;
+    slot.polling = false;
+    slot.submitted = false;
+
+    m_free_slots.push_back(index);
+}
+
+UringBackend::FdState& UringBackend::fd_state(int fd) {
+    assert(fd >= 0);
+
+    if (static_cast<std::size_t>(fd) >= m_fds.size()) {
+        m_fds.resize(fd + 1);
+    }
+
+    return m_fds[fd];
+}
+
+void UringBackend::reset_fd_state(int fd) {
+    auto& state = fd_state(fd);
+
+    // Anything still queued here belonged to a file which has since been closed. Operations
+    // which were in flight will complete (with an error) on their own.
+    for (auto* queue : {&state.read_queue, &state.write_queue}) {
+        for (auto index : *queue) {
+            free_slot(index);
+        }
+
+        queue->clear();
+    }
+
+    state.read_in_flight = NO_SLOT;
+    state.write_in_flight = NO_SLOT;
+}
+
+io_uring_sqe* UringBackend::get_sqe() {
+    // Submission ring is full, push what we have to the kernel without waiting
+    if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) == m_sq_entries) {
+        enter(0);
+    }
+
+    auto* sqe = &m_sqes[m_sq_local_tail & m_sq_mask];
+    m_sq_local_tail += 1;
+
+    std::memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+void UringBackend::prepare_sqe(std::uint32_t index) {
+    auto& slot = m_slots[index];
+    auto* sqe = get_sqe();
+
+    sqe->fd = slot.fd;
+    sqe->user_data = index;
+
+    slot.submitted = true;
+
+    if (slot.polling) {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = slot.write ? POLLOUT : POLLIN;
+
+        return;
+    }
+
+    std::visit(OverloadedVisitor{[&](RecvOp& op) {
+                                     sqe->opcode = IORING_OP_RECV;
+                                     sqe->addr = reinterpret_cast<std::uintptr_t>(op.buf);
+                                     sqe->len = static_cast<std::uint32_t>(op.maxlen);
+                                 },
+                                 [&](SendOp& op) {
+                                     sqe->opcode = IORING_OP_SEND;
+                                     sqe->addr = reinterpret_cast<std::uintptr_t>(op.buf);
+                                     sqe->len = static_cast<std::uint32_t>(op.maxlen);
+                                 },
+                                 [&](AcceptOp&) { sqe->opcode = IORING_OP_ACCEPT; },
+                                 [&](WaitOp&) {
+                                     sqe->opcode = IORING_OP_READ;
+                                     sqe->addr =
+                                         reinterpret_cast<std::uintptr_t>(&slot.expirations);
+                                     sqe->len = sizeof(slot.expirations);
+
+                                     // timerfds aren't seekable, read from the current position
+                                     sqe->off = ~std::uint64_t{0};
+                                 },
+                                 [](std::monostate) { assert(false); }},
+               slot.op);
+}
+
+void UringBackend::enter(std::uint32_t min_complete) {
+    auto to_submit = m_sq_local_tail - *m_sq_tail;
+
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    for (;;) {
+        int res = io_uring_enter(m_fd, to_submit, min_complete, flags);
+
+        if (res >= 0) {
+            return;
+        }
+
+        if (errno == EINTR) {
+            // Whatever was submitted before the interruption is consumed, so only retry
+            // waiting.
+            to_submit = 0;
+            continue;
+        }
+
+        // The completion ring is backed up, make room for more
+        if (errno == EBUSY || errno == EAGAIN) {
+            reap();
+            continue;
+        }
+
+        throw_errno("Failed to enter io_uring");
+    }
+}
+
+void UringBackend::reap() {
+    auto head = *m_cq_head;
+
+    while (head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+        auto cqe = m_cqes[head & m_cq_mask];
+
+        head += 1;
+
+        // Hand the entry back before running any callbacks, which may themselves enter the
+        // ring (and in turn reap).
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+        if (cqe.user_data != NO_SLOT) {
+            complete(static_cast<std::uint32_t>(cqe.user_data), cqe.res);
+        }
+
+        head = *m_cq_head;
+    }
+}
+
+void UringBackend::complete(std::uint32_t index, int res) {
+    auto& slot = m_slots[index];
+
+    slot.submitted = false;
+
+    if (slot.polling) {
+        // The fd is ready now (or polling failed, in which case the op reports the error)
+        slot.polling = false;
+        prepare_sqe(index);
+
+        return;
+    }
+
+    if (res == -EAGAIN) {
+        slot.polling = true;
+        prepare_sqe(index);
+
+        return;
+    }
+
+    auto op = std::move(slot.op);
+    auto fd = slot.fd;
+    auto write = slot.write;
+    auto expirations = slot.expirations;
+
+    free_slot(index);
+
+    // Start the next operation on this fd (if any) before running the callback, so anything
+    // the callback queues goes after it.
+    auto& state = fd_state(fd);
+    auto& in_flight = write ? state.write_in_flight : state.read_in_flight;
+    auto& queue = write ? state.write_queue : state.read_queue;
+
+    if (in_flight == index) {
+        in_flight = NO_SLOT;
+
+        if (!queue.empty()) {
+            in_flight = queue.front();
+            queue.erase(queue.begin());
+
+            prepare_sqe(in_flight);
+        }
+    }
+
+    std::visit(OverloadedVisitor{[&](RecvOp& op) {
+                                     if (res < 0) {
+                                         throw_res(res, "Failed to read from socket");
+                                     }
+
+                                     op.fn(res);
+                                 },
+                                 [&](SendOp& op) {
+                                     if (res < 0) {
+                                         throw_res(res, "Failed to send to socket");
+                                     }
+
+                                     op.fn(res);
+                                 },
+                                 [&](AcceptOp& op) {
+                                     if (res < 0) {
+                                         throw_res(res, "Failed to accept socket");
+                                     }
+
+                                     reset_fd_state(res);
+                                     op.fn(Socket{res});
+                                 },
+                                 [&](WaitOp& op) {
+                                     if (res < 0) {
+                                         throw_res(res, "Failed to get expire count of timerfd");
+                                     }
+
+                                     op.fn(static_cast<int>(expirations));
+                                 },
+                                 [](std::monostate) { assert(false); }},
+               op);
+}
+
+void UringBackend::cancel_all() {
+    // Closing the ring cancels whatever is in flight asynchronously, and until that happens the
+    // files those operations refer to stay open. For example, a closed listening socket would
+    // keep taking connections in its SO_REUSEPORT group only to reset them later. So we cancel
+    // everything and wait for it here. This runs in the destructor, so we stick to raw
+    // syscalls and give up on errors rather than throwing.
+    std::size_t in_flight = 0;
+
+    for (std::uint32_t i = 0; i < m_slots.size(); ++i) {
+        if (!m_slots[i].submitted) {
+            continue;
+        }
+
+        in_flight += 1;
+
+        if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) == m_sq_entries) {
+            auto to_submit = m_sq_local_tail - *m_sq_tail;
+
+            __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+            if (io_uring_enter(m_fd, to_submit, 0, 0) < 0) {
+                return;
+            }
+        }
+
+        auto* sqe = &m_sqes[m_sq_local_tail & m_sq_mask];
+        m_sq_local_tail += 1;
+
+        std::memset(sqe, 0, sizeof(*sqe));
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = i;
+        sqe->user_data = NO_SLOT;
+    }
+
+    auto to_submit = m_sq_local_tail - *m_sq_tail;
+
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+    while (in_flight > 0) {
+        if (io_uring_enter(m_fd, to_submit, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            return;
+        }
+
+        to_submit = 0;
+
+        auto head = *m_cq_head;
+
+        for (; head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE); ++head) {
+            if (m_cqes[head & m_cq_mask].user_data != NO_SLOT) {
+                in_flight -= 1;
+            }
+        }
+
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+}  // namespace boutique
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <variant>
+#include <vector>
+
+#include "context.hpp"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace boutique {
+
+// io_uring backend. Operations are written straight into the submission ring as they are
+// queued and the whole batch is submitted by the same io_uring_enter call that waits for
+// completions, so a loop iteration costs a single syscall no matter how many operations
+// complete in it.
+struct UringBackend {
+    // Whether the running kernel supports io_uring and all of the opcodes we use
+    static bool supported();
+
+    UringBackend();
+
+    UringBackend(const UringBackend& other) = delete;
+    UringBackend& operator=(const UringBackend& other) = delete;
+
+    ~UringBackend();
+
+    void async_recv(Socket& socket, char* buf, size_t maxlen, IOContext::IntFn fn);
+    void async_send(Socket& socket, const char* buf, size_t maxlen, IOContext::IntFn fn);
+    void async_accept(Socket& socket, IOContext::SocketFn fn);
+
+    void async_wait(Timer& timer, IOContext::IntFn fn);
+
+    // Runs until stop is set by one of the callbacks
+    void run(const bool& stop);
+
+private:
+    // Also used as the user_data of SQEs which don't belong to a slot
+    static constexpr std::uint32_t NO_SLOT = ~std::uint32_t{0};
+
+    struct RecvOp {
+        char* buf = nullptr;
+        size_t maxlen = 0;
+
+        IOContext::IntFn fn;
+    };
+
+    struct SendOp {
+        const char* buf = nullptr;
+        size_t maxlen = 0;
+
+        IOContext::IntFn fn;
+    };
+
+    struct AcceptOp {
+        IOContext::SocketFn fn;
+    };
+
+    struct WaitOp {
+        IOContext::IntFn fn;
+    };
+
+    using Op = std::variant<std::monostate, RecvOp, SendOp, AcceptOp, WaitOp>;
+
+    // The index of a slot is the user_data of its SQE
+    struct Slot {
+        Op op;
+
+        int fd = -1;
+        bool write = false;
+
+        // Older kernels complete operations on non-blocking fds with -EAGAIN instead of
+        // waiting, in which case we poll the fd first and then resubmit.
+        bool polling = false;
+
+        // Whether there's an SQE for this slot which hasn't completed yet
+        bool submitted = false;
+
+        // The kernel reads timerfd expirations into this, which is why slots live in a deque
+        std::uint64_t expirations = 0;
+    };
+
+    // Only one operation per fd and direction is in flight at a time; the kernel makes no
+    // ordering guarantees between SQEs, and we don't want two sends interleaving.
+    struct FdState {
+        std::uint32_t read_in_flight = NO_SLOT;
+        std::uint32_t write_in_flight = NO_SLOT;
+
+        // Slot indices, these are almost always empty
+        std::vector<std::uint32_t> read_queue;
+        std::vector<std::uint32_t> write_queue;
+    };
+
+    int m_fd = -1;
+
+    void* m_ring_ptr = nullptr;
+    std::size_t m_ring_size = 0;
+
+    io_uring_sqe* m_sqes = nullptr;
+    std::size_t m_sqes_size = 0;
+
+    std::uint32_t* m_sq_head = nullptr;
+    std::uint32_t* m_sq_tail = nullptr;
+    std::uint32_t m_sq_mask = 0;
+    std::uint32_t m_sq_entries = 0;
+
+    std::uint32_t* m_cq_head = nullptr;
+    std::uint32_t* m_cq_tail = nullptr;
+    std::uint32_t m_cq_mask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    // Our copy of the SQ tail; SQEs between *m_sq_tail and this haven't been submitted yet
+    std::uint32_t m_sq_local_tail = 0;
+
+    std::deque<Slot> m_slots;
+    std::vector<std::uint32_t> m_free_slots;
+
+    std::vector<FdState> m_fds;
+
+    void enqueue_op(int fd, bool write, Op op);
+
+    std::uint32_t alloc_slot();
+    void free_slot(std::uint32_t index);
+
+    FdState& fd_state(int fd);
+    void reset_fd_state(int fd);
+
+    io_uring_sqe* get_sqe();
+    void prepare_sqe(std::uint32_t index);
+
+    // Submits everything in the SQ ring, and waits for at least min_complete completions
+    void enter(std::uint32_t min_complete);
+
+    void reap();
+    void complete(std::uint32_t index, int res);
+
+    void cancel_all();
+};
+
+}  // namespace boutique
@@ -1,5 +1,6 @@
 #include "binary_protocol.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <optional>
@@ -153,6 +154,67 @@ boutique::ReadResult read(boutique::ConstBuffer& cursor, boutique::Schema& out_s
     return ReadResult::SUCCESS;
 }
 
+boutique::ConstBuffer from_string(std::string_view s, boutique::ConstBuffer*) {
+    return boutique::as_const_buffer(s);
+}
+
+std::string_view from_string(std::string_view s, std::string_view*) { return s; }
+
+// Count followed by that many length-prefixed buffers (or field paths)
+template <typename T>
+boutique::ReadResult read(boutique::ConstBuffer& cursor, std::pmr::vector<T>& out,
+                          std::pmr::memory_resource* mem) {
+    using namespace boutique;
+
+    auto c = cursor;
+
+    auto count = boutique::read<std::uint32_t>(c);
+
+    if (!count) {
+        return ReadResult::INCOMPLETE;
+    }
+
+    std::pmr::vector<T> bufs{mem};
+
+    // Don't trust the count enough to reserve more than could possibly be in the buffer
+    bufs.reserve(std::min<std::size_t>(*count, c.len / sizeof(LengthPrefixType)));
+
+    for (std::uint32_t i = 0; i < *count; ++i) {
+        auto buf = boutique::read<LengthPrefixedString>(c);
+
+        if (!buf) {
+            return ReadResult::INCOMPLETE;
+        }
+
+        bufs.push_back(from_string(buf->s, static_cast<T*>(nullptr)));
+    }
+
+    out = std::move(bufs);
+    cursor = c;
+
+    return ReadResult::SUCCESS;
+}
+
+void write(boutique::WriteFn write_fn, const std::pmr::vector<boutique::ConstBuffer>& bufs) {
+    using namespace boutique;
+
+    write(write_fn, static_cast<std::uint32_t>(bufs.size()));
+
+    for (const auto& buf : bufs) {
+        write(write_fn, LengthPrefixedString{{buf.data, buf.len}});
+    }
+}
+
+void write(boutique::WriteFn write_fn, const std::pmr::vector<std::string_view>& paths) {
+    using namespace boutique;
+
+    write(write_fn, static_cast<std::uint32_t>(paths.size()));
+
+    for (auto path : paths) {
+        write(write_fn, LengthPrefixedString{path});
+    }
+}
+
 void write(boutique::WriteFn write_fn, const boutique::AggregateType& agg) {
     using namespace boutique;
 
@@ -182,7 +244,7 @@ void write(boutique::WriteFn write_fn, const boutique::Schema& schema) {
 
 namespace boutique {
 
-ReadResult read(ConstBuffer& cursor, Command& cmd) {
+ReadResult read(ConstBuffer& cursor, Command& cmd, std::pmr::memory_resource* mem) {
     auto c = cursor;
 
     auto cmd_type = read<uint8_t>(c);
@@ -207,18 +269,25 @@ ReadResult read(ConstBuffer& cursor, Command& cmd) {
                 return res;
             }
 
-            cmd = RegisterSchemaCommand{name->s, schema};
+            cmd = RegisterSchemaCommand{name->s, std::move(schema)};
         } break;
 
         case type_index_v<CreateCollectionCommand, Command>: {
             auto name = read<LengthPrefixedString>(c);
             auto schema_name = read<LengthPrefixedString>(c);
+            auto max_memory = read<std::uint64_t>(c);
+            auto eviction = read<std::uint8_t>(c);
 
-            if (!name || !schema_name) {
+            if (!name || !schema_name || !max_memory || !eviction) {
                 return ReadResult::INCOMPLETE;
             }
 
-            cmd = CreateCollectionCommand{name->s, schema_name->s};
+            if (*eviction > static_cast<std::uint8_t>(EvictionPolicy::CLOCK)) {
+                return ReadResult::INVALID;
+            }
+
+            cmd = CreateCollectionCommand{name->s, schema_name->s, *max_memory,
+                                          static_cast<EvictionPolicy>(*eviction)};
         } break;
 
         case type_index_v<GetSchemaCommand, Command>: {
@@ -249,7 +318,15 @@ ReadResult read(ConstBuffer& cursor, Command& cmd) {
                 return ReadResult::INCOMPLETE;
             }
 
-            cmd = GetCommand{coll_name->s, as_const_buffer(key->s)};
+            std::pmr::vector<std::string_view> fields{mem};
+
+            auto res = ::read(c, fields, mem);
+
+            if (res != ReadResult::SUCCESS) {
+                return res;
+            }
+
+            cmd = GetCommand{coll_name->s, as_const_buffer(key->s), std::move(fields)};
         } break;
 
         case type_index_v<PutCommand, Command>: {
@@ -274,6 +351,160 @@ ReadResult read(ConstBuffer& cursor, Command& cmd) {
             cmd = DeleteCommand{coll_name->s, as_const_buffer(key->s)};
         } break;
 
+        case type_index_v<MultiGetCommand, Command>:
+        case type_index_v<MultiPutCommand, Command>:
+        case type_index_v<MultiDeleteCommand, Command>: {
+            auto coll_name = read<LengthPrefixedString>(c);
+
+            if (!coll_name) {
+                return ReadResult::INCOMPLETE;
+            }
+
+            std::pmr::vector<ConstBuffer> bufs{mem};
+
+            auto res = ::read(c, bufs, mem);
+
+            if (res != ReadResult::SUCCESS) {
+                return res;
+            }
+
+            if (*cmd_type == type_index_v<MultiGetCommand, Command>) {
+                std::pmr::vector<std::string_view> fields{mem};
+
+                res = ::read(c, fields, mem);
+
+                if (res != ReadResult::SUCCESS) {
+                    return res;
+                }
+
+                cmd = MultiGetCommand{coll_name->s, std::move(bufs), std::move(fields)};
+            } else if (*cmd_type == type_index_v<MultiPutCommand, Command>) {
+                cmd = MultiPutCommand{coll_name->s, std::move(bufs)};
+            } else {
+                cmd = MultiDeleteCommand{coll_name->s, std::move(bufs)};
+            }
+        } break;
+
+        case type_index_v<PutWithTtlCommand, Command>: {
+            auto coll_name = read<LengthPrefixedString>(c);
+            auto value = read<LengthPrefixedString>(c);
+            auto ttl_ms = read<std::uint64_t>(c);
+
+            if (!coll_name || !value || !ttl_ms) {
+                return ReadResult::INCOMPLETE;
+            }
+
+            cmd = PutWithTtlCommand{coll_name->s, as_const_buffer(value->s), *ttl_ms};
+        } break;
+
+        case type_index_v<SetCommand, Command>: {
+            auto coll_name = read<LengthPrefixedString>(c);
+            auto key = read<LengthPrefixedString>(c);
+            auto count = read<std::uint32_t>(c);
+
+            if (!coll_name || !key || !count) {
+                return ReadResult::INCOMPLETE;
+            }
+
+            std::pmr::vector<FieldUpdate> updates{mem};
+
+            // Each update takes at least an op and three lengths
+            updates.reserve(
+                std::min<std::size_t>(*count, c.len / (1 + 3 * sizeof(LengthPrefixType))));
+
+            for (std::uint32_t i = 0; i < *count; ++i) {
+                auto op = read<std::uint8_t>(c);
+                auto path = read<LengthPrefixedString>(c);
+                auto value = read<LengthPrefixedString>(c);
+                auto expected = read<LengthPrefixedString>(c);
+
+                if (!op || !path || !value || !expected) {
+                    return ReadResult::INCOMPLETE;
+                }
+
+                if (*op > static_cast<std::uint8_t>(FieldUpdate::Op::COMPARE_AND_SET)) {
+                    return ReadResult::INVALID;
+                }
+
+                updates.push_back({static_cast<FieldUpdate::Op>(*op), path->s,
+                                   as_const_buffer(value->s), as_const_buffer(expected->s)});
+            }
+
+            cmd = SetCommand{coll_name->s, as_const_buffer(key->s), std::move(updates)};
+        } break;
+
+        case type_index_v<CreateIndexCommand, Command>: {
+            auto coll_name = read<LengthPrefixedString>(c);
+            auto field = read<LengthPrefixedString>(c);
+            auto type = read<std::uint8_t>(c);
+
+            if (!coll_name || !field || !type) {
+                return ReadResult::INCOMPLETE;
+            }
+
+            if (*type > static_cast<std::uint8_t>(SecondaryIndexType::ORDERED)) {
+                return ReadResult::INVALID;
+            }
+
+            cmd = CreateIndexCommand{coll_name->s, field->s,
+                                     static_cast<SecondaryIndexType>(*type)};
+        } break;
+
+        case type_index_v<QueryCommand, Command>: {
+            auto coll_name = read<LengthPrefixedString>(c);
+            auto field = read<LengthPrefixedString>(c);
+            auto op = read<std::uint8_t>(c);
+            auto min = read<LengthPrefixedString>(c);
+            auto max = read<LengthPrefixedString>(c);
+            auto limit = read<std::uint32_t>(c);
+
+            if (!coll_name || !field || !op || !min || !max || !limit) {
+                return ReadResult::INCOMPLETE;
+            }
+
+            if (*op > static_cast<std::uint8_t>(QueryCommand::Op::RANGE)) {
+                return ReadResult::INVALID;
+            }
+
+            std::pmr::vector<std::string_view> fields{mem};
+
+            auto res = ::read(c, fields, mem);
+
+            if (res != ReadResult::SUCCESS) {
+                return res;
+            }
+
+            cmd = QueryCommand{coll_name->s,
+                               field->s,
+                               static_cast<QueryCommand::Op>(*op),
+                               as_const_buffer(min->s),
+                               as_const_buffer(max->s),
+                               *limit,
+                               std::move(fields)};
+        } break;
+
+        case type_index_v<GetCollectionStatsCommand, Command>: {
+            auto coll_name = read<LengthPrefixedString>(c);
+
+            if (!coll_name) {
+                return ReadResult::INCOMPLETE;
+            }
+
+            cmd = GetCollectionStatsCommand{coll_name->s};
+        } break;
+
+        case type_index_v<PutWithExpiryCommand, Command>: {
+            auto coll_name = read<LengthPrefixedString>(c);
+            auto value = read<LengthPrefixedString>(c);
+            auto expires_at = read<std::uint64_t>(c);
+
+            if (!coll_name || !value || !expires_at) {
+                return ReadResult::INCOMPLETE;
+            }
+
+            cmd = PutWithExpiryCommand{coll_name->s, as_const_buffer(value->s), *expires_at};
+        } break;
+
         default:
             return ReadResult::INVALID;
     }
@@ -282,7 +513,7 @@ ReadResult read(ConstBuffer& cursor, Command& cmd) {
     return ReadResult::SUCCESS;
 }
 
-ReadResult read(ConstBuffer& buffer, Response& res) {
+ReadResult read(ConstBuffer& buffer, Response& res, std::pmr::memory_resource* mem) {
     auto b = buffer;
 
     auto res_type = read<uint8_t>(b);
@@ -340,6 +571,35 @@ ReadResult read(ConstBuffer& buffer, Response& res) {
             res = SchemaResponse{std::move(schema)};
         } break;
 
+        case type_index_v<MultiFoundResponse, Response>: {
+            std::pmr::vector<ConstBuffer> values{mem};
+
+            auto read_res = ::read(b, values, mem);
+
+            if (read_res != ReadResult::SUCCESS) {
+                return read_res;
+            }
+
+            res = MultiFoundResponse{std::move(values)};
+        } break;
+
+        case type_index_v<CollectionStatsResponse, Response>: {
+            auto count = read<std::uint64_t>(b);
+            auto memory_usage = read<std::uint64_t>(b);
+            auto max_memory = read<std::uint64_t>(b);
+            auto hit_count = read<std::uint64_t>(b);
+            auto miss_count = read<std::uint64_t>(b);
+            auto eviction_count = read<std::uint64_t>(b);
+
+            if (!count || !memory_usage || !max_memory || !hit_count || !miss_count ||
+                !eviction_count) {
+                return ReadResult::INCOMPLETE;
+            }
+
+            res = CollectionStatsResponse{*count,     *memory_usage, *max_memory,
+                                          *hit_count, *miss_count,   *eviction_count};
+        } break;
+
         default:
             return ReadResult::INVALID;
     }
@@ -362,6 +622,8 @@ void write(WriteFn write_fn, const Command& cmd) {
             [&](const CreateCollectionCommand& cmd) {
                 write(write_fn, LengthPrefixedString{cmd.name});
                 write(write_fn, LengthPrefixedString{cmd.schema_name});
+                write(write_fn, cmd.max_memory);
+                write(write_fn, static_cast<std::uint8_t>(cmd.eviction));
             },
             [&](const GetSchemaCommand& cmd) { write(write_fn, LengthPrefixedString{cmd.name}); },
             [&](const GetCollectionSchemaCommand& cmd) {
@@ -370,6 +632,7 @@ void write(WriteFn write_fn, const Command& cmd) {
             [&](const GetCommand& cmd) {
                 write(write_fn, LengthPrefixedString{cmd.coll_name});
                 write(write_fn, LengthPrefixedString{{cmd.key.data, cmd.key.len}});
+                ::write(write_fn, cmd.fields);
             },
             [&](const PutCommand& cmd) {
                 write(write_fn, LengthPrefixedString{cmd.coll_name});
@@ -379,6 +642,59 @@ void write(WriteFn write_fn, const Command& cmd) {
                 write(write_fn, LengthPrefixedString{cmd.coll_name});
                 write(write_fn, LengthPrefixedString{{cmd.key.data, cmd.key.len}});
             },
+            [&](const MultiGetCommand& cmd) {
+                write(write_fn, LengthPrefixedString{cmd.coll_name});
+                ::write(write_fn, cmd.keys);
+                ::write(write_fn, cmd.fields);
+            },
+            [&](const MultiPutCommand& cmd) {
+                write(write_fn, LengthPrefixedString{cmd.coll_name});
+                ::write(write_fn, cmd.values);
+            },
+            [&](const MultiDeleteCommand& cmd) {
+                write(write_fn, LengthPrefixedString{cmd.coll_name});
+                ::write(write_fn, cmd.keys);
+            },
+            [&](const PutWithTtlCommand& cmd) {
+                write(write_fn, LengthPrefixedString{cmd.coll_name});
+                write(write_fn, LengthPrefixedString{{cmd.value.data, cmd.value.len}});
+                write(write_fn, cmd.ttl_ms);
+            },
+            [&](const SetCommand& cmd) {
+                write(write_fn, LengthPrefixedString{cmd.coll_name});
+                write(write_fn, LengthPrefixedString{{cmd.key.data, cmd.key.len}});
+                write(write_fn, static_cast<std::uint32_t>(cmd.updates.size()));
+
+                for (const auto& update : cmd.updates) {
+                    write(write_fn, static_cast<std::uint8_t>(update.op));
+                    write(write_fn, LengthPrefixedString{update.path});
+                    write(write_fn, LengthPrefixedString{{update.value.data, update.value.len}});
+                    write(write_fn,
+                          LengthPrefixedString{{update.expected.data, update.expected.len}});
+                }
+            },
+            [&](const CreateIndexCommand& cmd) {
+                write(write_fn, LengthPrefixedString{cmd.coll_name});
+                write(write_fn, LengthPrefixedString{cmd.field});
+                write(write_fn, static_cast<std::uint8_t>(cmd.type));
+            },
+            [&](const QueryCommand& cmd) {
+                write(write_fn, LengthPrefixedString{cmd.coll_name});
+                write(write_fn, LengthPrefixedString{cmd.field});
+                write(write_fn, static_cast<std::uint8_t>(cmd.op));
+                write(write_fn, LengthPrefixedString{{cmd.min.data, cmd.min.len}});
+                write(write_fn, LengthPrefixedString{{cmd.max.data, cmd.max.len}});
+                write(write_fn, cmd.limit);
+                ::write(write_fn, cmd.fields);
+            },
+            [&](const GetCollectionStatsCommand& cmd) {
+                write(write_fn, LengthPrefixedString{cmd.coll_name});
+            },
+            [&](const PutWithExpiryCommand& cmd) {
+                write(write_fn, LengthPrefixedString{cmd.coll_name});
+                write(write_fn, LengthPrefixedString{{cmd.value.data, cmd.value.len}});
+                write(write_fn, cmd.expires_at);
+            },
             [](auto) {}},
         cmd);
 }
@@ -394,8 +710,27 @@ void write(WriteFn write_fn, const Response& res) {
                 write(write_fn, LengthPrefixedString{{res.value.data, res.value.len}});
             },
             [&](const StringResponse& res) { write(write_fn, LengthPrefixedString{res.value}); },
-            [&](const SchemaResponse& res) { ::write(write_fn, res.schema); }, [](auto) {}},
+            [&](const SchemaResponse& res) { ::write(write_fn, res.schema); },
+            [&](const MultiFoundResponse& res) { ::write(write_fn, res.values); },
+            [&](const CollectionStatsResponse& res) {
+                write(write_fn, res.count);
+                write(write_fn, res.memory_usage);
+                write(write_fn, res.max_memory);
+                write(write_fn, res.hit_count);
+                write(write_fn, res.miss_count);
+                write(write_fn, res.eviction_count);
+            },
+            [](auto) {}},
         res);
 }
 
+void write_found_response_header(WriteFn write_fn, std::size_t value_len) {
+    write(write_fn, static_cast<uint8_t>(type_index_v<FoundResponse, Response>));
+    write(write_fn, static_cast<LengthPrefixType>(value_len));
+}
+
+ReadResult read(ConstBuffer& b, Schema& schema) { return ::read(b, schema); }
+
+void write(WriteFn write_fn, const Schema& schema) { ::write(write_fn, schema); }
+
 }  // namespace boutique
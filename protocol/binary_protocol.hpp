@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory_resource>
 #include <string_view>
 #include <variant>
 #include <vector>
@@ -16,10 +17,21 @@ enum class ReadResult { SUCCESS, INCOMPLETE, INVALID };
 
 // TODO This function actually mutates the buffer passed in if the read is complete.
 // That's a little confusing because the buffer is called a ConstBuffer.
-[[nodiscard]] ReadResult read(ConstBuffer& b, Command& cmd);
-[[nodiscard]] ReadResult read(ConstBuffer& b, Response& res);
+// The lists in batch commands/responses are allocated from mem.
+[[nodiscard]] ReadResult read(ConstBuffer& b, Command& cmd,
+                              std::pmr::memory_resource* mem = std::pmr::get_default_resource());
+[[nodiscard]] ReadResult read(ConstBuffer& b, Response& res,
+                              std::pmr::memory_resource* mem = std::pmr::get_default_resource());
 
 void write(WriteFn write_fn, const Command& cmd);
 void write(WriteFn write_fn, const Response& res);
 
+// Schemas on their own, e.g. for storing them somewhere other than in a message
+[[nodiscard]] ReadResult read(ConstBuffer& b, Schema& schema);
+void write(WriteFn write_fn, const Schema& schema);
+
+// Writes a FoundResponse for a value of the given length, minus the value itself, which has to
+// be sent right after. Lets a large value go out from wherever it lives without being copied.
+void write_found_response_header(WriteFn write_fn, std::size_t value_len);
+
 }  // namespace boutique
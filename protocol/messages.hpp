@@ -1,11 +1,17 @@
 #pragma once
 
+#include <cstdint>
+#include <memory_resource>
 #include <string_view>
 #include <variant>
+#include <vector>
 
 #include "core/const_buffer.hpp"
 #include "core/span.hpp"
+#include "db/eviction.hpp"
+#include "db/field_update.hpp"
 #include "db/schema.hpp"
+#include "db/secondary_index.hpp"
 
 namespace boutique {
 
@@ -14,9 +20,13 @@ struct RegisterSchemaCommand {
     Schema schema;
 };
 
+// max_memory and eviction work like the CollectionOptions of the same names, with 0 for no
+// limit. Every worker holds its own shard of the collection, and the limit is on each of them.
 struct CreateCollectionCommand {
     std::string_view name;
     std::string_view schema_name;
+    std::uint64_t max_memory = 0;
+    EvictionPolicy eviction = EvictionPolicy::NONE;
 };
 
 struct GetSchemaCommand {
@@ -27,9 +37,12 @@ struct GetCollectionSchemaCommand {
     std::string_view name;
 };
 
+// Responds with a FoundResponse holding the whole document, or just the given fields if there
+// are any (see Projection), and InvalidCommandResponse if one of them isn't a field
 struct GetCommand {
     std::string_view coll_name;
     ConstBuffer key;
+    std::pmr::vector<std::string_view> fields;
 };
 
 struct PutCommand {
@@ -42,9 +55,107 @@ struct DeleteCommand {
     ConstBuffer key;
 };
 
+// Batched versions of the above for keys/documents which are all in the same collection. These
+// save the per-command overhead (parsing, finding the collection, a response each) and let the
+// server overlap the lookups.
+//
+// Their lists use polymorphic allocators so that the server can parse them into a per-request
+// arena; they default to the heap like a regular vector.
+
+// Responds with a MultiFoundResponse. fields works like it does for GetCommand.
+struct MultiGetCommand {
+    std::string_view coll_name;
+    std::pmr::vector<ConstBuffer> keys;
+    std::pmr::vector<std::string_view> fields;
+};
+
+// Responds with FailedResponse if any of the documents couldn't be put, although the rest
+// still are
+struct MultiPutCommand {
+    std::string_view coll_name;
+    std::pmr::vector<ConstBuffer> values;
+};
+
+struct MultiDeleteCommand {
+    std::string_view coll_name;
+    std::pmr::vector<ConstBuffer> keys;
+};
+
+// Like PutCommand, but the document expires ttl_ms milliseconds from when it's put, after
+// which it's as good as deleted. Putting the same key again without a TTL takes it away.
+struct PutWithTtlCommand {
+    std::string_view coll_name;
+    ConstBuffer value;
+    std::uint64_t ttl_ms = 0;
+};
+
+// Changes some fields of the document with the given key in place (see Collection::update),
+// so only the fields being changed have to be sent. Responds with NotFoundResponse if there's
+// no such document, InvalidCommandResponse if an update doesn't fit its field, and
+// FailedResponse if a COMPARE_AND_SET didn't match, in which case nothing is changed.
+struct SetCommand {
+    std::string_view coll_name;
+    ConstBuffer key;
+    std::pmr::vector<FieldUpdate> updates;
+};
+
+// Adds a secondary index on a field of the collection (see Collection::create_index). Responds
+// with InvalidCommandResponse if the field can't have one.
+struct CreateIndexCommand {
+    std::string_view coll_name;
+    std::string_view field;
+    SecondaryIndexType type = SecondaryIndexType::HASH;
+};
+
+// Finds documents by a field with a secondary index rather than by their key, on every shard.
+// Responds with a MultiFoundResponse of the matching documents (or just the given fields of
+// them, like GetCommand), and InvalidCommandResponse if the field has no index which can do
+// the query or a value doesn't fit it.
+struct QueryCommand {
+    enum class Op : std::uint8_t {
+        // Documents whose field is min
+        EQUAL,
+
+        // Documents whose field is between min and max, inclusive, in order of their values.
+        // An empty min or max leaves that end open. Needs an ORDERED index.
+        RANGE,
+    };
+
+    std::string_view coll_name;
+    std::string_view field;
+
+    Op op = Op::EQUAL;
+
+    // Encoded like FieldUpdate::value
+    ConstBuffer min;
+    ConstBuffer max;
+
+    // Most documents to respond with, or 0 for all of them
+    std::uint32_t limit = 0;
+
+    std::pmr::vector<std::string_view> fields;
+};
+
+// Responds with a CollectionStatsResponse covering every shard of the collection
+struct GetCollectionStatsCommand {
+    std::string_view coll_name;
+};
+
+// What a PutWithTtlCommand is logged as, with ttl_ms worked out into when the document expires
+// (milliseconds since the Unix epoch) so that replaying it later doesn't extend the document's
+// life. It's only ever read back from the WAL; clients sending it get InvalidCommandResponse.
+struct PutWithExpiryCommand {
+    std::string_view coll_name;
+    ConstBuffer value;
+    std::uint64_t expires_at = 0;
+};
+
 using Command =
     std::variant<std::monostate, RegisterSchemaCommand, CreateCollectionCommand, GetSchemaCommand,
-                 GetCollectionSchemaCommand, GetCommand, PutCommand, DeleteCommand>;
+                 GetCollectionSchemaCommand, GetCommand, PutCommand, DeleteCommand,
+                 MultiGetCommand, MultiPutCommand, MultiDeleteCommand, PutWithTtlCommand,
+                 SetCommand, CreateIndexCommand, QueryCommand, GetCollectionStatsCommand,
+                 PutWithExpiryCommand>;
 
 struct SuccessResponse {};
 
@@ -66,8 +177,25 @@ struct SchemaResponse {
     Schema schema;
 };
 
+// One value per key of the MultiGetCommand, in the same order. Keys which weren't found get
+// an empty value.
+struct MultiFoundResponse {
+    std::pmr::vector<ConstBuffer> values;
+};
+
+// Summed over every shard (see CollectionStats)
+struct CollectionStatsResponse {
+    std::uint64_t count = 0;
+    std::uint64_t memory_usage = 0;
+    std::uint64_t max_memory = 0;
+    std::uint64_t hit_count = 0;
+    std::uint64_t miss_count = 0;
+    std::uint64_t eviction_count = 0;
+};
+
 using Response =
     std::variant<std::monostate, SuccessResponse, FailedResponse, InvalidCommandResponse,
-                 NotFoundResponse, FoundResponse, StringResponse, SchemaResponse>;
+                 NotFoundResponse, FoundResponse, StringResponse, SchemaResponse,
+                 MultiFoundResponse, CollectionStatsResponse>;
 
 }  // namespace boutique
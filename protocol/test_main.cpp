@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <cassert>
+#include <vector>
 
 #include "binary_protocol.hpp"
 #include "messages.hpp"
@@ -37,6 +38,7 @@ int main(int argc, char** argv) {
     GetCommand get_cmd;
 
     get_cmd.key = ConstBuffer{"hello"};
+    get_cmd.fields = {"name", "address.street"};
 
     PutCommand put_cmd;
 
@@ -47,6 +49,7 @@ int main(int argc, char** argv) {
         assert(std::get<GetCommand>(cmd).key.len == get_cmd.key.len);
         assert(std::memcmp(std::get<GetCommand>(cmd).key.data, get_cmd.key.data, get_cmd.key.len) ==
                0);
+        assert(std::get<GetCommand>(cmd).fields == get_cmd.fields);
     });
 
     write_read_check<Command>(put_cmd, [&](auto& cmd) {
@@ -56,10 +59,151 @@ int main(int argc, char** argv) {
                            put_cmd.value.len) == 0);
     });
 
+    MultiGetCommand multi_get_cmd{"coll",
+                                  {ConstBuffer{"a"}, ConstBuffer{"bc"}, ConstBuffer{"def"}}};
+
+    write_read_check<Command>(multi_get_cmd, [&](auto& cmd) {
+        assert(std::holds_alternative<MultiGetCommand>(cmd));
+
+        const auto& keys = std::get<MultiGetCommand>(cmd).keys;
+
+        assert(keys.size() == 3);
+        assert(keys[2].len == multi_get_cmd.keys[2].len);
+        assert(std::memcmp(keys[2].data, "def", keys[2].len) == 0);
+        assert(std::get<MultiGetCommand>(cmd).fields.empty());
+    });
+
+    write_read_check<Command>(MultiDeleteCommand{"coll", {}}, [&](auto& cmd) {
+        assert(std::holds_alternative<MultiDeleteCommand>(cmd));
+        assert(std::get<MultiDeleteCommand>(cmd).keys.empty());
+    });
+
+    write_read_check<Command>(PutWithTtlCommand{"coll", ConstBuffer{"hello"}, 1000},
+                              [&](auto& cmd) {
+                                  assert(std::holds_alternative<PutWithTtlCommand>(cmd));
+
+                                  const auto& put = std::get<PutWithTtlCommand>(cmd);
+
+                                  assert(put.coll_name == "coll" && put.value.len == 6);
+                                  assert(put.ttl_ms == 1000);
+                              });
+
+    write_read_check<Command>(PutWithExpiryCommand{"coll", ConstBuffer{"hello"}, 1234},
+                              [&](auto& cmd) {
+                                  assert(std::holds_alternative<PutWithExpiryCommand>(cmd));
+
+                                  const auto& put = std::get<PutWithExpiryCommand>(cmd);
+
+                                  assert(put.coll_name == "coll" && put.value.len == 6);
+                                  assert(put.expires_at == 1234);
+                              });
+
+    write_read_check<Command>(
+        CreateCollectionCommand{"coll", "schema", 1 << 20, EvictionPolicy::LFU}, [&](auto& cmd) {
+            assert(std::holds_alternative<CreateCollectionCommand>(cmd));
+
+            const auto& create = std::get<CreateCollectionCommand>(cmd);
+
+            assert(create.name == "coll" && create.schema_name == "schema");
+            assert(create.max_memory == 1 << 20 && create.eviction == EvictionPolicy::LFU);
+        });
+
+    // An eviction policy past the last one
+    {
+        std::vector<char> data;
+
+        auto write_fn = [&](size_t len) {
+            data.resize(data.size() + len);
+            return &data[data.size() - len];
+        };
+
+        write(write_fn, CreateCollectionCommand{"coll", "schema"});
+
+        data.back() = static_cast<char>(static_cast<std::uint8_t>(EvictionPolicy::CLOCK) + 1);
+
+        ConstBuffer cbuf{data.data(), data.size()};
+        Command cmd;
+
+        assert(read(cbuf, cmd) == ReadResult::INVALID);
+    }
+
+    write_read_check<Command>(GetCollectionStatsCommand{"coll"}, [&](auto& cmd) {
+        assert(std::get<GetCollectionStatsCommand>(cmd).coll_name == "coll");
+    });
+
+    std::uint64_t delta = 5;
+
+    SetCommand set_cmd{"coll", ConstBuffer{"key"}, {}};
+
+    set_cmd.updates.push_back({FieldUpdate::Op::SET, "name", ConstBuffer{"bob"}});
+    set_cmd.updates.push_back({FieldUpdate::Op::ADD, "address.number",
+                               {reinterpret_cast<const char*>(&delta), sizeof(delta)}});
+    set_cmd.updates.push_back(
+        {FieldUpdate::Op::COMPARE_AND_SET, "active", ConstBuffer{"\x01"}, ConstBuffer{"\x00"}});
+
+    write_read_check<Command>(set_cmd, [&](auto& cmd) {
+        assert(std::holds_alternative<SetCommand>(cmd));
+
+        const auto& set = std::get<SetCommand>(cmd);
+
+        assert(set.coll_name == "coll" && set.updates.size() == 3);
+        assert(set.updates[1].op == FieldUpdate::Op::ADD);
+        assert(set.updates[1].path == "address.number");
+        assert(std::memcmp(set.updates[1].value.data, &delta, sizeof(delta)) == 0);
+        assert(set.updates[2].op == FieldUpdate::Op::COMPARE_AND_SET);
+        assert(set.updates[2].expected.len == set_cmd.updates[2].expected.len);
+    });
+
+    write_read_check<Command>(
+        CreateIndexCommand{"coll", "address.number", SecondaryIndexType::ORDERED},
+        [&](auto& cmd) {
+            assert(std::holds_alternative<CreateIndexCommand>(cmd));
+
+            const auto& create = std::get<CreateIndexCommand>(cmd);
+
+            assert(create.coll_name == "coll" && create.field == "address.number");
+            assert(create.type == SecondaryIndexType::ORDERED);
+        });
+
+    QueryCommand query_cmd{"coll", "name", QueryCommand::Op::RANGE, {}, ConstBuffer{"m"}, 10};
+
+    query_cmd.fields = {"name"};
+
+    write_read_check<Command>(query_cmd, [&](auto& cmd) {
+        assert(std::holds_alternative<QueryCommand>(cmd));
+
+        const auto& query = std::get<QueryCommand>(cmd);
+
+        assert(query.coll_name == "coll" && query.field == "name");
+        assert(query.op == QueryCommand::Op::RANGE && query.limit == 10);
+        assert(query.min.len == 0 && query.max.len == query_cmd.max.len);
+        assert(query.fields == query_cmd.fields);
+    });
+
     FoundResponse found_res;
 
     found_res.value = ConstBuffer{"hello"};
 
+    // The header followed by the value is the same as the whole response
+    {
+        std::vector<char> whole;
+        std::vector<char> split;
+
+        auto writer = [](std::vector<char>& buf) {
+            return [&](size_t len) {
+                buf.resize(buf.size() + len);
+                return &buf[buf.size() - len];
+            };
+        };
+
+        write(writer(whole), Response{found_res});
+
+        write_found_response_header(writer(split), found_res.value.len);
+        split.insert(split.end(), found_res.value.data, found_res.value.data + found_res.value.len);
+
+        assert(whole == split);
+    }
+
     NotFoundResponse not_found_res;
     SuccessResponse success_res;
 
@@ -76,5 +220,26 @@ int main(int argc, char** argv) {
     write_read_check<Response>(
         success_res, [&](auto& res) { assert(std::holds_alternative<SuccessResponse>(res)); });
 
+    // Keys which weren't found come back as empty values
+    MultiFoundResponse multi_found_res{{ConstBuffer{"hello"}, ConstBuffer{}}};
+
+    write_read_check<Response>(multi_found_res, [&](auto& res) {
+        assert(std::holds_alternative<MultiFoundResponse>(res));
+
+        const auto& values = std::get<MultiFoundResponse>(res).values;
+
+        assert(values.size() == 2);
+        assert(values[0].len == multi_found_res.values[0].len);
+        assert(std::memcmp(values[0].data, "hello", values[0].len) == 0);
+        assert(values[1].len == 0);
+    });
+
+    write_read_check<Response>(CollectionStatsResponse{1, 2, 3, 4, 5, 6}, [&](auto& res) {
+        const auto& stats = std::get<CollectionStatsResponse>(res);
+
+        assert(stats.count == 1 && stats.memory_usage == 2 && stats.max_memory == 3);
+        assert(stats.hit_count == 4 && stats.miss_count == 5 && stats.eviction_count == 6);
+    });
+
     return 0;
 }
@@ -0,0 +1,514 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "core/logger.hpp"
+#include "core/streambuf.hpp"
+#include "io/socket.hpp"
+#include "protocol/binary_protocol.hpp"
+#include "server.hpp"
+
+namespace {
+
+const unsigned short PORT = 42691;
+
+const auto RUN_DURATION = std::chrono::seconds{2};
+
+const int CLIENTS_PER_WORKER = 4;
+const int PIPELINE_DEPTH = 32;
+
+const std::uint64_t KEY_COUNT = 100'000;
+
+// Enough that snapshotting takes a while
+const std::uint64_t SNAPSHOT_KEY_COUNT = 4'000'000;
+
+// Keys each client gets per round trip in the batching benchmark, however they're split up
+// into commands
+const std::uint32_t KEYS_PER_ROUND = 256;
+
+struct Doc {
+    std::uint64_t id = 0;
+    std::uint64_t value = 0;
+};
+
+// Synchronous client which pipelines a batch of commands and then waits for all of the
+// responses.
+struct Client {
+    explicit Client(unsigned short port)
+        : m_socket{boutique::Socket::ConnectParams{"localhost", port}} {
+        m_socket.set_non_blocking(false);
+        m_socket.set_no_delay(true);
+    }
+
+    void queue(const boutique::Command& cmd) {
+        auto writer = [&](size_t len) {
+            m_out.resize(m_out.size() + len);
+            return m_out.data() + m_out.size() - len;
+        };
+
+        write(writer, cmd);
+    }
+
+    void flush(int response_count) {
+        for (std::size_t n = 0; n < m_out.size();) {
+            n += m_socket.send(m_out.data() + n, static_cast<int>(m_out.size() - n));
+        }
+
+        m_out.clear();
+
+        char buf[4096];
+
+        while (response_count > 0) {
+            auto n = m_socket.recv(buf, sizeof(buf));
+
+            if (n == 0) {
+                std::cerr << "Server closed the connection.\n";
+                std::exit(1);
+            }
+
+            m_stream.append(buf, n);
+
+            auto res_buf = as_const_buffer(m_stream);
+
+            boutique::Response res;
+
+            while (response_count > 0 && read(res_buf, res) == boutique::ReadResult::SUCCESS) {
+                if (std::holds_alternative<boutique::InvalidCommandResponse>(res) ||
+                    std::holds_alternative<boutique::FailedResponse>(res)) {
+                    std::cerr << "Command failed.\n";
+                    std::exit(1);
+                }
+
+                response_count -= 1;
+            }
+
+            m_stream.consume(res_buf.data - m_stream.data());
+        }
+    }
+
+private:
+    boutique::Socket m_socket;
+
+    std::vector<char> m_out;
+    boutique::StreamBuf m_stream;
+};
+
+std::uint64_t run_client(int seed, const std::atomic<bool>& done, bool puts_only = false) {
+    using namespace boutique;
+
+    Client client{PORT};
+
+    std::mt19937_64 rng{static_cast<std::uint64_t>(seed)};
+
+    std::uint64_t op_count = 0;
+
+    Doc doc;
+
+    while (!done.load(std::memory_order_relaxed)) {
+        // Half gets and half puts over random keys
+        for (int i = 0; i < PIPELINE_DEPTH; ++i) {
+            doc.id = rng() % KEY_COUNT;
+
+            if (puts_only || (rng() & 1)) {
+                doc.value = op_count;
+                client.queue(
+                    PutCommand{"docs", {reinterpret_cast<const char*>(&doc), sizeof(doc)}});
+            } else {
+                client.queue(
+                    GetCommand{"docs", {reinterpret_cast<const char*>(&doc.id), sizeof(doc.id)}});
+            }
+        }
+
+        client.flush(PIPELINE_DEPTH);
+
+        op_count += PIPELINE_DEPTH;
+    }
+
+    return op_count;
+}
+
+void create_docs_collection() {
+    using namespace boutique;
+
+    Client setup{PORT};
+
+    Schema schema{{{"id", UInt64Type{}}, {"value", UInt64Type{}}}};
+
+    setup.queue(RegisterSchemaCommand{"doc", schema});
+    setup.flush(1);
+
+    setup.queue(CreateCollectionCommand{"docs", "doc"});
+    setup.flush(1);
+}
+
+double bench_workers(std::uint32_t worker_count) {
+    using namespace boutique;
+
+    Server server{PORT, worker_count};
+
+    std::thread server_thread{[&] { server.run(); }};
+
+    create_docs_collection();
+
+    std::atomic<bool> done{false};
+
+    auto client_count = worker_count * CLIENTS_PER_WORKER;
+
+    std::vector<std::uint64_t> op_counts(client_count);
+    std::vector<std::thread> clients;
+
+    for (std::uint32_t i = 0; i < client_count; ++i) {
+        clients.emplace_back([&, i] { op_counts[i] = run_client(i, done); });
+    }
+
+    std::this_thread::sleep_for(RUN_DURATION);
+
+    done = true;
+
+    for (auto& client : clients) {
+        client.join();
+    }
+
+    server.stop();
+    server_thread.join();
+
+    std::uint64_t total = 0;
+
+    for (auto count : op_counts) {
+        total += count;
+    }
+
+    auto ops_per_sec =
+        static_cast<double>(total) / std::chrono::duration<double>(RUN_DURATION).count();
+
+    std::cout << worker_count << " workers, " << client_count << " clients: " << ops_per_sec
+              << " ops/s.\n";
+
+    return ops_per_sec;
+}
+
+// Gets KEYS_PER_ROUND random keys per round trip, batch_size keys to a command. A batch size of
+// 1 sends plain GetCommands.
+std::uint64_t run_batch_client(int seed, std::uint32_t batch_size,
+                               const std::atomic<bool>& done) {
+    using namespace boutique;
+
+    Client client{PORT};
+
+    std::mt19937_64 rng{static_cast<std::uint64_t>(seed)};
+
+    std::uint64_t key_count = 0;
+
+    std::uint64_t keys[KEYS_PER_ROUND];
+
+    auto key_buf = [&](std::uint32_t i) {
+        return ConstBuffer{reinterpret_cast<const char*>(&keys[i]), sizeof(keys[i])};
+    };
+
+    while (!done.load(std::memory_order_relaxed)) {
+        for (auto& key : keys) {
+            key = rng() % KEY_COUNT;
+        }
+
+        if (batch_size == 1) {
+            for (std::uint32_t i = 0; i < KEYS_PER_ROUND; ++i) {
+                client.queue(GetCommand{"docs", key_buf(i)});
+            }
+        } else {
+            for (std::uint32_t first = 0; first < KEYS_PER_ROUND; first += batch_size) {
+                MultiGetCommand cmd{"docs", {}};
+
+                for (std::uint32_t i = first; i < first + batch_size; ++i) {
+                    cmd.keys.push_back(key_buf(i));
+                }
+
+                client.queue(cmd);
+            }
+        }
+
+        client.flush(KEYS_PER_ROUND / batch_size);
+
+        key_count += KEYS_PER_ROUND;
+    }
+
+    return key_count;
+}
+
+void bench_batch_sizes(std::uint32_t worker_count) {
+    using namespace boutique;
+
+    Server server{PORT, worker_count};
+
+    std::thread server_thread{[&] { server.run(); }};
+
+    create_docs_collection();
+
+    // Every key is present, loaded in batches as well
+    {
+        Client setup{PORT};
+
+        std::vector<Doc> docs(KEYS_PER_ROUND);
+
+        for (std::uint64_t first = 0; first < KEY_COUNT; first += KEYS_PER_ROUND) {
+            MultiPutCommand cmd{"docs", {}};
+
+            for (std::uint64_t i = 0; i < KEYS_PER_ROUND && first + i < KEY_COUNT; ++i) {
+                docs[i] = {first + i, first + i};
+                cmd.values.push_back({reinterpret_cast<const char*>(&docs[i]), sizeof(Doc)});
+            }
+
+            setup.queue(cmd);
+            setup.flush(1);
+        }
+    }
+
+    auto client_count = worker_count * CLIENTS_PER_WORKER;
+
+    for (std::uint32_t batch_size : {1u, 16u, 256u}) {
+        std::atomic<bool> done{false};
+
+        std::vector<std::uint64_t> key_counts(client_count);
+        std::vector<std::thread> clients;
+
+        for (std::uint32_t i = 0; i < client_count; ++i) {
+            clients.emplace_back(
+                [&, i] { key_counts[i] = run_batch_client(i, batch_size, done); });
+        }
+
+        std::this_thread::sleep_for(RUN_DURATION);
+
+        done = true;
+
+        for (auto& client : clients) {
+            client.join();
+        }
+
+        std::uint64_t total = 0;
+
+        for (auto count : key_counts) {
+            total += count;
+        }
+
+        std::cout << "Batch size " << batch_size << ": "
+                  << static_cast<double>(total) /
+                         std::chrono::duration<double>(RUN_DURATION).count()
+                  << " keys/s.\n";
+    }
+
+    server.stop();
+    server_thread.join();
+}
+
+// Puts only, so that every command is logged
+void bench_wal(std::uint32_t worker_count) {
+    using namespace boutique;
+
+    auto dir = std::filesystem::temp_directory_path() / "boutique_benchmark_wal";
+
+    struct Policy {
+        const char* name;
+        std::optional<Wal::Durability> durability;
+    };
+
+    const Policy policies[] = {{"No WAL", std::nullopt},
+                               {"Write every 10ms", Wal::Durability::WRITE},
+                               {"Write and sync every 10ms", Wal::Durability::INTERVAL},
+                               {"Sync before acknowledging", Wal::Durability::SYNC}};
+
+    for (const auto& policy : policies) {
+        std::filesystem::remove_all(dir);
+
+        std::optional<Wal::Params> wal_params;
+
+        if (policy.durability) {
+            wal_params.emplace();
+            wal_params->dir = dir.string();
+            wal_params->durability = *policy.durability;
+        }
+
+        Server server{PORT, worker_count, {}, wal_params};
+
+        std::thread server_thread{[&] { server.run(); }};
+
+        create_docs_collection();
+
+        std::atomic<bool> done{false};
+
+        auto client_count = worker_count * CLIENTS_PER_WORKER;
+
+        std::vector<std::uint64_t> op_counts(client_count);
+        std::vector<std::thread> clients;
+
+        for (std::uint32_t i = 0; i < client_count; ++i) {
+            clients.emplace_back([&, i] { op_counts[i] = run_client(i, done, true); });
+        }
+
+        std::this_thread::sleep_for(RUN_DURATION);
+
+        done = true;
+
+        for (auto& client : clients) {
+            client.join();
+        }
+
+        server.stop();
+        server_thread.join();
+
+        std::uint64_t total = 0;
+
+        for (auto count : op_counts) {
+            total += count;
+        }
+
+        std::cout << policy.name << ": "
+                  << static_cast<double>(total) /
+                         std::chrono::duration<double>(RUN_DURATION).count()
+                  << " puts/s.\n";
+    }
+
+    std::filesystem::remove_all(dir);
+}
+
+// Snapshots a database of SNAPSHOT_KEY_COUNT documents while puts carry on over the first
+// KEY_COUNT of them
+void bench_snapshot(std::uint32_t worker_count) {
+    using namespace boutique;
+
+    auto dir = std::filesystem::temp_directory_path() / "boutique_benchmark_snapshot";
+
+    std::filesystem::remove_all(dir);
+
+    Wal::Params wal_params;
+
+    wal_params.dir = dir.string();
+
+    Server server{PORT, worker_count, {}, wal_params};
+
+    std::thread server_thread{[&] { server.run(); }};
+
+    create_docs_collection();
+
+    {
+        Client setup{PORT};
+
+        std::vector<Doc> docs(KEYS_PER_ROUND);
+
+        for (std::uint64_t first = 0; first < SNAPSHOT_KEY_COUNT; first += KEYS_PER_ROUND) {
+            MultiPutCommand cmd{"docs", {}};
+
+            for (std::uint64_t i = 0; i < KEYS_PER_ROUND && first + i < SNAPSHOT_KEY_COUNT;
+                 ++i) {
+                docs[i] = {first + i, first + i};
+                cmd.values.push_back({reinterpret_cast<const char*>(&docs[i]), sizeof(Doc)});
+            }
+
+            setup.queue(cmd);
+            setup.flush(1);
+        }
+    }
+
+    auto report = [](const char* name, const SnapshotStats& stats) {
+        if (!stats.ok) {
+            std::cerr << "Snapshot failed.\n";
+            std::exit(1);
+        }
+
+        std::cout << name << ": " << stats.bytes << " bytes in " << stats.duration.count()
+                  << "ms, paused for " << stats.pause.count() << "us, "
+                  << stats.extra_memory / 1024 << "KiB of extra memory.\n";
+    };
+
+    report("Idle", server.snapshot());
+
+    std::atomic<bool> done{false};
+
+    auto client_count = worker_count * CLIENTS_PER_WORKER;
+
+    std::vector<std::thread> clients;
+
+    for (std::uint32_t i = 0; i < client_count; ++i) {
+        clients.emplace_back([&, i] { run_client(i, done, true); });
+    }
+
+    // Let the clients get going first
+    std::this_thread::sleep_for(RUN_DURATION / 4);
+
+    report("Under puts", server.snapshot());
+
+    done = true;
+
+    for (auto& client : clients) {
+        client.join();
+    }
+
+    // So that restarting is all loading the snapshot rather than replaying the log
+    report("After puts", server.snapshot());
+
+    server.stop();
+    server_thread.join();
+
+    for (bool map : {false, true}) {
+        wal_params.map_snapshots = map;
+
+        auto start = std::chrono::steady_clock::now();
+
+        Server restarted{PORT, worker_count, {}, wal_params};
+
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << (map ? "Restart mapping snapshots: " : "Restart reading snapshots: ")
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+                  << "ms.\n";
+    }
+
+    std::filesystem::remove_all(dir);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    using namespace boutique;
+
+    Logger::instance().configure(Logger::Level::ERROR, 0);
+
+    auto max_workers = std::max(2u, std::thread::hardware_concurrency());
+
+    std::cout << "50/50 get/put over " << KEY_COUNT << " keys, pipeline depth " << PIPELINE_DEPTH
+              << ".\n";
+
+    double base = 0;
+
+    for (std::uint32_t workers = 1; workers <= max_workers; workers *= 2) {
+        auto ops_per_sec = bench_workers(workers);
+
+        if (workers == 1) {
+            base = ops_per_sec;
+        } else {
+            std::cout << "Speedup over 1 worker: " << ops_per_sec / base << "x.\n";
+        }
+    }
+
+    std::cout << "Random gets, " << KEYS_PER_ROUND << " keys per round trip, " << max_workers
+              << " workers.\n";
+
+    bench_batch_sizes(max_workers);
+
+    std::cout << "Puts over " << KEY_COUNT << " keys, pipeline depth " << PIPELINE_DEPTH << ", "
+              << max_workers << " workers.\n";
+
+    bench_wal(max_workers);
+
+    std::cout << "Snapshots of " << SNAPSHOT_KEY_COUNT << " keys, " << max_workers
+              << " workers.\n";
+
+    bench_snapshot(max_workers);
+
+    return 0;
+}
@@ -1,26 +1,76 @@
 #include "client_handler.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <memory>
 #include <optional>
+#include <string>
 #include <string_view>
 
 #include "core/bind_front.hpp"
 #include "core/const_buffer.hpp"
 #include "core/logger.hpp"
 #include "core/overloaded_visitor.hpp"
+#include "db/collection.hpp"
+#include "executor.hpp"
 #include "io/helpers.hpp"
 #include "protocol/binary_protocol.hpp"
-#include "server.hpp"
+#include "worker.hpp"
+
+namespace {
+
+template <typename Message>
+std::vector<char> encode_message(const Message& msg) {
+    std::vector<char> buf;
+
+    auto buf_writer = [&](size_t len) {
+        buf.resize(buf.size() + len);
+        auto* ptr = buf.data() + buf.size() - len;
+
+        return ptr;
+    };
+
+    write(buf_writer, msg);
+
+    return buf;
+}
+
+// Found documents at least this big are sent straight from storage rather than being copied
+// into the output buffer. Below this, the copy is cheaper than an extra iovec.
+const std::size_t IN_PLACE_MIN_SIZE = 1024;
+
+std::vector<char> encode(const boutique::Response& res) { return encode_message(res); }
+std::vector<char> encode(const boutique::Command& cmd) { return encode_message(cmd); }
+
+// The keys or documents of a batch command, or nullptr if it isn't one
+const std::pmr::vector<boutique::ConstBuffer>* batch_items(const boutique::Command& cmd) {
+    using namespace boutique;
+
+    return std::visit(
+        OverloadedVisitor{
+            [](const MultiGetCommand& cmd) { return &cmd.keys; },
+            [](const MultiPutCommand& cmd) { return &cmd.values; },
+            [](const MultiDeleteCommand& cmd) { return &cmd.keys; },
+            [](const auto&) -> const std::pmr::vector<ConstBuffer>* { return nullptr; }},
+        cmd);
+}
+
+}  // namespace
 
 namespace boutique {
 
-ClientHandler::ClientHandler(Server& server, Socket socket)
-    : m_server{&server}, m_socket{std::move(socket)} {
+ClientHandler::ClientHandler(Worker& worker, Socket socket, const Params& params)
+    : m_params{params},
+      m_worker{&worker},
+      m_socket{std::move(socket)},
+      m_recv{params.recv_buffer_size} {
     BOUTIQUE_LOG_INFO("Client connected.");
-    m_server->io_context().async_recv(m_socket, m_buf, sizeof(m_buf),
-                                      bind_front(&ClientHandler::recv_handler, this));
+
+    // Responses are small and latency sensitive, don't let Nagle hold them back
+    m_socket.set_no_delay(true);
+
+    start_recv();
 }
 
 Socket& ClientHandler::socket() { return m_socket; }
@@ -33,146 +83,793 @@ void ClientHandler::close() {
 
 bool ClientHandler::closed() const { return m_closed; }
 
+bool ClientHandler::done() const { return m_closed && m_pending.empty() && !m_send_in_flight; }
+
+void ClientHandler::shard_response_handler(std::uint32_t from, std::uint64_t seq,
+                                           std::vector<char> data) {
+    for (auto& pending : m_pending) {
+        if (pending.seq != seq) {
+            continue;
+        }
+
+        assert(pending.acks_remaining > 0);
+
+        pending.acks_remaining -= 1;
+
+        if (pending.split) {
+            pending.split->responses[from] = std::move(data);
+
+            if (pending.acks_remaining == 0) {
+                pending.data = merge_split(*pending.split);
+            }
+        } else if (pending.data.empty()) {
+            // For broadcasts we already have our own response
+            pending.data = std::move(data);
+        }
+
+        break;
+    }
+
+    flush_pending();
+    flush_output();
+}
+
+void ClientHandler::start_recv() {
+    m_recv_paused = false;
+
+    // The client isn't reading its responses, so stop reading its commands until it does
+    if (m_send_in_flight && m_out.size() >= m_params.max_output_size) {
+        m_recv_paused = true;
+        return;
+    }
+
+    auto space = m_recv.prepare();
+
+    if (space.empty()) {
+        // The buffer is full of one incomplete command, so it needs to be bigger. We stay at
+        // the bigger size until the command has been handled.
+        if (!m_recv.grow(m_params.max_command_size)) {
+            BOUTIQUE_LOG_INFO("Command exceeded maximum size, disconnecting.");
+
+            respond(InvalidCommandResponse{});
+            flush_output();
+
+            close();
+            return;
+        }
+
+        space = m_recv.prepare();
+    }
+
+    m_worker->io_context().async_recv(m_socket, space.data, space.len,
+                                      bind_front<&ClientHandler::recv_handler>(this));
+}
+
 void ClientHandler::recv_handler(int len) {
     if (len == 0) {
         close();
         return;
     }
 
-    m_stream.append(m_buf, len);
-
-    auto cmd_buf = as_const_buffer(m_stream);
+    m_recv.commit(len);
 
-    Command cmd;
+    // Commands are parsed and run straight out of the receive buffer
+    auto cmd_buf = m_recv.data();
 
     for (;;) {
-        auto rc_res = read(cmd_buf, cmd);
+        // Whatever the last command allocated has been written out or encoded by now
+        m_arena.reset();
+
+        const auto* cmd_start = cmd_buf.data;
+
+        Command cmd;
+
+        auto rc_res = read(cmd_buf, cmd, &m_arena);
 
         if (rc_res == ReadResult::INCOMPLETE) {
             break;
         }
 
-        const auto write_and_send = [&](const auto& res) {
-            auto buf = std::make_shared<std::vector<char>>();
+        if (rc_res == ReadResult::INVALID) {
+            respond(InvalidCommandResponse{});
+
+            // There's no telling where the next command starts, and keeping the garbage around
+            // would only fill up the buffer
+            cmd_buf.remove_prefix(cmd_buf.len);
+            break;
+        }
+
+        assert(rc_res == ReadResult::SUCCESS);
+
+        auto& db = m_worker->db();
+
+        auto shard = m_worker->index();
+        bool broadcast = false;
+        bool modifies = false;
+
+        // Set for gets of whole documents, since their response might be sent in place.
+        // Projected ones are gathered into m_arena, which the next command reuses.
+        std::string_view get_coll_name;
+
+        std::pmr::vector<std::uint32_t> batch_shards{&m_arena};
+
+        std::visit(OverloadedVisitor{
+                       // Every shard needs all of the schemas and collections
+                       [&](const RegisterSchemaCommand&) {
+                           broadcast = true;
+                           modifies = true;
+                       },
+                       [&](const CreateCollectionCommand&) {
+                           broadcast = true;
+                           modifies = true;
+                       },
+                       [&](const CreateIndexCommand&) {
+                           broadcast = true;
+                           modifies = true;
+                       },
+                       [&](const GetCommand& cmd) {
+                           shard = m_worker->shard_for(cmd.coll_name, cmd.key);
+
+                           if (cmd.fields.empty()) {
+                               get_coll_name = cmd.coll_name;
+                           }
+                       },
+                       [&](const PutCommand& cmd) {
+                           modifies = true;
+
+                           auto* coll = db.collection(cmd.coll_name);
+
+                           // Let the local shard reject it if it's malformed
+                           if (coll && cmd.value.len == coll->doc_size()) {
+                               shard =
+                                   m_worker->shard_for(cmd.coll_name, coll->key(cmd.value.data));
+                           }
+                       },
+                       [&](const PutWithTtlCommand& cmd) {
+                           modifies = true;
+
+                           auto* coll = db.collection(cmd.coll_name);
+
+                           if (coll && cmd.value.len == coll->doc_size()) {
+                               shard =
+                                   m_worker->shard_for(cmd.coll_name, coll->key(cmd.value.data));
+                           }
+                       },
+                       [&](const DeleteCommand& cmd) {
+                           modifies = true;
+                           shard = m_worker->shard_for(cmd.coll_name, cmd.key);
+                       },
+                       [&](const SetCommand& cmd) {
+                           modifies = true;
+                           shard = m_worker->shard_for(cmd.coll_name, cmd.key);
+                       },
+                       [&](const MultiGetCommand& cmd) {
+                           batch_shards = item_shards(cmd.coll_name, cmd.keys, false);
+                       },
+                       [&](const MultiPutCommand& cmd) {
+                           modifies = true;
+                           batch_shards = item_shards(cmd.coll_name, cmd.values, true);
+                       },
+                       [&](const MultiDeleteCommand& cmd) {
+                           modifies = true;
+                           batch_shards = item_shards(cmd.coll_name, cmd.keys, false);
+                       },
+                       [](const auto&) {}},
+                   cmd);
+
+        // Documents with any value of the field could be on any shard
+        if (const auto* query = std::get_if<QueryCommand>(&cmd);
+            query && m_worker->worker_count() > 1) {
+            auto len = static_cast<std::size_t>(cmd_buf.data - cmd_start);
+
+            scatter_query(std::move(*query), {cmd_start, len});
+            continue;
+        }
+
+        // Every shard has its own part of the collection to count
+        if (std::holds_alternative<GetCollectionStatsCommand>(cmd) &&
+            m_worker->worker_count() > 1) {
+            auto split = std::make_unique<SplitBatch>();
 
-            auto buf_writer = [&](size_t len) {
-                buf->resize(buf->size() + len);
-                auto* ptr = buf->data() + buf->size() - len;
+            split->is_stats = true;
+            split->responses.resize(m_worker->worker_count());
 
-                return ptr;
-            };
+            scatter(std::move(split), std::move(cmd), std::vector<char>(cmd_start, cmd_buf.data));
+            continue;
+        }
+
+        if (!batch_shards.empty()) {
+            bool one_shard = std::all_of(batch_shards.begin(), batch_shards.end(),
+                                         [&](auto s) { return s == batch_shards.front(); });
 
-            write(buf_writer, res);
+            if (!one_shard) {
+                if (modifies) {
+                    own_out_refs();
+                }
 
-            auto* buf_data = buf->data();
-            auto buf_size = buf->size();
+                split_batch(cmd, batch_shards);
+                continue;
+            }
+
+            shard = batch_shards.front();
+        }
 
-            // Move the buffer into the function so it is kept alive until sent
-            async_send_all(m_server->io_context(), m_socket, buf_data, buf_size,
-                           [buf = std::move(buf)](int) {});
+        // The raw command is forwarded as-is since cmd points into m_recv
+        const auto make_request = [&](std::uint64_t seq) {
+            return ShardMessage{ShardMessage::Kind::REQUEST, m_worker->index(), this, seq,
+                                std::vector<char>(cmd_start, cmd_buf.data)};
         };
 
-        if (rc_res == ReadResult::INVALID) {
-            write_and_send(InvalidCommandResponse{});
-            break;
+        if (shard != m_worker->index()) {
+            auto seq = m_next_seq++;
+
+            m_pending.push_back({seq, 1, {}});
+            m_worker->send_to(shard, make_request(seq));
+        } else if (broadcast && m_worker->worker_count() > 1) {
+            auto seq = m_next_seq++;
+
+            // Our own shard acks too once its WAL has synced the change
+            auto acks = m_worker->worker_count() - (m_worker->waits_for_wal() ? 0 : 1);
+
+            m_pending.push_back(
+                {seq, acks, encode(execute(db, std::move(cmd), &m_arena, m_worker->wal()))});
+
+            for (std::uint32_t i = 0; i < m_worker->worker_count(); ++i) {
+                if (i != m_worker->index()) {
+                    m_worker->send_to(i, make_request(seq));
+                }
+            }
+
+            if (m_worker->waits_for_wal()) {
+                m_worker->send_when_durable(m_worker->index(), make_response(seq, {}));
+            }
+        } else {
+            // Documents we're about to send in place mustn't change under us
+            if (modifies) {
+                own_out_refs();
+            }
+
+            auto res = execute(db, std::move(cmd), &m_arena, m_worker->wal());
+
+            const auto* found = std::get_if<FoundResponse>(&res);
+
+            if (modifies && m_worker->waits_for_wal()) {
+                auto seq = m_next_seq++;
+
+                m_pending.push_back({seq, 1, {}});
+                m_worker->send_when_durable(m_worker->index(), make_response(seq, encode(res)));
+            } else if (found && !get_coll_name.empty() &&
+                       found->value.len >= IN_PLACE_MIN_SIZE && m_pending.empty() &&
+                       db.collection(get_coll_name)->layout() == StorageLayout::ROW) {
+                // Columnar documents are assembled into a buffer which the next get reuses,
+                // but rows stay put until the collection is modified
+                write_found_response_header([&](size_t len) { return extend_out(len); },
+                                            found->value.len);
+
+                m_out_refs.push_back({m_out.size(), found->value});
+            } else {
+                respond(res);
+            }
         }
+    }
 
-        assert(rc_res == ReadResult::SUCCESS);
+    // Nothing points into the buffer past here, so it's safe for it to move things around
+    m_recv.consume(m_recv.data().len - cmd_buf.len);
+
+    // Everything we could respond to from what we received goes out together
+    flush_output();
+
+    start_recv();
+}
+
+std::pmr::vector<std::uint32_t> ClientHandler::item_shards(
+    std::string_view coll_name, const std::pmr::vector<ConstBuffer>& items, bool docs) {
+    std::pmr::vector<std::uint32_t> shards{&m_arena};
 
-        std::visit(
+    if (m_worker->worker_count() == 1) {
+        return shards;
+    }
+
+    const auto* coll = docs ? m_worker->db().collection(coll_name) : nullptr;
+
+    shards.reserve(items.size());
+
+    for (const auto& item : items) {
+        if (!docs) {
+            shards.push_back(m_worker->shard_for(coll_name, item));
+        } else if (coll && item.len == coll->doc_size()) {
+            shards.push_back(m_worker->shard_for(coll_name, coll->key(item.data)));
+        } else {
+            // Let the local shard reject it if it's malformed
+            shards.push_back(m_worker->index());
+        }
+    }
+
+    return shards;
+}
+
+void ClientHandler::split_batch(const Command& cmd,
+                                const std::pmr::vector<std::uint32_t>& item_shards) {
+    auto worker_count = m_worker->worker_count();
+
+    auto split = std::make_unique<SplitBatch>();
+
+    split->is_get = std::holds_alternative<MultiGetCommand>(cmd);
+    split->positions.resize(worker_count);
+    split->responses.resize(worker_count);
+
+    for (std::uint32_t i = 0; i < item_shards.size(); ++i) {
+        split->positions[item_shards[i]].push_back(i);
+    }
+
+    const auto& items = *batch_items(cmd);
+
+    // The part of the batch which goes to the given shard
+    const auto sub_batch = [&](std::uint32_t shard) {
+        std::pmr::vector<ConstBuffer> sub_items{&m_arena};
+
+        sub_items.reserve(split->positions[shard].size());
+
+        for (auto pos : split->positions[shard]) {
+            sub_items.push_back(items[pos]);
+        }
+
+        return std::visit(
             OverloadedVisitor{
-                [&](RegisterSchemaCommand cmd) {
-                    m_server->db().register_schema(std::string{cmd.name}, std::move(cmd.schema));
-                    write_and_send(SuccessResponse{});
+                [&](const MultiGetCommand& cmd) -> Command {
+                    return MultiGetCommand{
+                        cmd.coll_name, std::move(sub_items),
+                        std::pmr::vector<std::string_view>{cmd.fields, &m_arena}};
+                },
+                [&](const MultiPutCommand& cmd) -> Command {
+                    return MultiPutCommand{cmd.coll_name, std::move(sub_items)};
+                },
+                [&](const MultiDeleteCommand& cmd) -> Command {
+                    return MultiDeleteCommand{cmd.coll_name, std::move(sub_items)};
                 },
-                [&](CreateCollectionCommand cmd) {
-                    auto* schema = m_server->db().schema(std::string{cmd.schema_name});
+                [](const auto&) -> Command {
+                    assert(false);
+                    return {};
+                }},
+            cmd);
+    };
 
-                    if (!schema) {
-                        // TODO Create SchemaNotFoundResponse
-                        write_and_send(NotFoundResponse{});
-                        return;
-                    }
+    auto seq = m_next_seq++;
 
-                    m_server->db().create_collection(std::string{cmd.name}, *schema);
-                    write_and_send(SuccessResponse{});
-                },
-                [&](GetSchemaCommand cmd) {
-                    auto* schema = m_server->db().schema(std::string{cmd.name});
+    std::uint32_t acks = 0;
 
-                    if (!schema) {
-                        write_and_send(NotFoundResponse{});
-                        return;
-                    }
+    for (std::uint32_t i = 0; i < worker_count; ++i) {
+        if (i != m_worker->index() && !split->positions[i].empty()) {
+            acks += 1;
+        }
+    }
 
-                    write_and_send(SchemaResponse{std::move(*schema)});
-                },
-                [&](GetCollectionSchemaCommand cmd) {
-                    auto* coll = m_server->db().collection(std::string{cmd.name});
+    assert(acks > 0);
 
-                    if (!coll) {
-                        write_and_send(NotFoundResponse{});
-                        return;
-                    }
+    // Our own part runs right away; the others' responses come back through
+    // shard_response_handler, as does ours if it has to wait for the WAL
+    if (!split->positions[m_worker->index()].empty()) {
+        auto res = encode(
+            execute(m_worker->db(), sub_batch(m_worker->index()), &m_arena, m_worker->wal()));
 
-                    write_and_send(SchemaResponse{coll->schema()});
-                },
-                [&](GetCommand cmd) {
-                    auto* coll = m_server->db().collection(std::string{cmd.coll_name});
+        if (!split->is_get && m_worker->waits_for_wal()) {
+            acks += 1;
+            m_worker->send_when_durable(m_worker->index(), make_response(seq, std::move(res)));
+        } else {
+            split->responses[m_worker->index()] = std::move(res);
+        }
+    }
 
-                    if (!coll) {
-                        write_and_send(NotFoundResponse{});
-                        return;
-                    }
+    for (std::uint32_t i = 0; i < worker_count; ++i) {
+        if (i == m_worker->index() || split->positions[i].empty()) {
+            continue;
+        }
 
-                    auto* found = coll->find(cmd.key);
+        m_worker->send_to(i, ShardMessage{ShardMessage::Kind::REQUEST, m_worker->index(), this,
+                                          seq, encode(sub_batch(i))});
+    }
 
-                    if (!found) {
-                        write_and_send(NotFoundResponse{});
-                        return;
-                    }
+    m_pending.push_back({seq, acks, {}, std::move(split)});
+}
 
-                    write_and_send(FoundResponse{
-                        ConstBuffer{reinterpret_cast<const char*>(found), coll->doc_size()}});
-                },
-                [&](PutCommand cmd) {
-                    auto* coll = m_server->db().collection(std::string{cmd.coll_name});
+void ClientHandler::scatter_query(QueryCommand cmd, ConstBuffer raw) {
+    auto worker_count = m_worker->worker_count();
 
-                    if (!coll) {
-                        write_and_send(NotFoundResponse{});
-                        return;
-                    }
+    auto split = std::make_unique<SplitBatch>();
 
-                    // TODO Add checks to make sure data len is the same as schema size
+    split->is_query = true;
+    split->limit = cmd.limit;
+    split->responses.resize(worker_count);
 
-                    auto* value = coll->put(cmd.value.data);
+    std::vector<char> request(raw.data, raw.data + raw.len);
 
-                    if (value) {
-                        write_and_send(SuccessResponse{});
-                    } else {
-                        write_and_send(FailedResponse{});
-                    }
-                },
-                [&](DeleteCommand cmd) {
-                    auto* coll = m_server->db().collection(std::string{cmd.coll_name});
+    const auto* coll = m_worker->db().collection(cmd.coll_name);
+    const auto* leaf = coll ? coll->schema_layout().find(cmd.field) : nullptr;
 
-                    if (!coll) {
-                        write_and_send(NotFoundResponse{});
-                        return;
-                    }
+    // Otherwise every shard is going to reject it, and there's nothing to merge
+    if (cmd.op == QueryCommand::Op::RANGE && leaf && can_index(leaf->type)) {
+        split->order_field = *leaf;
 
-                    coll->remove(cmd.key);
+        if (cmd.fields.empty()) {
+            split->order_offset = leaf->offset;
+        } else {
+            // The field might not be one the client asked for, so it's added in front
+            std::pmr::vector<std::string_view> fields{&m_arena};
 
-                    write_and_send(SuccessResponse{});
-                },
-                [](auto) {}},
-            std::move(cmd));
+            fields.reserve(cmd.fields.size() + 1);
+            fields.push_back(cmd.field);
+            fields.insert(fields.end(), cmd.fields.begin(), cmd.fields.end());
+
+            cmd.fields = std::move(fields);
+
+            split->order_field_added = true;
+
+            request = encode(Command{cmd});
+        }
+    }
+
+    scatter(std::move(split), std::move(cmd), std::move(request));
+}
+
+void ClientHandler::scatter(std::unique_ptr<SplitBatch> split, Command cmd,
+                            std::vector<char> request) {
+    auto worker_count = m_worker->worker_count();
+    auto seq = m_next_seq++;
+
+    for (std::uint32_t i = 0; i < worker_count; ++i) {
+        if (i != m_worker->index()) {
+            m_worker->send_to(i, ShardMessage{ShardMessage::Kind::REQUEST, m_worker->index(),
+                                              this, seq, request});
+        }
+    }
+
+    split->responses[m_worker->index()] =
+        encode(execute(m_worker->db(), std::move(cmd), &m_arena));
+
+    m_pending.push_back({seq, worker_count - 1, {}, std::move(split)});
+}
+
+ShardMessage ClientHandler::make_response(std::uint64_t seq, std::vector<char> data) {
+    return ShardMessage{ShardMessage::Kind::RESPONSE, m_worker->index(), this, seq,
+                        std::move(data)};
+}
+
+std::vector<char> ClientHandler::merge_split(const SplitBatch& split) {
+    if (split.is_query) {
+        return merge_query(split);
+    }
+
+    if (split.is_stats) {
+        return merge_stats(split);
+    }
+
+    std::size_t item_count = 0;
+
+    for (const auto& positions : split.positions) {
+        item_count += positions.size();
+    }
+
+    std::pmr::vector<ConstBuffer> values(split.is_get ? item_count : 0);
+
+    for (std::uint32_t i = 0; i < split.positions.size(); ++i) {
+        if (split.positions[i].empty()) {
+            continue;
+        }
+
+        const auto& data = split.responses[i];
+
+        auto res_buf = ConstBuffer{data.data(), data.size()};
+
+        Response res;
+
+        auto rr = read(res_buf, res);
+
+        assert(rr == ReadResult::SUCCESS);
 
-        m_stream.consume(cmd_buf.data - m_stream.data());
+        // Any shard failing fails the whole batch, same as it would have if one shard had run
+        // it
+        if (split.is_get) {
+            const auto* found = std::get_if<MultiFoundResponse>(&res);
+
+            if (!found) {
+                return data;
+            }
+
+            for (std::size_t j = 0; j < found->values.size(); ++j) {
+                values[split.positions[i][j]] = found->values[j];
+            }
+        } else if (!std::holds_alternative<SuccessResponse>(res)) {
+            return data;
+        }
+    }
+
+    if (split.is_get) {
+        // The values point into split.responses, which outlive this
+        return encode(MultiFoundResponse{std::move(values)});
+    }
+
+    return encode(SuccessResponse{});
+}
+
+std::vector<char> ClientHandler::merge_stats(const SplitBatch& split) {
+    CollectionStatsResponse total;
+
+    for (const auto& data : split.responses) {
+        auto res_buf = ConstBuffer{data.data(), data.size()};
+
+        Response res;
+
+        auto rr = read(res_buf, res);
+
+        assert(rr == ReadResult::SUCCESS);
+
+        // Every shard has every collection, so if one doesn't have it none of them do
+        const auto* stats = std::get_if<CollectionStatsResponse>(&res);
+
+        if (!stats) {
+            return data;
+        }
+
+        total.count += stats->count;
+        total.memory_usage += stats->memory_usage;
+        total.max_memory += stats->max_memory;
+        total.hit_count += stats->hit_count;
+        total.miss_count += stats->miss_count;
+        total.eviction_count += stats->eviction_count;
+    }
+
+    return encode(total);
+}
+
+std::vector<char> ClientHandler::merge_query(const SplitBatch& split) {
+    auto shard_count = split.responses.size();
+
+    std::vector<Response> results(shard_count);
+
+    // Every shard got the whole query, so any one of them failing means all of them did
+    for (std::size_t i = 0; i < shard_count; ++i) {
+        const auto& data = split.responses[i];
+
+        auto res_buf = ConstBuffer{data.data(), data.size()};
+
+        auto rr = read(res_buf, results[i]);
+
+        assert(rr == ReadResult::SUCCESS);
+
+        if (!std::holds_alternative<MultiFoundResponse>(results[i])) {
+            return data;
+        }
+    }
+
+    const auto shard_values = [&](std::size_t i) -> const std::pmr::vector<ConstBuffer>& {
+        return std::get<MultiFoundResponse>(results[i]).values;
+    };
+
+    // Each shard kept to the limit, but together they can go over it
+    const auto full = [&](std::size_t count) {
+        return split.limit != 0 && count >= split.limit;
+    };
+
+    std::pmr::vector<ConstBuffer> values;
+
+    if (!split.order_field) {
+        for (std::size_t i = 0; i < shard_count && !full(values.size()); ++i) {
+            for (auto value : shard_values(i)) {
+                if (full(values.size())) {
+                    break;
+                }
+
+                values.push_back(value);
+            }
+        }
+
+        return encode(MultiFoundResponse{std::move(values)});
+    }
+
+    const auto& field = *split.order_field;
+
+    // Each shard's documents are in order already, so it's just a matter of repeatedly taking
+    // the smallest of the next one from each shard. There are only ever a few shards, so they're
+    // compared one by one rather than kept in a heap.
+    std::vector<std::size_t> next(shard_count, 0);
+    std::vector<std::string> next_keys(shard_count);
+
+    const auto load_key = [&](std::size_t i) {
+        const auto& shard = shard_values(i);
+
+        if (next[i] < shard.size()) {
+            encode_index_key(field, shard[next[i]].data + split.order_offset, next_keys[i]);
+        }
+    };
+
+    for (std::size_t i = 0; i < shard_count; ++i) {
+        load_key(i);
+    }
+
+    while (!full(values.size())) {
+        std::optional<std::size_t> smallest;
+
+        for (std::size_t i = 0; i < shard_count; ++i) {
+            if (next[i] < shard_values(i).size() &&
+                (!smallest || next_keys[i] < next_keys[*smallest])) {
+                smallest = i;
+            }
+        }
+
+        if (!smallest) {
+            break;
+        }
+
+        auto value = shard_values(*smallest)[next[*smallest]];
+
+        if (split.order_field_added) {
+            value.data += field.size;
+            value.len -= field.size;
+        }
+
+        values.push_back(value);
+
+        next[*smallest] += 1;
+        load_key(*smallest);
+    }
+
+    // The values point into split.responses, which outlive this
+    return encode(MultiFoundResponse{std::move(values)});
+}
+
+void ClientHandler::respond(const Response& res) {
+    if (!m_pending.empty()) {
+        respond(encode(res));
+        return;
+    }
+
+    write([&](size_t len) { return extend_out(len); }, res);
+}
+
+void ClientHandler::respond(std::vector<char> data) {
+    if (m_pending.empty()) {
+        m_out.insert(m_out.end(), data.begin(), data.end());
+        return;
     }
 
-    m_server->io_context().async_recv(m_socket, m_buf, sizeof(m_buf),
-                                      bind_front(&ClientHandler::recv_handler, this));
+    m_pending.push_back({m_next_seq++, 0, std::move(data)});
+}
+
+void ClientHandler::flush_pending() {
+    while (!m_pending.empty() && m_pending.front().acks_remaining == 0) {
+        const auto& data = m_pending.front().data;
+
+        m_out.insert(m_out.end(), data.begin(), data.end());
+        m_pending.pop_front();
+    }
+}
+
+char* ClientHandler::extend_out(std::size_t len) {
+    m_out.resize(m_out.size() + len);
+    return m_out.data() + m_out.size() - len;
+}
+
+void ClientHandler::own_out_refs() {
+    if (m_out_refs.empty()) {
+        return;
+    }
+
+    std::size_t refs_size = 0;
+
+    for (const auto& ref : m_out_refs) {
+        refs_size += ref.data.len;
+    }
+
+    auto end = m_out.size();
+
+    m_out.resize(m_out.size() + refs_size);
+
+    auto dest_end = m_out.size();
+
+    // Going backwards, each byte of m_out only moves once
+    for (auto ref = m_out_refs.rbegin(); ref != m_out_refs.rend(); ++ref) {
+        auto tail_size = end - ref->offset;
+
+        dest_end -= tail_size;
+        std::memmove(m_out.data() + dest_end, m_out.data() + ref->offset, tail_size);
+
+        dest_end -= ref->data.len;
+        std::memcpy(m_out.data() + dest_end, ref->data.data, ref->data.len);
+
+        end = ref->offset;
+    }
+
+    m_out_refs.clear();
+}
+
+void ClientHandler::send_in_place() {
+    m_iov.clear();
+
+    std::size_t pos = 0;
+
+    for (const auto& ref : m_out_refs) {
+        m_iov.push_back({m_out.data() + pos, ref.offset - pos});
+        m_iov.push_back(ref.data);
+
+        pos = ref.offset;
+    }
+
+    m_iov.push_back({m_out.data() + pos, m_out.size() - pos});
+
+    std::size_t sent = 0;
+
+    for (std::size_t first = 0; first < m_iov.size();) {
+        auto count = std::min(m_iov.size() - first, Socket::MAX_SENDV_BUFFERS);
+
+        std::size_t size = 0;
+
+        for (std::size_t i = first; i < first + count; ++i) {
+            size += m_iov[i].len;
+        }
+
+        auto r = m_socket.try_sendv(m_iov.data() + first, count);
+
+        if (!r) {
+            break;
+        }
+
+        sent += *r;
+
+        // The socket buffer is full, the rest has to wait
+        if (static_cast<std::size_t>(*r) < size) {
+            break;
+        }
+
+        first += count;
+    }
+
+    // Usually everything went out. If not, the rest has to be copied since the refs can't
+    // outlive this call.
+    own_out_refs();
+
+    m_out.erase(m_out.begin(), m_out.begin() + sent);
+}
+
+void ClientHandler::flush_output() {
+    if (m_send_in_flight) {
+        // By the time the send in flight finishes, the documents might have changed
+        own_out_refs();
+        return;
+    }
+
+    if (!m_out_refs.empty()) {
+        send_in_place();
+    }
+
+    if (m_out.empty()) {
+        // The client is only let go of once another one connects, so if we're the ones
+        // disconnecting it, it's told now that there's nothing more coming
+        if (m_closed && m_pending.empty()) {
+            m_socket.shutdown_send();
+        }
+
+        return;
+    }
+
+    // m_out starts collecting the next batch in the buffer that was just sent
+    std::swap(m_out, m_sending);
+    m_out.clear();
+
+    m_send_in_flight = true;
+
+    async_send_all(m_worker->io_context(), m_socket, m_sending.data(), m_sending.size(),
+                   bind_front<&ClientHandler::send_handler>(this));
+}
+
+void ClientHandler::send_handler(int len) {
+    m_send_in_flight = false;
+
+    // Whatever was responded to while that was in flight
+    flush_output();
+
+    if (m_recv_paused && !m_closed) {
+        start_recv();
+    }
 }
 
 }  // namespace boutique
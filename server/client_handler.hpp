@@ -1,33 +1,181 @@
 #pragma once
 
-#include "core/streambuf.hpp"
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "core/arena.hpp"
+#include "core/const_buffer.hpp"
+#include "core/recv_buffer.hpp"
+#include "db/schema_layout.hpp"
 #include "io/socket.hpp"
+#include "protocol/messages.hpp"
 
 namespace boutique {
 
-struct IOContext;
-struct Server;
+struct ShardMessage;
+struct Worker;
 
 struct ClientHandler {
-    explicit ClientHandler(Server& server, Socket socket);
+    struct Params {
+        // Commands are received into a buffer of this size and handled in place
+        std::size_t recv_buffer_size = 64 * 1024;
+
+        // The receive buffer grows to fit a command bigger than itself up to this size, past
+        // which the client is disconnected
+        std::size_t max_command_size = 64 * 1024 * 1024;
+
+        // We stop reading commands while this many bytes of responses are waiting to be sent
+        std::size_t max_output_size = 1024 * 1024;
+    };
+
+    ClientHandler(Worker& worker, Socket socket, const Params& params);
 
     Socket& socket();
 
     void close();
     bool closed() const;
 
+    // Whether this handler can be destroyed, i.e. it's closed, no other worker is going to
+    // respond to it anymore, and nothing is being sent from its buffers.
+    bool done() const;
+
+    // Called when worker 'from' has run a command we forwarded to it
+    void shard_response_handler(std::uint32_t from, std::uint64_t seq, std::vector<char> data);
+
 private:
+    // Batch commands whose items live on different shards are split into one batch per shard,
+    // and the responses are put back together in the original order once they're all in.
+    // Queries are sent whole to every shard, and their responses are put one after another,
+    // or merged in order of the field for range queries.
+    struct SplitBatch {
+        bool is_get = false;
+        bool is_query = false;
+        bool is_stats = false;
+
+        // Only for queries
+        std::uint32_t limit = 0;
+
+        // Only for range queries. Each shard responds with its documents in order of this
+        // field, which is at order_offset in each of them. If it's only there because we asked
+        // for it in front of the fields the client did, it's cut off again when merging.
+        std::optional<LeafField> order_field;
+        std::size_t order_offset = 0;
+        bool order_field_added = false;
+
+        // positions[i] holds where each item sent to shard i was in the original batch
+        std::vector<std::vector<std::uint32_t>> positions;
+
+        // Encoded response from each shard
+        std::vector<std::vector<char>> responses;
+    };
+
+    // Responses have to go out in the order the commands came in, but commands forwarded to
+    // other workers complete asynchronously. These hold responses until everything before them
+    // has been sent.
+    struct PendingResponse {
+        std::uint64_t seq = 0;
+
+        // How many workers still have to respond before this is ready to send
+        std::uint32_t acks_remaining = 0;
+
+        std::vector<char> data;
+
+        // Only set for split batches, whose data is filled in once every shard has responded
+        std::unique_ptr<SplitBatch> split;
+    };
+
+    Params m_params;
+
     // TODO Track open/close state on the socket itself
     bool m_closed = false;
 
-    Server* m_server = nullptr;
+    Worker* m_worker = nullptr;
     Socket m_socket;
 
-    char m_buf[128];
+    RecvBuffer m_recv;
+
+    // Holds whatever parsing and running the current command needs, e.g. the key list of a
+    // batch. Reset before each command.
+    Arena m_arena;
 
-    StreamBuf m_stream;
+    // Set while we're holding off on receiving because too much output is waiting to be sent
+    bool m_recv_paused = false;
 
+    std::uint64_t m_next_seq = 0;
+    std::deque<PendingResponse> m_pending;
+
+    // Responses are appended here as they become ready and go out together in a single send
+    // once we're done with whatever woke us up. While that send is in flight, m_out collects
+    // the next batch. The two are swapped on each send so neither is reallocated.
+    std::vector<char> m_out;
+    std::vector<char> m_sending;
+
+    bool m_send_in_flight = false;
+
+    // Large found documents aren't copied into m_out; they're sent straight from the
+    // collection's storage, spliced in at the given offset of m_out. This is only safe until
+    // the collection is modified, so these never outlive the recv_handler call that added
+    // them: they're either sent right away with a gathering send, or copied into m_out
+    // (before any modifying command runs, and whenever the socket won't take them).
+    struct OutRef {
+        std::size_t offset = 0;
+        ConstBuffer data;
+    };
+
+    std::vector<OutRef> m_out_refs;
+
+    // Scratch space for send_in_place
+    std::vector<ConstBuffer> m_iov;
+
+    // Receives into m_recv unless we have to wait for output to drain first
+    void start_recv();
     void recv_handler(int len);
+
+    // The shard each item of a batch belongs to, or nothing if there's only one shard
+    std::pmr::vector<std::uint32_t> item_shards(std::string_view coll_name,
+                                                const std::pmr::vector<ConstBuffer>& items,
+                                                bool docs);
+
+    void split_batch(const Command& cmd, const std::pmr::vector<std::uint32_t>& item_shards);
+
+    // Runs the query on every shard. raw is the command as it was received, which is forwarded
+    // as-is unless it has to be changed to tell how to merge the responses.
+    void scatter_query(QueryCommand cmd, ConstBuffer raw);
+
+    // Sends request to every other shard and runs cmd (which is what it encodes) on our own,
+    // then waits for all of them to respond before split is merged
+    void scatter(std::unique_ptr<SplitBatch> split, Command cmd, std::vector<char> request);
+
+    // A response to ourselves, for holding back our own response until the WAL has synced
+    // the change it's for
+    ShardMessage make_response(std::uint64_t seq, std::vector<char> data);
+    std::vector<char> merge_split(const SplitBatch& split);
+    std::vector<char> merge_query(const SplitBatch& split);
+    std::vector<char> merge_stats(const SplitBatch& split);
+
+    // Queues the response to be sent once everything before it has been
+    void respond(const Response& res);
+    void respond(std::vector<char> data);
+
+    // Moves responses which are no longer waiting on anything before them into m_out
+    void flush_pending();
+
+    char* extend_out(std::size_t len);
+
+    // Copies the data of m_out_refs into m_out where they belong
+    void own_out_refs();
+
+    // Sends m_out along with m_out_refs without waiting, and then owns whatever didn't go out
+    void send_in_place();
+
+    // Sends m_out unless a send is already in flight, in which case it goes once that finishes
+    void flush_output();
+    void send_handler(int len);
 };
 
 }  // namespace boutique
@@ -0,0 +1,388 @@
+#include "executor.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "core/overloaded_visitor.hpp"
+#include "db/timing_wheel.hpp"
+
+namespace {
+
+// How many items ahead of the one being put/removed a batch prefetches the index slot for
+const std::size_t PREFETCH_DISTANCE = 8;
+
+bool modifies(const boutique::Command& cmd) {
+    using namespace boutique;
+
+    return std::holds_alternative<RegisterSchemaCommand>(cmd) ||
+           std::holds_alternative<CreateCollectionCommand>(cmd) ||
+           std::holds_alternative<PutCommand>(cmd) || std::holds_alternative<DeleteCommand>(cmd) ||
+           std::holds_alternative<MultiPutCommand>(cmd) ||
+           std::holds_alternative<MultiDeleteCommand>(cmd) ||
+           std::holds_alternative<PutWithExpiryCommand>(cmd) ||
+           std::holds_alternative<SetCommand>(cmd) ||
+           std::holds_alternative<CreateIndexCommand>(cmd);
+}
+
+// The projection of fields onto the collection's documents, or nullptr if there are no fields
+// and whole documents should be sent. Sets invalid if any of them isn't a field.
+const boutique::Projection* find_projection(boutique::Collection& coll,
+                                            const std::pmr::vector<std::string_view>& fields,
+                                            bool& invalid) {
+    if (fields.empty()) {
+        return nullptr;
+    }
+
+    const auto* projection = coll.projection({fields.data(), fields.size()});
+
+    invalid = !projection;
+
+    return projection;
+}
+
+}  // namespace
+
+namespace boutique {
+
+Response execute(Database& db, Command cmd, std::pmr::memory_resource* mem, Wal* wal) {
+    // Only ever logged by the server itself
+    if (std::holds_alternative<PutWithExpiryCommand>(cmd)) {
+        return InvalidCommandResponse{};
+    }
+
+    // The expiry time is fixed here, before it's logged, so a replay expires the document when
+    // it would have originally rather than ttl_ms after the replay
+    if (const auto* put = std::get_if<PutWithTtlCommand>(&cmd)) {
+        cmd = PutWithExpiryCommand{put->coll_name, put->value, unix_time_ms() + put->ttl_ms};
+    }
+
+    if (wal && modifies(cmd)) {
+        wal->append(cmd);
+    }
+
+    return execute_logged(db, std::move(cmd), mem);
+}
+
+Response execute_logged(Database& db, Command cmd, std::pmr::memory_resource* mem) {
+    return std::visit(
+        OverloadedVisitor{
+            [&](RegisterSchemaCommand cmd) -> Response {
+                db.register_schema(cmd.name, std::move(cmd.schema));
+                return SuccessResponse{};
+            },
+            [&](CreateCollectionCommand cmd) -> Response {
+                auto* schema = db.schema(cmd.schema_name);
+
+                if (!schema) {
+                    // TODO Create SchemaNotFoundResponse
+                    return NotFoundResponse{};
+                }
+
+                CollectionOptions options;
+
+                options.max_memory = static_cast<std::size_t>(cmd.max_memory);
+                options.eviction = cmd.eviction;
+
+                db.create_collection(cmd.name, *schema, options);
+                return SuccessResponse{};
+            },
+            [&](GetSchemaCommand cmd) -> Response {
+                auto* schema = db.schema(cmd.name);
+
+                if (!schema) {
+                    return NotFoundResponse{};
+                }
+
+                return SchemaResponse{*schema};
+            },
+            [&](GetCollectionSchemaCommand cmd) -> Response {
+                auto* coll = db.collection(cmd.name);
+
+                if (!coll) {
+                    return NotFoundResponse{};
+                }
+
+                return SchemaResponse{coll->schema()};
+            },
+            [&](GetCommand cmd) -> Response {
+                auto* coll = db.collection(cmd.coll_name);
+
+                if (!coll) {
+                    return NotFoundResponse{};
+                }
+
+                bool invalid = false;
+
+                const auto* projection = find_projection(*coll, cmd.fields, invalid);
+
+                if (invalid) {
+                    return InvalidCommandResponse{};
+                }
+
+                auto* found = coll->find(cmd.key);
+
+                if (!found) {
+                    return NotFoundResponse{};
+                }
+
+                if (projection) {
+                    auto* value = static_cast<char*>(mem->allocate(projection->size(), 1));
+
+                    projection->gather(found, value);
+
+                    return FoundResponse{ConstBuffer{value, projection->size()}};
+                }
+
+                return FoundResponse{
+                    ConstBuffer{reinterpret_cast<const char*>(found), coll->doc_size()}};
+            },
+            [&](PutCommand cmd) -> Response {
+                auto* coll = db.collection(cmd.coll_name);
+
+                if (!coll) {
+                    return NotFoundResponse{};
+                }
+
+                if (cmd.value.len != coll->doc_size()) {
+                    return FailedResponse{};
+                }
+
+                auto* value = coll->put(cmd.value.data);
+
+                if (value) {
+                    return SuccessResponse{};
+                }
+
+                return FailedResponse{};
+            },
+            [&](DeleteCommand cmd) -> Response {
+                auto* coll = db.collection(cmd.coll_name);
+
+                if (!coll) {
+                    return NotFoundResponse{};
+                }
+
+                coll->remove(cmd.key);
+
+                return SuccessResponse{};
+            },
+            [&](MultiGetCommand cmd) -> Response {
+                auto* coll = db.collection(cmd.coll_name);
+
+                if (!coll) {
+                    return NotFoundResponse{};
+                }
+
+                bool invalid = false;
+
+                const auto* projection = find_projection(*coll, cmd.fields, invalid);
+
+                if (invalid) {
+                    return InvalidCommandResponse{};
+                }
+
+                std::pmr::vector<void*> found(cmd.keys.size(), mem);
+
+                coll->find_many({cmd.keys.data(), cmd.keys.size()}, found.data());
+
+                MultiFoundResponse res{std::pmr::vector<ConstBuffer>{mem}};
+
+                res.values.reserve(found.size());
+
+                // Projected documents are gathered next to each other, so only the fields asked
+                // for go out
+                char* projected = nullptr;
+
+                if (projection) {
+                    projected = static_cast<char*>(
+                        mem->allocate(std::max<std::size_t>(found.size() * projection->size(), 1),
+                                      1));
+                }
+
+                for (auto* doc : found) {
+                    if (!doc) {
+                        res.values.push_back({});
+                    } else if (projection) {
+                        projection->gather(doc, projected);
+                        res.values.push_back({projected, projection->size()});
+
+                        projected += projection->size();
+                    } else {
+                        res.values.push_back({static_cast<const char*>(doc), coll->doc_size()});
+                    }
+                }
+
+                return res;
+            },
+            [&](MultiPutCommand cmd) -> Response {
+                auto* coll = db.collection(cmd.coll_name);
+
+                if (!coll) {
+                    return NotFoundResponse{};
+                }
+
+                bool failed = false;
+
+                for (std::size_t i = 0; i < cmd.values.size(); ++i) {
+                    const auto& value = cmd.values[i];
+
+                    if (value.len != coll->doc_size()) {
+                        failed = true;
+                        continue;
+                    }
+
+                    if (i + PREFETCH_DISTANCE < cmd.values.size()) {
+                        const auto& ahead = cmd.values[i + PREFETCH_DISTANCE];
+
+                        if (ahead.len == coll->doc_size()) {
+                            coll->prefetch(coll->key(ahead.data));
+                        }
+                    }
+
+                    failed = !coll->put(value.data) || failed;
+                }
+
+                return failed ? Response{FailedResponse{}} : Response{SuccessResponse{}};
+            },
+            [&](MultiDeleteCommand cmd) -> Response {
+                auto* coll = db.collection(cmd.coll_name);
+
+                if (!coll) {
+                    return NotFoundResponse{};
+                }
+
+                for (std::size_t i = 0; i < cmd.keys.size(); ++i) {
+                    if (i + PREFETCH_DISTANCE < cmd.keys.size()) {
+                        coll->prefetch(cmd.keys[i + PREFETCH_DISTANCE]);
+                    }
+
+                    coll->remove(cmd.keys[i]);
+                }
+
+                return SuccessResponse{};
+            },
+            // execute turns these into a PutWithExpiryCommand, so they're never logged
+            [](const PutWithTtlCommand&) -> Response { return InvalidCommandResponse{}; },
+            [&](PutWithExpiryCommand cmd) -> Response {
+                auto* coll = db.collection(cmd.coll_name);
+
+                if (!coll) {
+                    return NotFoundResponse{};
+                }
+
+                if (cmd.value.len != coll->doc_size()) {
+                    return FailedResponse{};
+                }
+
+                auto* value = coll->put(cmd.value.data, cmd.expires_at);
+
+                if (value) {
+                    return SuccessResponse{};
+                }
+
+                return FailedResponse{};
+            },
+            [&](SetCommand cmd) -> Response {
+                auto* coll = db.collection(cmd.coll_name);
+
+                if (!coll) {
+                    return NotFoundResponse{};
+                }
+
+                switch (coll->update(cmd.key, {cmd.updates.data(), cmd.updates.size()})) {
+                    case UpdateResult::SUCCESS:
+                        return SuccessResponse{};
+
+                    case UpdateResult::NOT_FOUND:
+                        return NotFoundResponse{};
+
+                    case UpdateResult::INVALID:
+                        return InvalidCommandResponse{};
+
+                    case UpdateResult::COMPARE_FAILED:
+                        break;
+                }
+
+                return FailedResponse{};
+            },
+            [&](CreateIndexCommand cmd) -> Response {
+                auto* coll = db.collection(cmd.coll_name);
+
+                if (!coll) {
+                    return NotFoundResponse{};
+                }
+
+                if (!coll->create_index(cmd.field, cmd.type)) {
+                    return InvalidCommandResponse{};
+                }
+
+                return SuccessResponse{};
+            },
+            [&](QueryCommand cmd) -> Response {
+                auto* coll = db.collection(cmd.coll_name);
+
+                if (!coll) {
+                    return NotFoundResponse{};
+                }
+
+                bool invalid = false;
+
+                const auto* projection = find_projection(*coll, cmd.fields, invalid);
+
+                if (invalid) {
+                    return InvalidCommandResponse{};
+                }
+
+                MultiFoundResponse res{std::pmr::vector<ConstBuffer>{mem}};
+
+                // Columnar documents are assembled into a buffer that the next one reuses, so
+                // they're copied out
+                auto copy = coll->layout() == StorageLayout::COLUMNAR;
+
+                auto found = [&](const void* doc) {
+                    if (projection) {
+                        auto* value = static_cast<char*>(mem->allocate(projection->size(), 1));
+
+                        projection->gather(doc, value);
+                        res.values.push_back({value, projection->size()});
+                    } else if (copy) {
+                        auto* value = static_cast<char*>(mem->allocate(coll->doc_size(), 1));
+
+                        std::memcpy(value, doc, coll->doc_size());
+                        res.values.push_back({value, coll->doc_size()});
+                    } else {
+                        res.values.push_back({static_cast<const char*>(doc), coll->doc_size()});
+                    }
+
+                    return cmd.limit == 0 || res.values.size() < cmd.limit;
+                };
+
+                auto ok = cmd.op == QueryCommand::Op::EQUAL
+                              ? coll->find_equal(cmd.field, cmd.min, found)
+                              : coll->find_range(cmd.field, cmd.min, cmd.max, found);
+
+                if (!ok) {
+                    return InvalidCommandResponse{};
+                }
+
+                return res;
+            },
+            [&](GetCollectionStatsCommand cmd) -> Response {
+                auto* coll = db.collection(cmd.coll_name);
+
+                if (!coll) {
+                    return NotFoundResponse{};
+                }
+
+                auto stats = coll->stats();
+
+                return CollectionStatsResponse{stats.count,      stats.memory_usage,
+                                               coll->max_memory(), stats.hit_count,
+                                               stats.miss_count,   stats.eviction_count};
+            },
+            [](std::monostate) -> Response { return InvalidCommandResponse{}; }},
+        std::move(cmd));
+}
+
+}  // namespace boutique
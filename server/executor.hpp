@@ -0,0 +1,28 @@
+#pragma once
+
+#include <memory_resource>
+
+#include "db/database.hpp"
+#include "protocol/messages.hpp"
+#include "wal.hpp"
+
+namespace boutique {
+
+// Runs the command against the given database. A FoundResponse (or MultiFoundResponse) points
+// into the database's storage, so it must be written out before the database is touched again.
+// Scratch space, the value list of a MultiFoundResponse and projected documents are allocated
+// from mem.
+//
+// Commands which change the database are appended to wal, if given, before they're run. Running
+// the same commands again in the same order always ends up with the same database, so the ones
+// which fail are logged too rather than working out which would have.
+Response execute(Database& db, Command cmd,
+                 std::pmr::memory_resource* mem = std::pmr::get_default_resource(),
+                 Wal* wal = nullptr);
+
+// Same as execute, for commands read back from a WAL, which run as they were logged. That
+// includes PutWithExpiryCommand, which execute logs each PutWithTtlCommand as.
+Response execute_logged(Database& db, Command cmd,
+                        std::pmr::memory_resource* mem = std::pmr::get_default_resource());
+
+}  // namespace boutique
@@ -1,7 +1,52 @@
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <string_view>
+
 #include "server.hpp"
 
 int main(int argc, char** argv) {
-    boutique::Server server{static_cast<unsigned short>(std::stoi(argv[1]))};
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0]
+                  << " port [worker count] [WAL directory] [write|interval|sync]"
+                     " [snapshot interval in seconds]\n";
+        return 1;
+    }
+
+    std::uint32_t worker_count = 1;
+
+    if (argc > 2) {
+        worker_count = static_cast<std::uint32_t>(std::stoul(argv[2]));
+    }
+
+    std::optional<boutique::Wal::Params> wal_params;
+
+    if (argc > 3) {
+        wal_params.emplace();
+        wal_params->dir = argv[3];
+    }
+
+    if (argc > 4) {
+        std::string_view durability = argv[4];
+
+        if (durability == "write") {
+            wal_params->durability = boutique::Wal::Durability::WRITE;
+        } else if (durability == "interval") {
+            wal_params->durability = boutique::Wal::Durability::INTERVAL;
+        } else if (durability == "sync") {
+            wal_params->durability = boutique::Wal::Durability::SYNC;
+        } else {
+            std::cerr << "Unknown durability " << durability << ".\n";
+            return 1;
+        }
+    }
+
+    if (argc > 5) {
+        wal_params->snapshot_interval = std::chrono::seconds{std::stoul(argv[5])};
+    }
+
+    boutique::Server server{static_cast<unsigned short>(std::stoi(argv[1])), worker_count, {},
+                            std::move(wal_params)};
 
     server.run();
 
@@ -1,34 +1,345 @@
 #include "server.hpp"
 
-#include <system_error>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <thread>
 
-#include "core/bind_front.hpp"
 #include "core/logger.hpp"
+#include "snapshot.hpp"
+#include "wal.hpp"
 
-namespace boutique {
+namespace {
+
+// What the snapshot process reports back through a pipe
+struct SnapshotResult {
+    bool ok = false;
+    std::uint64_t bytes = 0;
+    std::uint64_t private_memory = 0;
+};
+
+// Bytes of this process' memory which aren't shared with any other process, or 0 if we can't
+// tell. Doesn't allocate, since it runs in a forked child.
+std::uint64_t private_memory() {
+    int fd = ::open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return 0;
+    }
+
+    char buf[4096];
+
+    auto n = ::read(fd, buf, sizeof(buf) - 1);
+
+    ::close(fd);
+
+    if (n <= 0) {
+        return 0;
+    }
+
+    buf[n] = '\0';
+
+    std::uint64_t total_kb = 0;
+
+    for (const char* field : {"Private_Clean:", "Private_Dirty:"}) {
+        if (const char* line = std::strstr(buf, field)) {
+            total_kb += std::strtoull(line + std::strlen(field), nullptr, 10);
+        }
+    }
+
+    return total_kb * 1024;
+}
+
+// Writes every shard's snapshot to temp_paths[i] and then renames it to paths[i], so that a
+// snapshot file only ever exists complete
+SnapshotResult write_snapshots(boutique::Server& server, const std::vector<std::string>& paths,
+                               const std::vector<std::string>& temp_paths,
+                               const std::string& dir) {
+    using namespace boutique;
+
+    SnapshotResult result;
+
+    for (std::uint32_t i = 0; i < server.worker_count(); ++i) {
+        int fd = ::open(temp_paths[i].c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd < 0) {
+            return result;
+        }
+
+        try {
+            result.bytes += write_snapshot(fd, server.worker(i).db());
+        } catch (const std::exception&) {
+            ::close(fd);
+            return result;
+        }
+
+        if (fdatasync(fd) < 0) {
+            ::close(fd);
+            return result;
+        }
+
+        ::close(fd);
+
+        if (std::rename(temp_paths[i].c_str(), paths[i].c_str()) < 0) {
+            return result;
+        }
+    }
+
+    // Make the renames durable too
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (dir_fd < 0) {
+        return result;
+    }
 
-Server::Server(unsigned short port) : m_socket{Socket{Socket::ListenParams{port}}} {
-    BOUTIQUE_LOG_INFO("Listening on port {}", port);
+    result.ok = fsync(dir_fd) == 0;
+
+    ::close(dir_fd);
+
+    return result;
 }
 
-IOContext& Server::io_context() { return m_ioc; }
+}  // namespace
+
+namespace boutique {
+
+Server::Server(unsigned short port, std::uint32_t worker_count,
+               const ClientHandler::Params& client_params,
+               std::optional<Wal::Params> wal_params)
+    : m_client_params{client_params}, m_wal_params{std::move(wal_params)} {
+    assert(worker_count > 0);
+
+    if (m_wal_params) {
+        prepare_wal_dir(m_wal_params->dir, worker_count);
+    }
+
+    m_workers.resize(worker_count);
+
+    // Workers restore their shards as they're created, so they're created in parallel
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(worker_count);
+
+    for (std::uint32_t i = 0; i < worker_count; ++i) {
+        threads.emplace_back([&, i] {
+            try {
+                m_workers[i] = std::make_unique<Worker>(*this, i, worker_count, port);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    BOUTIQUE_LOG_INFO("Listening on port {} with {} workers", port, worker_count);
+}
 
 void Server::run() {
-    m_ioc.async_accept(m_socket, bind_front(&Server::accept_handler, this));
-    m_ioc.run();
+    std::vector<std::thread> threads;
+
+    for (std::uint32_t i = 1; i < m_workers.size(); ++i) {
+        threads.emplace_back([worker = m_workers[i].get()] { worker->run(); });
+    }
+
+    if (m_wal_params && m_wal_params->snapshot_interval.count() > 0) {
+        threads.emplace_back([this] { snapshot_loop(); });
+    }
+
+    m_workers[0]->run();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void Server::stop() {
+    {
+        std::lock_guard<std::mutex> lock{m_pause_mutex};
+        m_stopping = true;
+    }
+
+    // Let go of anything waiting on a snapshot, since the workers are about to stop
+    m_pause_cv.notify_all();
+
+    for (auto& worker : m_workers) {
+        worker->stop();
+    }
+}
+
+SnapshotStats Server::snapshot() {
+    assert(m_wal_params);
+
+    using Clock = std::chrono::steady_clock;
+
+    std::lock_guard<std::mutex> snapshot_lock{m_snapshot_mutex};
+
+    SnapshotStats stats;
+
+    auto start = Clock::now();
+
+    std::unique_lock<std::mutex> lock{m_pause_mutex};
+
+    m_paused = 0;
+
+    for (auto& worker : m_workers) {
+        worker->request_pause();
+    }
+
+    m_pause_cv.wait(lock, [&] { return m_stopping || m_paused == m_workers.size(); });
+
+    const auto release = [&] {
+        m_pause_gen += 1;
+
+        lock.unlock();
+        m_pause_cv.notify_all();
+    };
+
+    if (m_stopping) {
+        release();
+        return stats;
+    }
+
+    // Everything the child needs is set up beforehand, while the workers are paused (so their
+    // generations are settled)
+    const auto& dir = m_wal_params->dir;
+    auto count = worker_count();
+
+    std::vector<std::uint64_t> gens;
+    std::vector<std::string> paths;
+    std::vector<std::string> temp_paths;
+
+    for (std::uint32_t i = 0; i < count; ++i) {
+        gens.push_back(m_workers[i]->wal_gen());
+        paths.push_back(shard_file_path(dir, i, count, gens.back(), SNAPSHOT_EXT));
+        temp_paths.push_back(paths.back() + ".tmp");
+    }
+
+    int result_pipe[2];
+
+    if (pipe2(result_pipe, O_CLOEXEC) < 0) {
+        release();
+
+        BOUTIQUE_LOG_ERROR("Failed to create a pipe for the snapshot: {}", std::strerror(errno));
+        return stats;
+    }
+
+    auto pid = fork();
+
+    if (pid == 0) {
+        // Only this thread exists in the child, and the workers were all paused between
+        // commands when it was forked, so every shard is as it was at that moment
+        ::close(result_pipe[0]);
+
+        auto result = write_snapshots(*this, paths, temp_paths, dir);
+
+        result.private_memory = private_memory();
+
+        [[maybe_unused]] auto n = ::write(result_pipe[1], &result, sizeof(result));
+
+        _exit(result.ok ? 0 : 1);
+    }
+
+    release();
+
+    stats.pause = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+
+    ::close(result_pipe[1]);
+
+    if (pid < 0) {
+        ::close(result_pipe[0]);
+
+        BOUTIQUE_LOG_ERROR("Failed to fork for the snapshot: {}", std::strerror(errno));
+        return stats;
+    }
+
+    SnapshotResult result;
+
+    auto n = ::read(result_pipe[0], &result, sizeof(result));
+
+    while (n < 0 && errno == EINTR) {
+        n = ::read(result_pipe[0], &result, sizeof(result));
+    }
+
+    ::close(result_pipe[0]);
+
+    int status = 0;
+
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+
+    stats.duration = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+
+    if (n != sizeof(result) || !result.ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        BOUTIQUE_LOG_ERROR("Failed to write snapshot");
+        return stats;
+    }
+
+    stats.ok = true;
+    stats.bytes = result.bytes;
+    stats.extra_memory = result.private_memory;
+
+    for (std::uint32_t i = 0; i < count; ++i) {
+        remove_shard_files_before(dir, i, count, gens[i]);
+    }
+
+    BOUTIQUE_LOG_INFO("Wrote a {} byte snapshot in {}ms ({}us paused, {} bytes of extra memory)",
+                      stats.bytes, stats.duration.count(), stats.pause.count(),
+                      stats.extra_memory);
+
+    return stats;
+}
+
+void Server::pause_for_snapshot() {
+    std::unique_lock<std::mutex> lock{m_pause_mutex};
+
+    auto gen = m_pause_gen;
+
+    m_paused += 1;
+    m_pause_cv.notify_all();
+
+    m_pause_cv.wait(lock, [&] { return m_stopping || m_pause_gen != gen; });
 }
 
-Database& Server::db() { return m_db; }
+const ClientHandler::Params& Server::client_params() const { return m_client_params; }
+
+const Wal::Params* Server::wal_params() const {
+    return m_wal_params ? &*m_wal_params : nullptr;
+}
 
-void Server::accept_handler(Socket socket) {
-    auto clients_end =
-        std::remove_if(m_clients.begin(), m_clients.end(), [](auto& c) { return c.closed(); });
+void Server::snapshot_loop() {
+    std::unique_lock<std::mutex> lock{m_pause_mutex};
 
-    m_clients.erase(clients_end, m_clients.end());
+    for (;;) {
+        m_pause_cv.wait_for(lock, m_wal_params->snapshot_interval, [&] { return m_stopping; });
 
-    m_clients.emplace_back(*this, std::move(socket));
+        if (m_stopping) {
+            return;
+        }
 
-    m_ioc.async_accept(m_socket, bind_front(&Server::accept_handler, this));
+        lock.unlock();
+        snapshot();
+        lock.lock();
+    }
 }
 
+std::uint32_t Server::worker_count() const { return static_cast<std::uint32_t>(m_workers.size()); }
+
+Worker& Server::worker(std::uint32_t index) { return *m_workers[index]; }
+
 }  // namespace boutique
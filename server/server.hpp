@@ -1,34 +1,85 @@
 #pragma once
 
-#include <list>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
 
-#include "client_handler.hpp"
-#include "db/database.hpp"
-#include "io/context.hpp"
-#include "io/socket.hpp"
+#include "worker.hpp"
 
 namespace boutique {
 
-struct Server {
-    Server(unsigned short port);
+struct SnapshotStats {
+    bool ok = false;
+
+    // How long the workers were paused for, which is mostly the fork
+    std::chrono::microseconds pause{0};
+
+    // From starting until the snapshot was on disk
+    std::chrono::milliseconds duration{0};
+
+    std::uint64_t bytes = 0;
 
-    IOContext& io_context();
+    // Memory the snapshot process ended up not sharing with the server, which is mostly the
+    // pages that were copied because the server wrote to them while the snapshot was being taken
+    std::uint64_t extra_memory = 0;
+};
+
+struct Server {
+    // Starts worker_count workers (including the thread which calls run), each listening
+    // on the same port and owning one shard of the database. With wal_params, every change is
+    // logged and the database is rebuilt from the logs on startup, which requires the same
+    // worker_count as before.
+    explicit Server(unsigned short port, std::uint32_t worker_count = 1,
+                    const ClientHandler::Params& client_params = {},
+                    std::optional<Wal::Params> wal_params = std::nullopt);
 
+    // Blocks until stop is called
     void run();
 
-    Database& db();
+    // Can be called from any thread
+    void stop();
+
+    // Writes a snapshot of every shard next to its logs and then deletes the logs it covers.
+    // The workers only pause for as long as it takes to fork a process which writes the
+    // snapshot, and carry on serving (with their memory shared copy-on-write) while it does.
+    //
+    // Needs a WAL. Can be called from any thread other than the workers' while the server is
+    // running, and blocks until the snapshot has been written.
+    SnapshotStats snapshot();
+
+    // Called by each worker once it's ready for a snapshot to be taken. Blocks until it has
+    // been forked off.
+    void pause_for_snapshot();
+
+    std::uint32_t worker_count() const;
+    Worker& worker(std::uint32_t index);
+
+    const ClientHandler::Params& client_params() const;
+
+    // nullptr if changes aren't logged
+    const Wal::Params* wal_params() const;
 
 private:
-    Database m_db;
+    ClientHandler::Params m_client_params;
+    std::optional<Wal::Params> m_wal_params;
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
 
-    Socket m_socket;
-    IOContext m_ioc;
+    // Only one snapshot at a time
+    std::mutex m_snapshot_mutex;
 
-    // We use a list so that adding new clients does not invalidate
-    // existing clients.
-    std::list<ClientHandler> m_clients;
+    // Workers count themselves into m_paused and wait for m_pause_gen to move on
+    std::mutex m_pause_mutex;
+    std::condition_variable m_pause_cv;
+    std::uint32_t m_paused = 0;
+    std::uint64_t m_pause_gen = 0;
+    bool m_stopping = false;
 
-    void accept_handler(Socket socket);
+    void snapshot_loop();
 };
 
 }  // namespace boutique
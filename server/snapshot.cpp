@@ -0,0 +1,496 @@
+#include "snapshot.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "core/serialize.hpp"
+#include "io/unix_utils.hpp"
+#include "protocol/binary_protocol.hpp"
+
+namespace {
+
+// "BQSNAP01" as it appears in the file
+const std::uint64_t SNAPSHOT_MAGIC = 0x3130504e41535142;
+const std::uint32_t SNAPSHOT_VERSION = 5;
+
+// Sections of a snapshot which can be mapped start on a multiple of this, which is the page size
+// nearly everywhere. They're read normally anywhere it isn't.
+const std::uint64_t SECTION_ALIGNMENT = 4096;
+
+// Key hashes are mapped straight into an array of these
+static_assert(sizeof(std::size_t) == sizeof(std::uint64_t));
+
+enum class RecordKind : std::uint8_t { SCHEMA = 1, COLLECTION, END };
+
+// Writes are gathered into a buffer of this size, apart from documents, which are big enough
+// to go straight from storage
+const std::size_t BUFFER_SIZE = 1024 * 1024;
+
+struct Writer {
+    explicit Writer(int fd) : m_fd{fd} { m_buf.reserve(BUFFER_SIZE); }
+
+    // For WriteFn
+    char* prepare(std::size_t len) {
+        if (m_buf.size() + len > m_buf.capacity()) {
+            flush();
+        }
+
+        m_buf.resize(m_buf.size() + len);
+
+        return m_buf.data() + m_buf.size() - len;
+    }
+
+    void write_direct(const void* data, std::size_t len) {
+        if (len < BUFFER_SIZE / 4) {
+            std::memcpy(prepare(len), data, len);
+            return;
+        }
+
+        flush();
+        write_all(static_cast<const char*>(data), len);
+    }
+
+    void flush() {
+        write_all(m_buf.data(), m_buf.size());
+        m_buf.clear();
+    }
+
+    std::uint64_t written() const { return m_written + m_buf.size(); }
+
+    // Pads with zeros up to the next multiple of alignment
+    void align(std::uint64_t alignment) {
+        auto len = static_cast<std::size_t>((alignment - written() % alignment) % alignment);
+
+        std::memset(prepare(len), 0, len);
+    }
+
+private:
+    int m_fd = -1;
+
+    std::vector<char> m_buf;
+    std::uint64_t m_written = 0;
+
+    void write_all(const char* data, std::size_t len) {
+        m_written += len;
+
+        while (len > 0) {
+            auto n = ::write(m_fd, data, len);
+
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                boutique::throw_errno("Failed to write snapshot");
+            }
+
+            data += n;
+            len -= static_cast<std::size_t>(n);
+        }
+    }
+};
+
+struct Reader {
+    explicit Reader(int fd) : m_fd{fd} { m_buf.resize(BUFFER_SIZE); }
+
+    boutique::ConstBuffer data() const { return {m_buf.data() + m_pos, m_end - m_pos}; }
+
+    void consume(std::size_t len) { m_pos += len; }
+
+    // Position in the file of the start of data()
+    std::uint64_t offset() const { return m_buf_offset + m_pos; }
+
+    void skip(std::uint64_t len) {
+        if (len <= m_end - m_pos) {
+            consume(static_cast<std::size_t>(len));
+            return;
+        }
+
+        m_buf_offset = offset() + len;
+        m_pos = m_end = 0;
+
+        if (lseek(m_fd, static_cast<off_t>(m_buf_offset), SEEK_SET) < 0) {
+            boutique::throw_errno("Failed to seek in snapshot");
+        }
+    }
+
+    // Skips the padding up to the next multiple of alignment
+    void align(std::uint64_t alignment) { skip((alignment - offset() % alignment) % alignment); }
+
+    // Makes sure at least len bytes are buffered, throwing if the file ends first
+    void fill(std::size_t len) {
+        if (m_end - m_pos >= len) {
+            return;
+        }
+
+        std::memmove(m_buf.data(), m_buf.data() + m_pos, m_end - m_pos);
+
+        m_buf_offset += m_pos;
+        m_end -= m_pos;
+        m_pos = 0;
+
+        if (m_buf.size() < len) {
+            m_buf.resize(len);
+        }
+
+        while (m_end < len) {
+            auto n = ::read(m_fd, m_buf.data() + m_end, m_buf.size() - m_end);
+
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (n < 0) {
+                boutique::throw_errno("Failed to read snapshot");
+            }
+
+            if (n == 0) {
+                throw std::runtime_error{"Snapshot was cut short"};
+            }
+
+            m_end += static_cast<std::size_t>(n);
+        }
+    }
+
+    template <typename T>
+    T read_value() {
+        fill(sizeof(T));
+
+        auto c = data();
+        auto v = boutique::read<T>(c);
+
+        consume(sizeof(T));
+
+        return *v;
+    }
+
+    std::string read_string() {
+        auto len = read_value<boutique::LengthPrefixType>();
+
+        fill(len);
+
+        std::string s{m_buf.data() + m_pos, len};
+
+        consume(len);
+
+        return s;
+    }
+
+    boutique::Schema read_schema() {
+        using namespace boutique;
+
+        for (std::size_t want = 1;; want = data().len + 1) {
+            fill(want);
+
+            auto c = data();
+
+            Schema schema;
+
+            auto res = read(c, schema);
+
+            if (res == ReadResult::SUCCESS) {
+                consume(c.data - data().data);
+                return schema;
+            }
+
+            if (res == ReadResult::INVALID) {
+                throw std::runtime_error{"Snapshot has an invalid schema"};
+            }
+        }
+    }
+
+private:
+    int m_fd = -1;
+
+    std::vector<char> m_buf;
+    std::size_t m_pos = 0;
+    std::size_t m_end = 0;
+
+    // Position in the file of the start of m_buf
+    std::uint64_t m_buf_offset = 0;
+};
+
+std::uint64_t align_up(std::uint64_t offset) {
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+// Puts count documents from the reader into coll, which rebuilds the index as it goes
+void read_docs(Reader& reader, boutique::Collection& coll, std::uint64_t count) {
+    auto doc_size = coll.doc_size();
+
+    // A buffer's worth at a time
+    auto batch_size = std::max<std::uint64_t>(BUFFER_SIZE / doc_size, 1);
+
+    for (std::uint64_t i = 0; i < count; i += batch_size) {
+        auto n = std::min(batch_size, count - i);
+
+        reader.fill(n * doc_size);
+
+        const auto* docs = reader.data().data;
+
+        for (std::uint64_t j = 0; j < n; ++j) {
+            if (!coll.put(docs + j * doc_size)) {
+                throw std::runtime_error{"Failed to put a document from the snapshot"};
+            }
+        }
+
+        reader.consume(n * doc_size);
+    }
+}
+
+// Maps the documents of a row collection and builds its index from their key hashes, without
+// reading the documents themselves. Returns false if it can't, in which case they have to be
+// read.
+bool map_docs(int fd, boutique::Collection& coll, std::uint64_t hashes_offset,
+              std::uint64_t docs_offset, std::uint64_t count) {
+    using namespace boutique;
+
+    auto page_size = static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+
+    if (hashes_offset % page_size != 0 || docs_offset % page_size != 0) {
+        return false;
+    }
+
+    if (count == 0) {
+        return true;
+    }
+
+    auto hashes_len = count * sizeof(std::uint64_t);
+
+    auto* hashes = mmap(nullptr, hashes_len, PROT_READ, MAP_PRIVATE, fd,
+                        static_cast<off_t>(hashes_offset));
+
+    if (hashes == MAP_FAILED) {
+        throw_errno("Failed to map snapshot");
+    }
+
+    struct Unmapper {
+        void* data;
+        std::size_t len;
+        ~Unmapper() { munmap(data, len); }
+    } unmapper{hashes, hashes_len};
+
+    Span<const std::size_t> key_hashes{static_cast<const std::size_t*>(hashes), count};
+
+    // The hashes come from whatever build wrote the snapshot, and std::hash isn't guaranteed to
+    // be the same in another one, so check them against the first document before trusting them
+    std::vector<char> first(coll.doc_size());
+
+    if (pread(fd, first.data(), first.size(), static_cast<off_t>(docs_offset)) !=
+        static_cast<ssize_t>(first.size())) {
+        throw_errno("Failed to read snapshot");
+    }
+
+    if (coll.key_hash(first.data()) != key_hashes.data[0]) {
+        return false;
+    }
+
+    madvise(hashes, hashes_len, MADV_SEQUENTIAL);
+
+    if (!coll.map(fd, docs_offset, key_hashes)) {
+        throw std::runtime_error{"Failed to index the documents from the snapshot"};
+    }
+
+    return true;
+}
+
+}  // namespace
+
+namespace boutique {
+
+std::uint64_t write_snapshot(int fd, Database& db) {
+    Writer writer{fd};
+
+    auto prepare = [&](size_t len) { return writer.prepare(len); };
+
+    WriteFn write_fn = prepare;
+
+    write(write_fn, SNAPSHOT_MAGIC);
+    write(write_fn, SNAPSHOT_VERSION);
+
+    db.for_each_schema([&](std::string_view name, const Schema& schema) {
+        write(write_fn, static_cast<std::uint8_t>(RecordKind::SCHEMA));
+        write(write_fn, LengthPrefixedString{name});
+        write(write_fn, schema);
+    });
+
+    db.for_each_collection([&](std::string_view name, Collection& coll) {
+        write(write_fn, static_cast<std::uint8_t>(RecordKind::COLLECTION));
+        write(write_fn, LengthPrefixedString{name});
+        write(write_fn, coll.schema());
+        write(write_fn, static_cast<std::uint8_t>(coll.index_type()));
+        write(write_fn, static_cast<std::uint8_t>(coll.layout()));
+        write(write_fn, static_cast<std::uint8_t>(coll.hasher()));
+        write(write_fn, static_cast<std::uint8_t>(coll.eviction_policy()));
+        write(write_fn, static_cast<std::uint64_t>(coll.max_memory()));
+        write(write_fn, static_cast<std::uint64_t>(coll.doc_size()));
+        write(write_fn, static_cast<std::uint64_t>(coll.count()));
+
+        if (coll.layout() == StorageLayout::ROW) {
+            // The hash of each document's key and then the documents, both where they can be
+            // mapped
+            writer.align(SECTION_ALIGNMENT);
+
+            coll.for_each_run([&](const void* docs, std::size_t count) {
+                for (std::size_t i = 0; i < count; ++i) {
+                    const auto* doc = static_cast<const char*>(docs) + i * coll.doc_size();
+
+                    write(write_fn, static_cast<std::uint64_t>(coll.key_hash(doc)));
+                }
+            });
+
+            writer.align(SECTION_ALIGNMENT);
+        }
+
+        coll.for_each_run([&](const void* docs, std::size_t count) {
+            writer.write_direct(docs, count * coll.doc_size());
+        });
+
+        // When each document expires, if any of them do
+        auto expiry_times = coll.expiry_times();
+
+        write(write_fn, static_cast<std::uint8_t>(!expiry_times.empty()));
+
+        if (!expiry_times.empty()) {
+            writer.write_direct(expiry_times.data, expiry_times.size() * sizeof(std::uint64_t));
+        }
+
+        // Only which fields are indexed; the indexes are built again from the documents
+        const auto& indexes = coll.secondary_indexes();
+
+        write(write_fn, static_cast<std::uint32_t>(indexes.size()));
+
+        for (const auto& index : indexes) {
+            write(write_fn, LengthPrefixedString{index.leaf().path});
+            write(write_fn, static_cast<std::uint8_t>(index.type()));
+        }
+    });
+
+    write(write_fn, static_cast<std::uint8_t>(RecordKind::END));
+
+    writer.flush();
+
+    return writer.written();
+}
+
+void read_snapshot(const std::string& path, Database& db, bool map) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        throw_errno("Failed to open snapshot");
+    }
+
+    struct FdCloser {
+        int fd;
+        ~FdCloser() { ::close(fd); }
+    } closer{fd};
+
+    struct stat st;
+
+    if (fstat(fd, &st) < 0) {
+        throw_errno("Failed to stat snapshot");
+    }
+
+    auto file_size = static_cast<std::uint64_t>(st.st_size);
+
+    Reader reader{fd};
+
+    if (reader.read_value<std::uint64_t>() != SNAPSHOT_MAGIC ||
+        reader.read_value<std::uint32_t>() != SNAPSHOT_VERSION) {
+        throw std::runtime_error{path + " isn't a snapshot this version can read"};
+    }
+
+    for (;;) {
+        auto kind = static_cast<RecordKind>(reader.read_value<std::uint8_t>());
+
+        if (kind == RecordKind::END) {
+            return;
+        }
+
+        if (kind != RecordKind::SCHEMA && kind != RecordKind::COLLECTION) {
+            throw std::runtime_error{"Snapshot has an unknown record"};
+        }
+
+        auto name = reader.read_string();
+        auto schema = reader.read_schema();
+
+        if (kind == RecordKind::SCHEMA) {
+            db.register_schema(name, std::move(schema));
+            continue;
+        }
+
+        CollectionOptions options;
+
+        options.index_type = static_cast<IndexType>(reader.read_value<std::uint8_t>());
+        options.layout = static_cast<StorageLayout>(reader.read_value<std::uint8_t>());
+        options.hasher = static_cast<KeyHasher>(reader.read_value<std::uint8_t>());
+        options.eviction = static_cast<EvictionPolicy>(reader.read_value<std::uint8_t>());
+        options.max_memory = static_cast<std::size_t>(reader.read_value<std::uint64_t>());
+
+        auto doc_size = reader.read_value<std::uint64_t>();
+        auto count = reader.read_value<std::uint64_t>();
+
+        auto& coll = db.create_collection(name, std::move(schema), options);
+
+        if (doc_size != coll.doc_size()) {
+            throw std::runtime_error{"Snapshot's documents don't match their schema"};
+        }
+
+        if (options.layout == StorageLayout::ROW) {
+            reader.align(SECTION_ALIGNMENT);
+
+            auto hashes_offset = reader.offset();
+            auto docs_offset = align_up(hashes_offset + count * sizeof(std::uint64_t));
+            auto docs_end = docs_offset + count * doc_size;
+
+            // Touching a mapping past the end of the file would crash rather than throw
+            if (docs_end > file_size) {
+                throw std::runtime_error{"Snapshot was cut short"};
+            }
+
+            if (map && map_docs(fd, coll, hashes_offset, docs_offset, count)) {
+                reader.skip(docs_end - reader.offset());
+            } else {
+                reader.skip(docs_offset - reader.offset());
+                read_docs(reader, coll, count);
+            }
+        } else {
+            read_docs(reader, coll, count);
+        }
+
+        if (reader.read_value<std::uint8_t>() != 0) {
+            std::vector<std::uint64_t> expiry_times(count);
+
+            auto len = count * sizeof(std::uint64_t);
+
+            reader.fill(len);
+
+            std::memcpy(expiry_times.data(), reader.data().data, len);
+
+            reader.consume(len);
+
+            coll.set_expiry_times({expiry_times.data(), expiry_times.size()});
+        }
+
+        auto index_count = reader.read_value<std::uint32_t>();
+
+        for (std::uint32_t i = 0; i < index_count; ++i) {
+            auto path = reader.read_string();
+            auto type = static_cast<SecondaryIndexType>(reader.read_value<std::uint8_t>());
+
+            if (!coll.create_index(path, type)) {
+                throw std::runtime_error{"Snapshot has an index on a field that can't have one"};
+            }
+        }
+    }
+}
+
+}  // namespace boutique
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "db/database.hpp"
+
+namespace boutique {
+
+// A snapshot is a stream of every schema and collection in a database. Each collection's record
+// holds its name, schema, options and then its documents exactly as they're laid out in memory,
+// since they're fixed-size and pointer-free. Row collections also have the hash of each
+// document's key ahead of the documents, and both start on a page boundary so that they can be
+// mapped rather than read. Collections with documents that expire have their expiry times after
+// the documents, and last come the fields with secondary indexes.
+
+// Writes a snapshot of db to fd and returns how many bytes that took. Throws if writing fails.
+std::uint64_t write_snapshot(int fd, Database& db);
+
+// Loads the snapshot at path into db. Throws if it can't be read, or is cut short or corrupt.
+//
+// If map is set, the documents of row collections are mapped from the file privately instead
+// of being copied out of it, and their indexes are built from the saved key hashes, so loading
+// doesn't read the documents at all; they're paged in as they're used. The file can be deleted
+// while they're mapped, but its space on disk isn't freed until they're gone. Collections with
+// secondary indexes are the exception, since building those reads the indexed fields.
+void read_snapshot(const std::string& path, Database& db, bool map = false);
+
+}  // namespace boutique
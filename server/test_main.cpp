@@ -0,0 +1,1875 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "core/arena.hpp"
+#include "db/database.hpp"
+#include "db/timing_wheel.hpp"
+#include "executor.hpp"
+#include "io/socket.hpp"
+#include "protocol/binary_protocol.hpp"
+#include "server.hpp"
+#include "snapshot.hpp"
+#include "wal.hpp"
+
+namespace {
+
+// Atomic since the server tests have threads allocating too
+std::atomic<std::size_t> g_alloc_count{0};
+
+}  // namespace
+
+// Every heap allocation in the program goes through these, so we can tell whether a piece of
+// code allocated at all
+void* operator new(std::size_t size) {
+    g_alloc_count += 1;
+
+    if (auto* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+struct Doc {
+    std::uint64_t id = 0;
+    std::uint64_t value = 0;
+};
+
+const std::uint64_t DOC_COUNT = 1000;
+
+std::vector<char> encode(const boutique::Command& cmd) {
+    std::vector<char> buf;
+
+    boutique::write(
+        [&](size_t len) {
+            buf.resize(buf.size() + len);
+            return buf.data() + buf.size() - len;
+        },
+        cmd);
+
+    return buf;
+}
+
+// Parses, runs and writes the response for each command the way a worker does, returning how
+// many allocations that took
+std::size_t run(boutique::Database& db, boutique::Arena& arena,
+                const std::vector<std::vector<char>>& cmds, std::vector<char>& out) {
+    using namespace boutique;
+
+    out.clear();
+
+    auto before = g_alloc_count.load();
+
+    for (const auto& data : cmds) {
+        arena.reset();
+
+        ConstBuffer buf{data.data(), data.size()};
+
+        Command cmd;
+
+        auto rr = read(buf, cmd, &arena);
+
+        assert(rr == ReadResult::SUCCESS);
+
+        auto res = execute(db, std::move(cmd), &arena);
+
+        assert(std::holds_alternative<SuccessResponse>(res) ||
+               std::holds_alternative<FoundResponse>(res) ||
+               std::holds_alternative<MultiFoundResponse>(res));
+
+        write(
+            [&](size_t len) {
+                out.resize(out.size() + len);
+                return out.data() + out.size() - len;
+            },
+            res);
+    }
+
+    return g_alloc_count - before;
+}
+
+void test_no_allocations() {
+    using namespace boutique;
+
+    Database db;
+
+    // Longer than any small string optimization, so looking it up as a std::string would
+    // allocate
+    const std::string_view coll_name = "documents_with_a_long_collection_name";
+
+    db.register_schema("doc", Schema{{{"id", UInt64Type{}}, {"value", UInt64Type{}}}});
+    db.create_collection(coll_name, *db.schema("doc"));
+
+    std::vector<Doc> docs(DOC_COUNT);
+
+    for (std::uint64_t i = 0; i < DOC_COUNT; ++i) {
+        docs[i] = {i + 1, i};
+        db.collection(coll_name)->put(&docs[i]);
+    }
+
+    const auto doc_buf = [&](std::uint64_t i) {
+        return ConstBuffer{reinterpret_cast<const char*>(&docs[i]), sizeof(Doc)};
+    };
+
+    const auto key_buf = [&](std::uint64_t i) {
+        return ConstBuffer{reinterpret_cast<const char*>(&docs[i].id), sizeof(docs[i].id)};
+    };
+
+    std::vector<std::vector<char>> cmds;
+
+    for (std::uint64_t i = 0; i < DOC_COUNT; ++i) {
+        cmds.push_back(encode(GetCommand{coll_name, key_buf(i)}));
+        cmds.push_back(encode(PutCommand{coll_name, doc_buf(i)}));
+    }
+
+    MultiGetCommand multi_get{coll_name, {}};
+    MultiPutCommand multi_put{coll_name, {}};
+
+    for (std::uint64_t i = 0; i < 256; ++i) {
+        multi_get.keys.push_back(key_buf(i));
+        multi_put.values.push_back(doc_buf(i));
+    }
+
+    cmds.push_back(encode(multi_get));
+    cmds.push_back(encode(multi_put));
+
+    // Projections are compiled on the first run and found in the cache after that
+    GetCommand projected_get{coll_name, key_buf(0), {"value"}};
+
+    multi_get.fields = {"value"};
+
+    cmds.push_back(encode(projected_get));
+    cmds.push_back(encode(multi_get));
+
+    // Partial updates resolve their paths without building strings
+    std::uint64_t delta = 1;
+
+    SetCommand set{coll_name, key_buf(0), {}};
+
+    set.updates.push_back({FieldUpdate::Op::ADD, "value",
+                           {reinterpret_cast<const char*>(&delta), sizeof(delta)}});
+
+    cmds.push_back(encode(set));
+
+    Arena arena;
+    std::vector<char> out;
+
+    // The first run gets the output buffer up to size
+    run(db, arena, cmds, out);
+
+    assert(run(db, arena, cmds, out) == 0);
+
+    // A batch too big for the arena's block takes more blocks the first time around. The next
+    // reset swaps those for one block big enough for all of them, and after that it fits.
+    MultiGetCommand big_get{coll_name, {}};
+
+    for (std::uint64_t i = 0; i < DOC_COUNT; ++i) {
+        big_get.keys.push_back(key_buf(i));
+    }
+
+    std::vector<std::vector<char>> big_cmds{encode(big_get)};
+
+    Arena small_arena{1024};
+
+    assert(run(db, small_arena, big_cmds, out) > 0);
+    assert(run(db, small_arena, big_cmds, out) == 1);
+    assert(run(db, small_arena, big_cmds, out) == 0);
+}
+
+// Logs changes through execute, replays the log into another database, and checks they match
+void test_wal() {
+    using namespace boutique;
+
+    namespace fs = std::filesystem;
+
+    auto dir = fs::temp_directory_path() / "boutique_test_wal";
+
+    const auto doc_buf = [](const Doc& doc) {
+        return ConstBuffer{reinterpret_cast<const char*>(&doc), sizeof(doc)};
+    };
+
+    const auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    const auto find = [&](Database& db, std::uint64_t key) {
+        return static_cast<const Doc*>(db.collection("docs")->find(key_buf(key)));
+    };
+
+    for (auto durability :
+         {Wal::Durability::WRITE, Wal::Durability::INTERVAL, Wal::Durability::SYNC}) {
+        fs::remove_all(dir);
+        prepare_wal_dir(dir.string(), 1);
+
+        auto path = shard_file_path(dir.string(), 0, 1, 1, WAL_EXT);
+
+        Wal::Params params;
+
+        params.dir = dir.string();
+        params.durability = durability;
+
+        Database db;
+
+        std::atomic<int> durable_calls{0};
+
+        {
+            Wal wal{path, params, [&] { durable_calls += 1; }};
+
+            Schema schema{{{"id", UInt64Type{}}, {"value", UInt64Type{}}}};
+
+            execute(db, RegisterSchemaCommand{"doc", schema}, std::pmr::get_default_resource(),
+                    &wal);
+            execute(db, CreateCollectionCommand{"docs", "doc"}, std::pmr::get_default_resource(),
+                    &wal);
+
+            for (std::uint64_t i = 0; i < DOC_COUNT; ++i) {
+                Doc doc{i, i * 2};
+                execute(db, PutCommand{"docs", doc_buf(doc)}, std::pmr::get_default_resource(),
+                        &wal);
+            }
+
+            MultiDeleteCommand multi_delete{"docs", {}};
+
+            std::vector<std::uint64_t> keys;
+
+            for (std::uint64_t i = 0; i < DOC_COUNT; i += 2) {
+                keys.push_back(i);
+            }
+
+            for (const auto& key : keys) {
+                multi_delete.keys.push_back(key_buf(key));
+            }
+
+            execute(db, std::move(multi_delete), std::pmr::get_default_resource(), &wal);
+
+            // Reads aren't logged
+            std::uint64_t key = 1;
+            execute(db, GetCommand{"docs", key_buf(key)}, std::pmr::get_default_resource(),
+                    &wal);
+
+            assert(wal.appended() == DOC_COUNT + 3);
+
+            if (durability == Wal::Durability::SYNC) {
+                // The writer gets going as soon as there's anything to write
+                while (wal.durable() < wal.appended()) {
+                    std::this_thread::yield();
+                }
+
+                assert(durable_calls > 0);
+            }
+        }
+
+        const auto replay = [&](Database& db) {
+            return Wal::replay(path, [&](Command cmd) { execute_logged(db, std::move(cmd)); });
+        };
+
+        Database replayed;
+
+        assert(replay(replayed) == DOC_COUNT + 3);
+
+        for (std::uint64_t i = 0; i < DOC_COUNT; ++i) {
+            auto* doc = find(replayed, i);
+
+            assert((doc != nullptr) == (i % 2 == 1));
+            assert(!doc || doc->value == i * 2);
+        }
+
+        auto size = fs::file_size(path);
+
+        // A record cut short by a crash is dropped, and so is one which was garbled
+        {
+            std::ofstream file{path, std::ios::binary | std::ios::app};
+            file.write("\x10\x00\x00\x00\xff", 5);
+        }
+
+        Database torn;
+
+        assert(replay(torn) == DOC_COUNT + 3);
+        assert(fs::file_size(path) == size);
+
+        {
+            std::fstream file{path, std::ios::binary | std::ios::in | std::ios::out};
+            file.seekp(static_cast<std::streamoff>(size) - 1);
+            file.put('\x7f');
+        }
+
+        Database corrupt;
+
+        assert(replay(corrupt) == DOC_COUNT + 2);
+        assert(corrupt.collection("docs")->count() == DOC_COUNT);
+
+        // Appending carries on from where the log was cut off
+        {
+            Wal wal{path, params};
+
+            Doc doc{DOC_COUNT, 0};
+            execute(corrupt, PutCommand{"docs", doc_buf(doc)}, std::pmr::get_default_resource(),
+                    &wal);
+        }
+
+        Database reopened;
+
+        assert(replay(reopened) == DOC_COUNT + 3);
+        assert(find(reopened, 0) && find(reopened, DOC_COUNT));
+    }
+
+    // The logs only make sense with as many shards as they were written with
+    bool threw = false;
+
+    try {
+        prepare_wal_dir(dir.string(), 2);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+
+    assert(threw);
+
+    fs::remove_all(dir);
+}
+
+// Sends the commands and waits for a response to each
+void run_commands(unsigned short port, const std::vector<boutique::Command>& cmds) {
+    using namespace boutique;
+
+    Socket socket{Socket::ConnectParams{"localhost", port}};
+
+    socket.set_non_blocking(false);
+
+    std::vector<char> out;
+
+    for (const auto& cmd : cmds) {
+        auto data = encode(cmd);
+        out.insert(out.end(), data.begin(), data.end());
+    }
+
+    for (std::size_t n = 0; n < out.size();) {
+        n += socket.send(out.data() + n, static_cast<int>(out.size() - n));
+    }
+
+    std::vector<char> in;
+    std::size_t response_count = 0;
+
+    while (response_count < cmds.size()) {
+        char buf[4096];
+
+        auto n = socket.recv(buf, sizeof(buf));
+
+        assert(n > 0);
+
+        in.insert(in.end(), buf, buf + n);
+
+        ConstBuffer res_buf{in.data(), in.size()};
+
+        Response res;
+
+        while (read(res_buf, res) == ReadResult::SUCCESS) {
+            assert(std::holds_alternative<SuccessResponse>(res));
+            response_count += 1;
+        }
+
+        in.erase(in.begin(), in.end() - res_buf.len);
+    }
+}
+
+// Schema of documents with an id and a string body of the given size. With a big enough body,
+// gets of them are sent straight from storage (see ClientHandler).
+boutique::Schema body_schema(std::uint32_t body_size) {
+    using namespace boutique;
+
+    return Schema{{{"id", UInt64Type{}}, {"body", StringType{body_size}}}};
+}
+
+// A document of a body_schema with every byte of its body set to fill
+std::vector<char> make_body_doc(const boutique::SchemaLayout& layout, std::uint64_t id,
+                                char fill) {
+    using namespace boutique;
+
+    const auto& body = *layout.find("body");
+
+    std::vector<char> doc(layout.size(), fill);
+
+    StringHeader header{static_cast<std::uint32_t>(body.size - sizeof(StringHeader))};
+
+    std::memcpy(doc.data() + layout.find("id")->offset, &id, sizeof(id));
+    std::memcpy(doc.data() + body.offset, &header, sizeof(header));
+
+    return doc;
+}
+
+// Sends the commands in a single write and reads back a response for each. The responses point
+// into in, which has to outlive them. Nothing is read until read_delay is up, so that responses
+// can back up on the server.
+std::vector<boutique::Response> pipeline(boutique::Socket& socket,
+                                         const std::vector<boutique::Command>& cmds,
+                                         std::vector<char>& in,
+                                         std::chrono::milliseconds read_delay = {}) {
+    using namespace boutique;
+
+    std::vector<char> out;
+
+    for (const auto& cmd : cmds) {
+        auto data = encode(cmd);
+        out.insert(out.end(), data.begin(), data.end());
+    }
+
+    // Sent from another thread, since the server stops reading once its responses back up and
+    // would otherwise wait on us while we wait on it
+    std::thread sender{[&] {
+        for (std::size_t n = 0; n < out.size();) {
+            n += socket.send(out.data() + n, static_cast<int>(out.size() - n));
+        }
+    }};
+
+    in.clear();
+
+    std::this_thread::sleep_for(read_delay);
+
+    std::vector<char> buf(64 * 1024);
+
+    std::size_t response_count = 0;
+    std::size_t parsed_len = 0;
+
+    while (response_count < cmds.size()) {
+        auto n = socket.recv(buf.data(), static_cast<int>(buf.size()));
+
+        assert(n > 0);
+
+        in.insert(in.end(), buf.data(), buf.data() + n);
+
+        ConstBuffer res_buf{in.data() + parsed_len, in.size() - parsed_len};
+
+        Response res;
+
+        while (response_count < cmds.size() && read(res_buf, res) == ReadResult::SUCCESS) {
+            response_count += 1;
+        }
+
+        parsed_len = in.size() - res_buf.len;
+    }
+
+    sender.join();
+
+    // Nothing else is coming, so in won't move anymore
+    assert(parsed_len == in.size());
+
+    std::vector<Response> responses(cmds.size());
+
+    ConstBuffer res_buf{in.data(), in.size()};
+
+    for (auto& res : responses) {
+        auto rr = read(res_buf, res);
+
+        assert(rr == ReadResult::SUCCESS);
+    }
+
+    return responses;
+}
+
+void test_snapshot() {
+    using namespace boutique;
+
+    namespace fs = std::filesystem;
+
+    auto dir = fs::temp_directory_path() / "boutique_test_snapshot";
+
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    Schema schema{{{"id", UInt64Type{}}, {"value", UInt64Type{}}}};
+
+    const auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    // Round trip through a file, with both storage layouts
+    {
+        Database db;
+
+        db.register_schema("doc", schema);
+
+        auto& rows = db.create_collection("rows", schema,
+                                          {IndexType::SWISS, StorageLayout::ROW,
+                                           KeyHasher::WYHASH, 1 << 30, EvictionPolicy::LFU});
+        auto& columns = db.create_collection(
+            "columns", schema,
+            {IndexType::LINEAR_PROBE, StorageLayout::COLUMNAR, KeyHasher::STD});
+
+        db.create_collection("empty", schema);
+
+        for (std::uint64_t i = 0; i < DOC_COUNT * 10; ++i) {
+            Doc doc{i, i * 3};
+
+            rows.put(&doc);
+            columns.put(&doc);
+        }
+
+        auto path = (dir / "round_trip.snap").string();
+
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        auto bytes = write_snapshot(fd, db);
+
+        ::close(fd);
+
+        assert(bytes == fs::file_size(path));
+
+        const auto check_loaded = [&](Database& loaded) {
+            assert(loaded.schema("doc")->fields.size() == 2);
+            assert(loaded.collection("empty")->count() == 0);
+
+            for (auto name : {"rows", "columns"}) {
+                auto* coll = loaded.collection(name);
+
+                assert(coll->count() == DOC_COUNT * 10);
+                assert(coll->index_type() == db.collection(name)->index_type());
+                assert(coll->layout() == db.collection(name)->layout());
+                assert(coll->hasher() == db.collection(name)->hasher());
+                assert(coll->eviction_policy() == db.collection(name)->eviction_policy());
+                assert(coll->max_memory() == db.collection(name)->max_memory());
+
+                for (std::uint64_t i = 0; i < DOC_COUNT * 10; ++i) {
+                    auto* doc = static_cast<const Doc*>(coll->find(key_buf(i)));
+                    assert(doc && doc->value == i * 3);
+                }
+            }
+        };
+
+        {
+            Database loaded;
+
+            read_snapshot(path, loaded);
+            check_loaded(loaded);
+        }
+
+        // Mapped documents can be changed, removed and added to like any others, without
+        // changing the file
+        {
+            Database loaded;
+
+            read_snapshot(path, loaded, true);
+            check_loaded(loaded);
+
+            auto* rows = loaded.collection("rows");
+
+            for (std::uint64_t i = 0; i < DOC_COUNT * 20; ++i) {
+                Doc doc{i, i * 5};
+                assert(rows->put(&doc));
+            }
+
+            for (std::uint64_t i = 0; i < DOC_COUNT * 20; i += 2) {
+                rows->remove(key_buf(i));
+            }
+
+            assert(rows->count() == DOC_COUNT * 10);
+
+            for (std::uint64_t i = 0; i < DOC_COUNT * 20; ++i) {
+                auto* doc = static_cast<const Doc*>(rows->find(key_buf(i)));
+                assert(i % 2 == 0 ? !doc : doc && doc->value == i * 5);
+            }
+
+            Database reloaded;
+
+            read_snapshot(path, reloaded, true);
+            check_loaded(reloaded);
+        }
+
+        // Enough documents to map several chunks of storage. Key hashes which don't match the
+        // documents' (e.g. from a build with another std::hash) mean the documents are read
+        // instead; the only row collection's hashes are right after the header.
+        {
+            const std::uint64_t BIG_COUNT = 200'000;
+
+            Database big;
+
+            auto& coll = big.create_collection("rows", schema);
+
+            for (std::uint64_t i = 0; i < BIG_COUNT; ++i) {
+                Doc doc{i, i * 3};
+                coll.put(&doc);
+            }
+
+            auto big_path = (dir / "big.snap").string();
+
+            int big_fd = ::open(big_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+            write_snapshot(big_fd, big);
+
+            const auto check_big = [&](bool map) {
+                Database loaded;
+
+                read_snapshot(big_path, loaded, map);
+
+                auto* loaded_coll = loaded.collection("rows");
+
+                for (std::uint64_t i = 0; i < BIG_COUNT; ++i) {
+                    auto* doc = static_cast<const Doc*>(loaded_coll->find(key_buf(i)));
+                    assert(doc && doc->value == i * 3);
+                }
+            };
+
+            check_big(true);
+
+            std::uint64_t first_hash = 0;
+
+            auto n = pread(big_fd, &first_hash, sizeof(first_hash), 4096);
+
+            assert(n == sizeof(first_hash));
+            assert(first_hash == coll.key_hash(coll.find(key_buf(0))));
+
+            first_hash += 1;
+
+            n = pwrite(big_fd, &first_hash, sizeof(first_hash), 4096);
+
+            assert(n == sizeof(first_hash));
+
+            ::close(big_fd);
+
+            check_big(true);
+
+            fs::remove(big_path);
+        }
+
+        // A snapshot cut short is an error rather than a smaller database
+        fs::resize_file(path, bytes - 1);
+
+        bool threw = false;
+
+        try {
+            Database truncated;
+            read_snapshot(path, truncated, true);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+
+        assert(threw);
+
+        fs::remove(path);
+    }
+
+    // Through a server, which carries on taking writes while the snapshot is written, and is
+    // restored from the snapshot and the log after it
+    const unsigned short PORT = 42693;
+    const std::uint32_t WORKER_COUNT = 2;
+
+    Wal::Params params;
+
+    params.dir = dir.string();
+
+    const auto put_docs = [&](std::uint64_t first, std::uint64_t last, std::uint64_t value) {
+        std::vector<Doc> docs;
+
+        for (auto i = first; i < last; ++i) {
+            docs.push_back({i, value});
+        }
+
+        std::vector<Command> cmds;
+
+        for (const auto& doc : docs) {
+            cmds.push_back(
+                PutCommand{"docs", {reinterpret_cast<const char*>(&doc), sizeof(doc)}});
+        }
+
+        run_commands(PORT, cmds);
+    };
+
+    {
+        Server server{PORT, WORKER_COUNT, {}, params};
+
+        std::thread server_thread{[&] { server.run(); }};
+
+        run_commands(PORT, {RegisterSchemaCommand{"doc", schema},
+                            CreateCollectionCommand{"docs", "doc"}});
+
+        put_docs(0, DOC_COUNT, 1);
+
+        std::thread writer{[&] { put_docs(DOC_COUNT / 2, DOC_COUNT * 2, 2); }};
+
+        auto stats = server.snapshot();
+
+        writer.join();
+
+        assert(stats.ok && stats.bytes > DOC_COUNT * sizeof(Doc));
+
+        put_docs(DOC_COUNT * 2, DOC_COUNT * 3, 3);
+
+        server.stop();
+        server_thread.join();
+
+        // Each shard has its snapshot and the log since then, and the logs before it are gone
+        for (std::uint32_t i = 0; i < WORKER_COUNT; ++i) {
+            auto files = list_shard_files(dir.string(), i, WORKER_COUNT);
+
+            assert(files.snapshot_gens.size() == 1);
+            assert(files.wal_gens.size() == 1);
+            assert(files.wal_gens[0] == files.snapshot_gens[0]);
+        }
+    }
+
+    {
+        Server server{PORT, WORKER_COUNT, {}, params};
+
+        std::size_t total = 0;
+
+        for (std::uint32_t i = 0; i < WORKER_COUNT; ++i) {
+            total += server.worker(i).db().collection("docs")->count();
+        }
+
+        assert(total == DOC_COUNT * 3);
+
+        for (std::uint64_t key = 0; key < DOC_COUNT * 3; ++key) {
+            auto shard = server.worker(0).shard_for("docs", key_buf(key));
+
+            auto* doc = static_cast<const Doc*>(
+                server.worker(shard).db().collection("docs")->find(key_buf(key)));
+
+            assert(doc && doc->value == (key < DOC_COUNT / 2 ? 1 : key < DOC_COUNT * 2 ? 2 : 3));
+        }
+    }
+
+    fs::remove_all(dir);
+}
+
+void test_expiry() {
+    using namespace boutique;
+
+    namespace fs = std::filesystem;
+
+    auto dir = fs::temp_directory_path() / "boutique_test_expiry";
+
+    fs::remove_all(dir);
+    prepare_wal_dir(dir.string(), 1);
+
+    Schema schema{{{"id", UInt64Type{}}, {"value", UInt64Type{}}}};
+
+    const auto doc_buf = [](const Doc& doc) {
+        return ConstBuffer{reinterpret_cast<const char*>(&doc), sizeof(doc)};
+    };
+
+    const auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    const std::uint64_t HOUR_MS = 60 * 60 * 1000;
+
+    // The log gets the time the document expires at rather than its TTL, so replaying it later
+    // doesn't give the document longer to live
+    auto wal_path = shard_file_path(dir.string(), 0, 1, 1, WAL_EXT);
+
+    Wal::Params params;
+
+    params.dir = dir.string();
+
+    Database db;
+
+    auto before = unix_time_ms();
+
+    {
+        Wal wal{wal_path, params};
+
+        execute(db, RegisterSchemaCommand{"doc", schema}, std::pmr::get_default_resource(), &wal);
+        execute(db, CreateCollectionCommand{"docs", "doc"}, std::pmr::get_default_resource(),
+                &wal);
+
+        for (std::uint64_t i = 0; i < DOC_COUNT; ++i) {
+            Doc doc{i, i};
+
+            if (i % 2 == 0) {
+                execute(db, PutWithTtlCommand{"docs", doc_buf(doc), HOUR_MS},
+                        std::pmr::get_default_resource(), &wal);
+            } else {
+                execute(db, PutCommand{"docs", doc_buf(doc)}, std::pmr::get_default_resource(),
+                        &wal);
+            }
+        }
+
+        // Expired as soon as it's put
+        Doc doc{DOC_COUNT, 0};
+
+        auto res = execute(db, PutWithTtlCommand{"docs", doc_buf(doc), 0},
+                           std::pmr::get_default_resource(), &wal);
+
+        assert(std::holds_alternative<SuccessResponse>(res));
+
+        // Clients can't pick an expiry time themselves, and it isn't logged
+        Doc late_doc{DOC_COUNT + 1, 0};
+
+        res = execute(db, PutWithExpiryCommand{"docs", doc_buf(late_doc), 1},
+                      std::pmr::get_default_resource(), &wal);
+
+        assert(std::holds_alternative<InvalidCommandResponse>(res));
+    }
+
+    auto after = unix_time_ms();
+
+    auto* coll = db.collection("docs");
+
+    assert(coll->count() == DOC_COUNT + 1);
+    assert(!coll->find(key_buf(DOC_COUNT)));
+    assert(!coll->find(key_buf(DOC_COUNT + 1)));
+
+    std::size_t ttl_puts = 0;
+
+    Database replayed;
+
+    Wal::replay(wal_path, [&](Command cmd) {
+        assert(!std::holds_alternative<PutWithTtlCommand>(cmd));
+
+        if (auto* put = std::get_if<PutWithExpiryCommand>(&cmd)) {
+            assert(put->expires_at >= before && put->expires_at <= after + HOUR_MS);
+            ttl_puts += 1;
+        }
+
+        execute_logged(replayed, std::move(cmd));
+    });
+
+    assert(ttl_puts == DOC_COUNT / 2 + 1);
+    assert(replayed.collection("docs")->count() == DOC_COUNT + 1);
+
+    // Replaying keeps the logged expiry times rather than working them out again
+    auto logged_times = coll->expiry_times();
+    auto replayed_times = replayed.collection("docs")->expiry_times();
+
+    assert(logged_times.size() == DOC_COUNT + 1);
+    assert(replayed_times.size() == logged_times.size());
+    assert(std::equal(logged_times.begin(), logged_times.end(), replayed_times.begin()));
+
+    // Expiry times survive a snapshot, whether its documents are mapped or read
+    auto snap_path = (dir / "expiry.snap").string();
+
+    int fd = ::open(snap_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    write_snapshot(fd, db);
+
+    ::close(fd);
+
+    for (bool map : {false, true}) {
+        Database loaded;
+
+        read_snapshot(snap_path, loaded, map);
+
+        auto* loaded_coll = loaded.collection("docs");
+
+        auto times = loaded_coll->expiry_times();
+        auto expected = coll->expiry_times();
+
+        assert(times.size() == expected.size());
+        assert(std::equal(times.begin(), times.end(), expected.begin()));
+
+        assert(!loaded_coll->find(key_buf(DOC_COUNT)));
+
+        while (!loaded_coll->expire(after + HOUR_MS, 100)) {
+        }
+
+        assert(loaded_coll->count() == DOC_COUNT / 2);
+
+        for (std::uint64_t i = 0; i < DOC_COUNT; ++i) {
+            assert((loaded_coll->find(key_buf(i)) != nullptr) == (i % 2 == 1));
+        }
+    }
+
+    fs::remove_all(dir);
+
+    // Workers remove expired documents on their own, even when nothing looks for them
+    const unsigned short PORT = 42694;
+
+    Server server{PORT};
+
+    std::thread server_thread{[&] { server.run(); }};
+
+    std::vector<Doc> docs;
+
+    for (std::uint64_t i = 0; i < DOC_COUNT; ++i) {
+        docs.push_back({i, i});
+    }
+
+    std::vector<Command> cmds{RegisterSchemaCommand{"doc", schema},
+                              CreateCollectionCommand{"docs", "doc"}};
+
+    for (const auto& doc : docs) {
+        cmds.push_back(PutWithTtlCommand{"docs", doc_buf(doc), doc.id % 2 == 0 ? 1 : HOUR_MS});
+    }
+
+    run_commands(PORT, cmds);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{200});
+
+    server.stop();
+    server_thread.join();
+
+    assert(server.worker(0).db().collection("docs")->count() == DOC_COUNT / 2);
+}
+
+// Responses to a pipeline of all sorts of commands come back in order, however they're grouped
+// into sends, including when there's more of them than the socket takes at once
+// Commands for keys owned by different workers, all over one connection, have to reach the
+// right shard and come back in the order they were sent
+void test_sharding() {
+    using namespace boutique;
+
+    const unsigned short PORT = 42700;
+    const std::uint32_t WORKER_COUNT = 4;
+
+    Server server{PORT, WORKER_COUNT};
+
+    std::thread server_thread{[&] { server.run(); }};
+
+    Schema schema{{{"id", UInt64Type{}}, {"value", UInt64Type{}}}};
+
+    const std::uint64_t KEY_COUNT = 1000;
+
+    // Each key is put, read back along with the key before it, and every tenth one deletes
+    // an earlier key and checks it's gone. Then all of the keys are put again and read back in
+    // one batch each, which splits them up between the shards.
+    const std::uint64_t DELETE_EVERY = 10;
+    const std::uint64_t DELETE_DISTANCE = 5;
+
+    std::vector<Doc> docs(KEY_COUNT);
+    std::vector<Doc> new_docs(KEY_COUNT);
+    std::vector<std::uint64_t> keys(KEY_COUNT);
+
+    const auto buf = [](const auto& value) {
+        return ConstBuffer{reinterpret_cast<const char*>(&value), sizeof(value)};
+    };
+
+    const auto prev = [](std::uint64_t i) { return i > 0 ? i - 1 : 0; };
+
+    std::vector<Command> cmds{RegisterSchemaCommand{"doc", schema},
+                              CreateCollectionCommand{"docs", "doc"}};
+
+    MultiPutCommand multi_put{"docs", {}};
+    MultiGetCommand multi_get{"docs", {}, {}};
+
+    for (std::uint64_t i = 0; i < KEY_COUNT; ++i) {
+        docs[i] = {i, i};
+        new_docs[i] = {i, i + KEY_COUNT};
+        keys[i] = i;
+
+        cmds.push_back(PutCommand{"docs", buf(docs[i])});
+        cmds.push_back(GetCommand{"docs", buf(keys[i]), {}});
+        cmds.push_back(GetCommand{"docs", buf(keys[prev(i)]), {}});
+
+        if (i % DELETE_EVERY == 0 && i >= DELETE_DISTANCE) {
+            cmds.push_back(DeleteCommand{"docs", buf(keys[i - DELETE_DISTANCE])});
+            cmds.push_back(GetCommand{"docs", buf(keys[i - DELETE_DISTANCE]), {}});
+        }
+
+        multi_put.values.push_back(buf(new_docs[i]));
+        multi_get.keys.push_back(buf(keys[i]));
+    }
+
+    cmds.push_back(std::move(multi_put));
+    cmds.push_back(std::move(multi_get));
+
+    Socket socket{Socket::ConnectParams{"localhost", PORT}};
+
+    socket.set_non_blocking(false);
+
+    std::vector<char> in;
+
+    auto responses = pipeline(socket, cmds, in);
+
+    const auto doc_is = [](ConstBuffer value, const Doc& expected) {
+        Doc doc;
+
+        assert(value.len == sizeof(doc));
+        std::memcpy(&doc, value.data, sizeof(doc));
+
+        return doc.id == expected.id && doc.value == expected.value;
+    };
+
+    auto res = responses.begin();
+
+    assert(std::holds_alternative<SuccessResponse>(*res++));
+    assert(std::holds_alternative<SuccessResponse>(*res++));
+
+    for (std::uint64_t i = 0; i < KEY_COUNT; ++i) {
+        assert(std::holds_alternative<SuccessResponse>(*res++));
+        assert(doc_is(std::get<FoundResponse>(*res++).value, docs[i]));
+        assert(doc_is(std::get<FoundResponse>(*res++).value, docs[prev(i)]));
+
+        if (i % DELETE_EVERY == 0 && i >= DELETE_DISTANCE) {
+            assert(std::holds_alternative<SuccessResponse>(*res++));
+            assert(std::holds_alternative<NotFoundResponse>(*res++));
+        }
+    }
+
+    assert(std::holds_alternative<SuccessResponse>(*res++));
+
+    const auto& values = std::get<MultiFoundResponse>(*res++).values;
+
+    assert(values.size() == KEY_COUNT);
+
+    for (std::uint64_t i = 0; i < KEY_COUNT; ++i) {
+        assert(doc_is(values[i], new_docs[i]));
+    }
+
+    assert(res == responses.end());
+
+    // Every shard got some of the keys, and only the ones it owns
+    for (std::uint32_t i = 0; i < WORKER_COUNT; ++i) {
+        assert(server.worker(i).db().collection("docs")->count() > 0);
+    }
+
+    for (std::uint64_t i = 0; i < KEY_COUNT; ++i) {
+        auto shard = server.worker(0).shard_for("docs", buf(keys[i]));
+
+        for (std::uint32_t j = 0; j < WORKER_COUNT; ++j) {
+            auto* doc = server.worker(j).db().collection("docs")->find(buf(keys[i]));
+
+            assert((doc != nullptr) == (j == shard));
+        }
+    }
+
+    server.stop();
+    server_thread.join();
+}
+
+// Memory limits set when a collection is created hold on every shard, and the stats of all of
+// them come back together
+void test_collection_stats() {
+    using namespace boutique;
+
+    const unsigned short PORT = 42701;
+    const std::uint32_t WORKER_COUNT = 2;
+
+    Server server{PORT, WORKER_COUNT};
+
+    std::thread server_thread{[&] { server.run(); }};
+
+    Schema schema{{{"id", UInt64Type{}}, {"value", UInt64Type{}}}};
+
+    const std::uint64_t MAX_MEMORY = 64 * 1024;
+    const std::uint64_t DOC_COUNT = 20'000;
+    const std::uint64_t MISSING_COUNT = 5;
+    const std::uint64_t MISSING = std::numeric_limits<std::uint64_t>::max();
+
+    std::vector<Doc> docs(DOC_COUNT);
+    std::vector<std::uint64_t> missing(MISSING_COUNT);
+
+    const auto buf = [](const auto& value) {
+        return ConstBuffer{reinterpret_cast<const char*>(&value), sizeof(value)};
+    };
+
+    // "evicting" makes room by evicting, "capped" turns new documents away instead
+    std::vector<Command> cmds{
+        RegisterSchemaCommand{"doc", schema},
+        CreateCollectionCommand{"evicting", "doc", MAX_MEMORY, EvictionPolicy::SAMPLED_LRU},
+        CreateCollectionCommand{"capped", "doc", MAX_MEMORY, EvictionPolicy::NONE},
+        CreateCollectionCommand{"unlimited", "doc"}};
+
+    for (std::uint64_t i = 0; i < DOC_COUNT; ++i) {
+        docs[i] = {i, i};
+
+        cmds.push_back(PutCommand{"evicting", buf(docs[i])});
+        cmds.push_back(PutCommand{"capped", buf(docs[i])});
+    }
+
+    for (std::uint64_t i = 0; i < MISSING_COUNT; ++i) {
+        missing[i] = MISSING - i;
+
+        cmds.push_back(GetCommand{"evicting", buf(missing[i]), {}});
+    }
+
+    cmds.push_back(GetCommand{"evicting", buf(docs.back().id), {}});
+
+    cmds.push_back(GetCollectionStatsCommand{"evicting"});
+    cmds.push_back(GetCollectionStatsCommand{"capped"});
+    cmds.push_back(GetCollectionStatsCommand{"unlimited"});
+    cmds.push_back(GetCollectionStatsCommand{"nothing"});
+
+    Socket socket{Socket::ConnectParams{"localhost", PORT}};
+
+    socket.set_non_blocking(false);
+
+    std::vector<char> in;
+
+    auto responses = pipeline(socket, cmds, in);
+
+    auto res = responses.begin();
+
+    for (std::size_t i = 0; i < 4; ++i) {
+        assert(std::holds_alternative<SuccessResponse>(*res++));
+    }
+
+    std::uint64_t capped_failures = 0;
+
+    for (std::uint64_t i = 0; i < DOC_COUNT; ++i) {
+        assert(std::holds_alternative<SuccessResponse>(*res++));
+
+        if (std::holds_alternative<FailedResponse>(*res++)) {
+            capped_failures += 1;
+        }
+    }
+
+    for (std::uint64_t i = 0; i < MISSING_COUNT; ++i) {
+        assert(std::holds_alternative<NotFoundResponse>(*res++));
+    }
+
+    // Just put, so it's the last thing LRU would evict
+    assert(std::holds_alternative<FoundResponse>(*res++));
+
+    const auto& evicting = std::get<CollectionStatsResponse>(*res++);
+    const auto& capped = std::get<CollectionStatsResponse>(*res++);
+    const auto& unlimited = std::get<CollectionStatsResponse>(*res++);
+
+    assert(std::holds_alternative<NotFoundResponse>(*res++));
+    assert(res == responses.end());
+
+    // Each shard has its own limit
+    assert(evicting.max_memory == MAX_MEMORY * WORKER_COUNT);
+    assert(evicting.eviction_count > 0);
+    assert(evicting.count + evicting.eviction_count == DOC_COUNT);
+    assert(evicting.hit_count == 1 && evicting.miss_count == MISSING_COUNT);
+
+    std::uint64_t shard_count = 0;
+    std::uint64_t shard_memory_usage = 0;
+
+    for (std::uint32_t i = 0; i < WORKER_COUNT; ++i) {
+        auto* coll = server.worker(i).db().collection("evicting");
+
+        assert(coll->max_memory() == MAX_MEMORY);
+        assert(coll->eviction_policy() == EvictionPolicy::SAMPLED_LRU);
+
+        // Only the index growing can take it over the limit (see CollectionOptions::max_memory)
+        assert(coll->memory_usage() <= MAX_MEMORY + coll->index_memory_usage() / 2);
+
+        shard_count += coll->count();
+        shard_memory_usage += coll->memory_usage();
+    }
+
+    assert(shard_count == evicting.count);
+    assert(shard_memory_usage == evicting.memory_usage);
+
+    assert(capped.max_memory == MAX_MEMORY * WORKER_COUNT);
+    assert(capped.eviction_count == 0 && capped_failures > 0);
+    assert(capped.count + capped_failures == DOC_COUNT);
+
+    assert(unlimited.count == 0 && unlimited.max_memory == 0 && unlimited.memory_usage == 0);
+
+    server.stop();
+    server_thread.join();
+}
+
+void test_coalescing() {
+    using namespace boutique;
+
+    const unsigned short PORT = 42699;
+
+    Server server{PORT};
+
+    std::thread server_thread{[&] { server.run(); }};
+
+    // The body keeps documents under the size that's sent in place, so all of the output is
+    // copied into one buffer, and there's a lot more of it than the socket buffers can hold
+    Schema schema{{{"id", UInt64Type{}}, {"value", UInt64Type{}}, {"body", StringType{192}}}};
+
+    SchemaLayout layout{schema};
+
+    const auto& id_field = *layout.find("id");
+    const auto& value_field = *layout.find("value");
+    const auto& body_field = *layout.find("body");
+
+    const std::uint64_t ROUNDS = 2000;
+
+    // Each round deletes the document from BATCH_SIZE rounds before, puts a new one, adds to its
+    // value, gets it, gets one that isn't there, and then gets it and the previous ones all at
+    // once. Everything the commands point to is allocated up front so that it doesn't move.
+    const std::uint64_t BATCH_SIZE = 128;
+    const std::uint64_t MISSING = std::numeric_limits<std::uint64_t>::max();
+    const std::uint64_t ADDED = 1000;
+
+    std::vector<std::vector<char>> docs(ROUNDS);
+    std::vector<std::uint64_t> keys(ROUNDS);
+
+    std::uint64_t missing = MISSING;
+    std::uint64_t added = ADDED;
+
+    const auto buf = [](const auto& value) {
+        return ConstBuffer{reinterpret_cast<const char*>(&value), sizeof(value)};
+    };
+
+    std::vector<Command> cmds{RegisterSchemaCommand{"doc", schema},
+                              CreateCollectionCommand{"docs", "doc"},
+                              GetCollectionSchemaCommand{"docs"}};
+
+    for (std::uint64_t i = 0; i < ROUNDS; ++i) {
+        docs[i] = make_body_doc(layout, i, 'p');
+        std::memcpy(docs[i].data() + value_field.offset, &i, sizeof(i));
+
+        keys[i] = i;
+
+        SetCommand set{"docs", buf(keys[i]), {}};
+
+        set.updates.push_back({FieldUpdate::Op::ADD, "value", buf(added)});
+
+        MultiGetCommand multi_get{"docs", {}};
+
+        for (std::uint64_t j = 0; j < BATCH_SIZE; ++j) {
+            multi_get.keys.push_back(buf(keys[i - std::min(i, j)]));
+        }
+
+        multi_get.keys.push_back(buf(missing));
+
+        if (i >= BATCH_SIZE) {
+            cmds.push_back(DeleteCommand{"docs", buf(keys[i - BATCH_SIZE])});
+        }
+
+        cmds.push_back(PutCommand{"docs", {docs[i].data(), docs[i].size()}});
+        cmds.push_back(std::move(set));
+        cmds.push_back(GetCommand{"docs", buf(keys[i])});
+        cmds.push_back(GetCommand{"docs", buf(keys[i - std::min(i, BATCH_SIZE)])});
+        cmds.push_back(std::move(multi_get));
+    }
+
+    Socket socket{Socket::ConnectParams{"localhost", PORT}};
+
+    socket.set_non_blocking(false);
+
+    std::vector<char> in;
+
+    auto responses = pipeline(socket, cmds, in, std::chrono::milliseconds{100});
+
+    const auto doc_is = [&](ConstBuffer value, std::uint64_t id) {
+        std::uint64_t doc_id = 0;
+        std::uint64_t doc_value = 0;
+
+        assert(value.len == layout.size());
+
+        std::memcpy(&doc_id, value.data + id_field.offset, sizeof(doc_id));
+        std::memcpy(&doc_value, value.data + value_field.offset, sizeof(doc_value));
+
+        const char* body_end = value.data + body_field.offset + body_field.size;
+
+        return doc_id == id && doc_value == id + ADDED &&
+               std::memcmp(body_end - 8, "pppppppp", 8) == 0;
+    };
+
+    auto res = responses.begin();
+
+    assert(std::holds_alternative<SuccessResponse>(*res++));
+    assert(std::holds_alternative<SuccessResponse>(*res++));
+    assert(std::get<SchemaResponse>(*res++).schema.fields.size() == 3);
+
+    for (std::uint64_t i = 0; i < ROUNDS; ++i) {
+        if (i >= BATCH_SIZE) {
+            assert(std::holds_alternative<SuccessResponse>(*res++));
+        }
+
+        assert(std::holds_alternative<SuccessResponse>(*res++));
+        assert(std::holds_alternative<SuccessResponse>(*res++));
+        assert(doc_is(std::get<FoundResponse>(*res++).value, i));
+
+        // The one deleted this round, except in the first rounds where nothing is
+        if (i >= BATCH_SIZE) {
+            assert(std::holds_alternative<NotFoundResponse>(*res++));
+        } else {
+            assert(doc_is(std::get<FoundResponse>(*res++).value, 0));
+        }
+
+        const auto& values = std::get<MultiFoundResponse>(*res++).values;
+
+        assert(values.size() == BATCH_SIZE + 1);
+        assert(values[BATCH_SIZE].len == 0);
+
+        for (std::uint64_t j = 0; j < BATCH_SIZE; ++j) {
+            assert(doc_is(values[j], i - std::min(i, j)));
+        }
+    }
+
+    assert(res == responses.end());
+
+    server.stop();
+    server_thread.join();
+}
+
+// Found documents sent straight from storage arrive intact, however the send is split up and
+// whatever happens to the documents after they've been found
+void test_in_place() {
+    using namespace boutique;
+
+    auto schema = body_schema(8 * 1024);
+
+    SchemaLayout layout{schema};
+
+    const auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    const unsigned short PORT = 42698;
+
+    Server server{PORT};
+
+    std::thread server_thread{[&] { server.run(); }};
+
+    const std::uint64_t DOC_COUNT = 16;
+
+    // Every version of every document that's put, and the one each document is on
+    std::vector<std::vector<char>> versions;
+    std::vector<std::size_t> current(DOC_COUNT);
+
+    const auto next_version = [&](std::uint64_t id) {
+        current[id] = versions.size();
+        versions.push_back(
+            make_body_doc(layout, id, static_cast<char>('a' + versions.size() % 26)));
+
+        const auto& doc = versions.back();
+
+        return PutCommand{"docs", {doc.data(), doc.size()}};
+    };
+
+    versions.reserve(DOC_COUNT * 100);
+
+    std::vector<Command> cmds{RegisterSchemaCommand{"doc", schema},
+                              CreateCollectionCommand{"docs", "doc"}};
+
+    for (std::uint64_t id = 0; id < DOC_COUNT; ++id) {
+        cmds.push_back(next_version(id));
+    }
+
+    run_commands(PORT, cmds);
+
+    // Gets, with puts over the documents being got, and deletes which move the last document
+    // into the deleted one's place, mixed in. The expected response for each get is the version
+    // its document was on when the get came in.
+    const std::uint64_t CMD_COUNT = 4000;
+
+    // For everything but gets, which just succeed
+    const auto NO_VERSION = std::numeric_limits<std::size_t>::max();
+
+    std::vector<std::uint64_t> ids(CMD_COUNT);
+    std::vector<std::size_t> expected(CMD_COUNT, NO_VERSION);
+
+    cmds.clear();
+
+    for (std::uint64_t i = 0; i < CMD_COUNT; ++i) {
+        auto id = ids[i] = (i * 7) % DOC_COUNT;
+
+        if (i % 50 == 48) {
+            // Put back right after, as a new document which goes at the end
+            cmds.push_back(DeleteCommand{"docs", key_buf(ids[i])});
+            cmds.push_back(next_version(id));
+
+            i += 1;
+            ids[i] = id;
+        } else if (i % 10 == 9) {
+            cmds.push_back(next_version(id));
+        } else {
+            expected[i] = current[id];
+            cmds.push_back(GetCommand{"docs", key_buf(ids[i])});
+        }
+    }
+
+    Socket socket{Socket::ConnectParams{"localhost", PORT}};
+
+    socket.set_non_blocking(false);
+
+    std::vector<char> in;
+
+    // Some time for the socket buffers to fill up, so that sends are only partly taken and the
+    // commands after them are run while they're in flight
+    auto responses = pipeline(socket, cmds, in, std::chrono::milliseconds{200});
+
+    std::size_t get_count = 0;
+
+    for (std::uint64_t i = 0; i < CMD_COUNT; ++i) {
+        if (expected[i] == NO_VERSION) {
+            assert(std::holds_alternative<SuccessResponse>(responses[i]));
+            continue;
+        }
+
+        const auto& found = std::get<FoundResponse>(responses[i]).value;
+        const auto& doc = versions[expected[i]];
+
+        assert(found.len == doc.size());
+        assert(std::memcmp(found.data, doc.data(), doc.size()) == 0);
+
+        get_count += 1;
+    }
+
+    assert(get_count > CMD_COUNT / 2);
+
+    server.stop();
+    server_thread.join();
+}
+
+// Commands bigger than the receive buffer make it grow, up to the limit, and clients which
+// don't read their responses are stopped from sending more until they do
+void test_backpressure() {
+    using namespace boutique;
+
+    auto schema = body_schema(1000);
+
+    SchemaLayout layout{schema};
+
+    const auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    ClientHandler::Params params;
+
+    // Every put is bigger than the buffer starts out, and so is the output of a few gets
+    params.recv_buffer_size = 256;
+    params.max_command_size = 16 * 1024;
+    params.max_output_size = 4 * 1024;
+
+    const unsigned short PORT = 42697;
+
+    Server server{PORT, 1, params};
+
+    std::thread server_thread{[&] { server.run(); }};
+
+    const std::uint64_t DOC_COUNT = 100;
+
+    std::vector<std::vector<char>> docs;
+
+    for (std::uint64_t i = 0; i < DOC_COUNT; ++i) {
+        docs.push_back(make_body_doc(layout, i, static_cast<char>('a' + i % 26)));
+    }
+
+    std::vector<Command> cmds{RegisterSchemaCommand{"doc", schema},
+                              CreateCollectionCommand{"docs", "doc"}};
+
+    for (const auto& doc : docs) {
+        cmds.push_back(PutCommand{"docs", {doc.data(), doc.size()}});
+    }
+
+    run_commands(PORT, cmds);
+
+    // Far more output than the socket buffers hold, which the client only starts reading once
+    // it's all been asked for
+    const std::uint64_t GET_COUNT = 20'000;
+
+    std::vector<std::uint64_t> ids(GET_COUNT);
+
+    cmds.clear();
+
+    for (std::uint64_t i = 0; i < GET_COUNT; ++i) {
+        ids[i] = (i * 7) % DOC_COUNT;
+        cmds.push_back(GetCommand{"docs", key_buf(ids[i])});
+    }
+
+    {
+        Socket socket{Socket::ConnectParams{"localhost", PORT}};
+
+        socket.set_non_blocking(false);
+
+        std::vector<char> in;
+
+        auto responses = pipeline(socket, cmds, in, std::chrono::milliseconds{200});
+
+        for (std::uint64_t i = 0; i < GET_COUNT; ++i) {
+            const auto& found = std::get<FoundResponse>(responses[i]).value;
+            const auto& doc = docs[ids[i]];
+
+            assert(found.len == doc.size());
+            assert(std::memcmp(found.data, doc.data(), doc.size()) == 0);
+        }
+    }
+
+    // A command bigger than max_command_size is rejected and the client is disconnected. Only
+    // max_command_size bytes of it are sent, so that all of them have been read by the time the
+    // server hangs up.
+    {
+        std::vector<char> big(2 * params.max_command_size);
+
+        auto data = encode(PutCommand{"docs", {big.data(), big.size()}});
+
+        Socket socket{Socket::ConnectParams{"localhost", PORT}};
+
+        socket.set_non_blocking(false);
+
+        for (std::size_t n = 0; n < params.max_command_size;) {
+            n += socket.send(data.data() + n, static_cast<int>(params.max_command_size - n));
+        }
+
+        std::vector<char> in;
+
+        char buf[4096];
+
+        for (;;) {
+            auto n = socket.recv(buf, sizeof(buf));
+
+            if (n == 0) {
+                break;
+            }
+
+            in.insert(in.end(), buf, buf + n);
+        }
+
+        ConstBuffer res_buf{in.data(), in.size()};
+
+        Response res;
+
+        assert(read(res_buf, res) == ReadResult::SUCCESS);
+        assert(std::holds_alternative<InvalidCommandResponse>(res) && res_buf.len == 0);
+    }
+
+    // Which doesn't affect anyone else
+    run_commands(PORT, {PutCommand{"docs", {docs[0].data(), docs[0].size()}}});
+
+    server.stop();
+    server_thread.join();
+}
+
+// A get which finds an expired document leaves it for the expiry pass to remove, since removing
+// it would move documents which earlier gets in the same batch are still sending in place
+void test_expired_get() {
+    using namespace boutique;
+
+    // Big enough that every document gets a storage chunk of its own, so removing two documents
+    // frees the chunk which the last one was in
+    auto schema = body_schema(1100 * 1024);
+
+    SchemaLayout layout{schema};
+
+    const auto make_doc = [&](std::uint64_t id) {
+        return make_body_doc(layout, id, static_cast<char>('a' + id));
+    };
+
+    const auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    const unsigned short PORT = 42696;
+
+    Server server{PORT};
+
+    std::thread server_thread{[&] { server.run(); }};
+
+    run_commands(PORT,
+                 {RegisterSchemaCommand{"doc", schema}, CreateCollectionCommand{"docs", "doc"}});
+
+    std::vector<std::vector<char>> docs{make_doc(0), make_doc(1), make_doc(2), make_doc(3)};
+
+    std::uint64_t ids[] = {0, 1, 2, 3};
+
+    // Documents 0 and 1 expire as soon as they're put, and the gets come in right behind them
+    // so that the worker doesn't get a chance to remove them first. Removing both of them would
+    // free the chunk that document 3 is being sent from, and the projected get of document 2
+    // after that allocates enough to reuse it.
+    std::vector<Command> cmds{
+        PutWithTtlCommand{"docs", {docs[0].data(), docs[0].size()}, 0},
+        PutWithTtlCommand{"docs", {docs[1].data(), docs[1].size()}, 0},
+        PutCommand{"docs", {docs[2].data(), docs[2].size()}},
+        PutCommand{"docs", {docs[3].data(), docs[3].size()}},
+        GetCommand{"docs", key_buf(ids[3])},
+        GetCommand{"docs", key_buf(ids[0])},
+        GetCommand{"docs", key_buf(ids[1])},
+        GetCommand{"docs", key_buf(ids[2]), {"body"}},
+    };
+
+    Socket socket{Socket::ConnectParams{"localhost", PORT}};
+
+    socket.set_non_blocking(false);
+
+    std::vector<char> in;
+
+    auto responses = pipeline(socket, cmds, in);
+
+    const auto& found = std::get<FoundResponse>(responses[4]).value;
+
+    assert(found.len == docs[3].size());
+    assert(std::memcmp(found.data, docs[3].data(), found.len) == 0);
+
+    assert(std::holds_alternative<NotFoundResponse>(responses[5]));
+    assert(std::holds_alternative<NotFoundResponse>(responses[6]));
+    assert(std::get<FoundResponse>(responses[7]).value.len == layout.find("body")->size);
+
+    // The expiry pass still gets rid of them
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+
+    server.stop();
+    server_thread.join();
+
+    assert(server.worker(0).db().collection("docs")->count() == 2);
+}
+
+// Gets with fields only send back those fields, gathered out of each document
+void test_projection() {
+    using namespace boutique;
+
+    Database db;
+
+    execute(db, RegisterSchemaCommand{"doc", Schema{{{"id", UInt64Type{}},
+                                                     {"value", UInt64Type{}}}}});
+    execute(db, CreateCollectionCommand{"docs", "doc"});
+
+    Doc docs[] = {{1, 10}, {2, 20}};
+
+    for (const auto& doc : docs) {
+        execute(db, PutCommand{"docs", {reinterpret_cast<const char*>(&doc), sizeof(doc)}});
+    }
+
+    const auto key_buf = [](const std::uint64_t& key) {
+        return ConstBuffer{reinterpret_cast<const char*>(&key), sizeof(key)};
+    };
+
+    const auto value_of = [](ConstBuffer buf) {
+        assert(buf.len == sizeof(std::uint64_t));
+
+        std::uint64_t value;
+        std::memcpy(&value, buf.data, sizeof(value));
+
+        return value;
+    };
+
+    auto res = execute(db, GetCommand{"docs", key_buf(2), {"value"}});
+
+    assert(value_of(std::get<FoundResponse>(res).value) == 20);
+
+    res = execute(db, MultiGetCommand{"docs", {key_buf(1), key_buf(3), key_buf(2)}, {"value"}});
+
+    const auto& values = std::get<MultiFoundResponse>(res).values;
+
+    assert(values.size() == 3);
+    assert(value_of(values[0]) == 10 && values[1].len == 0 && value_of(values[2]) == 20);
+
+    res = execute(db, GetCommand{"docs", key_buf(1), {"value", "missing"}});
+
+    assert(std::holds_alternative<InvalidCommandResponse>(res));
+}
+
+// Finds documents by their value through secondary indexes, directly, after a snapshot, and
+// across the shards of a server
+void test_query() {
+    using namespace boutique;
+
+    namespace fs = std::filesystem;
+
+    Schema schema{{{"id", UInt64Type{}}, {"value", UInt64Type{}}}};
+
+    const auto value_buf = [](const std::uint64_t& value) {
+        return ConstBuffer{reinterpret_cast<const char*>(&value), sizeof(value)};
+    };
+
+    const auto ids = [](const Response& res) {
+        std::vector<std::uint64_t> ids;
+
+        for (const auto& value : std::get<MultiFoundResponse>(res).values) {
+            assert(value.len == sizeof(Doc));
+
+            Doc doc;
+            std::memcpy(&doc, value.data, sizeof(doc));
+
+            ids.push_back(doc.id);
+        }
+
+        std::sort(ids.begin(), ids.end());
+
+        return ids;
+    };
+
+    std::uint64_t three = 3;
+    std::uint64_t five = 5;
+
+    const auto check = [&](Database& db) {
+        // Values go 0 to 9 ten times over
+        auto res = execute(db, QueryCommand{"docs", "value", QueryCommand::Op::EQUAL,
+                                            value_buf(three)});
+
+        assert(ids(res) == (std::vector<std::uint64_t>{3, 13, 23, 33, 43, 53, 63, 73, 83, 93}));
+
+        res = execute(db, QueryCommand{"docs", "value", QueryCommand::Op::RANGE, value_buf(three),
+                                       value_buf(five)});
+
+        assert(ids(res).size() == 30);
+    };
+
+    Database db;
+
+    execute(db, RegisterSchemaCommand{"doc", schema});
+    execute(db, CreateCollectionCommand{"docs", "doc"});
+
+    for (std::uint64_t i = 0; i < 100; ++i) {
+        Doc doc{i, i % 10};
+        execute(db, PutCommand{"docs", {reinterpret_cast<const char*>(&doc), sizeof(doc)}});
+    }
+
+    // Without an index, queries aren't answered rather than scanning
+    auto res = execute(db, QueryCommand{"docs", "value", QueryCommand::Op::EQUAL,
+                                        value_buf(three)});
+
+    assert(std::holds_alternative<InvalidCommandResponse>(res));
+
+    assert(std::holds_alternative<SuccessResponse>(
+        execute(db, CreateIndexCommand{"docs", "value", SecondaryIndexType::ORDERED})));
+    assert(std::holds_alternative<InvalidCommandResponse>(
+        execute(db, CreateIndexCommand{"docs", "missing", SecondaryIndexType::HASH})));
+    assert(std::holds_alternative<NotFoundResponse>(
+        execute(db, CreateIndexCommand{"missing", "value", SecondaryIndexType::HASH})));
+
+    check(db);
+
+    // The limit and projection work like they do for gets
+    res = execute(db, QueryCommand{"docs", "value", QueryCommand::Op::RANGE, {}, value_buf(five),
+                                   4, {"id"}});
+
+    const auto& values = std::get<MultiFoundResponse>(res).values;
+
+    assert(values.size() == 4);
+    assert(values[0].len == sizeof(std::uint64_t));
+
+    // A value that can't be in the field is invalid
+    res = execute(db, QueryCommand{"docs", "value", QueryCommand::Op::EQUAL, as_const_buffer("x")});
+
+    assert(std::holds_alternative<InvalidCommandResponse>(res));
+
+    // Snapshots keep which fields are indexed and build the indexes again when they're loaded
+    auto dir = fs::temp_directory_path() / "boutique_test_query";
+
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    auto path = (dir / "query.snap").string();
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    write_snapshot(fd, db);
+
+    ::close(fd);
+
+    for (auto map : {false, true}) {
+        Database loaded;
+
+        read_snapshot(path, loaded, map);
+
+        assert(loaded.collection("docs")->secondary_indexes().size() == 1);
+
+        check(loaded);
+    }
+
+    fs::remove_all(dir);
+
+    // Every shard has some of the documents, and the query gets all of them
+    const unsigned short PORT = 42695;
+    const std::uint32_t WORKER_COUNT = 3;
+
+    Server server{PORT, WORKER_COUNT};
+
+    std::thread server_thread{[&] { server.run(); }};
+
+    std::vector<Doc> docs;
+
+    for (std::uint64_t i = 0; i < 100; ++i) {
+        docs.push_back({i, i % 10});
+    }
+
+    std::vector<Command> cmds{RegisterSchemaCommand{"doc", schema},
+                              CreateCollectionCommand{"docs", "doc"},
+                              CreateIndexCommand{"docs", "value", SecondaryIndexType::HASH},
+                              CreateIndexCommand{"docs", "value", SecondaryIndexType::ORDERED}};
+
+    for (const auto& doc : docs) {
+        cmds.push_back(PutCommand{"docs", {reinterpret_cast<const char*>(&doc), sizeof(doc)}});
+    }
+
+    run_commands(PORT, cmds);
+
+    for (std::uint32_t i = 0; i < WORKER_COUNT; ++i) {
+        assert(server.worker(i).db().collection("docs")->count() < docs.size());
+    }
+
+    Socket socket{Socket::ConnectParams{"localhost", PORT}};
+
+    socket.set_non_blocking(false);
+
+    std::vector<char> in;
+
+    // The response is only good until the next query
+    const auto query = [&](QueryCommand cmd) {
+        return std::move(pipeline(socket, {std::move(cmd)}, in).front());
+    };
+
+    res = query(QueryCommand{"docs", "value", QueryCommand::Op::EQUAL, value_buf(three)});
+
+    assert(ids(res) == (std::vector<std::uint64_t>{3, 13, 23, 33, 43, 53, 63, 73, 83, 93}));
+
+    res = query(QueryCommand{"docs", "value", QueryCommand::Op::EQUAL, value_buf(three), {}, 4});
+
+    assert(ids(res).size() == 4);
+
+    // Ranges come back in order of the field even though each shard found its own part of them,
+    // and the limit keeps the smallest values rather than whichever shard answered first
+    res = query(QueryCommand{"docs", "value", QueryCommand::Op::RANGE, value_buf(three), {}, 25});
+
+    std::vector<std::uint64_t> found_values;
+
+    for (const auto& value : std::get<MultiFoundResponse>(res).values) {
+        assert(value.len == sizeof(Doc));
+
+        Doc doc;
+        std::memcpy(&doc, value.data, sizeof(doc));
+
+        found_values.push_back(doc.value);
+    }
+
+    std::vector<std::uint64_t> expected_values(10, 3);
+
+    expected_values.insert(expected_values.end(), 10, 4);
+    expected_values.insert(expected_values.end(), 5, 5);
+
+    assert(found_values == expected_values);
+
+    // Same when the field isn't one of the ones asked for
+    res = query(QueryCommand{"docs", "value", QueryCommand::Op::RANGE, value_buf(three),
+                             value_buf(five), 0, {"id"}});
+
+    found_values.clear();
+
+    for (const auto& value : std::get<MultiFoundResponse>(res).values) {
+        assert(value.len == sizeof(std::uint64_t));
+
+        std::uint64_t id;
+        std::memcpy(&id, value.data, sizeof(id));
+
+        found_values.push_back(id % 10);
+    }
+
+    assert(found_values.size() == 30);
+    assert(std::is_sorted(found_values.begin(), found_values.end()));
+    assert(found_values.front() == 3 && found_values.back() == 5);
+
+    server.stop();
+    server_thread.join();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    test_no_allocations();
+    test_wal();
+    test_snapshot();
+    test_expiry();
+    test_sharding();
+    test_collection_stats();
+    test_coalescing();
+    test_in_place();
+    test_backpressure();
+    test_expired_get();
+    test_projection();
+    test_query();
+
+    return 0;
+}
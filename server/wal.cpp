@@ -0,0 +1,402 @@
+#include "wal.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+
+#include "core/logger.hpp"
+#include "db/key_hash.hpp"
+#include "io/unix_utils.hpp"
+#include "protocol/binary_protocol.hpp"
+
+namespace {
+
+// Precedes each record
+struct RecordHeader {
+    std::uint32_t len = 0;
+    std::uint32_t checksum = 0;
+};
+
+std::uint32_t checksum(const char* data, std::size_t len) {
+    return static_cast<std::uint32_t>(boutique::wyhash(data, len, len));
+}
+
+void write_all(int fd, const char* data, std::size_t len) {
+    while (len > 0) {
+        auto n = ::write(fd, data, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            boutique::throw_errno("Failed to write to WAL");
+        }
+
+        data += n;
+        len -= static_cast<std::size_t>(n);
+    }
+}
+
+struct ShardFile {
+    std::uint32_t index = 0;
+    std::uint32_t count = 0;
+    std::uint64_t gen = 0;
+    std::string ext;
+};
+
+// Calls fn with each file in dir named by shard_file_path
+template <typename Fn>
+void for_each_shard_file(const std::string& dir, Fn&& fn) {
+    for (const auto& entry : std::filesystem::directory_iterator{dir}) {
+        auto name = entry.path().filename().string();
+
+        ShardFile file;
+        int ext_pos = 0;
+
+        if (std::sscanf(name.c_str(), "shard-%u-of-%u-%" SCNu64 "%n", &file.index, &file.count,
+                        &file.gen, &ext_pos) != 3) {
+            continue;
+        }
+
+        file.ext = name.substr(ext_pos);
+
+        fn(file);
+    }
+}
+
+}  // namespace
+
+namespace boutique {
+
+Wal::Wal(std::string path, const Params& params, std::function<void()> on_durable)
+    : m_path{std::move(path)}, m_params{params}, m_on_durable{std::move(on_durable)} {
+    m_fd = open_log(m_path);
+
+    m_writer = std::thread{[this] { write_loop(); }};
+}
+
+Wal::~Wal() {
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_stop = true;
+    }
+
+    m_cv.notify_one();
+    m_writer.join();
+
+    ::close(m_fd);
+}
+
+std::uint64_t Wal::replay(const std::string& path, FunctionView<void(Command)> fn) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+
+        throw_errno("Failed to open WAL");
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        throw_errno("Failed to stat WAL");
+    }
+
+    std::vector<char> data(static_cast<std::size_t>(st.st_size));
+
+    for (std::size_t pos = 0; pos < data.size();) {
+        auto n = ::read(fd, data.data() + pos, data.size() - pos);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            ::close(fd);
+            throw_errno("Failed to read WAL");
+        }
+
+        pos += static_cast<std::size_t>(n);
+    }
+
+    std::uint64_t count = 0;
+    std::size_t pos = 0;
+
+    while (data.size() - pos >= sizeof(RecordHeader)) {
+        RecordHeader header;
+        std::memcpy(&header, data.data() + pos, sizeof(header));
+
+        const auto* record = data.data() + pos + sizeof(header);
+
+        if (header.len > data.size() - pos - sizeof(header) ||
+            header.checksum != checksum(record, header.len)) {
+            break;
+        }
+
+        ConstBuffer buf{record, header.len};
+
+        Command cmd;
+
+        if (read(buf, cmd) != ReadResult::SUCCESS || buf.len != 0) {
+            break;
+        }
+
+        fn(std::move(cmd));
+
+        count += 1;
+        pos += sizeof(header) + header.len;
+    }
+
+    if (pos < data.size()) {
+        BOUTIQUE_LOG_ERROR("Discarding {} bytes of incomplete or corrupt records from {}",
+                           data.size() - pos, path);
+
+        if (ftruncate(fd, static_cast<off_t>(pos)) < 0) {
+            ::close(fd);
+            throw_errno("Failed to truncate WAL");
+        }
+    }
+
+    ::close(fd);
+
+    return count;
+}
+
+const std::string& Wal::path() const { return m_path; }
+
+Wal::Durability Wal::durability() const { return m_params.durability; }
+
+std::uint64_t Wal::append(const Command& cmd) {
+    bool wake_writer = false;
+
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+
+        auto start = m_buf.size();
+
+        m_buf.resize(start + sizeof(RecordHeader));
+
+        write(
+            [&](size_t len) {
+                m_buf.resize(m_buf.size() + len);
+                return m_buf.data() + m_buf.size() - len;
+            },
+            cmd);
+
+        RecordHeader header;
+
+        header.len = static_cast<std::uint32_t>(m_buf.size() - start - sizeof(header));
+        header.checksum = checksum(m_buf.data() + start + sizeof(header), header.len);
+
+        std::memcpy(m_buf.data() + start, &header, sizeof(header));
+
+        m_appended += 1;
+
+        // Only wake the writer when it would be waiting for this; otherwise the interval does
+        if (m_params.durability == Durability::SYNC) {
+            wake_writer = start == 0;
+        } else {
+            wake_writer = start < m_params.sync_bytes && m_buf.size() >= m_params.sync_bytes;
+        }
+    }
+
+    if (wake_writer) {
+        m_cv.notify_one();
+    }
+
+    return m_appended;
+}
+
+std::uint64_t Wal::appended() const {
+    // Only the appending thread changes this, so it doesn't need the lock to read it
+    return m_appended;
+}
+
+std::uint64_t Wal::durable() const { return m_durable.load(std::memory_order_acquire); }
+
+void Wal::rotate(std::string path) {
+    {
+        std::unique_lock<std::mutex> lock{m_mutex};
+
+        // The writer picks a rotation up as soon as it's woken, so this hardly ever waits
+        m_cv.wait(lock, [&] { return !m_rotating; });
+
+        m_rotating = true;
+        m_rotate_at = m_buf.size();
+        m_rotate_path = path;
+    }
+
+    m_path = std::move(path);
+
+    m_cv.notify_all();
+}
+
+void Wal::write_loop() {
+    using Clock = std::chrono::steady_clock;
+
+    auto next_write = Clock::now() + m_params.sync_interval;
+
+    std::unique_lock<std::mutex> lock{m_mutex};
+
+    for (;;) {
+        if (m_params.durability == Durability::SYNC) {
+            m_cv.wait(lock, [&] { return m_stop || m_rotating || !m_buf.empty(); });
+        } else {
+            m_cv.wait_until(lock, next_write, [&] {
+                return m_stop || m_rotating || m_buf.size() >= m_params.sync_bytes;
+            });
+        }
+
+        bool stop = m_stop;
+        auto appended = m_appended;
+
+        std::swap(m_buf, m_writing);
+
+        bool rotating = m_rotating;
+        auto rotate_at = m_rotate_at;
+        auto rotate_path = std::move(m_rotate_path);
+
+        m_rotating = false;
+
+        lock.unlock();
+
+        if (rotating) {
+            // Let rotate know it's been picked up
+            m_cv.notify_all();
+        }
+
+        try {
+            auto old_size = rotating ? rotate_at : m_writing.size();
+
+            if (old_size > 0) {
+                write_all(m_fd, m_writing.data(), old_size);
+            }
+
+            if (rotating) {
+                // The old log is done with, so it's synced whatever the durability
+                if (fdatasync(m_fd) < 0) {
+                    throw_errno("Failed to sync WAL");
+                }
+
+                ::close(m_fd);
+
+                m_fd = open_log(rotate_path);
+            }
+
+            if (m_writing.size() > old_size) {
+                write_all(m_fd, m_writing.data() + old_size, m_writing.size() - old_size);
+            }
+
+            if (!m_writing.empty() && m_params.durability != Durability::WRITE &&
+                fdatasync(m_fd) < 0) {
+                throw_errno("Failed to sync WAL");
+            }
+        } catch (const std::system_error& e) {
+            // Carrying on would mean acknowledging changes we can't keep
+            BOUTIQUE_LOG_ERROR("WAL: {}", e.what());
+            std::abort();
+        }
+
+        m_writing.clear();
+
+        next_write = Clock::now() + m_params.sync_interval;
+
+        if (appended > m_durable.load(std::memory_order_relaxed)) {
+            m_durable.store(appended, std::memory_order_release);
+
+            if (m_on_durable) {
+                m_on_durable();
+            }
+        }
+
+        if (stop) {
+            return;
+        }
+
+        lock.lock();
+    }
+}
+
+int Wal::open_log(const std::string& path) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        throw_errno("Failed to open WAL");
+    }
+
+    return fd;
+}
+
+std::string shard_file_path(const std::string& dir, std::uint32_t index, std::uint32_t count,
+                            std::uint64_t gen, std::string_view ext) {
+    auto name = "shard-" + std::to_string(index) + "-of-" + std::to_string(count) + "-" +
+                std::to_string(gen) + std::string{ext};
+
+    return (std::filesystem::path{dir} / name).string();
+}
+
+ShardFiles list_shard_files(const std::string& dir, std::uint32_t index, std::uint32_t count) {
+    ShardFiles files;
+
+    for_each_shard_file(dir, [&](const ShardFile& file) {
+        if (file.index != index || file.count != count) {
+            return;
+        }
+
+        if (file.ext == WAL_EXT) {
+            files.wal_gens.push_back(file.gen);
+        } else if (file.ext == SNAPSHOT_EXT) {
+            files.snapshot_gens.push_back(file.gen);
+        }
+    });
+
+    std::sort(files.wal_gens.begin(), files.wal_gens.end());
+    std::sort(files.snapshot_gens.begin(), files.snapshot_gens.end());
+
+    return files;
+}
+
+void remove_shard_files_before(const std::string& dir, std::uint32_t index, std::uint32_t count,
+                               std::uint64_t gen) {
+    auto files = list_shard_files(dir, index, count);
+
+    for (auto old_gen : files.wal_gens) {
+        if (old_gen < gen) {
+            std::filesystem::remove(shard_file_path(dir, index, count, old_gen, WAL_EXT));
+        }
+    }
+
+    for (auto old_gen : files.snapshot_gens) {
+        if (old_gen < gen) {
+            std::filesystem::remove(shard_file_path(dir, index, count, old_gen, SNAPSHOT_EXT));
+        }
+    }
+}
+
+void prepare_wal_dir(const std::string& dir, std::uint32_t count) {
+    std::filesystem::create_directories(dir);
+
+    for_each_shard_file(dir, [&](const ShardFile& file) {
+        if (file.count != count) {
+            throw std::runtime_error{"WAL directory " + dir +
+                                     " was written with a different number of workers"};
+        }
+    });
+}
+
+}  // namespace boutique
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "core/function_view.hpp"
+#include "protocol/messages.hpp"
+
+namespace boutique {
+
+// Append-only log of the commands which changed a database, so it can be rebuilt after a
+// restart by running them again. Each record is a command in the usual binary encoding behind
+// its length and a checksum.
+//
+// Appending only copies the record into a buffer. A dedicated writer thread writes that buffer
+// out (and syncs it, depending on the durability) in the background, so whatever appends never
+// waits on the disk; everything which accumulated while the writer was busy goes out in one
+// write and one sync (group commit).
+struct Wal {
+    enum class Durability : std::uint8_t {
+        // Records are written out every sync_interval (or sync_bytes) but never synced, so they
+        // survive the process dying but not the machine
+        WRITE,
+
+        // Each write is followed by a sync, so at most about sync_interval's worth of
+        // acknowledged changes is lost if the machine goes down
+        INTERVAL,
+
+        // Changes aren't acknowledged until they've been synced. The writer starts as soon as
+        // there's anything to write rather than waiting for the interval.
+        SYNC,
+    };
+
+    struct Params {
+        // Directory the logs (and snapshots, see Server::snapshot) go in
+        std::string dir;
+
+        Durability durability = Durability::INTERVAL;
+
+        std::chrono::milliseconds sync_interval{10};
+
+        // The writer doesn't wait for the interval once this much is waiting to be written
+        std::size_t sync_bytes = 1024 * 1024;
+
+        // How often the server snapshots the database, which lets it delete the logs from
+        // before then. Zero means only when Server::snapshot is called.
+        std::chrono::seconds snapshot_interval{0};
+
+        // Whether shards map their documents from the snapshot they're restored from rather than
+        // reading them in (see read_snapshot), which makes starting up take next to no time
+        // however big the snapshot is
+        bool map_snapshots = true;
+    };
+
+    // Opens (creating it if needed) the log at path for appending. on_durable is called from the
+    // writer thread whenever durable() goes up.
+    Wal(std::string path, const Params& params, std::function<void()> on_durable = {});
+
+    Wal(const Wal& other) = delete;
+    Wal& operator=(const Wal& other) = delete;
+
+    // Writes and syncs whatever's left
+    ~Wal();
+
+    // Calls fn with each command in the log at path, in the order they were appended, and
+    // returns how many there were. A record which was cut short or corrupted (e.g. by a crash
+    // in the middle of writing it) ends the log, and it's truncated there.
+    static std::uint64_t replay(const std::string& path, FunctionView<void(Command)> fn);
+
+    const std::string& path() const;
+    Durability durability() const;
+
+    // Returns the number of records appended so far, which counts as this one's position
+    std::uint64_t append(const Command& cmd);
+
+    // Number of records appended so far
+    std::uint64_t appended() const;
+
+    // Number of records which have been made as durable as the durability allows. Can be
+    // called from any thread.
+    std::uint64_t durable() const;
+
+    // Makes everything appended from now on go to the log at path instead, without waiting for
+    // what's already been appended to be written to the old one
+    void rotate(std::string path);
+
+private:
+    std::string m_path;
+    Params m_params;
+
+    std::function<void()> m_on_durable;
+
+    int m_fd = -1;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    // Records waiting for the writer, guarded by m_mutex, along with how many records have been
+    // appended and whether we're shutting down. The writer swaps m_buf with m_writing so that
+    // appends can carry on while it writes, and neither is reallocated once they're big enough.
+    std::vector<char> m_buf;
+    std::uint64_t m_appended = 0;
+    bool m_stop = false;
+
+    // Set by rotate until the writer picks it up. The first m_rotate_at bytes of m_buf still
+    // go to the old log.
+    bool m_rotating = false;
+    std::size_t m_rotate_at = 0;
+    std::string m_rotate_path;
+
+    std::vector<char> m_writing;
+
+    std::atomic<std::uint64_t> m_durable{0};
+
+    std::thread m_writer;
+
+    void write_loop();
+
+    int open_log(const std::string& path);
+};
+
+// Each shard has a series of logs, numbered by generation. A snapshot of a shard (see
+// Server::snapshot) starts a new generation and holds everything in the ones before it, so
+// those can be deleted once it's been written, and a shard is restored by loading its latest
+// snapshot and replaying the logs from that generation on.
+//
+// The shard count is part of the file names since documents are spread over shards by key, so
+// the files only make sense with the same number of shards.
+inline constexpr std::string_view WAL_EXT = ".wal";
+inline constexpr std::string_view SNAPSHOT_EXT = ".snap";
+
+std::string shard_file_path(const std::string& dir, std::uint32_t index, std::uint32_t count,
+                            std::uint64_t gen, std::string_view ext);
+
+// Generations of the logs and snapshots shard 'index' of 'count' has in dir, oldest first
+struct ShardFiles {
+    std::vector<std::uint64_t> wal_gens;
+    std::vector<std::uint64_t> snapshot_gens;
+};
+
+ShardFiles list_shard_files(const std::string& dir, std::uint32_t index, std::uint32_t count);
+
+// Deletes the logs and snapshots shard 'index' of 'count' has from before generation gen
+void remove_shard_files_before(const std::string& dir, std::uint32_t index, std::uint32_t count,
+                               std::uint64_t gen);
+
+// Creates dir if it doesn't exist yet, and throws if it holds files for a different number of
+// shards than count
+void prepare_wal_dir(const std::string& dir, std::uint32_t count);
+
+}  // namespace boutique
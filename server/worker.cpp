@@ -0,0 +1,288 @@
+#include "worker.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <functional>
+
+#include "core/bind_front.hpp"
+#include "core/logger.hpp"
+#include "db/timing_wheel.hpp"
+#include "executor.hpp"
+#include "protocol/binary_protocol.hpp"
+#include "server.hpp"
+#include "snapshot.hpp"
+
+namespace {
+
+const auto EXPIRY_INTERVAL = std::chrono::milliseconds{10};
+
+// Most documents removed per tick of the expiry timer, so that a lot of them expiring at once
+// doesn't hold up requests; the rest are picked up by the following ticks
+const std::size_t EXPIRY_BATCH_SIZE = 4096;
+
+}  // namespace
+
+namespace boutique {
+
+Worker::Worker(Server& server, std::uint32_t index, std::uint32_t worker_count,
+               unsigned short port)
+    : m_server{&server},
+      m_index{index},
+      m_worker_count{worker_count},
+      m_socket{Socket::ListenParams{port, 128}},
+      m_wake{Socket::pair()},
+      m_expiry_timer{Timer::Params{EXPIRY_INTERVAL, EXPIRY_INTERVAL}} {
+    for (std::uint32_t i = 0; i < worker_count; ++i) {
+        m_inboxes.emplace_back(std::make_unique<SpscQueue<ShardMessage>>());
+    }
+
+    if (const auto* wal_params = server.wal_params()) {
+        restore(*wal_params);
+
+        auto path = shard_file_path(wal_params->dir, index, worker_count, m_wal_gen, WAL_EXT);
+
+        std::function<void()> on_durable;
+
+        // Nothing's waiting otherwise
+        if (wal_params->durability == Wal::Durability::SYNC) {
+            on_durable = [this] { wake(); };
+        }
+
+        m_wal = std::make_unique<Wal>(std::move(path), *wal_params, std::move(on_durable));
+    }
+}
+
+IOContext& Worker::io_context() { return m_ioc; }
+
+Database& Worker::db() { return m_db; }
+
+Wal* Worker::wal() { return m_wal.get(); }
+
+bool Worker::waits_for_wal() const {
+    return m_wal && m_wal->durability() == Wal::Durability::SYNC;
+}
+
+std::uint32_t Worker::index() const { return m_index; }
+
+std::uint32_t Worker::worker_count() const { return m_worker_count; }
+
+std::uint32_t Worker::shard_for(std::string_view coll_name, ConstBuffer key) const {
+    if (m_worker_count == 1) {
+        return 0;
+    }
+
+    // This has to agree between workers, and between the key of a GetCommand and the key we
+    // pull out of a PutCommand's document, so we hash the raw key bytes.
+    auto h = std::hash<std::string_view>{}(coll_name) * 31 +
+             std::hash<std::string_view>{}({key.data, key.len});
+
+    return static_cast<std::uint32_t>(h % m_worker_count);
+}
+
+void Worker::send_to(std::uint32_t to, ShardMessage msg) {
+    m_server->worker(to).post(m_index, std::move(msg));
+}
+
+void Worker::post(std::uint32_t from, ShardMessage msg) {
+    m_inboxes[from]->push(std::move(msg));
+    wake();
+}
+
+std::uint64_t Worker::wal_gen() const { return m_wal_gen; }
+
+void Worker::request_pause() {
+    m_pause_requested.store(true);
+    wake();
+}
+
+void Worker::send_when_durable(std::uint32_t to, ShardMessage msg) {
+    if (!waits_for_wal()) {
+        deliver(to, std::move(msg));
+        return;
+    }
+
+    // Even if the WAL has already synced this far, it's woken us up for it, so the wait is
+    // picked up by the wake handler either way
+    m_durable_waits.push_back({m_wal->appended(), to, std::move(msg)});
+}
+
+void Worker::run() {
+    m_ioc.async_accept(m_socket, bind_front<&Worker::accept_handler>(this));
+    m_ioc.async_recv(m_wake.first, m_wake_buf, sizeof(m_wake_buf),
+                     bind_front<&Worker::wake_handler>(this));
+    m_ioc.async_wait(m_expiry_timer, bind_front<&Worker::expiry_handler>(this));
+
+    m_ioc.run();
+}
+
+void Worker::stop() {
+    m_stop_requested.store(true);
+
+    // Make sure a byte goes out even if one is already in flight; the handler for that one
+    // may have already checked m_stop_requested.
+    char c = 0;
+    m_wake.second.send(&c, 1);
+}
+
+void Worker::accept_handler(Socket socket) {
+    // Clients are unlinked rather than shuffled down (as std::remove_if would), since their
+    // pending callbacks point at them
+    m_clients.remove_if([](const auto& c) { return c.done(); });
+
+    m_clients.emplace_back(*this, std::move(socket), m_server->client_params());
+
+    m_ioc.async_accept(m_socket, bind_front<&Worker::accept_handler>(this));
+}
+
+void Worker::wake_handler(int len) {
+    // Reset this before draining so that anything posted while we drain wakes us up again
+    m_woken.store(false);
+
+    ShardMessage msg;
+
+    for (auto& inbox : m_inboxes) {
+        while (inbox->pop(msg)) {
+            handle(std::move(msg));
+        }
+    }
+
+    release_durable();
+
+    if (m_pause_requested.exchange(false)) {
+        // Whatever's logged from here on isn't in the snapshot
+        m_wal_gen += 1;
+        m_wal->rotate(shard_file_path(m_server->wal_params()->dir, m_index, m_worker_count,
+                                      m_wal_gen, WAL_EXT));
+
+        m_server->pause_for_snapshot();
+    }
+
+    if (m_stop_requested.load()) {
+        m_ioc.stop();
+        return;
+    }
+
+    m_ioc.async_recv(m_wake.first, m_wake_buf, sizeof(m_wake_buf),
+                     bind_front<&Worker::wake_handler>(this));
+}
+
+void Worker::expiry_handler(int) {
+    m_db.expire(unix_time_ms(), EXPIRY_BATCH_SIZE);
+
+    m_ioc.async_wait(m_expiry_timer, bind_front<&Worker::expiry_handler>(this));
+}
+
+void Worker::wake() {
+    if (m_woken.exchange(true)) {
+        return;
+    }
+
+    char c = 0;
+    m_wake.second.send(&c, 1);
+}
+
+void Worker::handle(ShardMessage msg) {
+    if (msg.kind == ShardMessage::Kind::RESPONSE) {
+        msg.client->shard_response_handler(msg.from, msg.seq, std::move(msg.data));
+        return;
+    }
+
+    auto cmd_buf = ConstBuffer{msg.data.data(), msg.data.size()};
+
+    m_arena.reset();
+
+    Command cmd;
+
+    // The origin worker already parsed this successfully
+    auto res = read(cmd_buf, cmd, &m_arena);
+
+    assert(res == ReadResult::SUCCESS);
+
+    std::vector<char> res_data;
+
+    auto res_writer = [&](size_t len) {
+        res_data.resize(res_data.size() + len);
+        return res_data.data() + res_data.size() - len;
+    };
+
+    auto appended = m_wal ? m_wal->appended() : 0;
+
+    write(res_writer, execute(m_db, std::move(cmd), &m_arena, m_wal.get()));
+
+    ShardMessage res_msg{ShardMessage::Kind::RESPONSE, m_index, msg.client, msg.seq,
+                         std::move(res_data)};
+
+    // Only changes have to wait for the WAL
+    if (m_wal && m_wal->appended() != appended) {
+        send_when_durable(msg.from, std::move(res_msg));
+    } else {
+        send_to(msg.from, std::move(res_msg));
+    }
+}
+
+void Worker::restore(const Wal::Params& params) {
+    auto files = list_shard_files(params.dir, m_index, m_worker_count);
+
+    // A snapshot holds everything from the generations before it
+    std::uint64_t first_gen = 0;
+
+    if (!files.snapshot_gens.empty()) {
+        first_gen = files.snapshot_gens.back();
+
+        auto path = shard_file_path(params.dir, m_index, m_worker_count, first_gen, SNAPSHOT_EXT);
+
+        read_snapshot(path, m_db, params.map_snapshots);
+
+        BOUTIQUE_LOG_INFO("Loaded {}", path);
+    }
+
+    m_wal_gen = first_gen;
+
+    for (auto gen : files.wal_gens) {
+        if (gen < first_gen) {
+            continue;
+        }
+
+        auto path = shard_file_path(params.dir, m_index, m_worker_count, gen, WAL_EXT);
+
+        auto count =
+            Wal::replay(path, [&](Command cmd) { execute_logged(m_db, std::move(cmd)); });
+
+        BOUTIQUE_LOG_INFO("Replayed {} commands from {}", count, path);
+
+        m_wal_gen = gen;
+    }
+
+    // Anything a snapshot was taken of but which wasn't deleted because we went down first
+    remove_shard_files_before(params.dir, m_index, m_worker_count, first_gen);
+
+    // Every run gets a log of its own, rather than appending to one which might have been cut
+    // short
+    m_wal_gen += 1;
+}
+
+void Worker::deliver(std::uint32_t to, ShardMessage msg) {
+    if (to == m_index) {
+        handle(std::move(msg));
+    } else {
+        send_to(to, std::move(msg));
+    }
+}
+
+void Worker::release_durable() {
+    if (m_durable_waits.empty()) {
+        return;
+    }
+
+    auto durable = m_wal->durable();
+
+    while (!m_durable_waits.empty() && m_durable_waits.front().lsn <= durable) {
+        auto& wait = m_durable_waits.front();
+
+        deliver(wait.to, std::move(wait.msg));
+
+        m_durable_waits.pop_front();
+    }
+}
+
+}  // namespace boutique
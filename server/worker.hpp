@@ -0,0 +1,161 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "client_handler.hpp"
+#include "core/arena.hpp"
+#include "core/const_buffer.hpp"
+#include "core/spsc_queue.hpp"
+#include "db/database.hpp"
+#include "io/context.hpp"
+#include "io/socket.hpp"
+#include "io/timer.hpp"
+#include "wal.hpp"
+
+namespace boutique {
+
+struct Server;
+
+// Passed between workers to run a command on the shard that owns its key
+struct ShardMessage {
+    enum class Kind : std::uint8_t { REQUEST, RESPONSE };
+
+    Kind kind = Kind::REQUEST;
+
+    // Index of the worker which sent this message
+    std::uint32_t from = 0;
+
+    // The client (living on the worker which sent the request) that the response goes to
+    ClientHandler* client = nullptr;
+    std::uint64_t seq = 0;
+
+    // The encoded command for requests, and the encoded response for responses
+    std::vector<char> data;
+};
+
+// One thread's worth of the server. Each worker has its own IOContext, its own listening
+// socket on the shared (SO_REUSEPORT) port, and its own shard of the database. Every shard
+// has all of the schemas and collections, but a document only lives in the shard that owns
+// its key.
+//
+// If the server has a WAL, each shard logs its own changes to its own file and replays it when
+// the worker is created.
+struct Worker {
+    Worker(Server& server, std::uint32_t index, std::uint32_t worker_count, unsigned short port);
+
+    Worker(const Worker& other) = delete;
+    Worker& operator=(const Worker& other) = delete;
+
+    IOContext& io_context();
+    Database& db();
+
+    // The log changes to this shard go to, or nullptr if there isn't one
+    Wal* wal();
+
+    // Whether responses to changes have to wait until the WAL has synced them
+    bool waits_for_wal() const;
+
+    std::uint32_t index() const;
+    std::uint32_t worker_count() const;
+
+    // Index of the worker whose shard owns the given key
+    std::uint32_t shard_for(std::string_view coll_name, ConstBuffer key) const;
+
+    // Sends the message to worker 'to'. Must be called from this worker's thread.
+    void send_to(std::uint32_t to, ShardMessage msg);
+
+    // Must be called from worker 'from's thread
+    void post(std::uint32_t from, ShardMessage msg);
+
+    // Generation of the log this shard is writing to (see shard_file_path)
+    std::uint64_t wal_gen() const;
+
+    // Makes the worker start a new generation of its log and then wait in
+    // Server::pause_for_snapshot. Can be called from any thread.
+    void request_pause();
+
+    // Sends the message to worker 'to' (which can be this one) once everything logged to the
+    // WAL so far is durable, or right away unless waits_for_wal. Must be called from this
+    // worker's thread.
+    void send_when_durable(std::uint32_t to, ShardMessage msg);
+
+    void run();
+
+    // Can be called from any thread
+    void stop();
+
+private:
+    Server* m_server = nullptr;
+
+    std::uint32_t m_index = 0;
+    std::uint32_t m_worker_count = 1;
+
+    Database m_db;
+
+    Socket m_socket;
+    IOContext m_ioc;
+
+    // We use a list so that adding new clients does not invalidate
+    // existing clients.
+    std::list<ClientHandler> m_clients;
+
+    // m_inboxes[i] is written to by worker i and read by this worker
+    std::vector<std::unique_ptr<SpscQueue<ShardMessage>>> m_inboxes;
+
+    // Other workers write a byte to the second socket to wake this worker's IOContext up
+    // through the first. m_woken makes sure there's at most one such byte in flight no matter
+    // how many messages are posted before we get around to them.
+    std::pair<Socket, Socket> m_wake;
+
+    char m_wake_buf[64];
+
+    // For running the requests other workers forward to us
+    Arena m_arena;
+
+    // Fires every EXPIRY_INTERVAL to remove documents whose TTLs have run out, so that ones
+    // which are never looked at again don't hang around forever
+    Timer m_expiry_timer;
+
+    std::atomic<bool> m_woken{false};
+    std::atomic<bool> m_stop_requested{false};
+
+    // Wakes us up whenever it syncs while we wait for it, so it goes after m_wake to be
+    // destroyed first
+    std::unique_ptr<Wal> m_wal;
+    std::uint64_t m_wal_gen = 0;
+
+    std::atomic<bool> m_pause_requested{false};
+
+    // Messages held back by send_when_durable, in the order they were logged
+    struct DurableWait {
+        std::uint64_t lsn = 0;
+        std::uint32_t to = 0;
+        ShardMessage msg;
+    };
+
+    std::deque<DurableWait> m_durable_waits;
+
+    void accept_handler(Socket socket);
+    void wake_handler(int len);
+    void expiry_handler(int count);
+
+    void wake();
+    void handle(ShardMessage msg);
+
+    void deliver(std::uint32_t to, ShardMessage msg);
+
+    // Loads the latest snapshot and replays the logs after it
+    void restore(const Wal::Params& params);
+
+    // Sends whichever of m_durable_waits the WAL has caught up to
+    void release_durable();
+};
+
+}  // namespace boutique